@@ -19,6 +19,7 @@
 
 #include "base/tools/Cvt.h"
 #include "3rdparty/rapidjson/document.h"
+#include "hex.h"
 
 
 #include <cassert>
@@ -35,28 +36,14 @@ namespace jdkcat {
 
 static char *cvt_bin2hex(char *const hex, const size_t hex_maxlen, const unsigned char *const bin, const size_t bin_len)
 {
-    size_t       i = 0U;
-    unsigned int x = 0U;
-    int          b = 0;
-    int          c = 0;
-
     if (bin_len >= SIZE_MAX / 2 || hex_maxlen < bin_len * 2U) {
         return nullptr; /* LCOV_EXCL_LINE */
     }
 
-    while (i < bin_len) {
-        c = bin[i] & 0xf;
-        b = bin[i] >> 4;
-        x = (unsigned char) (87U + c + (((c - 10U) >> 8) & ~38U)) << 8 |
-            (unsigned char) (87U + b + (((b - 10U) >> 8) & ~38U));
-        hex[i * 2U] = (char) x;
-        x >>= 8;
-        hex[i * 2U + 1U] = (char) x;
-        i++;
-    }
+    hex_encode(bin, bin_len, hex);
 
-    if (i * 2U < hex_maxlen) {
-        hex[i * 2U] = 0U;
+    if (bin_len * 2U < hex_maxlen) {
+        hex[bin_len * 2U] = 0U;
     }
 
     return hex;
@@ -66,80 +53,6 @@ static char *cvt_bin2hex(char *const hex, const size_t hex_maxlen, const unsigne
 #ifndef jdkcat_SODIUM
 static std::random_device randomDevice;
 static std::mt19937 randomEngine(randomDevice());
-
-
-static int cvt_hex2bin(unsigned char *const bin, const size_t bin_maxlen, const char *const hex, const size_t hex_len, const char *const ignore, size_t *const bin_len, const char **const hex_end)
-{
-    size_t        bin_pos   = 0U;
-    size_t        hex_pos   = 0U;
-    int           ret       = 0;
-    unsigned char c         = 0U;
-    unsigned char c_acc     = 0U;
-    unsigned char c_alpha0  = 0U;
-    unsigned char c_alpha   = 0U;
-    unsigned char c_num0    = 0U;
-    unsigned char c_num     = 0U;
-    unsigned char c_val     = 0U;
-    unsigned char state     = 0U;
-
-    while (hex_pos < hex_len) {
-        c        = (unsigned char) hex[hex_pos];
-        c_num    = c ^ 48U;
-        c_num0   = (c_num - 10U) >> 8;
-        c_alpha  = (c & ~32U) - 55U;
-        c_alpha0 = ((c_alpha - 10U) ^ (c_alpha - 16U)) >> 8;
-
-        if ((c_num0 | c_alpha0) == 0U) {
-            if (ignore != nullptr && state == 0U && strchr(ignore, c) != nullptr) {
-                hex_pos++;
-                continue;
-            }
-            break;
-        }
-
-        c_val = (c_num0 & c_num) | (c_alpha0 & c_alpha);
-
-        if (bin_pos >= bin_maxlen) {
-            ret   = -1;
-            errno = ERANGE;
-            break;
-        }
-
-        if (state == 0U) {
-            c_acc = c_val * 16U;
-        } else {
-            bin[bin_pos++] = c_acc | c_val;
-        }
-
-        state = ~state;
-        hex_pos++;
-    }
-
-    if (state != 0U) {
-        hex_pos--;
-        errno = EINVAL;
-        ret = -1;
-    }
-
-    if (ret != 0) {
-        bin_pos = 0U;
-    }
-
-    if (hex_end != nullptr) {
-        *hex_end = &hex[hex_pos];
-    } else if (hex_pos != hex_len) {
-        errno = EINVAL;
-        ret = -1;
-    }
-
-    if (bin_len != nullptr) {
-        *bin_len = bin_pos;
-    }
-
-    return ret;
-}
-
-#define sodium_hex2bin cvt_hex2bin
 #endif
 
 
@@ -153,7 +66,14 @@ inline bool fromHexImpl(T &buf, const char *in, size_t size)
 
     buf.resize(size / 2);
 
-    return sodium_hex2bin(reinterpret_cast<uint8_t *>(&buf.front()), buf.size(), in, size, nullptr, nullptr, nullptr) == 0;
+    size_t decoded = 0;
+    if (!hex_decode(in, size, reinterpret_cast<uint8_t *>(&buf.front()), buf.size(), &decoded)) {
+        return false;
+    }
+
+    buf.resize(decoded);
+
+    return true;
 }
 
 
@@ -189,7 +109,7 @@ bool jdkcat::Cvt::fromHex(uint8_t *bin, size_t bin_maxlen, const char *hex, size
         return false;
     }
 
-    return sodium_hex2bin(bin, bin_maxlen, hex, hex_len, nullptr, nullptr, nullptr) == 0;
+    return hex_decode(hex, hex_len, bin, bin_maxlen);
 }
 
 
@@ -0,0 +1,480 @@
+// bench/fault_proxy.cpp
+//
+// Transparent TCP proxy between the miner and a stratum server that injects
+// network faults, one scenario after another, and reports what each one cost
+// the miner:
+//   clean      - pass through, the baseline
+//   latency    - fixed delay in both directions
+//   jitter     - random delay per read, order kept as TCP would
+//   bandwidth  - bytes per second cap in both directions
+//   split      - every pool message is cut mid-JSON and sent in two writes
+//   stall      - periodically nothing is forwarded for a while, then the
+//                backlog arrives at once
+//   reset      - periodically every connection is reset (RST)
+//   halfopen   - periodically the connections go silent without closing,
+//                as when a NAT entry or the pool host disappears
+//
+// Time lost is the time the miner spent without a session or on a job
+// older than the newest one the pool had sent. Shares are counted from the
+// mining.submit requests the miner sends and the verdicts the pool returns;
+// unanswered ones were lost with their connection.
+//
+//   fault_proxy [--listen 3334] [--upstream 127.0.0.1:3333]
+//               [--scenarios clean,latency,...] [--duration seconds]
+//               [--latency ms] [--jitter ms] [--bandwidth bytes/s]
+//               [--split-delay ms] [--fault-every seconds] [--stall-for seconds]
+//
+// Run it against mock_pool (or any pool) and point the miner at the listen port.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "rapidjson/document.h"
+
+#define POLL_INTERVAL_MS 5
+#define READ_SIZE 65536
+
+typedef std::chrono::steady_clock Clock;
+
+enum Scenario { CLEAN, LATENCY, JITTER, BANDWIDTH, SPLIT, STALL, RESET, HALFOPEN };
+static const char* kScenarioNames[] = {"clean", "latency", "jitter", "bandwidth", "split", "stall", "reset", "halfopen"};
+
+struct Options {
+    int listen_port = 3334;
+    std::string upstream_host = "127.0.0.1";
+    int upstream_port = 3333;
+    std::vector<Scenario> scenarios = {CLEAN, LATENCY, JITTER, BANDWIDTH, SPLIT, STALL, RESET, HALFOPEN};
+    int duration = 60;          // seconds per scenario
+    int latency = 200;          // ms
+    int jitter = 300;           // ms, delay drawn from [0, jitter]
+    int bandwidth = 512;        // bytes per second
+    int split_delay = 100;      // ms between the two halves of a message
+    int fault_every = 20;       // seconds between stalls, resets and silences
+    int stall_for = 8;          // seconds
+};
+
+struct ScenarioStats {
+    double lost_ms = 0;
+    uint64_t connections = 0;
+    uint64_t faults = 0;
+    uint64_t submitted = 0;
+    uint64_t accepted = 0;
+    uint64_t rejected = 0;
+    uint64_t unanswered = 0;
+};
+
+// Bytes waiting to be written; job is set on the piece that completes a
+// mining.notify so delivery to the miner can be timed.
+struct Piece {
+    Clock::time_point due;
+    std::string data;
+    std::string job;
+};
+
+struct Pipe {
+    std::deque<Piece> queue;
+    std::string partial_line;
+    Clock::time_point last_due;
+    double tokens = 0;
+};
+
+struct Link {
+    int miner = -1;
+    int pool = -1;
+    bool silent = false;        // half-open: everything is dropped, nothing closed
+    Pipe up;                    // miner to pool
+    Pipe down;                  // pool to miner
+    std::map<int64_t, Clock::time_point> submits;
+};
+
+static double ms_between(Clock::time_point a, Clock::time_point b) {
+    return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+class FaultProxy {
+public:
+    explicit FaultProxy(const Options& options) : options(options), rng(std::random_device{}()) {}
+
+    int run() {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int yes = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(options.listen_port);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 16) != 0) {
+            fprintf(stderr, "cannot listen on port %d: %s\n", options.listen_port, strerror(errno));
+            return 1;
+        }
+        printf("fault proxy on port %d -> %s:%d, %zu scenarios of %d s\n", options.listen_port,
+               options.upstream_host.c_str(), options.upstream_port, options.scenarios.size(), options.duration);
+
+        stats.resize(options.scenarios.size());
+        Clock::time_point last = Clock::now();
+        for (scenario_index = 0; scenario_index < options.scenarios.size(); ++scenario_index) {
+            Scenario scenario = options.scenarios[scenario_index];
+            scenario_start = Clock::now();
+            next_fault = scenario_start + std::chrono::seconds(options.fault_every);
+            stall_until = scenario_start;
+            printf("scenario %s\n", kScenarioNames[scenario]);
+            fflush(stdout);
+
+            while (Clock::now() < scenario_start + std::chrono::seconds(options.duration)) {
+                poll_once();
+                Clock::time_point now = Clock::now();
+                inject(scenario, now);
+                flush_all(scenario, now);
+                if (!newest_job.empty() && miner_job != newest_job) {
+                    stats[scenario_index].lost_ms += ms_between(std::max(last, scenario_start), now);
+                }
+                last = now;
+            }
+            print(scenario_index);
+        }
+
+        printf("\n%-10s %10s %7s %7s %10s %9s %9s %11s\n", "scenario", "lost ms", "lost %", "faults", "submitted",
+               "accepted", "rejected", "unanswered");
+        for (size_t i = 0; i < stats.size(); ++i) {
+            const ScenarioStats& s = stats[i];
+            printf("%-10s %10.0f %6.1f%% %7llu %10llu %9llu %9llu %11llu\n", kScenarioNames[options.scenarios[i]],
+                   s.lost_ms, 100.0 * s.lost_ms / (options.duration * 1000.0), (unsigned long long)s.faults,
+                   (unsigned long long)s.submitted, (unsigned long long)s.accepted, (unsigned long long)s.rejected,
+                   (unsigned long long)s.unanswered);
+        }
+        return 0;
+    }
+
+private:
+    void poll_once() {
+        std::vector<pollfd> fds;
+        fds.push_back({listen_fd, POLLIN, 0});
+        for (const auto& link : links) {
+            fds.push_back({link->miner, POLLIN, 0});
+            fds.push_back({link->pool, POLLIN, 0});     // -1 is ignored by poll
+        }
+        if (poll(fds.data(), fds.size(), POLL_INTERVAL_MS) <= 0) {
+            return;
+        }
+        if (fds[0].revents & POLLIN) {
+            accept_miner();
+        }
+        // Links accepted just now have no pollfd yet
+        size_t polled = (fds.size() - 1) / 2;
+        for (size_t i = 0; i < polled && i < links.size(); ++i) {
+            Link& link = *links[i];
+            if (fds[1 + 2 * i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                if (!read_side(link, link.miner, link.up, true)) link.miner = close_fd(link.miner);
+            }
+            if (link.pool >= 0 && (fds[2 + 2 * i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                if (!read_side(link, link.pool, link.down, false)) link.pool = close_fd(link.pool);
+            }
+        }
+        // A silent link keeps the miner's socket until the miner gives up on it
+        for (size_t i = 0; i < links.size();) {
+            Link& link = *links[i];
+            if (link.miner < 0 || (link.pool < 0 && !link.silent)) {
+                drop(i, false);
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    void accept_miner() {
+        int miner = accept(listen_fd, nullptr, nullptr);
+        if (miner < 0) {
+            return;
+        }
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* result = nullptr;
+        int pool = -1;
+        if (getaddrinfo(options.upstream_host.c_str(), std::to_string(options.upstream_port).c_str(), &hints, &result) == 0) {
+            for (addrinfo* ai = result; ai && pool < 0; ai = ai->ai_next) {
+                pool = socket(ai->ai_family, SOCK_STREAM, 0);
+                if (pool >= 0 && connect(pool, ai->ai_addr, ai->ai_addrlen) != 0) {
+                    pool = close_fd(pool);
+                }
+            }
+            freeaddrinfo(result);
+        }
+        if (pool < 0) {
+            printf("upstream %s:%d unreachable\n", options.upstream_host.c_str(), options.upstream_port);
+            close(miner);
+            return;
+        }
+        // Each write becomes its own segment, so a split really arrives split
+        int yes = 1;
+        setsockopt(miner, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        setsockopt(pool, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        std::unique_ptr<Link> link(new Link);
+        link->miner = miner;
+        link->pool = pool;
+        links.push_back(std::move(link));
+        stats[scenario_index].connections++;
+    }
+
+    bool read_side(Link& link, int fd, Pipe& pipe, bool from_miner) {
+        char buf[READ_SIZE];
+        ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return false;
+        }
+        if (n < 0) {
+            return true;
+        }
+
+        Clock::time_point now = Clock::now();
+        std::string job;
+        pipe.partial_line.append(buf, n);
+        size_t end;
+        while ((end = pipe.partial_line.find('\n')) != std::string::npos) {
+            std::string line = pipe.partial_line.substr(0, end);
+            pipe.partial_line.erase(0, end + 1);
+            inspect(link, line, from_miner, now, job);
+        }
+        if (link.silent) {
+            return true;
+        }
+
+        Scenario scenario = options.scenarios[scenario_index];
+        double delay = 0;
+        if (scenario == LATENCY) {
+            delay = options.latency;
+        } else if (scenario == JITTER) {
+            delay = std::uniform_real_distribution<double>(0, options.jitter)(rng);
+        }
+        Clock::time_point due = std::max(pipe.last_due, now + std::chrono::microseconds(static_cast<int64_t>(delay * 1000)));
+
+        std::vector<std::string> pieces;
+        if (scenario == SPLIT && !from_miner) {
+            // Cut each message in the middle
+            size_t begin = 0;
+            for (ssize_t i = 0; i < n; ++i) {
+                if (buf[i] == '\n' || i == n - 1) {
+                    size_t mid = begin + (i + 1 - begin) / 2;
+                    if (mid > begin) pieces.emplace_back(buf + begin, mid - begin);
+                    pieces.emplace_back(buf + mid, i + 1 - mid);
+                    begin = i + 1;
+                }
+            }
+        } else {
+            pieces.emplace_back(buf, n);
+        }
+        for (size_t i = 0; i < pieces.size(); ++i) {
+            if (i > 0) due += std::chrono::milliseconds(options.split_delay);
+            pipe.queue.push_back({due, pieces[i], i + 1 == pieces.size() ? job : std::string()});
+        }
+        pipe.last_due = due;
+        return true;
+    }
+
+    // Follows submits, verdicts and jobs as they pass
+    void inspect(Link& link, const std::string& line, bool from_miner, Clock::time_point now, std::string& job) {
+        rapidjson::Document doc;
+        doc.Parse(line.c_str());
+        if (doc.HasParseError() || !doc.IsObject()) {
+            return;
+        }
+        ScenarioStats& s = stats[scenario_index];
+        bool has_id = doc.HasMember("id") && doc["id"].IsInt64();
+        if (from_miner) {
+            if (has_id && doc.HasMember("method") && doc["method"].IsString() &&
+                strcmp(doc["method"].GetString(), "mining.submit") == 0) {
+                link.submits[doc["id"].GetInt64()] = now;
+                s.submitted++;
+            }
+            return;
+        }
+        if (doc.HasMember("method") && doc["method"].IsString() &&
+            strcmp(doc["method"].GetString(), "mining.notify") == 0 && doc.HasMember("params") &&
+            doc["params"].IsArray() && doc["params"].Size() > 0 && doc["params"][0].IsString()) {
+            job = doc["params"][0].GetString();
+            newest_job = job;
+        } else if (has_id) {
+            auto it = link.submits.find(doc["id"].GetInt64());
+            if (it != link.submits.end()) {
+                bool ok = doc.HasMember("result") && doc["result"].IsBool() && doc["result"].GetBool();
+                (ok ? s.accepted : s.rejected)++;
+                link.submits.erase(it);
+            }
+        }
+    }
+
+    void inject(Scenario scenario, Clock::time_point now) {
+        if ((scenario != STALL && scenario != RESET && scenario != HALFOPEN) || now < next_fault) {
+            return;
+        }
+        next_fault = now + std::chrono::seconds(options.fault_every);
+        stats[scenario_index].faults++;
+        if (scenario == STALL) {
+            stall_until = now + std::chrono::seconds(options.stall_for);
+            printf("  stalling for %d s\n", options.stall_for);
+        } else if (scenario == RESET) {
+            printf("  resetting %zu connections\n", links.size());
+            while (!links.empty()) {
+                drop(0, true);
+            }
+        } else {
+            size_t silenced = 0;
+            for (auto& link : links) {
+                silenced += !link->silent;
+                link->silent = true;
+                link->up.queue.clear();
+                link->down.queue.clear();
+            }
+            miner_job.clear();
+            printf("  silencing %zu connections\n", silenced);
+        }
+        fflush(stdout);
+    }
+
+    void flush_all(Scenario scenario, Clock::time_point now) {
+        if (scenario == STALL && now < stall_until) {
+            return;
+        }
+        for (auto& link : links) {
+            if (link->silent) continue;
+            flush(*link, link->up, link->pool, scenario, now, false);
+            flush(*link, link->down, link->miner, scenario, now, true);
+        }
+    }
+
+    void flush(Link& link, Pipe& pipe, int fd, Scenario scenario, Clock::time_point now, bool to_miner) {
+        if (fd < 0) {
+            return;
+        }
+        if (scenario == BANDWIDTH) {
+            // A tenth of a second of burst
+            pipe.tokens = std::min(pipe.tokens + options.bandwidth * POLL_INTERVAL_MS / 1000.0, options.bandwidth / 10.0 + 1);
+        }
+        while (!pipe.queue.empty() && pipe.queue.front().due <= now) {
+            Piece& piece = pipe.queue.front();
+            size_t size = piece.data.size();
+            if (scenario == BANDWIDTH) {
+                size = std::min(size, static_cast<size_t>(pipe.tokens));
+                if (size == 0) return;
+            }
+            ssize_t n = send(fd, piece.data.data(), size, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n <= 0) {
+                return;
+            }
+            if (scenario == BANDWIDTH) pipe.tokens -= n;
+            piece.data.erase(0, n);
+            if (!piece.data.empty()) {
+                return;
+            }
+            if (to_miner && !piece.job.empty() && &link == links.back().get()) {
+                miner_job = piece.job;
+            }
+            pipe.queue.pop_front();
+        }
+    }
+
+    void drop(size_t index, bool reset) {
+        Link& link = *links[index];
+        stats[scenario_index].unanswered += link.submits.size();
+        if (reset) {
+            // Zero linger turns close into RST
+            linger hard = {1, 0};
+            if (link.miner >= 0) setsockopt(link.miner, SOL_SOCKET, SO_LINGER, &hard, sizeof(hard));
+            if (link.pool >= 0) setsockopt(link.pool, SOL_SOCKET, SO_LINGER, &hard, sizeof(hard));
+        }
+        close_fd(link.miner);
+        close_fd(link.pool);
+        links.erase(links.begin() + index);
+        if (links.empty() || links.back()->silent) {
+            miner_job.clear();
+        }
+    }
+
+    static int close_fd(int fd) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    void print(size_t index) {
+        const ScenarioStats& s = stats[index];
+        printf("  %s: %.0f ms of %d s lost (%.1f%%), %llu connections, %llu faults, shares %llu submitted, "
+               "%llu accepted, %llu rejected, %llu unanswered\n",
+               kScenarioNames[options.scenarios[index]], s.lost_ms, options.duration,
+               100.0 * s.lost_ms / (options.duration * 1000.0), (unsigned long long)s.connections,
+               (unsigned long long)s.faults, (unsigned long long)s.submitted, (unsigned long long)s.accepted,
+               (unsigned long long)s.rejected, (unsigned long long)s.unanswered);
+        fflush(stdout);
+    }
+
+    Options options;
+    std::mt19937 rng;
+    int listen_fd = -1;
+    std::vector<std::unique_ptr<Link>> links;
+    std::vector<ScenarioStats> stats;
+    size_t scenario_index = 0;
+    Clock::time_point scenario_start;
+    Clock::time_point next_fault;
+    Clock::time_point stall_until;
+    std::string newest_job;     // last job the pool sent on any connection
+    std::string miner_job;      // last job delivered to the miner's current connection
+};
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        const char* value = argv[i + 1];
+        if (key == "--listen") options.listen_port = atoi(value);
+        else if (key == "--upstream") {
+            std::string upstream = value;
+            size_t colon = upstream.rfind(':');
+            options.upstream_host = upstream.substr(0, colon);
+            if (colon != std::string::npos) options.upstream_port = atoi(upstream.c_str() + colon + 1);
+        } else if (key == "--scenarios") {
+            options.scenarios.clear();
+            std::stringstream list(value);
+            std::string name;
+            while (std::getline(list, name, ',')) {
+                auto it = std::find_if(std::begin(kScenarioNames), std::end(kScenarioNames),
+                                       [&](const char* known) { return name == known; });
+                if (it == std::end(kScenarioNames)) {
+                    fprintf(stderr, "unknown scenario %s\n", name.c_str());
+                    return 1;
+                }
+                options.scenarios.push_back(static_cast<Scenario>(it - std::begin(kScenarioNames)));
+            }
+        }
+        else if (key == "--duration") options.duration = std::max(atoi(value), 1);
+        else if (key == "--latency") options.latency = atoi(value);
+        else if (key == "--jitter") options.jitter = atoi(value);
+        else if (key == "--bandwidth") options.bandwidth = std::max(atoi(value), 1);
+        else if (key == "--split-delay") options.split_delay = atoi(value);
+        else if (key == "--fault-every") options.fault_every = std::max(atoi(value), 1);
+        else if (key == "--stall-for") options.stall_for = atoi(value);
+        else {
+            fprintf(stderr, "unknown option %s\n", key.c_str());
+            return 1;
+        }
+    }
+    return FaultProxy(options).run();
+}
@@ -0,0 +1,102 @@
+// bench/hex_bench.cpp
+//
+// Hex conversion on the protocol path, before and after the shared codec:
+//   job parse    - header hash, seed hash and target of a mining.notify
+//   share submit - nonce and mix hash of a found share
+// The "old" variants are the sscanf / stringstream / stoul code the call
+// sites used before.
+//
+//   hex_bench [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "hex.h"
+#include "uint256.h"
+
+static volatile uint64_t sink;
+
+template <typename F>
+static double run(const char* name, int iterations, F&& body) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t acc = 0;
+    for (int i = 0; i < iterations; ++i) {
+        acc += body(i);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+    sink = acc;
+    printf("%-28s %10.1f ns/op\n", name, ns);
+    return ns;
+}
+
+static const std::string kHeader = "4b5a80a1b6f15d8a6a993abc5c8273e1761a03da80a7e841bce0a53f2a6f8ebf";
+static const std::string kSeed = "5c0aa6d68aa7eb3c6bb5d0b48be88f233e61f70cedbd7f3b06ac8a303a4127be";
+static const std::string kTarget = "00000000ffff0000000000000000000000000000000000000000000000000000";
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    printf("hex codec (%s), %d iterations\n", hex_backend(), iterations);
+
+    double old_parse = run("job parse, old", iterations, [&](int) {
+        uint32_t seed[8], target[8];
+        for (int i = 0; i < 8; ++i) {
+            sscanf(kSeed.c_str() + i * 8, "%8x", &seed[i]);
+            sscanf(kTarget.c_str() + i * 8, "%8x", &target[7 - i]);
+        }
+        std::vector<uint8_t> header;
+        for (size_t i = 0; i < kHeader.size(); i += 2) {
+            header.push_back(static_cast<uint8_t>(std::stoul(kHeader.substr(i, 2), nullptr, 16)));
+        }
+        return static_cast<uint64_t>(seed[3] + target[5] + header[7]);
+    });
+    double new_parse = run("job parse, codec", iterations, [&](int) {
+        uint8_t header[32], seed[32];
+        uint256 target;
+        hex_decode(kHeader.data(), kHeader.size(), header, sizeof(header));
+        hex_decode(kSeed.data(), kSeed.size(), seed, sizeof(seed));
+        uint256::from_hex(kTarget, target);
+        return static_cast<uint64_t>(seed[12] + target.words[5] + header[7]);
+    });
+
+    uint8_t mix[32];
+    for (int i = 0; i < 32; ++i) {
+        mix[i] = static_cast<uint8_t>(i * 37 + 11);
+    }
+    double old_submit = run("share submit, old", iterations, [&](int n) {
+        std::stringstream nonce_ss;
+        nonce_ss << std::hex << std::setfill('0') << std::setw(16) << (0xcaaf9def00000000ULL + n);
+        std::stringstream mix_ss;
+        for (int i = 0; i < 32; ++i) {
+            mix_ss << std::hex << std::setfill('0') << std::setw(2) << static_cast<int>(mix[i]);
+        }
+        return static_cast<uint64_t>(nonce_ss.str()[15] + mix_ss.str()[63]);
+    });
+    double new_submit = run("share submit, codec", iterations, [&](int n) {
+        char nonce_hex[16], mix_hex[64];
+        hex_encode_u64(0xcaaf9def00000000ULL + n, nonce_hex);
+        hex_encode(mix, sizeof(mix), mix_hex);
+        std::string nonce(nonce_hex, sizeof(nonce_hex)), mix_str(mix_hex, sizeof(mix_hex));
+        return static_cast<uint64_t>(nonce[15] + mix_str[63]);
+    });
+
+    std::vector<uint8_t> blob(4096);
+    std::vector<char> blob_hex(blob.size() * 2);
+    for (size_t i = 0; i < blob.size(); ++i) {
+        blob[i] = static_cast<uint8_t>(i * 131);
+    }
+    run("encode 4 KiB", iterations / 100, [&](int) {
+        hex_encode(blob.data(), blob.size(), blob_hex.data());
+        return static_cast<uint64_t>(blob_hex[100]);
+    });
+    run("decode 4 KiB", iterations / 100, [&](int) {
+        hex_decode(blob_hex.data(), blob_hex.size(), blob.data(), blob.size());
+        return static_cast<uint64_t>(blob[100]);
+    });
+
+    printf("speedup: job parse %.1fx, share submit %.1fx\n", old_parse / new_parse, old_submit / new_submit);
+    return 0;
+}
@@ -0,0 +1,197 @@
+// bench/journal_query.cpp
+//
+// Reads share journals (see share_journal.h) and summarizes them per pool
+// and per device: outcomes, the difficulty the pool credited, submit round
+// trips, time from a share being found to it going out, and the most
+// common rejection reasons. --list prints the matching records as CSV
+// instead, one per share.
+//
+//   journal_query [--pool host:port] [--device id] [--outcome accepted|rejected|stale|lost]
+//                 [--since unix_seconds] [--until unix_seconds] [--list] journal...
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "share_journal.h"
+
+static const char* kOutcomes[] = {"unknown", "accepted", "rejected", "stale", "lost"};
+
+struct Filter {
+    std::string pool;
+    int device = -2;            // -2 = any
+    int outcome = 0;            // 0 = any
+    uint64_t since_us = 0;
+    uint64_t until_us = UINT64_MAX;
+};
+
+struct Summary {
+    uint64_t outcomes[5] = {};
+    double credited = 0;        // difficulty of accepted shares
+    std::vector<double> rtt_ms;
+    std::vector<double> to_wire_ms;
+};
+
+static bool matches(const ShareRecord& r, const Filter& filter) {
+    return (filter.pool.empty() || filter.pool == r.pool) && (filter.device == -2 || filter.device == r.device) &&
+           (filter.outcome == 0 || filter.outcome == r.outcome) && r.found_us >= filter.since_us &&
+           r.found_us < filter.until_us;
+}
+
+static void add(Summary& s, const ShareRecord& r) {
+    s.outcomes[r.outcome < 5 ? r.outcome : 0]++;
+    if (r.outcome == static_cast<uint8_t>(ShareOutcome::ACCEPTED)) {
+        s.credited += r.difficulty;
+    }
+    if (r.sent_us && r.answered_us >= r.sent_us) {
+        s.rtt_ms.push_back((r.answered_us - r.sent_us) / 1000.0);
+    }
+    if (r.sent_us && r.found_us && r.sent_us >= r.found_us) {
+        s.to_wire_ms.push_back((r.sent_us - r.found_us) / 1000.0);
+    }
+}
+
+static double percentile(std::vector<double>& values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    size_t k = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+static void print_header(const char* key) {
+    printf("%-24s %9s %9s %9s %9s %8s %14s %9s %9s %9s\n", key, "accepted", "rejected", "stale", "lost", "accept%",
+           "credited diff", "rtt p50", "rtt p99", "wire p99");
+}
+
+static void print_row(const std::string& key, Summary& s) {
+    uint64_t total = s.outcomes[1] + s.outcomes[2] + s.outcomes[3] + s.outcomes[4];
+    printf("%-24s %9llu %9llu %9llu %9llu %7.2f%% %14.6g %7.1fms %7.1fms %7.1fms\n", key.c_str(),
+           static_cast<unsigned long long>(s.outcomes[1]), static_cast<unsigned long long>(s.outcomes[2]),
+           static_cast<unsigned long long>(s.outcomes[3]), static_cast<unsigned long long>(s.outcomes[4]),
+           total ? 100.0 * s.outcomes[1] / total : 0.0, s.credited, percentile(s.rtt_ms, 0.5),
+           percentile(s.rtt_ms, 0.99), percentile(s.to_wire_ms, 0.99));
+}
+
+static void print_csv(const ShareRecord& r) {
+    char header[65], mix[65];
+    for (int i = 0; i < 32; ++i) {
+        snprintf(header + 2 * i, 3, "%02x", r.header_hash[i]);
+        snprintf(mix + 2 * i, 3, "%02x", r.mix_hash[i]);
+    }
+    printf("%llu,%llu,%llu,%s,%d,%s,%llu,%016llx,%s,%s,%.9g,%s,\"%s\"\n",
+           static_cast<unsigned long long>(r.found_us), static_cast<unsigned long long>(r.sent_us),
+           static_cast<unsigned long long>(r.answered_us), r.pool, r.device, r.job_id,
+           static_cast<unsigned long long>(r.block_number), static_cast<unsigned long long>(r.nonce), header, mix,
+           r.difficulty, kOutcomes[r.outcome < 5 ? r.outcome : 0], r.reason);
+}
+
+int main(int argc, char** argv) {
+    Filter filter;
+    bool list = false;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        std::string key = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : "";
+        if (key == "--list") {
+            list = true;
+            continue;
+        }
+        if (key.compare(0, 2, "--") != 0) {
+            files.push_back(key);
+            continue;
+        }
+        ++i;
+        if (key == "--pool") filter.pool = value;
+        else if (key == "--device") filter.device = atoi(value);
+        else if (key == "--since") filter.since_us = strtoull(value, nullptr, 10) * 1000000;
+        else if (key == "--until") filter.until_us = strtoull(value, nullptr, 10) * 1000000;
+        else if (key == "--outcome") {
+            auto it = std::find_if(std::begin(kOutcomes) + 1, std::end(kOutcomes),
+                                   [&](const char* name) { return strcmp(value, name) == 0; });
+            if (it == std::end(kOutcomes)) {
+                fprintf(stderr, "unknown outcome %s\n", value);
+                return 1;
+            }
+            filter.outcome = static_cast<int>(it - std::begin(kOutcomes));
+        } else {
+            fprintf(stderr, "unknown option %s\n", key.c_str());
+            return 1;
+        }
+    }
+    if (files.empty()) {
+        fprintf(stderr, "usage: journal_query [--pool host:port] [--device id] [--outcome name] "
+                        "[--since s] [--until s] [--list] journal...\n");
+        return 1;
+    }
+
+    if (list) {
+        printf("found_us,sent_us,answered_us,pool,device,job_id,block,nonce,header_hash,mix_hash,difficulty,outcome,reason\n");
+    }
+    Summary all;
+    std::map<std::string, Summary> pools;
+    std::map<int, Summary> devices;
+    std::map<std::string, uint64_t> reasons;
+    uint64_t first_us = UINT64_MAX, last_us = 0;
+    for (const std::string& path : files) {
+        ShareJournalReader reader;
+        if (!reader.open(path)) {
+            fprintf(stderr, "%s: not a share journal\n", path.c_str());
+            return 1;
+        }
+        ShareRecord r;
+        while (reader.next(r)) {
+            if (!matches(r, filter)) {
+                continue;
+            }
+            if (list) {
+                print_csv(r);
+                continue;
+            }
+            add(all, r);
+            add(pools[r.pool], r);
+            add(devices[r.device], r);
+            if (r.outcome != static_cast<uint8_t>(ShareOutcome::ACCEPTED)) {
+                reasons[r.reason[0] ? r.reason : "(none)"]++;
+            }
+            first_us = std::min(first_us, r.found_us);
+            last_us = std::max(last_us, r.found_us);
+        }
+    }
+    if (list) {
+        return 0;
+    }
+
+    uint64_t total = all.outcomes[1] + all.outcomes[2] + all.outcomes[3] + all.outcomes[4];
+    printf("%llu shares", static_cast<unsigned long long>(total));
+    if (total) {
+        printf(" found over %.1f hours", (last_us - first_us) / 3.6e9);
+    }
+    printf("\n\n");
+    print_header("pool");
+    for (auto& entry : pools) {
+        print_row(entry.first, entry.second);
+    }
+    print_row("all", all);
+    printf("\n");
+    print_header("device");
+    for (auto& entry : devices) {
+        print_row(entry.first < 0 ? "proxy rigs" : std::to_string(entry.first), entry.second);
+    }
+    if (!reasons.empty()) {
+        std::vector<std::pair<uint64_t, std::string>> ranked;
+        for (const auto& entry : reasons) {
+            ranked.emplace_back(entry.second, entry.first);
+        }
+        std::sort(ranked.rbegin(), ranked.rend());
+        printf("\nnot accepted, by reason\n");
+        for (size_t i = 0; i < ranked.size() && i < 10; ++i) {
+            printf("%9llu  %s\n", static_cast<unsigned long long>(ranked[i].first), ranked[i].second.c_str());
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+// bench/metrics_bench.cpp
+//
+// Cost of recording metrics on the hot path: a histogram sample and a
+// counter add on the calling thread's own shard, the same with a clock read,
+// the shared overflow shard, and all threads recording at once. For
+// comparison, every thread adding to one shared atomic, which is what the
+// shards avoid. Ends with the cost of a scrape.
+//
+//   metrics_bench [iterations] [threads]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "metrics.h"
+
+// Keeps results alive so the optimizer cannot drop the measured work
+static volatile int64_t sink;
+
+template <typename F>
+static double time_ns(int iterations, F&& body) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        body(i);
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+template <typename F>
+static void run(const char* name, int iterations, F&& body) {
+    printf("%-36s %8.2f ns/op\n", name, time_ns(iterations, body));
+}
+
+// Every thread runs body at once; reports the slowest thread's ns/op
+template <typename F>
+static void run_threads(const char* name, int threads, int iterations, F&& body) {
+    std::vector<std::thread> pool;
+    std::vector<double> ns(threads);
+    std::atomic<int> ready{0};
+    for (int t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t] {
+            ready++;
+            while (ready < threads) {
+            }
+            ns[t] = time_ns(iterations, body);
+        });
+    }
+    double worst = 0;
+    for (int t = 0; t < threads; ++t) {
+        pool[t].join();
+        worst = std::max(worst, ns[t]);
+    }
+    char label[64];
+    snprintf(label, sizeof(label), "%s, %d threads", name, threads);
+    printf("%-36s %8.2f ns/op\n", label, worst);
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 10000000;
+    int threads = argc > 2 ? atoi(argv[2]) : static_cast<int>(std::thread::hardware_concurrency());
+    threads = std::max(1, std::min(threads, METRIC_SHARDS - 1));
+
+    Metrics& metrics = Metrics::instance();
+    Histogram& histogram = metrics.histogram("bench_seconds", "Benchmark histogram", "device=\"0\"");
+    Counter& counter = metrics.counter("bench_total", "Benchmark counter", "device=\"0\"");
+    std::atomic<uint64_t> shared{0};
+
+    printf("metric recording, %d iterations\n", iterations);
+    run("histogram observe_ns", iterations, [&](int i) { histogram.observe_ns(static_cast<uint64_t>(i) * 977); });
+    run("counter add", iterations, [&](int i) { counter.add(256); });
+    run("histogram observe_since (+clock)", iterations, [&](int i) {
+        histogram.observe_since(std::chrono::steady_clock::now());
+    });
+    run("steady_clock::now alone", iterations, [&](int i) {
+        sink = std::chrono::steady_clock::now().time_since_epoch().count();
+    });
+
+    run_threads("histogram observe_ns", threads, iterations, [&](int i) {
+        histogram.observe_ns(static_cast<uint64_t>(i) * 977);
+    });
+    run_threads("counter add", threads, iterations, [&](int i) { counter.add(256); });
+    run_threads("shared atomic fetch_add", threads, iterations, [&](int i) {
+        shared.fetch_add(256, std::memory_order_relaxed);
+    });
+
+    // Use up the exclusive shards so the next threads land on the overflow one
+    std::vector<std::thread> fillers;
+    for (int t = 0; t < METRIC_SHARDS; ++t) {
+        fillers.emplace_back([&] { counter.add(); });
+    }
+    for (auto& t : fillers) {
+        t.join();
+    }
+    std::thread overflow([&] {
+        run("histogram observe_ns, overflow shard", iterations, [&](int i) {
+            histogram.observe_ns(static_cast<uint64_t>(i) * 977);
+        });
+    });
+    overflow.join();
+
+    // A scrape of a realistic registry: 8 devices and 4 pools
+    for (int d = 0; d < 8; ++d) {
+        std::string labels = "device=\"" + std::to_string(d) + "\"";
+        metrics.counter("kawpow_hashes_total", "Hashes computed", labels).add(d);
+        metrics.histogram("kawpow_batch_duration_seconds", "Batch", labels).observe_ns(d * 1000000);
+        metrics.histogram("kawpow_job_switch_seconds", "Job switch", labels).observe_ns(d * 1000);
+    }
+    for (int p = 0; p < 4; ++p) {
+        std::string labels = "pool=\"pool" + std::to_string(p) + ":3333\"";
+        metrics.histogram("kawpow_submit_rtt_seconds", "RTT", labels).observe_ns(p * 1000000);
+        metrics.counter("kawpow_shares_total", "Shares", labels + ",result=\"accepted\"").add(p);
+    }
+    std::string out;
+    double scrape_ns = time_ns(1000, [&](int) {
+        out.clear();
+        metrics.render(out);
+    });
+    printf("%-36s %8.1f us, %zu bytes\n", "scrape", scrape_ns / 1000, out.size());
+    return 0;
+}
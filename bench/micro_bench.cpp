@@ -0,0 +1,444 @@
+// bench/micro_bench.cpp
+//
+// Microbenchmarks for the host-side hashing code and the protocol codecs:
+//   keccak        every Keccak-f1600 in the tree (keccakf1600.c, the one
+//                 in base/crypto/keccak.cpp, and sha3_HashBuffer from
+//                 base/crypto/sha3.cpp as the DAG code calls it), and
+//                 ethash_keccakf800
+//   kiss99        one draw of ProgPoW's random number generator
+//   progpow       a full KawPoW hash through kawpow_verify_hash at epoch
+//                 0, its DAG items derived from the light cache
+//   dag item      the three ethash_calculate_dag_item variants, per item
+//   light cache   building the cache the DAG is generated from
+//   hex           32 bytes in and out of the codec
+//   notify/submit the steps Stratum takes to parse a mining.notify and to
+//                 serialize a mining.submit
+//
+// Each benchmark doubles its batch until one takes --min-time, then
+// reports the median of --repeat batches: ns/op, ops/s and heap
+// allocations (operator new) per op. --json writes the results to a file,
+// and --compare reads one back as the baseline: any benchmark slower by
+// more than --threshold percent is flagged and the exit status is 1.
+//
+//   micro_bench [--filter substring] [--min-time ms] [--repeat n]
+//               [--json file] [--compare baseline.json] [--threshold percent]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+#include "base/crypto/keccak.h"
+#include "base/crypto/sha3.h"
+#include "hex.h"
+#include "kawpow_verify.h"
+#include "libethash/ethash_internal.h"
+#include "rapidjson/document.h"
+#include "rapidjson/filereadstream.h"
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+#include "share_target.h"
+
+extern "C" void keccakf(uint64_t state[25]);
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+// The operator new below is malloc underneath, which GCC takes for a
+// mismatch wherever both get inlined
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+// Every operator new goes through here, so a benchmark's allocations can
+// be counted
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// Keeps results alive so the optimizer cannot drop the measured work
+static volatile uint64_t sink;
+
+struct Benchmark {
+    const char* name;
+    // Does n operations and returns something derived from their results
+    std::function<uint64_t(uint64_t n)> run;
+};
+
+struct Result {
+    std::string name;
+    uint64_t iterations = 0;    // per batch
+    double ns_per_op = 0;
+    double ops_per_sec = 0;
+    double allocs_per_op = 0;
+};
+
+static double batch_ns(const Benchmark& bench, uint64_t n) {
+    auto start = std::chrono::steady_clock::now();
+    sink = bench.run(n);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+static Result measure(const Benchmark& bench, double min_ns, int repeat) {
+    Result result;
+    result.name = bench.name;
+    uint64_t n = 1;
+    while (batch_ns(bench, n) < min_ns && n < (1ULL << 40)) {
+        n *= 2;
+    }
+    std::vector<double> samples;
+    samples.reserve(repeat);
+    uint64_t allocated = allocations.load();
+    for (int i = 0; i < repeat; ++i) {
+        samples.push_back(batch_ns(bench, n) / n);
+    }
+    allocated = allocations.load() - allocated;
+    std::sort(samples.begin(), samples.end());
+    result.iterations = n;
+    result.ns_per_op = samples[samples.size() / 2];
+    result.ops_per_sec = 1e9 / result.ns_per_op;
+    result.allocs_per_op = static_cast<double>(allocated) / (static_cast<double>(n) * repeat);
+    return result;
+}
+
+// --- Inputs ----------------------------------------------------------------
+
+static const char* kNotify =
+    "{\"id\":null,\"method\":\"mining.notify\",\"params\":[\"8f3a\","
+    "\"4b5a80a1b6f15d8a6a993abc5c8273e1761a03da80a7e841bce0a53f2a6f8ebf\","
+    "\"5c0aa6d68aa7eb3c6bb5d0b48be88f233e61f70cedbd7f3b06ac8a303a4127be\","
+    "\"00000000ffff0000000000000000000000000000000000000000000000000000\",true,3000000,\"1b00f0ff\"]}";
+static const char* kHeader = "4b5a80a1b6f15d8a6a993abc5c8273e1761a03da80a7e841bce0a53f2a6f8ebf";
+static const char* kWallet = "RKbMpiXtFJmTrKNzcHRpxhR8Tu6xUPKFdy.rig0";
+
+// Built once; the DAG item benchmarks read it
+static ethash_light_t light;
+
+static std::vector<Benchmark> benchmarks() {
+    std::vector<Benchmark> list;
+
+    list.push_back({"keccak-f1600 keccakf1600.c", [](uint64_t n) {
+        uint64_t state[25] = {1};
+        for (uint64_t i = 0; i < n; ++i) {
+            keccakf(state);
+        }
+        return state[0];
+    }});
+    list.push_back({"keccak-f1600 base/crypto/keccak", [](uint64_t n) {
+        uint64_t state[25] = {1};
+        for (uint64_t i = 0; i < n; ++i) {
+            jdkcat::keccakf(state, 24);
+        }
+        return state[0];
+    }});
+    list.push_back({"keccak-512 sha3_HashBuffer 64B", [](uint64_t n) {
+        uint8_t data[64] = {1};
+        for (uint64_t i = 0; i < n; ++i) {
+            sha3_HashBuffer(512, SHA3_FLAGS_KECCAK, data, sizeof(data), data, sizeof(data));
+        }
+        return static_cast<uint64_t>(data[0]);
+    }});
+    list.push_back({"keccak-f800 ethash_keccakf800", [](uint64_t n) {
+        uint32_t state[25] = {1};
+        for (uint64_t i = 0; i < n; ++i) {
+            ethash_keccakf800(state);
+        }
+        return static_cast<uint64_t>(state[0]);
+    }});
+    list.push_back({"kiss99", [](uint64_t n) {
+        Kiss99 rng = {0x811c9dc5, 0x811c9dc5, 0x811c9dc5, 0x811c9dc5};
+        uint64_t acc = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            acc += rng.get();
+        }
+        return acc;
+    }});
+    list.push_back({"progpow hash (light cache)", [](uint64_t n) {
+        uint8_t header[32];
+        hex_decode(kHeader, 64, header, sizeof(header));
+        auto epoch = kawpow_epoch(0);
+        KawpowResult result;
+        uint64_t acc = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            kawpow_verify_hash(*epoch, 1000, header, 0xcaaf9def00000000ULL + i, result);
+            acc += result.hash[0];
+        }
+        return acc;
+    }});
+
+    list.push_back({"dag item", [](uint64_t n) {
+        node item;
+        uint64_t acc = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            ethash_calculate_dag_item(&item, static_cast<uint32_t>(i), ETHASH_DATASET_PARENTS, light);
+            acc += item.words[0];
+        }
+        return acc;
+    }});
+    list.push_back({"dag item opt", [](uint64_t n) {
+        node item;
+        uint64_t acc = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            ethash_calculate_dag_item_opt(&item, static_cast<uint32_t>(i), ETHASH_DATASET_PARENTS, light);
+            acc += item.words[0];
+        }
+        return acc;
+    }});
+    list.push_back({"dag item 4 opt, per item", [](uint64_t n) {
+        node items[4];
+        uint64_t acc = 0;
+        for (uint64_t i = 0; i < n; i += 4) {
+            ethash_calculate_dag_item4_opt(items, static_cast<uint32_t>(i), ETHASH_DATASET_PARENTS, light);
+            acc += items[0].words[0];
+        }
+        return acc;
+    }});
+    list.push_back({"light cache build", [](uint64_t n) {
+        uint64_t acc = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            ethash_light_t built = ethash_light_new(light->block_number);
+            acc += static_cast<const uint8_t*>(built->cache)[0];
+            ethash_light_delete(built);
+        }
+        return acc;
+    }});
+
+    list.push_back({"hex decode 32B", [](uint64_t n) {
+        uint8_t out[32];
+        uint64_t acc = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            hex_decode(kHeader, 64, out, sizeof(out));
+            acc += out[i & 31];
+        }
+        return acc;
+    }});
+    list.push_back({"hex encode 32B", [](uint64_t n) {
+        uint8_t in[32];
+        char out[64];
+        hex_decode(kHeader, 64, in, sizeof(in));
+        uint64_t acc = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            in[0] = static_cast<uint8_t>(i);
+            hex_encode(in, sizeof(in), out);
+            acc += out[1];
+        }
+        return acc;
+    }});
+
+    // As Stratum::process_single_message handles a notify, without the logging
+    list.push_back({"mining.notify parse", [](uint64_t n) {
+        uint64_t acc = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            rapidjson::Document doc;
+            doc.Parse(kNotify);
+            const rapidjson::Value& params = doc["params"];
+            std::string job_id = params[0].IsString() ? params[0].GetString() : "";
+            std::string header_hash = params[1].IsString() ? params[1].GetString() : "";
+            std::string seed_hash = params[2].IsString() ? params[2].GetString() : "";
+            uint64_t block_number = params[5].IsUint64() ? params[5].GetUint64() : 0;
+            ShareBoundary target;
+            boundary_from_hex(params[3].GetString(), target);
+            uint32_t bits = static_cast<uint32_t>(strtoul(params[6].GetString(), nullptr, 16));
+            acc += job_id.size() + header_hash.size() + seed_hash.size() + block_number + bits + target.prefix;
+        }
+        return acc;
+    }});
+    // As Stratum::send_share builds a submit
+    list.push_back({"mining.submit serialize", [](uint64_t n) {
+        char nonce[16], mix[64];
+        uint8_t mix_bytes[32] = {7};
+        hex_encode(mix_bytes, sizeof(mix_bytes), mix);
+        std::string mix_hex(mix, 64);
+        uint64_t acc = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            hex_encode_u64(0xcaaf9def00000000ULL + i, nonce);
+            rapidjson::Document d;
+            d.SetObject();
+            d.AddMember("id", static_cast<int>(i), d.GetAllocator());
+            d.AddMember("method", "mining.submit", d.GetAllocator());
+            rapidjson::Value params(rapidjson::kArrayType);
+            params.PushBack(rapidjson::Value(kWallet, d.GetAllocator()).Move(), d.GetAllocator());
+            params.PushBack(rapidjson::Value("8f3a", d.GetAllocator()).Move(), d.GetAllocator());
+            std::string full_nonce = "0x" + std::string(nonce, 16);
+            params.PushBack(rapidjson::Value(full_nonce.c_str(), d.GetAllocator()).Move(), d.GetAllocator());
+            std::string full_header = "0x" + std::string(kHeader);
+            params.PushBack(rapidjson::Value(full_header.c_str(), d.GetAllocator()).Move(), d.GetAllocator());
+            std::string full_mix = "0x" + mix_hex;
+            params.PushBack(rapidjson::Value(full_mix.c_str(), d.GetAllocator()).Move(), d.GetAllocator());
+            d.AddMember("params", params, d.GetAllocator());
+            rapidjson::StringBuffer buffer;
+            rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+            d.Accept(writer);
+            std::string msg = std::string(buffer.GetString()) + "\n";
+            acc += msg.size();
+        }
+        return acc;
+    }});
+    return list;
+}
+
+// The optimized DAG item variants have to agree with the reference one
+static bool check_dag_items() {
+    for (uint32_t index = 0; index < 4096; index += 4) {
+        node reference[4], opt, four[4];
+        ethash_calculate_dag_item4_opt(four, index, ETHASH_DATASET_PARENTS, light);
+        for (uint32_t j = 0; j < 4; ++j) {
+            ethash_calculate_dag_item(&reference[j], index + j, ETHASH_DATASET_PARENTS, light);
+            ethash_calculate_dag_item_opt(&opt, index + j, ETHASH_DATASET_PARENTS, light);
+            if (memcmp(&reference[j], &opt, sizeof(node)) != 0 || memcmp(&reference[j], &four[j], sizeof(node)) != 0) {
+                fprintf(stderr, "DAG item %u differs between the variants\n", index + j);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool write_json(const std::string& path, const std::vector<Result>& results) {
+    rapidjson::StringBuffer buffer;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("benchmarks");
+    writer.StartArray();
+    for (const Result& r : results) {
+        writer.StartObject();
+        writer.Key("name");
+        writer.String(r.name.c_str());
+        writer.Key("iterations");
+        writer.Uint64(r.iterations);
+        writer.Key("ns_per_op");
+        writer.Double(r.ns_per_op);
+        writer.Key("ops_per_sec");
+        writer.Double(r.ops_per_sec);
+        writer.Key("allocs_per_op");
+        writer.Double(r.allocs_per_op);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "cannot write %s\n", path.c_str());
+        return false;
+    }
+    fprintf(f, "%s\n", buffer.GetString());
+    fclose(f);
+    return true;
+}
+
+// ns/op by benchmark name, from a file written by --json
+static bool read_baseline(const std::string& path, std::map<std::string, double>& baseline) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) {
+        fprintf(stderr, "cannot read %s\n", path.c_str());
+        return false;
+    }
+    char buffer[4096];
+    rapidjson::FileReadStream stream(f, buffer, sizeof(buffer));
+    rapidjson::Document doc;
+    doc.ParseStream(stream);
+    fclose(f);
+    if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("benchmarks") || !doc["benchmarks"].IsArray()) {
+        fprintf(stderr, "%s: not a micro_bench result file\n", path.c_str());
+        return false;
+    }
+    for (const rapidjson::Value& entry : doc["benchmarks"].GetArray()) {
+        if (entry.IsObject() && entry.HasMember("name") && entry["name"].IsString() &&
+            entry.HasMember("ns_per_op") && entry["ns_per_op"].IsNumber()) {
+            baseline[entry["name"].GetString()] = entry["ns_per_op"].GetDouble();
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::string filter, json_path, baseline_path;
+    double min_ms = 200, threshold = 10;
+    int repeat = 5;
+    for (int i = 1; i < argc; ++i) {
+        std::string key = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing value for %s\n", key.c_str());
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (key == "--filter") filter = value;
+        else if (key == "--min-time") min_ms = atof(value);
+        else if (key == "--repeat") repeat = std::max(atoi(value), 1);
+        else if (key == "--json") json_path = value;
+        else if (key == "--compare") baseline_path = value;
+        else if (key == "--threshold") threshold = atof(value);
+        else {
+            fprintf(stderr, "unknown option %s\n", key.c_str());
+            return 2;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    if (!baseline_path.empty() && !read_baseline(baseline_path, baseline)) {
+        return 2;
+    }
+
+    // Epoch 100: a cache of the size the miner builds today
+    light = ethash_light_new(100 * ETHASH_EPOCH_LENGTH);
+    if (!light || !check_dag_items()) {
+        return 2;
+    }
+
+    std::vector<Result> results;
+    int regressions = 0;
+    printf("%-34s %12s %14s %10s", "benchmark", "ns/op", "ops/s", "allocs/op");
+    if (!baseline.empty()) {
+        printf(" %12s %8s", "baseline", "change");
+    }
+    printf("\n");
+    for (const Benchmark& bench : benchmarks()) {
+        if (!filter.empty() && std::string(bench.name).find(filter) == std::string::npos) {
+            continue;
+        }
+        Result r = measure(bench, min_ms * 1e6, repeat);
+        printf("%-34s %12.1f %14.0f %10.2f", r.name.c_str(), r.ns_per_op, r.ops_per_sec, r.allocs_per_op);
+        auto it = baseline.find(r.name);
+        if (it != baseline.end() && it->second > 0) {
+            double change = (r.ns_per_op / it->second - 1) * 100;
+            printf(" %12.1f %+7.1f%%", it->second, change);
+            if (change > threshold) {
+                printf("  REGRESSION");
+                regressions++;
+            }
+        }
+        printf("\n");
+        fflush(stdout);
+        results.push_back(r);
+    }
+    ethash_light_delete(light);
+
+    if (!json_path.empty() && !write_json(json_path, results)) {
+        return 2;
+    }
+    if (regressions) {
+        printf("%d benchmark%s slower than the baseline by more than %.0f%%\n", regressions,
+               regressions == 1 ? "" : "s", threshold);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,398 @@
+// bench/mock_pool.cpp
+//
+// Local KawPoW stratum pool for exercising the miner without a live pool.
+// Issues mining.notify at a fixed rate with clean and non-clean jobs, block
+// and epoch changes and optional set_target changes, verifies every share
+// on the host (kawpow_verify, from the light cache) and reports
+// job-to-first-share latency, stale rate and accept rate.
+//
+//   mock_pool [--port 3333] [--job-interval ms] [--clean-every jobs]
+//             [--epoch-every blocks] [--difficulty d] [--target-every jobs]
+//             [--report seconds] [--duration seconds]
+//
+// Point the miner at it with "url": "127.0.0.1:3333" in config.json.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "rapidjson/document.h"
+#include "base/crypto/sha3.h"
+#include "hex.h"
+#include "kawpow_verify.h"
+#include "uint256.h"
+
+#define EPOCH_LENGTH 7500
+#define MAX_JOBS 32
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    int port = 3333;
+    int job_interval = 1000;    // ms between notifies
+    int clean_every = 5;        // every Nth job starts a new block
+    int epoch_every = 0;        // every Nth block jumps an epoch, 0 = never
+    double difficulty = 1;
+    int target_every = 0;       // every Nth job alternates the share target, 0 = never
+    int report = 10;
+    int duration = 0;           // 0 = run until killed
+};
+
+struct MockJob {
+    std::string id;
+    std::string header_hex;
+    uint64_t block = 0;
+    Clock::time_point sent;
+    uint256 target;
+    bool answered = false;      // first share seen
+};
+
+struct Session {
+    int fd = -1;
+    std::string extranonce;
+    std::mutex write_mutex;
+};
+
+class MockPool {
+public:
+    explicit MockPool(const Options& options) : options(options), rng(std::random_device{}()) {
+        current_target = target_from_difficulty(options.difficulty);
+    }
+
+    void run() {
+        int listen_fd = socket(AF_INET6, SOCK_STREAM, 0);
+        int one = 1, zero = 0;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        sockaddr_in6 addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin6_family = AF_INET6;
+        addr.sin6_port = htons(options.port);
+        addr.sin6_addr = in6addr_any;
+        if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 64) != 0) {
+            perror("mock_pool: listen");
+            exit(1);
+        }
+        printf("mock pool listening on port %d, job every %d ms, clean every %d jobs, difficulty %g\n",
+               options.port, options.job_interval, options.clean_every, options.difficulty);
+        fflush(stdout);
+
+        new_job(true);
+        std::thread(&MockPool::job_loop, this).detach();
+        std::thread(&MockPool::report_loop, this).detach();
+
+        while (true) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) continue;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            auto session = std::make_shared<Session>();
+            session->fd = fd;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                char extranonce[8];
+                snprintf(extranonce, sizeof(extranonce), "%04x", next_extranonce++ & 0xffff);
+                session->extranonce = extranonce;
+                sessions.push_back(session);
+            }
+            std::thread(&MockPool::serve, this, session).detach();
+        }
+    }
+
+private:
+    std::string seed_hash(uint64_t block) {
+        uint8_t seed[32] = {0};
+        for (uint64_t i = 0; i < block / EPOCH_LENGTH; ++i) {
+            sha3_HashBuffer(256, SHA3_FLAGS_KECCAK, seed, sizeof(seed), seed, sizeof(seed));
+        }
+        std::string hex(64, '0');
+        hex_encode(seed, sizeof(seed), &hex[0]);
+        return hex;
+    }
+
+    void job_loop() {
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.job_interval));
+            new_job(false);
+        }
+    }
+
+    void new_job(bool first) {
+        std::lock_guard<std::mutex> lock(mutex);
+        job_count++;
+        bool clean = first || (options.clean_every > 0 && job_count % options.clean_every == 0);
+        if (clean && !first) {
+            block++;
+            blocks++;
+            if (options.epoch_every > 0 && blocks % options.epoch_every == 0) {
+                block += EPOCH_LENGTH;
+                printf("epoch jump to %llu\n", static_cast<unsigned long long>(block / EPOCH_LENGTH));
+            }
+        }
+        if (block / EPOCH_LENGTH != seed_epoch) {
+            seed_hex = seed_hash(block);
+            seed_epoch = block / EPOCH_LENGTH;
+        }
+
+        if (options.target_every > 0 && job_count % options.target_every == 0) {
+            alternate = !alternate;
+            current_target = target_from_difficulty(options.difficulty * (alternate ? 2 : 1));
+            broadcast("{\"id\":null,\"method\":\"mining.set_target\",\"params\":[\"" + current_target.to_hex() + "\"]}\n");
+        }
+
+        uint8_t header[32];
+        for (auto& b : header) b = static_cast<uint8_t>(rng());
+        MockJob job;
+        char id[16];
+        snprintf(id, sizeof(id), "%llx", static_cast<unsigned long long>(job_count));
+        job.id = id;
+        job.header_hex.assign(64, '0');
+        hex_encode(header, sizeof(header), &job.header_hex[0]);
+        job.block = block;
+        job.target = current_target;
+        job.sent = Clock::now();
+        jobs[job.id] = job;
+        if (jobs.size() > MAX_JOBS) {
+            auto oldest = std::min_element(jobs.begin(), jobs.end(), [](const std::pair<const std::string, MockJob>& a,
+                                                                        const std::pair<const std::string, MockJob>& b) {
+                return a.second.sent < b.second.sent;
+            });
+            submitted.erase(oldest->first);
+            jobs.erase(oldest);
+        }
+        last_notify = notify_line(job, clean);
+        broadcast(last_notify);
+    }
+
+    std::string notify_line(const MockJob& job, bool clean) {
+        return "{\"id\":null,\"method\":\"mining.notify\",\"params\":[\"" + job.id + "\",\"" + job.header_hex +
+               "\",\"" + seed_hex + "\",\"" + job.target.to_hex() + "\"," + (clean ? "true" : "false") + "," +
+               std::to_string(job.block) + ",\"1b00f0ff\"]}\n";
+    }
+
+    // Caller holds mutex
+    void broadcast(const std::string& line) {
+        for (auto it = sessions.begin(); it != sessions.end();) {
+            if (!write_line(**it, line)) {
+                it = sessions.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    bool write_line(Session& session, const std::string& line) {
+        std::lock_guard<std::mutex> lock(session.write_mutex);
+        size_t sent = 0;
+        while (sent < line.size()) {
+            ssize_t n = send(session.fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            sent += n;
+        }
+        return true;
+    }
+
+    void reply(Session& session, const rapidjson::Value& id, const std::string& result, int code = 0,
+               const std::string& message = "") {
+        std::string id_text = id.IsInt() ? std::to_string(id.GetInt()) : id.IsString() ? "\"" + std::string(id.GetString()) + "\"" : "null";
+        std::string error = code ? "[" + std::to_string(code) + ",\"" + message + "\",null]" : "null";
+        write_line(session, "{\"id\":" + id_text + ",\"result\":" + result + ",\"error\":" + error + "}\n");
+    }
+
+    void serve(std::shared_ptr<Session> session) {
+        std::string buffer;
+        char buf[4096];
+        while (true) {
+            ssize_t n = recv(session->fd, buf, sizeof(buf), 0);
+            if (n <= 0) break;
+            buffer.append(buf, n);
+            size_t pos;
+            while ((pos = buffer.find('\n')) != std::string::npos) {
+                std::string line = buffer.substr(0, pos);
+                buffer.erase(0, pos + 1);
+                if (!line.empty()) handle(*session, line);
+            }
+        }
+        close(session->fd);
+        std::lock_guard<std::mutex> lock(mutex);
+        sessions.erase(std::remove(sessions.begin(), sessions.end(), session), sessions.end());
+    }
+
+    void handle(Session& session, const std::string& line) {
+        rapidjson::Document doc;
+        doc.Parse(line.c_str());
+        if (doc.HasParseError() || !doc.HasMember("method") || !doc.HasMember("id")) {
+            printf("bad request: %s\n", line.c_str());
+            return;
+        }
+        std::string method = doc["method"].GetString();
+        const rapidjson::Value& id = doc["id"];
+        const rapidjson::Value* params = doc.HasMember("params") && doc["params"].IsArray() ? &doc["params"] : nullptr;
+
+        if (method == "mining.subscribe") {
+            reply(session, id, "[null,\"" + session.extranonce + "\"]");
+            std::lock_guard<std::mutex> lock(mutex);
+            write_line(session, "{\"id\":null,\"method\":\"mining.set_target\",\"params\":[\"" + current_target.to_hex() + "\"]}\n");
+            write_line(session, last_notify);
+        } else if (method == "mining.authorize" || method == "mining.extranonce.subscribe") {
+            reply(session, id, "true");
+        } else if (method == "mining.submit" && params && params->Size() >= 5) {
+            submit(session, id, (*params)[1].GetString(), (*params)[2].GetString(), (*params)[3].GetString(),
+                   (*params)[4].GetString());
+        } else {
+            reply(session, id, "null", 20, "Unsupported method");
+        }
+    }
+
+    static std::string strip(const std::string& hex) {
+        return hex.compare(0, 2, "0x") == 0 ? hex.substr(2) : hex;
+    }
+
+    void submit(Session& session, const rapidjson::Value& id, const std::string& job_id, const std::string& nonce,
+                const std::string& header, const std::string& mix) {
+        auto now = Clock::now();
+        MockJob job;
+        bool known, stale = false, duplicate = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shares++;
+            auto it = jobs.find(job_id);
+            known = it != jobs.end();
+            if (known) {
+                job = it->second;
+                stale = job.block != block;
+                duplicate = !submitted[job_id].insert(strip(nonce)).second;
+                if (!it->second.answered && !stale) {
+                    it->second.answered = true;
+                    first_share_ms.push_back(std::chrono::duration<double, std::milli>(now - job.sent).count());
+                }
+            }
+        }
+
+        int code = 0;
+        std::string reason;
+        if (!known || stale) {
+            code = 21;
+            reason = known ? "Stale share" : "Job not found";
+        } else if (duplicate) {
+            code = 22;
+            reason = "Duplicate share";
+        } else if (strip(header) != job.header_hex) {
+            code = 20;
+            reason = "Header hash does not match job";
+        } else if (strncasecmp(strip(nonce).c_str(), session.extranonce.c_str(), session.extranonce.size()) != 0) {
+            code = 20;
+            reason = "Nonce outside extranonce";
+        } else {
+            ShareVerdict verdict = kawpow_verify_share(job.block, job.header_hex, strip(nonce), strip(mix), job.target);
+            if (verdict != ShareVerdict::VALID) {
+                code = verdict == ShareVerdict::LOW_DIFFICULTY ? 23 : 20;
+                reason = share_verdict_name(verdict);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (code == 0) {
+                accepted++;
+            } else if (code == 21) {
+                stale_shares++;
+            } else {
+                rejected[reason]++;
+            }
+        }
+        reply(session, id, code ? "false" : "true", code, reason);
+    }
+
+    void report_loop() {
+        auto start = Clock::now();
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::seconds(options.report));
+            bool done = options.duration > 0 && Clock::now() - start >= std::chrono::seconds(options.duration);
+            print_report();
+            if (done) exit(0);
+        }
+    }
+
+    void print_report() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<double> latency = first_share_ms;
+        std::sort(latency.begin(), latency.end());
+        auto pct = [&](double p) { return latency.empty() ? 0.0 : latency[std::min(latency.size() - 1, size_t(p * latency.size()))]; };
+        double sum = 0;
+        for (double l : latency) sum += l;
+
+        uint64_t bad = 0;
+        for (const auto& entry : rejected) bad += entry.second;
+        printf("jobs %llu, blocks %llu, miners %zu | shares %llu: accepted %.1f%%, stale %.1f%%, rejected %.1f%%\n",
+               (unsigned long long)job_count, (unsigned long long)blocks, sessions.size(), (unsigned long long)shares,
+               shares ? 100.0 * accepted / shares : 0.0, shares ? 100.0 * stale_shares / shares : 0.0,
+               shares ? 100.0 * bad / shares : 0.0);
+        printf("  job to first share: %zu jobs answered, mean %.1f ms, p50 %.1f ms, p95 %.1f ms, max %.1f ms\n",
+               latency.size(), latency.empty() ? 0.0 : sum / latency.size(), pct(0.5), pct(0.95),
+               latency.empty() ? 0.0 : latency.back());
+        for (const auto& entry : rejected) {
+            printf("  rejected: %s x%llu\n", entry.first.c_str(), (unsigned long long)entry.second);
+        }
+        fflush(stdout);
+    }
+
+    const Options options;
+    std::mt19937_64 rng;
+
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Session>> sessions;
+    std::map<std::string, MockJob> jobs;
+    std::map<std::string, std::set<std::string>> submitted;    // nonces per job
+    std::string last_notify;
+    std::string seed_hex;
+    uint64_t seed_epoch = ~0ULL;
+    uint64_t block = 3000000;
+    uint64_t blocks = 0;
+    uint64_t job_count = 0;
+    uint32_t next_extranonce = 1;
+    uint256 current_target;
+    bool alternate = false;
+
+    uint64_t shares = 0;
+    uint64_t accepted = 0;
+    uint64_t stale_shares = 0;
+    std::map<std::string, uint64_t> rejected;
+    std::vector<double> first_share_ms;
+};
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        const char* value = argv[i + 1];
+        if (key == "--port") options.port = atoi(value);
+        else if (key == "--job-interval") options.job_interval = std::max(atoi(value), 1);
+        else if (key == "--clean-every") options.clean_every = atoi(value);
+        else if (key == "--epoch-every") options.epoch_every = atoi(value);
+        else if (key == "--difficulty") options.difficulty = atof(value);
+        else if (key == "--target-every") options.target_every = atoi(value);
+        else if (key == "--report") options.report = std::max(atoi(value), 1);
+        else if (key == "--duration") options.duration = atoi(value);
+        else {
+            fprintf(stderr, "unknown option %s\n", key.c_str());
+            return 1;
+        }
+    }
+    MockPool(options).run();
+}
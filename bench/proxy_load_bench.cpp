@@ -0,0 +1,174 @@
+// bench/proxy_load_bench.cpp
+//
+// Load test for the stratum proxy. Opens many downstream connections to a
+// ProxyServer whose upstream answers every share at once, then measures
+//   fan-out    - time from broadcast_job until every rig has the line
+//   round trip - shares/s through submit, upstream handler and response
+//
+//   proxy_load_bench [connections] [jobs] [shares_per_connection]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "config.h"
+#include "proxy_server.h"
+
+struct Rig {
+    int fd = -1;
+    std::string buffer;
+    std::string extranonce;
+    size_t lines = 0;
+};
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void send_all(int fd, const std::string& data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+        if (n <= 0) {
+            perror("send");
+            exit(1);
+        }
+        off += n;
+    }
+}
+
+// Reads until every rig has seen `expected` lines in total
+static void pump(int epfd, std::vector<Rig>& rigs, size_t expected) {
+    std::vector<epoll_event> events(256);
+    char buf[65536];
+    while (true) {
+        size_t total = 0;
+        for (const Rig& rig : rigs) total += rig.lines;
+        if (total >= expected) return;
+
+        int n = epoll_wait(epfd, events.data(), static_cast<int>(events.size()), 5000);
+        if (n == 0) {
+            fprintf(stderr, "timed out with %zu of %zu lines\n", total, expected);
+            exit(1);
+        }
+        for (int i = 0; i < n; ++i) {
+            Rig& rig = rigs[events[i].data.u32];
+            ssize_t got;
+            while ((got = recv(rig.fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+                rig.buffer.append(buf, got);
+            }
+            size_t start = 0, end;
+            while ((end = rig.buffer.find('\n', start)) != std::string::npos) {
+                if (rig.extranonce.empty()) {
+                    size_t at = rig.buffer.find("[null,\"", start);
+                    if (at != std::string::npos && at < end) {
+                        rig.extranonce = rig.buffer.substr(at + 7, rig.buffer.find('"', at + 7) - at - 7);
+                    }
+                }
+                rig.lines++;
+                start = end + 1;
+            }
+            rig.buffer.erase(0, start);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t connections = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000;
+    int jobs = argc > 2 ? atoi(argv[2]) : 20;
+    int shares = argc > 3 ? atoi(argv[3]) : 10;
+
+    const char* path = "/tmp/proxy_load_bench.json";
+    std::ofstream(path) << "{\"pools\":[{\"url\":\"127.0.0.1:1\",\"user\":\"bench\",\"pass\":\"\"}],"
+                           "\"proxy\":{\"enabled\":true,\"host\":\"127.0.0.1\",\"port\":0,"
+                           "\"extranonce_bytes\":2,\"max_connections\":"
+                        << connections << "}}";
+    Config config;
+    if (!config.load(path)) {
+        return 1;
+    }
+
+    std::atomic<uint64_t> upstream{0};
+    ProxyServer proxy(config, [&upstream](const QueuedShare&, ShareResultCallback done) {
+        upstream++;
+        done(true, "");
+    });
+    if (!proxy.start()) {
+        return 1;
+    }
+    proxy.set_upstream_extranonce("ab");
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(proxy.port());
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+    int epfd = epoll_create1(0);
+    std::vector<Rig> rigs(connections);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < connections; ++i) {
+        rigs[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(rigs[i].fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            perror("connect");
+            return 1;
+        }
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = static_cast<uint32_t>(i);
+        epoll_ctl(epfd, EPOLL_CTL_ADD, rigs[i].fd, &ev);
+        send_all(rigs[i].fd, "{\"id\":1,\"method\":\"mining.subscribe\",\"params\":[]}\n"
+                             "{\"id\":2,\"method\":\"mining.authorize\",\"params\":[\"rig\",\"x\"]}\n");
+    }
+    pump(epfd, rigs, connections * 2);
+    printf("connect+subscribe  %zu rigs in %.1f ms\n", connections, elapsed_ms(start));
+
+    const std::string job = "{\"id\":null,\"method\":\"mining.notify\",\"params\":[\"1a2b\","
+                            "\"0x4b5a80a1b6f15d8a6a993abc5c8273e1761a03da80a7e841bce0a53f2a6f8ebf\","
+                            "\"0x5c0aa6d68aa7eb3c6bb5d0b48be88f233e61f70cedbd7f3b06ac8a303a4127be\","
+                            "\"0x00000000ffff0000000000000000000000000000000000000000000000000000\",true,3000000,\"1b00f0ff\"]}";
+    double worst = 0, sum = 0;
+    for (int j = 0; j < jobs; ++j) {
+        size_t before = 0;
+        for (const Rig& rig : rigs) before += rig.lines;
+        auto sent = std::chrono::steady_clock::now();
+        proxy.broadcast_job(job);
+        pump(epfd, rigs, before + connections);
+        double ms = elapsed_ms(sent);
+        worst = std::max(worst, ms);
+        sum += ms;
+    }
+    printf("job fan-out        %.2f ms mean, %.2f ms worst to reach all %zu rigs\n", sum / jobs, worst, connections);
+
+    size_t before = 0;
+    for (const Rig& rig : rigs) before += rig.lines;
+    start = std::chrono::steady_clock::now();
+    for (int s = 0; s < shares; ++s) {
+        for (Rig& rig : rigs) {
+            std::string nonce = rig.extranonce + std::string(16 - rig.extranonce.size() - 4, '0');
+            char tail[16];
+            snprintf(tail, sizeof(tail), "%04x", s);
+            nonce += tail;
+            send_all(rig.fd, "{\"id\":" + std::to_string(10 + s) + ",\"method\":\"mining.submit\",\"params\":[\"rig\","
+                             "\"1a2b\",\"0x" + nonce + "\",\"0x4b5a80a1b6f15d8a6a993abc5c8273e1761a03da80a7e841bce0a53f2a6f8ebf\","
+                             "\"0x0000000000000000000000000000000000000000000000000000000000000000\"]}\n");
+        }
+    }
+    pump(epfd, rigs, before + connections * shares);
+    double ms = elapsed_ms(start);
+    printf("share round trip   %zu shares in %.1f ms, %.0f shares/s (%llu reached upstream)\n",
+           connections * shares, ms, connections * shares * 1000.0 / ms, static_cast<unsigned long long>(upstream.load()));
+
+    for (Rig& rig : rigs) close(rig.fd);
+    proxy.print_stats();
+    proxy.stop();
+    return 0;
+}
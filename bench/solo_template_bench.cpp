@@ -0,0 +1,256 @@
+// bench/solo_template_bench.cpp
+//
+// Solo mining path against a fake ravend on 127.0.0.1:
+//   merkle     - branch for a full template, 8-lane SHA-256d vs one at a time
+//   template   - getblocktemplate round trip through parse, coinbase and
+//                header hash, i.e. node reply to job ready
+//   long-poll  - time from a new block on the node to the job being ready
+//   submit     - submitblock round trip; the fake node checks the block's
+//                header against the header hash the miner mined on
+//
+//   solo_template_bench [transactions] [iterations]
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "block_template.h"
+#include "daemon_rpc.h"
+#include "hex.h"
+#include "sha256.h"
+
+// Minimal node: one thread per connection, keep-alive, and a long-poll that
+// returns when new_block() is called.
+class FakeNode {
+public:
+    explicit FakeNode(size_t transactions) {
+        std::mt19937_64 rng(42);
+        for (size_t i = 0; i < transactions; ++i) {
+            char txid[65];
+            snprintf(txid, sizeof(txid), "%016llx%016llx%016llx%016llx", (unsigned long long)rng(),
+                     (unsigned long long)rng(), (unsigned long long)rng(), (unsigned long long)rng());
+            txs += std::string(i ? "," : "") + "{\"data\":\"0100000000\",\"txid\":\"" + txid + "\"}";
+        }
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        listen(listen_fd, 16);
+        socklen_t len = sizeof(addr);
+        getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr), &len);
+        port = ntohs(addr.sin_port);
+        std::thread([this] {
+            int fd;
+            while ((fd = accept(listen_fd, nullptr, nullptr)) >= 0) {
+                std::thread(&FakeNode::serve, this, fd).detach();
+            }
+        }).detach();
+    }
+
+    void new_block() {
+        std::lock_guard<std::mutex> lock(mutex);
+        height++;
+        cv.notify_all();
+    }
+
+    int port = 0;
+    std::atomic<int> blocks_ok{0};
+    std::atomic<int> blocks_bad{0};
+    std::string expected_header_hash;
+
+private:
+    std::string block_template() {
+        char prev[65];
+        snprintf(prev, sizeof(prev), "%064x", height);
+        return "{\"version\":805306368,\"previousblockhash\":\"" + std::string(prev) +
+               "\",\"transactions\":[" + txs + "],\"coinbasevalue\":250000000000,"
+               "\"longpollid\":\"" + std::string(prev) + std::to_string(height) +
+               "\",\"target\":\"00000000ffff0000000000000000000000000000000000000000000000000000\","
+               "\"curtime\":1700000000,\"bits\":\"1d00ffff\",\"height\":" + std::to_string(height) + "}";
+    }
+
+    void serve(int fd) {
+        std::string data;
+        char buf[65536];
+        while (true) {
+            size_t header_end;
+            while ((header_end = data.find("\r\n\r\n")) == std::string::npos) {
+                ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                if (n <= 0) { close(fd); return; }
+                data.append(buf, n);
+            }
+            size_t length = strtoul(data.c_str() + data.find("Content-Length: ") + 16, nullptr, 10);
+            while (data.size() < header_end + 4 + length) {
+                ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                if (n <= 0) { close(fd); return; }
+                data.append(buf, n);
+            }
+            std::string body = data.substr(header_end + 4, length);
+            data.erase(0, header_end + 4 + length);
+
+            std::string result;
+            if (body.find("\"submitblock\"") != std::string::npos) {
+                result = check_block(body) ? "null" : "\"high-hash\"";
+            } else {
+                std::unique_lock<std::mutex> lock(mutex);
+                size_t at = body.find("\"longpollid\":\"");
+                if (at != std::string::npos) {
+                    int seen = height;
+                    cv.wait(lock, [&] { return height != seen; });
+                }
+                result = block_template();
+            }
+            std::string reply = "{\"result\":" + result + ",\"error\":null,\"id\":1}";
+            std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " +
+                                   std::to_string(reply.size()) + "\r\n\r\n" + reply;
+            send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+        }
+    }
+
+    bool check_block(const std::string& body) {
+        size_t at = body.find("[\"") + 2;
+        uint8_t header[80];
+        if (!hex_decode(body.c_str() + at, 160, header, sizeof(header))) {
+            blocks_bad++;
+            return false;
+        }
+        bool ok = kawpow_header_hash(header) == expected_header_hash;
+        (ok ? blocks_ok : blocks_bad)++;
+        return ok;
+    }
+
+    int listen_fd;
+    std::string txs;
+    std::mutex mutex;
+    std::condition_variable cv;
+    int height = 3000000;
+};
+
+static double elapsed_us(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+// What SoloClient::apply_template does before handing the job to the GPU
+static std::string build_job(const BlockTemplate& tpl, const std::vector<uint8_t>& script, uint8_t header[80],
+                             std::vector<uint8_t>& coinbase) {
+    coinbase = build_coinbase(tpl, script, "/kawpow-miner/", true);
+    std::vector<uint8_t> stripped = build_coinbase(tpl, script, "/kawpow-miner/", false);
+    Hash256 txid;
+    sha256d(stripped.data(), stripped.size(), txid.data());
+    kawpow_header(tpl, merkle_root(txid, tpl.merkle_branch), header);
+    return kawpow_header_hash(header);
+}
+
+int main(int argc, char** argv) {
+    size_t transactions = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000;
+    int iterations = argc > 2 ? atoi(argv[2]) : 50;
+    printf("SHA-256 multi-buffer backend: %s, %zu transactions\n", sha256_backend(), transactions);
+
+    std::vector<uint8_t> script;
+    if (!address_to_script("RKMHU6p7KLWRLkn64rP2Dg3oyNf2QV7RrN", script)) {
+        fprintf(stderr, "address decode failed\n");
+        return 1;
+    }
+
+    // Merkle branch: batched levels vs hashing node by node
+    std::vector<Hash256> txids(transactions);
+    std::mt19937 rng(7);
+    for (auto& id : txids) for (auto& b : id) b = static_cast<uint8_t>(rng());
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Hash256> branch;
+    for (int i = 0; i < iterations; ++i) branch = merkle_branch(txids);
+    double batched = elapsed_us(start) / iterations;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        std::vector<Hash256> level = txids;
+        while (level.size() > 1) {
+            if (level.size() & 1) level.push_back(level.back());
+            for (size_t j = 0; j < level.size() / 2; ++j) sha256d(level[2 * j].data(), 64, level[j].data());
+            level.resize(level.size() / 2);
+        }
+    }
+    double single = elapsed_us(start) / iterations;
+    printf("merkle branch      %8.1f us batched, %8.1f us one at a time (%.1fx)\n", batched, single, single / batched);
+
+    Hash256 coinbase_txid{};
+    coinbase_txid[0] = 1;
+    std::vector<Hash256> leaves(1, coinbase_txid);
+    leaves.insert(leaves.end(), txids.begin(), txids.end());
+    if (merkle_root(coinbase_txid, branch) != merkle_root_full(leaves)) {
+        fprintf(stderr, "merkle branch does not match the full tree\n");
+        return 1;
+    }
+
+    FakeNode node(transactions);
+    DaemonRpc rpc("127.0.0.1", node.port, "user", "pass");
+    rapidjson::Document reply;
+    BlockTemplate tpl;
+    uint8_t header[80];
+    std::vector<uint8_t> coinbase;
+
+    double total = 0;
+    for (int i = 0; i < iterations; ++i) {
+        start = std::chrono::steady_clock::now();
+        if (!rpc.call("getblocktemplate", "[{\"rules\":[\"segwit\"]}]", reply, 10) ||
+            !parse_block_template(reply["result"], tpl)) {
+            fprintf(stderr, "getblocktemplate failed: %s\n", rpc.last_error().c_str());
+            return 1;
+        }
+        build_job(tpl, script, header, coinbase);
+        total += elapsed_us(start);
+    }
+    printf("template to job    %8.1f us (RPC, parse, coinbase, merkle root, header hash)\n", total / iterations);
+
+    // Long-poll: a second connection waits while the node finds a block
+    total = 0;
+    for (int i = 0; i < iterations; ++i) {
+        std::atomic<bool> ready{false};
+        std::chrono::steady_clock::time_point found;
+        std::thread waiter([&] {
+            DaemonRpc longpoll("127.0.0.1", node.port, "user", "pass");
+            rapidjson::Document doc;
+            BlockTemplate next;
+            ready = true;
+            longpoll.call("getblocktemplate", "[{\"rules\":[\"segwit\"],\"longpollid\":\"" + tpl.longpollid + "\"}]", doc, 10);
+            parse_block_template(doc["result"], next);
+            uint8_t h[80];
+            std::vector<uint8_t> cb;
+            build_job(next, script, h, cb);
+            total += elapsed_us(found);
+            tpl = next;
+        });
+        while (!ready) std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        found = std::chrono::steady_clock::now();
+        node.new_block();
+        waiter.join();
+    }
+    printf("new block to job   %8.1f us via long-poll\n", total / iterations);
+
+    // Submit a "solution" for the current template
+    node.expected_header_hash = build_job(tpl, script, header, coinbase);
+    total = 0;
+    for (int i = 0; i < iterations; ++i) {
+        start = std::chrono::steady_clock::now();
+        std::string block = serialize_block(header, 0x1234 + i, std::string(64, 'a'), coinbase, tpl.tx_data);
+        rpc.call("submitblock", "[\"" + block + "\"]", reply, 10);
+        total += elapsed_us(start);
+    }
+    printf("submitblock        %8.1f us round trip, %d accepted, %d rejected\n", total / iterations,
+           node.blocks_ok.load(), node.blocks_bad.load());
+    return node.blocks_bad.load() == 0 ? 0 : 1;
+}
@@ -0,0 +1,237 @@
+// bench/tls_connect_bench.cpp
+//
+// Connect-to-first-job latency for plaintext, full TLS handshake and resumed
+// TLS, measured against a local stand-in pool that answers mining.subscribe
+// with a mining.notify. Uses the miner's own connect and TLS code paths.
+//
+//   tls_connect_bench [iterations]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include "dns_cache.h"
+#include "tls_transport.h"
+
+static const char* kNotify =
+    "{\"id\":1,\"result\":[null,\"00000001\"],\"error\":null}\n"
+    "{\"id\":null,\"method\":\"mining.notify\",\"params\":[\"1\","
+    "\"4b5a80a1b6f15d8a6a993abc5c8273e1761a03da80a7e841bce0a53f2a6f8ebf\","
+    "\"0000000000000000000000000000000000000000000000000000000000000000\","
+    "\"00000000ffff0000000000000000000000000000000000000000000000000000\",true,3000000,\"1b00f968\"]}\n";
+
+static EVP_PKEY* generate_pkey() {
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+    EVP_PKEY* pkey = EVP_PKEY_new();
+    BIGNUM* exponent = BN_new();
+    RSA* rsa = RSA_new();
+    BN_set_word(exponent, RSA_F4);
+    RSA_generate_key_ex(rsa, 2048, exponent, nullptr);
+    EVP_PKEY_assign_RSA(pkey, rsa);
+    BN_free(exponent);
+    return pkey;
+#else
+    return EVP_RSA_gen(2048);
+#endif
+}
+
+// Self-signed "localhost" certificate, the same shape base/net/tls/TlsGen makes
+static SSL_CTX* create_server_ctx() {
+    EVP_PKEY* pkey = generate_pkey();
+    X509* x509 = X509_new();
+    X509_set_pubkey(x509, pkey);
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_get_notBefore(x509), 0);
+    X509_gmtime_adj(X509_get_notAfter(x509), 86400L);
+    X509_NAME* name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(x509, name);
+    X509_sign(x509, pkey, EVP_sha256());
+
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_use_certificate(ctx, x509);
+    SSL_CTX_use_PrivateKey(ctx, pkey);
+    SSL_CTX_set_session_id_context(ctx, reinterpret_cast<const unsigned char*>("bench"), 5);
+    X509_free(x509);
+    EVP_PKEY_free(pkey);
+    return ctx;
+}
+
+static int listen_local(int& port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    listen(fd, 64);
+    socklen_t len = sizeof(addr);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// Stand-in pool: answer the first line with a subscribe result and a job,
+// then hold the connection until the client closes it.
+static void serve(int listen_fd, SSL_CTX* ctx) {
+    while (true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        SSL* ssl = nullptr;
+        if (ctx) {
+            ssl = SSL_new(ctx);
+            SSL_set_fd(ssl, fd);
+            if (SSL_accept(ssl) != 1) {
+                SSL_free(ssl);
+                close(fd);
+                continue;
+            }
+        }
+
+        char buf[4096];
+        std::string line;
+        bool answered = false;
+        while (true) {
+            int n = ssl ? SSL_read(ssl, buf, sizeof(buf)) : static_cast<int>(recv(fd, buf, sizeof(buf), 0));
+            if (n <= 0) {
+                break;
+            }
+            line.append(buf, n);
+            if (!answered && line.find('\n') != std::string::npos) {
+                size_t len = strlen(kNotify);
+                if (ssl) SSL_write(ssl, kNotify, static_cast<int>(len));
+                else send(fd, kNotify, len, 0);
+                answered = true;
+            }
+        }
+
+        if (ssl) {
+            SSL_shutdown(ssl);
+            SSL_free(ssl);
+        }
+        close(fd);
+    }
+}
+
+// One client session; returns microseconds from connect start to the job.
+static double first_job_us(int port, TlsTransport* tls) {
+    auto start = std::chrono::steady_clock::now();
+
+    sockaddr_storage addr;
+    memset(&addr, 0, sizeof(addr));
+    reinterpret_cast<sockaddr_in*>(&addr)->sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &reinterpret_cast<sockaddr_in*>(&addr)->sin_addr);
+
+    std::string ip;
+    int fd = happy_eyeballs_connect(std::vector<sockaddr_storage>(1, addr), port, 5000, ip);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (tls && !tls->handshake(fd, 5000)) {
+        close(fd);
+        return -1;
+    }
+
+    const std::string subscribe = "{\"id\":1,\"method\":\"mining.subscribe\",\"params\":[\"KawPowMiner/0.1\"]}\n";
+    if (tls) tls->send(subscribe.c_str(), subscribe.size());
+    else send(fd, subscribe.c_str(), subscribe.size(), 0);
+
+    std::string received;
+    char buf[4096];
+    while (received.find("mining.notify") == std::string::npos) {
+        struct pollfd fds;
+        fds.fd = fd;
+        fds.events = POLLIN;
+        if (!(tls && tls->pending()) && poll(&fds, 1, 5000) <= 0) {
+            break;
+        }
+        int n = tls ? tls->recv(buf, sizeof(buf)) : static_cast<int>(recv(fd, buf, sizeof(buf), 0));
+        if (n == 0 || (n < 0 && errno != EAGAIN)) {
+            break;
+        }
+        if (n > 0) {
+            received.append(buf, n);
+        }
+    }
+    bool ok = received.find("mining.notify") != std::string::npos;
+    auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    if (tls) {
+        tls->shutdown();
+    }
+    close(fd);
+    return ok ? elapsed : -1;
+}
+
+static void report(const char* mode, std::vector<double> samples) {
+    if (samples.empty()) {
+        printf("%-14s no successful sessions\n", mode);
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (double v : samples) sum += v;
+    printf("%-14s n=%-5zu median %8.1f us   p90 %8.1f us   mean %8.1f us\n", mode, samples.size(),
+           samples[samples.size() / 2], samples[samples.size() * 9 / 10], sum / samples.size());
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    signal(SIGPIPE, SIG_IGN);
+
+    int plain_port = 0, tls_port = 0;
+    int plain_fd = listen_local(plain_port);
+    int tls_fd = listen_local(tls_port);
+    SSL_CTX* server_ctx = create_server_ctx();
+    std::thread(serve, plain_fd, nullptr).detach();
+    std::thread(serve, tls_fd, server_ctx).detach();
+
+    std::vector<double> plain, full, resumed;
+    TlsTransport resuming("localhost", "");
+    first_job_us(tls_port, &resuming); // obtain the first session ticket
+
+    for (int i = 0; i < iterations; ++i) {
+        double us = first_job_us(plain_port, nullptr);
+        if (us >= 0) plain.push_back(us);
+
+        TlsTransport fresh("localhost", "");
+        us = first_job_us(tls_port, &fresh);
+        if (us >= 0) full.push_back(us);
+
+        us = first_job_us(tls_port, &resuming);
+        if (us >= 0 && resuming.resumed()) resumed.push_back(us);
+    }
+
+    printf("connect-to-first-job latency, %d iterations against 127.0.0.1\n", iterations);
+    report("plaintext", plain);
+    report("tls-full", full);
+    report("tls-resumed", resumed);
+    return 0;
+}
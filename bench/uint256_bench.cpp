@@ -0,0 +1,83 @@
+// bench/uint256_bench.cpp
+//
+// Hot operations of the target math: hex parsing and formatting, the
+// share check compare, difficulty <-> target conversion, full division and
+// multiplication, and share difficulty from a final hash.
+//
+//   uint256_bench [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "uint256.h"
+
+// Keeps results alive so the optimizer cannot drop the measured work
+static volatile uint64_t sink;
+
+template <typename F>
+static void run(const char* name, int iterations, F&& body) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t acc = 0;
+    for (int i = 0; i < iterations; ++i) {
+        acc += body(i);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    sink = acc;
+    printf("%-24s %10.1f ns/op\n", name, ns / iterations);
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    std::mt19937_64 rng(42);
+    const int kValues = 1024;
+    std::vector<uint256> values(kValues), divisors(kValues);
+    std::vector<std::string> hexes(kValues);
+    std::vector<double> difficulties(kValues);
+    for (int i = 0; i < kValues; ++i) {
+        for (int w = 0; w < 8; ++w) {
+            values[i].words[w] = static_cast<uint32_t>(rng());
+        }
+        divisors[i] = values[i] >> (32 + rng() % 160);
+        hexes[i] = values[i].to_hex();
+        difficulties[i] = 0.5 + static_cast<double>(rng() % 1000000) / 7.0;
+    }
+    const uint256 target = target_from_difficulty(256);
+
+    printf("uint256 operations, %d iterations\n", iterations);
+    run("from_hex", iterations, [&](int i) {
+        uint256 v;
+        uint256::from_hex(hexes[i % kValues], v);
+        return v.words[0];
+    });
+    run("to_hex", iterations, [&](int i) {
+        char out[64];
+        values[i % kValues].to_hex(out);
+        return static_cast<uint64_t>(out[i % 64]);
+    });
+    run("compare (share check)", iterations, [&](int i) {
+        return static_cast<uint64_t>(values[i % kValues] <= target);
+    });
+    run("target_from_difficulty", iterations, [&](int i) {
+        return target_from_difficulty(difficulties[i % kValues]).words[5];
+    });
+    run("share_difficulty", iterations, [&](int i) {
+        return static_cast<uint64_t>(share_difficulty(values[i % kValues]) > 1);
+    });
+    run("multiply", iterations, [&](int i) {
+        return (values[i % kValues] * values[(i + 1) % kValues]).words[7];
+    });
+    run("divide (32-bit divisor)", iterations, [&](int i) {
+        return (values[i % kValues] / uint256(static_cast<uint32_t>(i) | 1)).words[3];
+    });
+    run("divide (wide divisor)", iterations, [&](int i) {
+        return (values[i % kValues] / divisors[i % kValues]).words[0];
+    });
+    run("from_compact/to_compact", iterations, [&](int i) {
+        return static_cast<uint64_t>(uint256::from_compact(0x1b00f968 + (i & 0xff)).to_compact());
+    });
+    return 0;
+}
@@ -0,0 +1,133 @@
+// include/api_server.h
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "config.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+class KawPow;
+class Stratum;
+struct PoolStatus;
+struct EffectiveEstimate;
+
+struct ApiConnection {
+    int fd = -1;
+    std::string read_buffer;
+    std::string write_buffer;
+    size_t write_offset = 0;
+    bool keep_alive = true;
+    bool want_write = false;
+    bool read_closed = false;       // the client shut down its side
+    std::chrono::steady_clock::time_point last_active;
+};
+
+// HTTP monitoring API:
+//   GET /1/summary    everything below in one document (also /2/summary and
+//                     /api.json, the paths base/api answers)
+//   GET /1/devices    per-device hashrate windows, share and DAG status,
+//                     effective hashrate (see effective_hashrate.h)
+//   GET /1/pools      connection state, share counters and effective
+//                     hashrate per pool session
+//   GET /metrics      Prometheus text format, see metrics.h
+//   GET /1/trace      job lifecycle trace as Chrome trace-event JSON, when
+//                     tracing is enabled, see trace.h
+//
+// and, with "restricted": false, control endpoints (see control()) to
+// pause and resume devices, set or retune their intensity and switch the
+// failover session's pool. Each change takes effect by a device's next
+// batch, without stopping mining threads or dropping their DAG. With an
+// access_token set every request needs it as a bearer token.
+//
+// Runs its own epoll loop on one thread, like ProxyServer. The loop also
+// samples the device hash counters once a second for the 10 s / 60 s /
+// 15 min windows. Scrapes only read: device counters are atomics and pool
+// sessions hand out a copy of their status, so scraping every second never
+// holds up hashing or stratum I/O; controls set atomics the devices and
+// sessions check on their own time.
+// Replies are rendered into buffers that are reused from one request to
+// the next.
+class ApiServer {
+public:
+    ApiServer(const Config& config, KawPow& kawpow);
+    ~ApiServer();
+
+    // Pool sessions to report on; sessions started later can be added
+    // while the server runs
+    void add_pool(Stratum* stratum);
+
+    bool start();
+    void stop();
+    int port() const { return bound_port; }
+
+private:
+    void loop();
+    void sample(std::chrono::steady_clock::time_point now);
+    // Hashes per second over the last seconds, for one device or all of
+    // them (SIZE_MAX); negative until two samples exist
+    double hashrate(size_t device, int seconds) const;
+
+    void accept_all();
+    void read_from(ApiConnection& conn);
+    void write_to(ApiConnection& conn);
+    void close_connection(int fd);
+    void update_events(ApiConnection& conn);
+    void close_idle(std::chrono::steady_clock::time_point now);
+
+    bool handle_request(ApiConnection& conn);
+    bool authorized(const std::string& authorization) const;
+    void control(ApiConnection& conn, const std::string& path);
+    void respond(ApiConnection& conn, int status, const char* reason);
+    void respond(ApiConnection& conn, int status, const char* reason, const char* content_type,
+                 const char* data, size_t size);
+    void write_error(const char* message);
+    void write_summary();
+    void write_devices();
+    void write_pools();
+    void write_device(size_t device);
+    void write_pool(const PoolStatus& status);
+    void write_rates(size_t device);
+    void write_rate(double rate);
+    void write_effective(const EffectiveEstimate& e);
+    void snapshot_pools();
+
+    const ApiConfig settings;
+    KawPow& kawpow;
+    std::mutex pools_mutex;
+    std::vector<Stratum*> pools;
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    int bound_port = 0;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::chrono::steady_clock::time_point started;
+
+    // Loop thread only
+    std::unordered_map<int, std::unique_ptr<ApiConnection>> conns;
+
+    // Ring of per-second hash counter samples, newest at sample_head
+    struct Sample {
+        std::chrono::steady_clock::time_point time;
+        std::vector<uint64_t> hashes;   // per device
+    };
+    std::vector<Sample> samples;
+    size_t sample_head = 0;
+    size_t sample_count = 0;
+    double highest = 0;                 // best 10 s total seen
+
+    // Reused for every reply
+    rapidjson::StringBuffer body;
+    rapidjson::Writer<rapidjson::StringBuffer> writer;
+    std::vector<PoolStatus> pool_status;
+    std::string text;                   // /metrics and /1/trace
+    std::string request_body;
+};
@@ -0,0 +1,51 @@
+// include/bench_client.h
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "kawpow.h"
+
+// One height of a benchmark run
+struct BenchResult {
+    uint64_t height = 0;
+    uint64_t epoch = 0;
+    double dag_seconds = 0;     // slowest device's DAG generation, 0 if none was needed
+    double seconds = 0;         // job handed out to the last nonce hashed, DAG included
+    double hashrate = 0;        // over the hashing alone
+    uint64_t digest = 0;
+};
+
+// Offline benchmark, the job of base/net/stratum/benchmark/BenchClient in
+// its STATIC_BENCH and STATIC_VERIFY modes. A fixed synthetic job is
+// mined by every configured device for a fixed number of nonces, with no
+// pool, and the kernel folds every hash into a digest (see
+// KawPow::record_digest) that is checked against a known value, so a
+// fast but wrong kernel fails the run. Heights and sizes without a known
+// value are checked against kawpow_verify_hash on the host instead.
+//
+// Given several heights, they are run in turn on the same mining
+// threads, so a change of epoch is measured end to end, DAG generation
+// included. The digest depends on the height's epoch (the DAG) and period
+// (the random program), so each height has its own.
+class BenchClient {
+public:
+    BenchClient(const Config& config, KawPow& kawpow, uint64_t nonces, const std::vector<uint64_t>& heights);
+
+    // True if every height's digest matched
+    bool run();
+
+    // 250K, 500K, 1M to 10M, or a plain count; 0 if the string is none of them
+    static uint64_t parse_size(const std::string& size);
+
+private:
+    bool run_height(uint64_t height, BenchResult& result);
+    uint64_t reference(uint64_t height);
+
+    KawPow& kawpow;
+    const uint64_t nonces;
+    const std::vector<uint64_t> heights;
+    size_t slot;
+    std::string header_hex;
+};
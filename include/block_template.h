@@ -0,0 +1,62 @@
+// include/block_template.h
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "rapidjson/document.h"
+
+using Hash256 = std::array<uint8_t, 32>;
+
+// A getblocktemplate result, reduced to what the miner needs to build and
+// submit a block. Hashes are kept in internal (serialized) byte order, i.e.
+// reversed from the hex the node prints.
+struct BlockTemplate {
+    int32_t version = 0;
+    Hash256 prev_hash{};
+    uint32_t bits = 0;
+    uint32_t curtime = 0;
+    uint32_t height = 0;
+    int64_t coinbase_value = 0;
+    std::string target_hex;
+    std::string longpollid;
+    std::vector<std::string> tx_data;           // serialized transactions, hex
+    std::vector<Hash256> txids;
+    std::vector<uint8_t> witness_commitment;    // output script, empty if none
+
+    // Siblings on the path from the coinbase to the merkle root. The
+    // coinbase is the only leaf that changes between headers, so the rest
+    // of the tree is hashed once per template.
+    std::vector<Hash256> merkle_branch;
+};
+
+bool parse_block_template(const rapidjson::Value& result, BlockTemplate& tpl);
+
+// Output script paying a Ravencoin P2PKH or P2SH address (mainnet or testnet)
+bool address_to_script(const std::string& address, std::vector<uint8_t>& script);
+
+// Serialized coinbase transaction. With witness it carries the reserved
+// value a witness commitment refers to; the txid is always taken without.
+std::vector<uint8_t> build_coinbase(const BlockTemplate& tpl, const std::vector<uint8_t>& payout_script,
+                                    const std::string& tag, bool with_witness);
+
+// Branch for leaf 0 of a tree whose remaining leaves are txids
+std::vector<Hash256> merkle_branch(const std::vector<Hash256>& txids);
+Hash256 merkle_root(const Hash256& coinbase_txid, const std::vector<Hash256>& branch);
+
+// Full tree over all leaves, for checking a branch
+Hash256 merkle_root_full(std::vector<Hash256> leaves);
+
+// The 80-byte KawPoW header input: version, previous block, merkle root,
+// time, bits and height; nonce and mix hash are appended on submission.
+void kawpow_header(const BlockTemplate& tpl, const Hash256& merkle_root, uint8_t out[80]);
+
+// Header hash as the miner and pools pass it around: SHA-256d of the
+// header input, printed most significant byte first
+std::string kawpow_header_hash(const uint8_t header[80]);
+
+// Block ready for submitblock, hex encoded. mix_hash_hex is the mix hash as
+// the miner reports it (most significant byte first).
+std::string serialize_block(const uint8_t header[80], uint64_t nonce, const std::string& mix_hash_hex,
+                            const std::vector<uint8_t>& coinbase, const std::vector<std::string>& tx_data);
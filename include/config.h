@@ -1,5 +1,6 @@
 #pragma once
 
+#include <map>
 #include <string>
 #include <vector>
 #include "rapidjson/document.h"
@@ -13,21 +14,172 @@ struct PoolConfig {
     std::string url;
     std::string user;
     std::string pass;
+    std::string host;   // parsed from url
+    int port = 3333;    // parsed from url
+    bool tls = false;   // stratum+ssl:// or stratum+tls://
+    std::string tls_fingerprint;    // optional SHA-256 certificate pin (hex)
+    bool nicehash = false;  // EthereumStratum/1.0.0 dialect, like base/net/stratum/Pool
+    double weight = 0;      // share of hashrate when splitting; 0 = failover only
 };
 
+struct PoolSelectionConfig {
+    bool enabled = false;
+    int interval = 60;          // seconds between probes/re-ranking
+    double hysteresis = 0.2;    // candidate must be this much better to switch
+    int min_dwell = 300;        // seconds to stay on a pool after switching
+};
+
+// Mining several weighted pools at once instead of failing over between them
+struct PoolSplitConfig {
+    bool enabled = false;
+    int report_interval = 60;   // seconds between achieved split reports
+};
+
+// Same keys and defaults as base/net/dns/DnsConfig
+struct DnsSettings {
+    bool ipv6 = false;          // prefer AAAA records
+    unsigned ttl = 30;          // seconds a resolved answer is reused
+};
+
+struct ShareQueueConfig {
+    bool enabled = true;
+    std::string file = "shares.queue";  // append-only backing file, empty = memory only
+    size_t max_shares = 256;
+    int max_age = 90;                   // seconds a job is assumed valid after it arrived
+};
+
+// Local stratum proxy for farms: one upstream session, many downstream rigs
+struct ProxyConfig {
+    bool enabled = false;
+    std::string host = "127.0.0.1";     // same default as base/net/tools/TcpServer
+    int port = 3334;
+    int extranonce_bytes = 2;           // per-downstream slice appended to the pool's extranonce, 1 to 3
+    size_t max_connections = 4096;
+};
+
+// Solo mining against a local node, like base/net/stratum/DaemonClient
+struct SoloConfig {
+    bool enabled = false;
+    std::string url = "127.0.0.1:8766";     // ravend RPC
+    std::string host;                       // parsed from url
+    int port = 8766;
+    std::string user;
+    std::string pass;
+    std::string address;                    // payout address for the coinbase
+    std::string coinbase_tag = "/kawpow-miner/";
+    int poll_interval = 5;                  // seconds between getblocktemplate polls
+    bool longpoll = true;                   // also hold a long-poll request open
+    int notify_port = 0;                    // UDP port for block notifications, 0 = off
+};
+
+// Dead connection detection. By default only TCP keepalive watches an idle
+// connection, starting after half the budget. Probes are opt-in: set
+// probe_method to a method the pool answers (e.g. "mining.ping"), and after
+// half the budget without data from the pool a probe goes out; if neither a
+// reply nor the TCP acknowledgement of the probe arrives within the other
+// half, the connection is abandoned. A budget under a few seconds fails
+// over on ordinary network hiccups and pools that are slow to notify.
+struct KeepaliveConfig {
+    int failover_budget_ms = 10000;
+    std::string probe_method;                   // any reply will do; empty disables probes
+    int tcp_user_timeout_ms = 0;                // unacknowledged data aborts the connection, 0 = OS default
+    bool tcp_keepalive = true;
+    double notify_timeout = 8;                  // expected notify intervals without a job before failing over
+};
+
+// Every stratum line in and out, timestamped, for replaying a session later
+struct RecordConfig {
+    bool enabled = false;
+    std::string file = "stratum-session.rec";
+};
+
+// HTTP monitoring and control API. Listens on loopback unless told
+// otherwise, and is read-only unless restricted is turned off, like
+// base/api/Httpd.
+struct ApiConfig {
+    bool enabled = false;
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    std::string access_token;   // required as "Authorization: Bearer <token>" when set
+    bool restricted = true;     // false enables the control endpoints
+};
+
+// Every share's outcome in a binary journal, see share_journal.h
+struct ShareJournalConfig {
+    bool enabled = false;
+    std::string file = "shares.journal";
+};
+
+// Hashrate from accepted shares, next to the counted one, see
+// effective_hashrate.h
+struct EffectiveHashrateConfig {
+    int window = 900;               // seconds of shares behind an estimate
+    double confidence = 0.99;       // of its bounds; a counted rate outside them is a warning
+};
+
+// Where log lines go: the console, a file and syslog, the backends of
+// base/io/log
+struct LogConfig {
+    std::string level = "info";     // error, warn, info or debug (stratum traffic)
+    bool console = true;
+    bool colors = true;             // on a terminal only
+    std::string file;               // appended to; empty = none
+    bool syslog = false;
+};
+
+// Job lifecycle trace in Chrome trace-event format, see trace.h
+struct TraceConfig {
+    bool enabled = false;
+    std::string file = "trace.json";    // written at exit; empty = only served by the API
+    size_t events_per_thread = 16384;   // ring size, rounded up to a power of two
+};
+
+// Splits "[scheme://]host[:port]" into host and port (default 3333); tls is
+// set when the scheme names an SSL/TLS transport.
+bool parse_pool_url(const std::string& url, std::string& host, int& port, bool& tls);
+
 class Config {
 public:
     bool load(const std::string& filename);
 
     const std::vector<PoolConfig>& getPools() const { return pools; }
     const std::vector<CudaDeviceConfig>& getCudaDevices() const { return cuda_devices; }
-    int getApiPort() const { return api_port; }
-    bool isApiEnabled() const { return api_enabled; }
+    const PoolSelectionConfig& getPoolSelection() const { return pool_selection; }
+    const PoolSplitConfig& getPoolSplit() const { return pool_split; }
+    const DnsSettings& getDns() const { return dns; }
+    const ShareQueueConfig& getShareQueue() const { return share_queue; }
+    const ProxyConfig& getProxy() const { return proxy; }
+    const SoloConfig& getSolo() const { return solo; }
+    const RecordConfig& getRecord() const { return record; }
+    const KeepaliveConfig& getKeepalive() const { return keepalive; }
+    const ApiConfig& getApi() const { return api; }
+    const TraceConfig& getTrace() const { return trace; }
+    const LogConfig& getLog() const { return log; }
+    const ShareJournalConfig& getShareJournal() const { return share_journal; }
+    const EffectiveHashrateConfig& getEffectiveHashrate() const { return effective_hashrate; }
+    // Reload the file when it changes, see config_watcher.h
+    bool getWatch() const { return watch; }
+
+    // Top-level sections whose JSON differs between the two, for reloads
+    std::vector<std::string> changed_sections(const Config& other) const;
 
 private:
     std::vector<PoolConfig> pools;
     std::vector<CudaDeviceConfig> cuda_devices;
-    int api_port;
-    bool api_enabled;
+    PoolSelectionConfig pool_selection;
+    PoolSplitConfig pool_split;
+    DnsSettings dns;
+    ShareQueueConfig share_queue;
+    ProxyConfig proxy;
+    SoloConfig solo;
+    RecordConfig record;
+    KeepaliveConfig keepalive;
+    ApiConfig api;
+    TraceConfig trace;
+    LogConfig log;
+    ShareJournalConfig share_journal;
+    EffectiveHashrateConfig effective_hashrate;
+    bool watch = true;
+    std::map<std::string, std::string> sections;    // top-level member -> its JSON as loaded
 };
 
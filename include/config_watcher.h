@@ -0,0 +1,74 @@
+// include/config_watcher.h
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "config.h"
+
+class KawPow;
+
+// Calls back once a file has changed and stayed unchanged for a moment,
+// like base/io/Watcher. Uses inotify on the file's directory, so editors
+// that save by writing a new file and renaming it over the old one are
+// seen too.
+class ConfigWatcher {
+public:
+    ConfigWatcher(const std::string& path, std::function<void()> changed);
+    ~ConfigWatcher();
+
+    bool start();
+
+private:
+    void run();
+
+    std::string path;
+    std::string dir;
+    std::string name;
+    std::function<void()> changed;
+    int inotify_fd = -1;
+    int wake_fd = -1;
+    std::thread thread;
+    std::atomic<bool> running{false};
+};
+
+// Applies config file edits to the running miner. Each reload parses the
+// file into a new Config snapshot and compares its top-level sections with
+// the last one:
+//   log      reconfigured in place
+//   cuda     intensities set, devices taken out paused, devices put back
+//            resumed; mining threads and their DAG stay
+//   api      handed to on_api, which rebinds the server
+//   pools    pools appended to a hashrate split get their own session
+//            through on_pools_added
+// Anything else is logged as taking effect at the next start. Snapshots
+// are kept for the life of the process, since sessions started from one
+// keep reading it.
+class ConfigReloader {
+public:
+    ConfigReloader(const Config& config, KawPow& kawpow);
+
+    // Set by whoever owns the API server and the pool sessions
+    std::function<void(const Config& snapshot)> on_api;
+    // Pools from first on, in the snapshot, are new
+    std::function<void(const Config& snapshot, size_t first)> on_pools_added;
+
+    // Called from the watcher thread
+    void reload(const std::string& path);
+
+private:
+    void apply_devices(const Config& before, const Config& after);
+    bool apply_pools(const Config& after);
+
+    std::mutex mutex;
+    const Config* current;
+    std::vector<std::unique_ptr<Config>> snapshots;
+    KawPow& kawpow;
+    const std::vector<CudaDeviceConfig> devices;    // as the mining threads were started
+    std::vector<PoolConfig> pools;                  // with a session each, when split
+    const bool split;
+};
@@ -0,0 +1,34 @@
+// include/daemon_rpc.h
+#pragma once
+
+#include <string>
+#include "rapidjson/document.h"
+
+// JSON-RPC over HTTP to a local node (ravend), the transport
+// base/net/stratum/DaemonClient gets from base/net/http. Keeps the
+// connection alive between calls and reconnects once if the node dropped
+// it. Not thread safe: use one instance per thread.
+class DaemonRpc {
+public:
+    DaemonRpc(const std::string& host, int port, const std::string& user, const std::string& pass);
+    ~DaemonRpc();
+
+    // Sends method(params) and parses the whole reply object into reply.
+    // params is a JSON array. Returns false on transport, HTTP or parse
+    // errors; an RPC-level error is returned in reply["error"].
+    bool call(const std::string& method, const std::string& params, rapidjson::Document& reply, int timeout_seconds);
+
+    const std::string& last_error() const { return error; }
+
+private:
+    bool connect_node(int timeout_seconds);
+    void close_node();
+    bool exchange(const std::string& request, std::string& body, int timeout_seconds);
+
+    std::string host;
+    int port;
+    std::string authorization;
+    int fd = -1;
+    int next_id = 1;
+    std::string error;
+};
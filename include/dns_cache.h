@@ -0,0 +1,54 @@
+// include/dns_cache.h
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include "config.h"
+
+// Resolved addresses for one host, kept with the same TTL semantics as
+// base/net/dns/DnsUvBackend: answers are reused until the configured TTL
+// expires, then refreshed in the background.
+struct DnsEntry {
+    std::vector<sockaddr_storage> records;  // interleaved by family, preferred first
+    std::chrono::steady_clock::time_point expires;
+    bool pending = false;
+    uint64_t generation = 0;                // bumped on every completed lookup
+};
+
+// getaddrinfo() on a worker thread with a TTL cache in front of it. Callers
+// only block on the very first lookup of a host; afterwards they get cached
+// (or, if the resolver is down, stale) records immediately.
+class DnsCache {
+public:
+    DnsCache(const Config& config);
+    ~DnsCache();
+
+    void prefetch(const std::string& host);
+    bool lookup(const std::string& host, std::vector<sockaddr_storage>& records);
+
+private:
+    void enqueue_locked(const std::string& host, DnsEntry& entry);
+    void worker_main();
+    std::vector<sockaddr_storage> resolve(const std::string& host, int& status) const;
+
+    const Config& config;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<std::string, DnsEntry> entries;
+    std::deque<std::string> queue;
+    bool running = true;
+    std::thread worker;
+};
+
+// Races non-blocking connects across `records` (RFC 8305 "happy eyeballs"),
+// starting the next address every HAPPY_EYEBALLS_DELAY_MS or as soon as an
+// attempt fails. Returns the first connected socket, still non-blocking, or
+// -1 if every attempt failed within timeout_ms.
+int happy_eyeballs_connect(const std::vector<sockaddr_storage>& records, int port, int timeout_ms, std::string& ip);
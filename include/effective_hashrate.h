@@ -0,0 +1,99 @@
+// include/effective_hashrate.h
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "config.h"
+#include "metrics.h"
+
+// Seconds between counter samples; the window moves in steps of this
+#define EFFECTIVE_SAMPLE_SECONDS 10
+
+// Work handed out to a device or a pool: hashes, and the shares those
+// hashes should find at the targets they were searched at
+struct MinedWork {
+    uint64_t hashes = 0;
+    double shares = 0;
+};
+
+// One device or pool over the window
+struct EffectiveEstimate {
+    double seconds = 0;         // covered so far, up to the window
+    double counted = 0;         // H/s from the hash counters
+    double effective = 0;       // H/s credited by accepted shares
+    double low = 0;             // confidence bounds of the true rate
+    double high = 0;
+    double expected = 0;        // shares the counted hashes should have found
+    uint64_t accepted = 0;
+    uint64_t rejected = 0;
+    uint64_t stale = 0;
+    bool diverged = false;      // counted lies outside [low, high]
+};
+
+// Effective hashrate per device and per pool, from the shares the pool
+// accepted.
+//
+// The hash counters only say how many hashes were computed, not that they
+// were right: a kernel with a bug or a corrupted DAG keeps counting but
+// finds shares the pool rejects, or none at all. Accepted shares arrive
+// as a Poisson process, so k of them give exact (Garwood) bounds on the
+// rate, and a counted rate outside those bounds is logged as a warning
+// until it comes back inside.
+//
+// KawPow adds up the work it hands out and passes it to sample() every
+// EFFECTIVE_SAMPLE_SECONDS. The window is a ring of buckets, one per
+// sample, that collect verdicts and counted work alike, so both rates
+// cover the same span.
+class EffectiveHashrate {
+public:
+    EffectiveHashrate(const Config& config);
+
+    // The pool's verdict on a share found by device (an index into the
+    // configured devices), at difficulty
+    void record_result(size_t device, const std::string& pool, double difficulty, bool accepted, bool stale);
+
+    // Work handed out so far: per device, and per job source with the pool
+    // it is mining for. Closes the current bucket.
+    void sample(std::chrono::steady_clock::time_point now, const std::vector<MinedWork>& device_work,
+                const std::vector<std::pair<std::string, MinedWork>>& source_work);
+
+    EffectiveEstimate device(size_t device) const;
+    // Empty estimate for a pool nothing was mined for
+    EffectiveEstimate pool(const std::string& pool) const;
+
+private:
+    struct Bucket {
+        std::chrono::steady_clock::time_point start;
+        uint64_t hashes = 0;
+        double expected = 0;
+        double credited = 0;        // hashes the accepted shares stand for
+        uint64_t accepted = 0;
+        uint64_t rejected = 0;
+        uint64_t stale = 0;
+    };
+    struct Window {
+        std::string name;               // for the log
+        std::deque<Bucket> buckets;     // the last one is still open
+        bool diverged = false;
+        Gauge* rate = nullptr;
+        Gauge* diverged_metric = nullptr;
+    };
+
+    Window& pool_window(const std::string& pool);
+    void close(Window& window, std::chrono::steady_clock::time_point now, const MinedWork& work);
+    EffectiveEstimate estimate(const Window& window) const;
+
+    const EffectiveHashrateConfig settings;
+    mutable std::mutex mutex;
+    std::vector<Window> devices;
+    std::map<std::string, Window> pools;
+    std::vector<MinedWork> last_devices;    // at the previous sample
+    std::vector<MinedWork> last_sources;
+    std::chrono::steady_clock::time_point last_sample;
+};
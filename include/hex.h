@@ -0,0 +1,25 @@
+// include/hex.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Hex codec for the protocol path: job fields, share submissions, targets.
+// Nothing allocates; callers pass the output buffer. Long runs go through
+// AVX2 or SSSE3 when the CPU has them (picked once at startup), the tail and
+// older CPUs use a table-driven scalar loop with identical results.
+
+// Decodes bare hex digits into out; callers reading fields a pool may send
+// with a 0x prefix strip it first. Fails on an odd digit count, any non-hex
+// character or more than out_size bytes of output; the decoded byte count
+// is stored in decoded when given.
+bool hex_decode(const char* hex, size_t length, uint8_t* out, size_t out_size, size_t* decoded = nullptr);
+
+// Writes exactly size * 2 lowercase digits, no terminator
+void hex_encode(const uint8_t* in, size_t size, char* out);
+
+// 16 digits, most significant first, the way nonces are submitted
+void hex_encode_u64(uint64_t value, char out[16]);
+
+// Name of the implementation in use ("avx2", "ssse3" or "scalar")
+const char* hex_backend();
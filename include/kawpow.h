@@ -5,52 +5,215 @@
 #include <vector>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include "config.h"
+#include "effective_hashrate.h"
+#include "metrics.h"
+#include "share_target.h"
 
 class Stratum; // Forward declaration
+class SoloClient;
+
+// One batch of device work, handed out by KawPow::next_work. The device
+// keeps it between batches; changed says the job is not the one it had.
+struct DeviceWork {
+    size_t device = 0;          // index into the configured devices
+    size_t slot = SIZE_MAX;
+    uint64_t generation = 0;
+    bool changed = false;
+    std::string job_id;
+    std::string header_hash;
+    std::string seed_hash;
+    uint64_t block_number = 0;
+    ShareBoundary target;
+    uint64_t nonce = 0;         // first nonce of the batch
+    uint64_t batch_size = 0;    // hashes per batch, set by the device
+    uint64_t count = 0;         // nonces to search from nonce, at most batch_size
+    uint64_t nonce_end = 0;     // a bench job's nonces stop here, see record_digest; 0 for pool work
+};
+
+// The latest job from one source (a pool session, or the solo client)
+struct WorkSlot {
+    Stratum* stratum = nullptr;
+    std::string name;
+    double weight = 1;
+    bool live = false;          // has a job
+    bool connected = true;      // its shares can be delivered right away
+    uint64_t generation = 0;
+    std::chrono::steady_clock::time_point received;    // of the current job
+    std::string job_id;
+    std::string header_hash;
+    std::string seed_hash;
+    uint64_t block_number = 0;
+    ShareBoundary target;
+    uint64_t nonce_prefix = 0;          // of the current job
+    int nonce_prefix_bits = 0;
+    uint64_t next_prefix = 0;           // extranonce for the next job
+    int next_prefix_bits = 0;
+    double hashes = 0;                  // batches handed out, for the split
+    double reported_hashes = 0;
+    std::string pool;                   // host:port it mines for, once connected
+    MinedWork mined;                    // for the effective hashrate
+    // A bench job: nonces [0, nonce_end) are handed out once, shared by
+    // all devices, and the batches' digests add up here
+    uint64_t nonce_end = 0;
+    uint64_t next_nonce = 0;
+    uint64_t digest = 0;
+    uint64_t digested = 0;              // hashes
+};
+
+// Per device and slot, where the next batch starts and how much of the
+// device's slice of the job's nonce range is left
+struct NonceCursor {
+    uint64_t generation = 0;
+    uint64_t nonce = 0;
+    uint64_t left = 0;
+};
+
+// Written by a device's mining thread as it goes, read by the API without
+// taking any lock the device ever waits on
+struct DeviceStats {
+    int device_id = -1;
+    std::atomic<uint64_t> hashes{0};
+    std::atomic<uint64_t> shares{0};            // found at the pool's target
+    std::atomic<uint64_t> dag_epoch{UINT64_MAX};  // of the DAG in device memory
+    std::atomic<uint64_t> dag_size{0};
+    std::atomic<bool> dag_building{false};
+    std::atomic<uint64_t> dag_build_us{0};      // of the last DAG this device generated
+    Histogram* job_switch = nullptr;    // job received to this device's first batch on it
+
+    // Set through KawPow's controls, see set_paused and set_intensity
+    std::atomic<bool> paused{false};
+    std::atomic<int> intensity{0};      // blocks per launch, 0 keeps the launch default; applied before the next batch
+    std::atomic<bool> tuning{false};
+};
+
+// One intensity tried by KawPow::retune
+struct TuneResult {
+    int intensity = 0;
+    double hashrate = 0;
+};
 
 class KawPow {
 public:
     KawPow(const Config& config);
     ~KawPow();
 
-    void set_stratum(Stratum* s);
-    void set_job(const std::string& job_id, const std::string& header_hash, const std::string& seed_hash, uint64_t block_number, const std::string& target);
+    // Registers a job source; with several, devices divide their batches
+    // between them by weight. Returns the slot for set_job.
+    size_t add_source(Stratum* s, const std::string& name, double weight);
+    void set_solo(SoloClient* s);
+    // Replaces the slot's job. Devices pick it up with their next batch;
+    // the mining threads keep running. Returns the job's generation, 0 if
+    // the slot is unknown. With nonce_end, the job is a bench job: its
+    // nonces from 0 to nonce_end are searched once, and the slot goes idle
+    // after the last batch is handed out.
+    uint64_t set_job(size_t slot, const std::string& job_id, const std::string& header_hash, const std::string& seed_hash, uint64_t block_number, const ShareBoundary& target, uint64_t nonce_end = 0);
+    // A disconnected slot only gets work when no connected one has a job.
+    // pool names the pool a connected slot now mines for.
+    void set_connected(size_t slot, bool connected, const std::string& pool = std::string());
     void stop_mining();
     bool should_continue() const;
 
+    // Fixes the high bits of every nonce to the pool-assigned extranonce so
+    // rigs sharing an account search disjoint ranges. Takes effect with the
+    // next job; an empty string clears it.
+    bool set_extranonce(size_t slot, const std::string& extranonce_hex);
+
+    // Called by a device before every batch; false once mining stops.
+    // The batch never leaves the device's slice of the nonces below the
+    // extranonce; a device that has searched its whole slice moves on to
+    // another slot, or waits for a new job.
+    bool next_work(size_t device, DeviceWork& work);
+
     // This is called from the CUDA code when a share is found
-    // In kawpow.h, inside the KawPow class
-    void submit_share(const std::string& nonce_hex, const std::string& mix_hash_hex);
+    void submit_share(const DeviceWork& work, const std::string& nonce_hex, const std::string& mix_hash_hex);
+
+    // Called by a device after each batch of a bench job: the XOR of the
+    // top 64 bits of the final hashes of the batch's count nonces, and how
+    // many hashes that was. XOR makes the job's digest independent of the
+    // batch sizes and of how the devices split the range.
+    void record_digest(const DeviceWork& work, uint64_t digest, uint64_t hashes);
+    // The digest of the slot's current job so far; returns the hashes it covers
+    uint64_t job_digest(size_t slot, uint64_t& digest);
+
+    // Live controls for the API. Each takes effect by the device's next
+    // batch; mining threads keep running and keep their DAG. A paused
+    // device waits in next_work. False for an unknown device or an
+    // intensity out of range.
+    bool set_paused(size_t device, bool paused);
+    bool set_intensity(size_t device, int intensity);
+    // Mines at a range of intensities around the current one, a few
+    // seconds each on live work, and keeps the fastest
+    bool retune(size_t device);
+    std::vector<TuneResult> tune_results(size_t device) const;
+
+    // The pool's verdict on a share found by the CUDA device device_id
+    void record_result(int device_id, const std::string& pool, double difficulty, bool accepted, bool stale);
+
+    // One per configured device, in config order
+    size_t device_count() const { return devices; }
+    DeviceStats& device_stats(size_t device) { return stats[device]; }
+    const EffectiveHashrate& effective_hashrate() const { return effective; }
 private:
     void start_mining_threads();
-    void mining_thread_main(int device_id);
+    void mining_thread_main(size_t device_index, int device_id);
+    size_t pick_slot(size_t device, const DeviceWork& current) const;
+    NonceCursor& cursor_for(size_t device, size_t slot);
+    bool exhausted(size_t device, size_t slot) const;
+    double virtual_time() const;
+    void report_split(std::chrono::steady_clock::time_point now);
+    void sample_effective(std::chrono::steady_clock::time_point now);
+    void tune_step(size_t device, const DeviceWork& work, std::chrono::steady_clock::time_point entered);
 
     const Config& config;
-    Stratum* stratum_client = nullptr;
+    SoloClient* solo_client = nullptr;
+    size_t devices;
+    std::unique_ptr<DeviceStats[]> stats;
     
     std::atomic<bool> continue_mining;
     std::vector<std::thread> mining_threads;
 
-    // Current job parameters
-    std::string current_job_id;
-    std::string current_header_hash;
-    std::string current_seed_hash;
-    uint64_t current_block_number = 0;
-    std::string current_target;
+    std::mutex work_mutex;
+    std::condition_variable work_cv;
+    std::vector<WorkSlot> slots;
+    std::vector<std::vector<NonceCursor>> cursors;     // [device][slot]
+    uint64_t next_generation = 0;
+    std::chrono::steady_clock::time_point last_split_report;
+
+    // A retune in progress or done, per device; only touched while the
+    // device's tuning flag is set or by the API
+    struct Tuning {
+        std::vector<int> candidates;
+        size_t current = 0;
+        bool skip = true;                   // the last batch ran at the previous intensity
+        std::chrono::steady_clock::time_point returned;    // from the last next_work
+        uint64_t batch = 0;                 // size of the batch handed out then
+        uint64_t hashes = 0;
+        double seconds = 0;
+        std::vector<TuneResult> results;
+    };
+    mutable std::mutex tune_mutex;
+    std::vector<Tuning> tunings;
+
+    EffectiveHashrate effective;
+    std::vector<MinedWork> device_mined;            // guarded by work_mutex
+    std::chrono::steady_clock::time_point last_effective_sample;
 };
 
 // This C-style function is what you will call from your C++ code to launch the CUDA part.
 // It needs to be declared `extern "C"` to avoid C++ name mangling.
+// Runs until kawpow_instance->next_work returns false, asking it for the job
+// and nonces of every batch.
 extern "C" void kawpow_cuda_search(
-    const char* header_hash, 
-    const char* seed_hash, 
-    uint64_t block_number, 
-    uint64_t start_nonce, 
     int device_id, 
+    size_t device_index, 
     int intensity, 
-    KawPow* kawpow_instance, // Pass a pointer to the class instance
-    const char* target
+    KawPow* kawpow_instance // Pass a pointer to the class instance
 );
 
 #endif // KAWPOW_H
@@ -0,0 +1,100 @@
+// include/kawpow_verify.h
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "uint256.h"
+
+struct ethash_light;
+
+// Host implementation of KawPoW: ProgPoW 0.9.4 over the ethash DAG, with
+// Ravencoin's 7500-block epochs, 512 parents per DAG node and the
+// "RAVENCOINKAWPOW" Keccak-f800 padding. It is the reference kawpow_kernel
+// in src/kawpow.cu is checked against (bench digests, the mock pool), so
+// the two must agree hash for hash.
+struct KawpowResult {
+    uint8_t hash[32];       // most significant byte first, as compared to the target
+    uint8_t mix[32];        // bytes as the miner hex-encodes them
+};
+
+// ProgPoW's random number generator
+struct Kiss99 {
+    uint32_t z, w, jsr, jcong;
+    uint32_t get() {
+        z = 36969 * (z & 65535) + (z >> 16);
+        w = 18000 * (w & 65535) + (w >> 16);
+        uint32_t mwc = (z << 16) + w;
+        jsr ^= (jsr << 17); jsr ^= (jsr >> 13); jsr ^= (jsr << 5);
+        jcong = 69069 * jcong + 1234567;
+        return (mwc ^ jcong) + jsr;
+    }
+};
+
+// The random program of one ProgPoW period (KAWPOW_PERIOD blocks): the
+// registers and selectors of each round's cache, math and DAG merges, in
+// the order a round executes them. Every round of every hash in the
+// period runs the same program.
+struct KawpowProgram {
+    struct CacheOp { uint32_t src, dst, sel; };
+    struct MathOp { uint32_t src1, src2, sel1, dst, sel2; };
+    CacheOp cache[11];
+    MathOp math[18];
+    uint32_t dag_dst[4], dag_sel[4];
+};
+
+void kawpow_program(uint64_t block_number, KawpowProgram& program);
+
+// What hashing needs for one epoch: the light cache, the 16 KiB L1 cache
+// (the first words of the DAG) and, once built, the DAG itself. Without
+// the DAG every hash derives its 64 DAG items from the light cache, a few
+// milliseconds each; build_dag makes hashing millions of nonces practical
+// at the cost of the DAG's memory.
+class KawpowEpoch {
+public:
+    explicit KawpowEpoch(uint64_t epoch);
+    ~KawpowEpoch();
+    KawpowEpoch(const KawpowEpoch&) = delete;
+    KawpowEpoch& operator=(const KawpowEpoch&) = delete;
+
+    bool valid() const { return light != nullptr; }
+    uint64_t epoch() const { return number; }
+    uint64_t dag_size() const { return dag_bytes; }
+    // 2048-bit items, the unit of a DAG access
+    uint32_t dag_items() const { return static_cast<uint32_t>(dag_bytes / 256); }
+
+    // Generates the whole DAG on threads threads; false if it does not fit
+    bool build_dag(unsigned threads);
+    // The 64 words of 2048-bit item index
+    void item(uint32_t index, uint32_t words[64]) const;
+    const uint32_t* l1() const { return l1_cache; }
+    // The light cache the DAG is generated from: cache_size() bytes of
+    // 512-bit nodes in native-endian words
+    const uint32_t* cache() const;
+    uint64_t cache_size() const;
+
+private:
+    uint64_t number;
+    uint64_t dag_bytes = 0;
+    ethash_light* light = nullptr;
+    uint32_t l1_cache[4096];
+    std::vector<uint32_t> dag;
+};
+
+// The epoch's light context, built on first use; the last two used are
+// kept, so shares straddling an epoch change do not rebuild it
+std::shared_ptr<const KawpowEpoch> kawpow_epoch(uint64_t epoch);
+
+void kawpow_verify_hash(const KawpowEpoch& epoch, uint64_t block_number, const uint8_t header_hash[32], uint64_t nonce,
+                        KawpowResult& result);
+
+enum class ShareVerdict { VALID, BAD_INPUT, BAD_MIX, LOW_DIFFICULTY };
+
+// Recomputes a submitted share for a job at block_number and checks it
+// against target. header, nonce and mix are bare hex as sent in
+// mining.submit; the hash is stored in hash when given.
+ShareVerdict kawpow_verify_share(uint64_t block_number, const std::string& header_hex, const std::string& nonce_hex,
+                                 const std::string& mix_hex, const uint256& target, uint256* hash = nullptr);
+
+const char* share_verdict_name(ShareVerdict verdict);
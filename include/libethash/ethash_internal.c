@@ -365,6 +365,32 @@ bool ethash_quick_check_difficulty(
 	return ethash_check_difficulty(&return_hash, boundary);
 }
 
+// Reciprocal for fast_mod(): a % d as a - ((a + increment) * reciprocal >> shift) * d
+static void ethash_calculate_fast_mod_data(uint32_t divisor, uint32_t* reciprocal, uint32_t* increment, uint32_t* shift)
+{
+	uint32_t top = 31;
+	while (!(divisor >> top)) {
+		--top;
+	}
+	if ((divisor & (divisor - 1)) == 0) {
+		*reciprocal = 1;
+		*increment = 0;
+		*shift = top;
+		return;
+	}
+	*shift = 32 + top;
+	uint64_t const n = 1ULL << *shift;
+	uint64_t const q = n / divisor;
+	uint64_t const r = n - q * divisor;
+	if (r * 2 < divisor) {
+		*reciprocal = (uint32_t)q;
+		*increment = 1;
+	} else {
+		*reciprocal = (uint32_t)(q + 1);
+		*increment = 0;
+	}
+}
+
 ethash_light_t ethash_light_new_internal(uint64_t cache_size, ethash_h256_t const* seed)
 {
 	struct ethash_light *ret;
@@ -382,6 +408,8 @@ ethash_light_t ethash_light_new_internal(uint64_t cache_size, ethash_h256_t cons
 		goto fail_free_cache_mem;
 	}
 	ret->cache_size = cache_size;
+	ret->num_parent_nodes = (uint32_t)(cache_size / sizeof(node));
+	ethash_calculate_fast_mod_data(ret->num_parent_nodes, &ret->reciprocal, &ret->increment, &ret->shift);
 	return ret;
 
 fail_free_cache_mem:
@@ -1,59 +1,94 @@
 // include/logging.h
 #pragma once
 
-#include <iostream>
+#include <atomic>
+#include <cstdint>
+#include <sstream>
 #include <string>
-#include <chrono>
-#include <iomanip>
-#include <mutex>
-
-extern std::mutex log_mutex;
-
-// Helper function to get formatted timestamp
-inline std::string get_timestamp() {
-    auto now = std::chrono::system_clock::now();
-    auto in_time_t = std::chrono::system_clock::to_time_t(now);
-    std::tm tm_buf;
-    localtime_r(&in_time_t, &tm_buf);
-    
-    char buffer[128];
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d %X", &tm_buf);
-    return std::string(buffer);
-}
-
-// Simple logging class to handle stream operators
+
+// Asynchronous logging. A LOG_* line is formatted on the calling thread into
+// a reused stream, copied into a slot of a lock-free ring, and written out
+// by a background thread to the console, a file and/or syslog (the
+// backends of base/io/log). The calling thread never takes a lock or waits
+// for I/O. When the ring is full the line is dropped and counted; the
+// writer reports the count. Each call site may log LOG_SITE_RATE lines per
+// second, the rest are suppressed and their number is appended to the
+// site's next line.
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3   // stratum wire traffic
+
+// Lines above this level are compiled out, e.g. -DLOG_MAX_LEVEL=2
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_SITE_RATE 100
+
+enum class LogTag : uint8_t { ERROR, WARN, INFO, CUDA, STRATUM };
+
+struct LogConfig;
+
+// Lines above this level are skipped at run time; set from the config
+extern std::atomic<int> log_level;
+
+// Applies the "log" section: level and backends. Lines logged before
+// this go to the console.
+void log_configure(const LogConfig& config);
+// Lines dropped because the ring was full, since startup
+uint64_t log_dropped();
+
+// Rate limit of one call site, per wall clock second
+struct LogSite {
+    std::atomic<uint32_t> second{0};
+    std::atomic<uint32_t> lines{0};
+    std::atomic<uint32_t> suppressed{0};
+
+    // True if the line may go out; takes the count suppressed before it
+    bool allow(uint32_t now, uint32_t& skipped);
+};
+
 class Logger {
-private:
-    std::string color_code;
-    
 public:
-    Logger(const std::string& level, const std::string& color) : color_code(color) {
-        std::lock_guard<std::mutex> lock(log_mutex);
-        std::cout << "\033[" << color << "m[" << get_timestamp() << " " << level << "] ";
-    }
-    
-    ~Logger() {
-        std::cout << "\033[0m" << std::endl;
-    }
-    
+    Logger(LogTag tag, LogSite& site);
+    ~Logger();
+
     template<typename T>
     Logger& operator<<(const T& data) {
-        std::cout << data;
+        if (stream) {
+            *stream << data;
+        }
         return *this;
     }
-    
+
     // Special handling for endl
     Logger& operator<<(std::ostream& (*f)(std::ostream&)) {
-        f(std::cout);
+        if (stream) {
+            f(*stream);
+        }
         return *this;
     }
+
+private:
+    LogTag tag;
+    uint64_t time_us;
+    uint32_t suppressed = 0;
+    std::ostringstream* stream = nullptr;   // null when the line is not logged
 };
 
-#define LOG_INFO Logger("INFO ", "32")
-#define LOG_WARN Logger("WARN ", "33")
-#define LOG_ERROR Logger("ERROR", "31")
-#define LOG_CUDA Logger("CUDA ", "36")
-#define LOG_STRATUM Logger("STRATUM", "35")
+// Each expansion has its own static LogSite
+#define LOG_LINE(tag, level)                                                            \
+    if ((level) > LOG_MAX_LEVEL || (level) > log_level.load(std::memory_order_relaxed)) { \
+    } else                                                                              \
+        Logger(tag, []() -> LogSite& { static LogSite site; return site; }())
+
+#define LOG_INFO LOG_LINE(LogTag::INFO, LOG_LEVEL_INFO)
+#define LOG_WARN LOG_LINE(LogTag::WARN, LOG_LEVEL_WARN)
+#define LOG_ERROR LOG_LINE(LogTag::ERROR, LOG_LEVEL_ERROR)
+#define LOG_CUDA LOG_LINE(LogTag::CUDA, LOG_LEVEL_INFO)
+#define LOG_STRATUM LOG_LINE(LogTag::STRATUM, LOG_LEVEL_DEBUG)
 
 // For backward compatibility
 #define ENDL ""
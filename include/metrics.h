@@ -0,0 +1,142 @@
+// include/metrics.h
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Counters and histograms for the Prometheus /metrics endpoint.
+//
+// Every metric is split into per-thread shards, each on its own cache line.
+// The first METRIC_SHARDS - 1 threads to record anything get a shard to
+// themselves and update it with a plain load and store; later threads share
+// the last shard and use atomic adds. Scrapes sum the shards. Recording
+// never locks, and threads never write a cache line another thread writes.
+#define METRIC_SHARDS 16
+
+// Bucket k counts observations up to 2^k microseconds (1 us .. 67 s),
+// the last one everything above
+#define HISTOGRAM_BUCKETS 28
+
+namespace metrics_detail {
+
+// This thread's shard; exclusive unless it is the last one
+inline unsigned shard_index() {
+    static std::atomic<unsigned> next{0};
+    static thread_local unsigned index = std::min(next.fetch_add(1, std::memory_order_relaxed),
+                                                  static_cast<unsigned>(METRIC_SHARDS - 1));
+    return index;
+}
+
+inline void bump(std::atomic<uint64_t>& value, uint64_t n, unsigned shard) {
+    if (shard < METRIC_SHARDS - 1) {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    } else {
+        value.fetch_add(n, std::memory_order_relaxed);
+    }
+}
+
+} // namespace metrics_detail
+
+class Counter {
+public:
+    void add(uint64_t n = 1) {
+        unsigned shard = metrics_detail::shard_index();
+        metrics_detail::bump(shards[shard].value, n, shard);
+    }
+    uint64_t value() const;
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    Shard shards[METRIC_SHARDS];
+};
+
+// Last value set wins; not sharded, gauges change on events
+class Gauge {
+public:
+    void set(int64_t v) { value_.store(v, std::memory_order_relaxed); }
+    int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+class Histogram {
+public:
+    static int bucket_of(uint64_t ns) {
+        uint64_t us = (ns + 999) / 1000;
+        if (us <= 1) {
+            return 0;
+        }
+        int k = 64 - __builtin_clzll(us - 1);
+        return k < HISTOGRAM_BUCKETS - 1 ? k : HISTOGRAM_BUCKETS - 1;
+    }
+
+    void observe_ns(uint64_t ns) {
+        unsigned shard = metrics_detail::shard_index();
+        Shard& s = shards[shard];
+        metrics_detail::bump(s.buckets[bucket_of(ns)], 1, shard);
+        metrics_detail::bump(s.sum_ns, ns, shard);
+    }
+    void observe(std::chrono::steady_clock::duration d) {
+        observe_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    }
+    void observe_since(std::chrono::steady_clock::time_point start) {
+        observe(std::chrono::steady_clock::now() - start);
+    }
+
+    // Merged over all shards; counts are per bucket, not cumulative
+    void snapshot(uint64_t counts[HISTOGRAM_BUCKETS], uint64_t& sum_ns) const;
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS] = {};
+        std::atomic<uint64_t> sum_ns{0};
+    };
+    Shard shards[METRIC_SHARDS];
+};
+
+// Process-wide set of metric families. Registration takes a lock and hands
+// out a reference that stays valid for the life of the process; asking for
+// the same name and labels again returns the same metric.
+class Metrics {
+public:
+    static Metrics& instance();
+
+    // labels are preformatted, e.g. device="0",pool="host:3333"
+    Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "");
+    Gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+    Histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = "");
+
+    // Prometheus text exposition format (0.0.4), appended to out
+    void render(std::string& out) const;
+
+private:
+    enum class Type { COUNTER, GAUGE, HISTOGRAM };
+    struct Series {
+        std::string labels;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+    };
+    struct Family {
+        std::string name;
+        std::string help;
+        Type type;
+        std::vector<std::unique_ptr<Series>> series;
+    };
+    Series& series(const std::string& name, const std::string& help, Type type, const std::string& labels);
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Family>> families;
+};
+
+// Label value with quotes, backslashes and newlines escaped
+std::string metric_label(const std::string& value);
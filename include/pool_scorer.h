@@ -0,0 +1,92 @@
+// include/pool_scorer.h
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "config.h"
+#include "dns_cache.h"
+
+// Live measurements for one configured pool. Latency samples are kept the
+// same way NetworkState does it: a bounded vector, reduced with a median.
+struct PoolStats {
+    std::vector<uint16_t> connect_ms;
+    std::vector<uint16_t> rtt_ms;
+    std::chrono::steady_clock::time_point last_notify;
+    double notify_interval_ms = 0.0;    // EWMA of notify inter-arrival time
+    double notify_jitter_ms = 0.0;      // EWMA of |interval - mean|
+    uint64_t accepted = 0;
+    uint64_t rejected = 0;
+    uint64_t stale = 0;
+    uint32_t failures = 0;              // consecutive connect failures
+};
+
+// Share verdicts and median request round trip, for reporting
+struct PoolResults {
+    uint64_t accepted = 0;
+    uint64_t rejected = 0;
+    uint64_t stale = 0;
+    double rtt_ms = 0;
+};
+
+// Ranks pools by the expected fraction of work they lose, and decides when
+// hashrate should be migrated to a better one.
+class PoolScorer {
+public:
+    PoolScorer(const Config& config, DnsCache& dns);
+    ~PoolScorer();
+
+    void start();
+    void stop();
+
+    void record_connect(size_t pool, uint32_t ms);
+    void record_connect_failure(size_t pool);
+    void record_rtt(size_t pool, uint32_t ms);
+    void record_notify(size_t pool);
+    void record_result(size_t pool, bool accepted, bool stale);
+
+    // How soon a new job can be expected from this pool: its notify
+    // interval so far, but never longer than a block.
+    double expected_notify_interval_ms(size_t pool) const;
+
+    PoolResults results(size_t pool) const;
+
+    // Expected fraction of work lost on this pool; lower is better.
+    double score(size_t pool) const;
+
+    // Pool to mine on, given the one we are currently connected to.
+    // Only moves away from `current` when a candidate beats it by the
+    // configured hysteresis and the minimum dwell time has passed.
+    size_t select(size_t current);
+
+    // A switch made by hand; select() keeps to it for the minimum dwell time
+    void record_switch();
+
+    // Best pool to try after `failed` could not be reached.
+    size_t next_after_failure(size_t failed) const;
+
+    bool rank_due();
+    void print() const;
+
+private:
+    double score_locked(size_t pool) const;
+    void probe_loop();
+    void probe(size_t pool);
+
+    const Config& config;
+    DnsCache& dns;
+    mutable std::mutex mutex;
+    std::vector<PoolStats> stats;
+
+    std::chrono::steady_clock::time_point last_rank;
+    std::chrono::steady_clock::time_point last_switch;
+
+    std::atomic<bool> running;
+    std::mutex probe_mutex;
+    std::condition_variable probe_cv;
+    std::thread probe_thread;
+};
@@ -0,0 +1,110 @@
+// include/proxy_server.h
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "config.h"
+#include "share_queue.h"
+
+// Forwards a downstream share to the pool; done receives the pool's verdict
+using ProxySubmitHandler = std::function<void(const QueuedShare& share, ShareResultCallback done)>;
+
+struct ProxyConnection {
+    uint64_t id = 0;
+    int fd = -1;
+    uint32_t slice = 0;                 // index into the extranonce space
+    bool subscribed = false;
+    bool closing = false;
+    std::string worker;
+    std::string read_buffer;
+    std::deque<std::shared_ptr<const std::string>> write_queue;
+    size_t write_offset = 0;            // into write_queue.front()
+    size_t queued_bytes = 0;
+    bool want_write = false;
+};
+
+// Local stratum server for farms: rigs connect here instead of to the pool,
+// and the miner keeps a single upstream session for all of them. Each
+// downstream gets the pool's extranonce plus its own slice, so rigs search
+// disjoint nonce ranges; slice 0 is kept for this miner's own devices.
+//
+// Like base/net/tools/TcpServer it listens on 127.0.0.1 by default, but runs
+// its own epoll loop so thousands of downstream sockets cost one thread.
+// Upstream jobs and targets are forwarded as the raw line the pool sent, so
+// a job is serialized once no matter how many rigs receive it.
+class ProxyServer {
+public:
+    ProxyServer(const Config& config, ProxySubmitHandler submit);
+    ~ProxyServer();
+
+    bool start();
+    void stop();
+
+    // Called from the stratum thread as upstream events arrive. Returns the
+    // extranonce this miner's own devices should use.
+    std::string set_upstream_extranonce(const std::string& extranonce);
+    void broadcast_job(const std::string& line);
+    void broadcast_target(const std::string& line);
+
+    size_t connections() const { return connection_count.load(); }
+    int port() const { return bound_port; }
+    void print_stats() const;
+
+private:
+    // Work handed to the loop thread by other threads
+    struct Outbound {
+        enum Kind { LINE, BROADCAST, EXTRANONCE } kind;
+        uint64_t connection;
+        std::shared_ptr<const std::string> line;
+    };
+
+    void loop();
+    void post(Outbound outbound);
+    void drain_inbox();
+    void accept_all();
+    void read_from(ProxyConnection& conn);
+    void write_to(ProxyConnection& conn);
+    void send(ProxyConnection& conn, std::shared_ptr<const std::string> line);
+    void send(ProxyConnection& conn, const std::string& line);
+    void close_connection(ProxyConnection& conn);
+    void update_events(ProxyConnection& conn);
+
+    void handle_line(ProxyConnection& conn, const std::string& line);
+    void handle_submit(ProxyConnection& conn, const std::string& id, const std::string& job_id,
+                       const std::string& nonce, const std::string& header, const std::string& mix);
+    std::string extranonce_for(uint32_t slice) const;
+    std::string extranonce_message(const ProxyConnection& conn) const;
+
+    const ProxyConfig settings;
+    ProxySubmitHandler submit;
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    int bound_port = 0;
+    std::thread thread;
+    std::atomic<bool> running{false};
+
+    // Loop thread only
+    std::unordered_map<uint64_t, std::unique_ptr<ProxyConnection>> conns;
+    std::vector<uint32_t> free_slices;
+    uint64_t next_connection_id = 2;    // 0 = listen socket, 1 = wake eventfd
+    std::atomic<size_t> connection_count{0};
+
+    // Shared with the stratum thread
+    mutable std::mutex state_mutex;
+    std::string upstream_extranonce;
+    std::shared_ptr<const std::string> last_job;
+    std::shared_ptr<const std::string> last_target;
+    std::vector<Outbound> inbox;
+
+    std::atomic<uint64_t> forwarded{0};
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> rejected{0};
+};
@@ -0,0 +1,57 @@
+// include/session_log.h
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+// What a record in a session log is
+enum class SessionEvent : uint8_t {
+    CONNECTED = 0,      // a new pool session starts; data is "host:port"
+    RECEIVED = 1,       // one JSON message from the pool
+    SENT = 2            // one line to the pool, without its newline
+};
+
+struct SessionRecord {
+    uint64_t time_us = 0;       // since the recording started
+    SessionEvent event = SessionEvent::RECEIVED;
+    std::string data;
+};
+
+// Append-only binary log of a stratum session. After an 8 byte magic and
+// the wall clock start time (ms, little endian), each record is
+//   varint microseconds since the previous record
+//   event byte
+//   varint length, then the bytes
+// A few bytes of overhead per line; a log cut short by a crash reads up to
+// its last complete record.
+class SessionRecorder {
+public:
+    ~SessionRecorder();
+
+    bool open(const std::string& path);
+    void record(SessionEvent event, const char* data, size_t size);
+    void record(SessionEvent event, const std::string& data) { record(event, data.data(), data.size()); }
+
+private:
+    std::mutex mutex;
+    FILE* file = nullptr;
+    std::chrono::steady_clock::time_point last;
+    std::chrono::steady_clock::time_point last_flush;
+};
+
+class SessionReader {
+public:
+    ~SessionReader();
+
+    bool open(const std::string& path);
+    bool next(SessionRecord& record);
+    uint64_t start_ms() const { return wall_start_ms; }
+
+private:
+    FILE* file = nullptr;
+    uint64_t wall_start_ms = 0;
+    uint64_t time_us = 0;
+};
@@ -0,0 +1,22 @@
+// include/sha256.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// SHA-256 for block construction: coinbase txid, merkle tree and the KawPoW
+// header hash. Merkle levels hash many independent 64-byte nodes, so those
+// go through an 8-lane AVX2 path when the CPU has it (picked once at
+// startup); everything else is a plain scalar implementation.
+
+void sha256(const uint8_t* data, size_t size, uint8_t out[32]);
+
+// SHA-256 applied twice, as Ravencoin hashes transactions and headers
+void sha256d(const uint8_t* data, size_t size, uint8_t out[32]);
+
+// Double SHA-256 of count independent 64-byte inputs, i.e. one merkle level
+// where each input is a pair of child hashes. in and out may alias.
+void sha256d_64(const uint8_t* in, uint8_t* out, size_t count);
+
+// Name of the multi-buffer implementation in use ("avx2" or "scalar")
+const char* sha256_backend();
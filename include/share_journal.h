@@ -0,0 +1,103 @@
+// include/share_journal.h
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "config.h"
+
+#define SHARE_RECORD_MAGIC 0x5253504bu     // "KPSR"
+
+// How a share ended
+enum class ShareOutcome : uint8_t {
+    ACCEPTED = 1,
+    REJECTED = 2,
+    STALE = 3,
+    LOST = 4        // never answered: dropped from a full queue, or expired in it
+};
+
+// One share, fixed size, in host byte order (little-endian wherever the
+// miner runs). Strings are NUL padded and cut to fit. Times are wall clock
+// microseconds; sent and answered are 0 if that never happened.
+struct ShareRecord {
+    uint32_t magic = SHARE_RECORD_MAGIC;
+    uint8_t outcome = 0;            // ShareOutcome
+    uint8_t reserved = 0;
+    int16_t device = -1;            // CUDA device id; -1 for shares from proxy rigs
+    uint64_t found_us = 0;          // a device handed it over
+    uint64_t sent_us = 0;           // mining.submit written
+    uint64_t answered_us = 0;       // verdict read
+    uint64_t nonce = 0;
+    uint64_t block_number = 0;
+    double difficulty = 0;          // of the share target
+    uint8_t header_hash[32] = {};
+    uint8_t mix_hash[32] = {};
+    uint8_t target[32] = {};        // share target, big-endian
+    char job_id[32] = {};
+    char pool[40] = {};             // host:port
+    char reason[32] = {};           // the pool's error message
+};
+static_assert(sizeof(ShareRecord) == 256, "journal records are 256 bytes");
+
+// Append-only journal of every share that got a verdict or was given up,
+// for settling disputes with a pool and offline analysis (see
+// bench/journal_query). The file is a 64 byte header followed by records;
+// it is mapped and grown a chunk at a time, so a record is a memcpy.
+//
+// record() only copies the record into a pending batch; a writer thread
+// moves batches into the mapping and msyncs them once a second, so neither
+// hashing nor network threads ever wait on the disk. A crash loses at most
+// the last second; a reader stops at the first slot without a record.
+class ShareJournal {
+public:
+    // suffix keeps the files of several pool sessions apart
+    ShareJournal(const Config& config, const std::string& suffix = "");
+    ~ShareJournal();
+
+    bool enabled() const { return map != nullptr; }
+    void record(const ShareRecord& r);
+
+private:
+    bool open(const std::string& path);
+    bool reserve(uint64_t records);
+    void run();
+    void write_batch(std::vector<ShareRecord>& batch);
+
+    int fd = -1;
+    uint8_t* map = nullptr;
+    size_t map_size = 0;
+    uint64_t count = 0;             // records in the file
+
+    std::mutex mutex;               // guards pending and stopping
+    std::condition_variable cv;
+    std::vector<ShareRecord> pending;
+    uint64_t dropped = 0;
+    bool stopping = false;
+    std::thread writer;
+};
+
+// Sequential reader of a journal file, for tools
+class ShareJournalReader {
+public:
+    ~ShareJournalReader();
+
+    bool open(const std::string& path);
+    bool next(ShareRecord& record);
+
+private:
+    FILE* file = nullptr;
+};
+
+// Sets a text field of a record, cut to fit with room for the NUL
+template <size_t N>
+inline void share_record_text(char (&field)[N], const std::string& value) {
+    size_t n = std::min(value.size(), N - 1);
+    memcpy(field, value.data(), n);
+    memset(field + n, 0, N - n);
+}
@@ -0,0 +1,98 @@
+// include/share_queue.h
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "config.h"
+#include "share_target.h"
+
+// A found share that could not be delivered to the pool yet
+struct QueuedShare {
+    uint64_t seq = 0;
+    uint64_t expires_ms = 0;    // wall clock, so it survives a restart
+    uint64_t block_number = 0;
+    std::string pool;           // host:port of the pool that issued the job
+    std::string job_id;
+    std::string nonce_hex;
+    std::string header_hash;
+    std::string mix_hash_hex;
+
+    // For the share journal; not kept in the queue file
+    uint64_t found_us = 0;
+    int device = -1;
+    ShareBoundary target{};
+};
+
+// The pool's verdict on a share submitted on someone else's behalf
+using ShareResultCallback = std::function<void(bool accepted, const std::string& error)>;
+
+// A share the queue gives up on, and why
+using ShareDiscardCallback = std::function<void(const QueuedShare& share, const char* reason)>;
+
+// Bounded queue of undelivered shares, mirrored to an append-only file so
+// that shares found during an outage also survive a restart. Every queued
+// share gets a "Q" record; a later "R" record marks it resolved (replayed or
+// discarded). The file is compacted when it is loaded and when resolved
+// records pile up.
+//
+// Records are only collected under the queue's lock; a writer thread
+// appends and syncs them, and rewrites the file when it is compacted, so
+// a mining thread that queues a share never waits on the disk.
+class ShareQueue {
+public:
+    // suffix keeps the files of several pool sessions apart
+    ShareQueue(const Config& config, const std::string& suffix = "");
+    ~ShareQueue();
+
+    bool enabled() const { return settings.enabled; }
+
+    // Called, under the queue's lock, for every share that will not be sent
+    void set_discard_handler(ShareDiscardCallback handler) { on_discard = std::move(handler); }
+
+    // Never blocks on the network; the oldest share is dropped when full.
+    void push(QueuedShare share);
+
+    // Removes every queued share; expired ones, ones for another block and
+    // ones from another pool (whose job ids mean nothing to this one) are
+    // discarded here with accounting, the rest are returned to replay.
+    std::vector<QueuedShare> take_replayable(uint64_t current_block, const std::string& pool);
+
+    size_t size() const;
+    void print_stats() const;
+
+private:
+    void load();
+    void run();
+    void append(const std::string& record);
+    void resolve_locked(const QueuedShare& share);
+    void rewrite(const std::string& records);
+
+    ShareQueueConfig settings;
+    ShareDiscardCallback on_discard;
+    mutable std::mutex mutex;
+    std::deque<QueuedShare> shares;
+    uint64_t next_seq = 1;
+    size_t resolved_records = 0;
+
+    // Writer thread; the file is its own once it runs
+    FILE* file = nullptr;
+    std::condition_variable cv;
+    std::string pending;            // records not written yet
+    bool compact_due = false;
+    bool stopping = false;
+    std::thread writer;
+
+    uint64_t queued_total = 0;
+    uint64_t replayed = 0;
+    uint64_t discarded_expired = 0;
+    uint64_t discarded_stale = 0;
+    uint64_t discarded_pool = 0;
+    uint64_t dropped_overflow = 0;
+};
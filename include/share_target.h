@@ -0,0 +1,32 @@
+// include/share_target.h
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "uint256.h"
+
+// Share boundary as handed to the kernel: the full target plus its top 64
+// bits, so most hashes can be rejected with a single compare before the
+// full 256-bit one.
+struct ShareBoundary {
+    uint256 target;
+    uint64_t prefix;
+    double difficulty;
+};
+
+// mining.set_target / mining.notify: 64 hex chars, optionally 0x-prefixed
+bool boundary_from_hex(const std::string& hex, ShareBoundary& boundary);
+
+// mining.set_difficulty, relative to the stratum difficulty-1 target
+ShareBoundary boundary_from_difficulty(double difficulty);
+
+std::string boundary_to_hex(const ShareBoundary& boundary);
+
+// hash uses the same word order as uint256
+bool boundary_meets(const uint32_t hash[8], const ShareBoundary& boundary);
+
+// Local monitoring boundary: easy enough that a device at this hashrate
+// hits it about once per interval, so found shares give a steady hashrate
+// estimate, but never harder than the pool's share boundary. Only hits that
+// also meet the pool boundary are submitted.
+ShareBoundary monitor_boundary(const ShareBoundary& share, double hashrate, double interval_seconds);
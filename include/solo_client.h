@@ -0,0 +1,72 @@
+// include/solo_client.h
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "block_template.h"
+#include "config.h"
+#include "daemon_rpc.h"
+#include "kawpow.h"
+
+// Everything needed to turn a found nonce back into a block
+struct SoloJob {
+    std::shared_ptr<const BlockTemplate> tpl;
+    std::vector<uint8_t> coinbase;      // with witness, as it goes in the block
+    uint8_t header[80];
+};
+
+// Solo mining straight from a local node, the job of
+// base/net/stratum/DaemonClient. Templates come from getblocktemplate:
+// polled every poll_interval seconds, held open as a long-poll, and
+// fetched at once when the node pings notify_port (for example
+// -blocknotify="sh -c 'echo %s | nc -u -w0 127.0.0.1 <port>'"), the
+// closest thing to a ZMQ hashblock subscription without libzmq. Headers are
+// built locally and blocks go back through submitblock.
+class SoloClient {
+public:
+    SoloClient(const Config& config, KawPow& kawpow);
+    ~SoloClient();
+    void run();
+    void stop();
+    // Same contract as Stratum::submit; called from the mining threads
+    void submit(const std::string& job_id, const std::string& nonce_hex, const std::string& header_hash_hex,
+                const std::string& mix_hash_hex);
+
+private:
+    bool refresh(DaemonRpc& rpc, const std::string& longpollid);
+    void apply_template(std::shared_ptr<const BlockTemplate> tpl, const char* source);
+    void longpoll_loop();
+    void notify_loop();
+    void wake();
+    std::string seed_hash(uint64_t block_number);
+
+    const Config& config;
+    const SoloConfig& settings;
+    KawPow& kawpow;
+    std::vector<uint8_t> payout_script;
+    std::atomic<bool> running{false};
+    std::thread longpoll_thread;
+    std::thread notify_thread;
+    int notify_fd = -1;
+
+    std::mutex wake_mutex;
+    std::condition_variable wake_cv;
+    bool wake_pending = false;
+
+    std::mutex apply_mutex;             // one template change at a time
+    std::mutex job_mutex;               // guards everything below
+    std::map<uint64_t, SoloJob> jobs;   // recent jobs by id, for submit
+    uint64_t next_job_id = 1;
+    Hash256 current_prev_hash{};
+    std::string current_longpollid;
+    uint64_t seed_epoch = ~0ULL;
+    std::string seed_hex;
+
+    std::mutex submit_mutex;
+    DaemonRpc submit_rpc;
+};
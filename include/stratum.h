@@ -1,29 +1,177 @@
 #pragma once
 
 #include <string>
+#include <atomic>
 #include <functional>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <thread>
 #include "config.h"
 #include "kawpow.h"
+#include "dns_cache.h"
+#include "pool_scorer.h"
+#include "share_journal.h"
+#include "share_queue.h"
+#include "metrics.h"
+#include "session_log.h"
+#include "share_target.h"
+#include "tls_transport.h"
+
+// A request sent to the pool that is still waiting for its response
+struct PendingRequest {
+    std::chrono::steady_clock::time_point sent;
+    bool share = false;
+    QueuedShare share_data;     // resubmitted if the connection dies first
+    ShareResultCallback on_result;  // set for shares forwarded from the proxy
+};
+
+class ProxyServer;
+
+// Dead connections of one kind, by how long each went unnoticed after the
+// pool's last sign of life
+struct FailureStats {
+    uint64_t count = 0;
+    double total_ms = 0;
+    double max_ms = 0;
+};
+
+// What a share needs to know about the job it was found for
+struct JobInfo {
+    uint64_t expires_ms = 0;
+    uint64_t block_number = 0;
+    std::string pool;       // host:port of the pool that sent it
+};
+
+// Prometheus series of one configured pool
+struct PoolMetrics {
+    std::string labels;
+    Counter* accepted = nullptr;
+    Counter* rejected = nullptr;
+    Counter* stale = nullptr;
+    Histogram* submit_rtt = nullptr;
+    Histogram* share_to_wire = nullptr;
+    Gauge* connected = nullptr;
+};
+
+// What the API shows for a pool session
+struct PoolStatus {
+    std::string pool;               // host:port
+    bool connected = false;
+    bool tls = false;
+    double weight = 0;              // in the hashrate split, 0 without one
+    uint64_t uptime_ms = 0;         // of the current session
+    uint32_t failures = 0;          // sessions lost
+    double diff = 0;                // of the current job
+    std::string job_id;
+    uint64_t block_number = 0;
+    size_t queued_shares = 0;
+    PoolResults results;
+};
 
 class Stratum {
 public:
-    Stratum(const Config& config, KawPow& kawpow);
+    // A pinned client stays on that pool (for the hashrate split) instead of
+    // ranking and failing over between all of them
+    Stratum(const Config& config, KawPow& kawpow, int pinned_pool = -1);
+    ~Stratum();
     void run();
-    // NEW, CORRECTED VERSION
-    void submit(const std::string& job_id, const std::string& nonce_hex, const std::string& header_hash_hex, const std::string& mix_hash_hex);
+    // A share found by device_id on work
+    void submit(const DeviceWork& work, int device_id, const std::string& nonce_hex, const std::string& mix_hash_hex);
+    // Shares from proxy downstreams; done gets the pool's verdict. Queued
+    // for the stratum thread, so the proxy never waits on the pool socket.
+    void submit_forwarded(const QueuedShare& share, ShareResultCallback done);
+    void set_proxy(ProxyServer* server) { proxy = server; }
+    // Plays a recorded session into the miner instead of connecting, speed
+    // times faster than it was recorded
+    bool replay(const std::string& path, double speed);
+    // Safe to call from any thread
+    PoolStatus status() const;
+    // Moves a failover session to pool, an index into the configured pools,
+    // within a poll interval. False for a session pinned by the hashrate
+    // split or an unknown pool. Safe to call from any thread.
+    bool switch_pool(size_t pool);
 private:
-    void connect();
+    bool connect();
+    void disconnect();
+    void open_session();
+    void start_session();
+    int check_liveness();
+    void fail_over(const std::string& cause, double undetected_ms);
+    bool send_line(const std::string& msg);
+    int recv_some(char* data, size_t size);
     void subscribe();
     void authorize();
-    void handle_message(const std::string& message);
+    void subscribe_extranonce();
+    void handle_subscribe_result(const rapidjson::Value& result);
+    void apply_extranonce(const std::string& extranonce);
+    bool handle_received(const char* data, size_t size);
+    void reset_receive();
     void process_single_message(const std::string& message);
+    int track_request(bool share, int fixed_id = 0, const QueuedShare* share_data = nullptr,
+                      ShareResultCallback on_result = nullptr);
+    void fill_job_info(QueuedShare& share);
+    std::string pool_name() const;
+    bool send_share(const QueuedShare& share, ShareResultCallback on_result = nullptr);
+    void send_forwarded();
+    void replay_shares(uint64_t block_number);
+    bool take_request(int id, PendingRequest& request);
+    void record_result(bool accepted, bool stale);
+    void journal_share(const QueuedShare& share, ShareOutcome outcome, uint64_t sent_us, const std::string& reason);
     
     const Config& config;
     KawPow& kawpow;
     int sock;
+    int pinned_pool;
+    std::atomic<size_t> pool_index{0};      // written by the stratum thread, read by submits
+    size_t slot = 0;                // this client's job source in KawPow
+    DnsCache dns;
+    PoolScorer scorer;
+    std::vector<std::unique_ptr<TlsTransport>> tls_sessions;   // per pool, null for plaintext
+    TlsTransport* tls = nullptr;                                // active connection, if TLS
+    std::mutex conn_mutex;                                      // guards sock/tls/connected changes against submits
+    std::atomic<bool> connected{false};
+    ShareQueue share_queue;
+    ShareJournal journal;
+    bool replay_pending = false;
+    std::mutex job_mutex;
+    std::map<std::string, JobInfo> recent_jobs;
+    uint64_t last_block_number = 0;
+    std::mutex request_mutex;
+    std::map<int, PendingRequest> pending_requests;
+    int next_request_id = 4;
+    std::string recv_buffer;        // bytes of the pool message still being received
+    size_t scan_offset = 0;         // how far recv_buffer has been scanned
+    int scan_depth = 0;
+    bool scan_in_string = false;
+    bool scan_escaped = false;
     std::string session_id;
+    std::string extranonce;
+    ProxyServer* proxy = nullptr;
+    int wake_fd = -1;               // eventfd, wakes the receive loop for forwarded shares
+    std::mutex forward_mutex;
+    std::vector<std::pair<QueuedShare, ShareResultCallback>> forwarded;
+    std::unique_ptr<SessionRecorder> recorder;
+    std::atomic<bool> replaying{false};
+    std::atomic<int> requested_pool{-1};    // from switch_pool
+    std::thread::id replay_thread;
+    std::string replay_sent;        // last line the replay thread sent
     std::string current_job_id;
     std::string current_header_hash;
-    std::string current_target;
+    ShareBoundary pool_target = boundary_from_difficulty(1);    // from set_target / set_difficulty
+    std::chrono::steady_clock::time_point last_alive;   // data from the pool, or a probe acknowledged
+    std::chrono::steady_clock::time_point last_job;
+    std::chrono::steady_clock::time_point probe_sent;
+    bool probing = false;
+    bool probe_answered = false;    // the pool replies to probes on this session
+    int probe_id = 0;
+    std::map<std::string, FailureStats> failure_stats;
+    mutable std::mutex status_mutex;                    // guards the fields below, read by the API
+    PoolStatus live_status;
+    std::vector<PoolMetrics> pool_metrics;              // by pool index
+    size_t status_pool = 0;
+    std::chrono::steady_clock::time_point session_start;
 };
 
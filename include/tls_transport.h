@@ -0,0 +1,52 @@
+// include/tls_transport.h
+#pragma once
+
+#include <mutex>
+#include <string>
+
+using SSL = struct ssl_st;
+using SSL_CTX = struct ssl_ctx_st;
+using SSL_SESSION = struct ssl_session_st;
+
+// Client side of a stratum+ssl connection to one pool. The context and the
+// last session ticket outlive individual connections, so a reconnect to the
+// same pool resumes the session instead of doing a full handshake.
+//
+// Like base/net/stratum/Tls, the certificate chain is not verified; instead
+// an optional SHA-256 fingerprint pins the pool's certificate.
+class TlsTransport {
+public:
+    TlsTransport(const std::string& host, const std::string& fingerprint);
+    ~TlsTransport();
+
+    TlsTransport(const TlsTransport&) = delete;
+    TlsTransport& operator=(const TlsTransport&) = delete;
+
+    // Runs the handshake on a connected, non-blocking socket.
+    bool handshake(int fd, int timeout_ms);
+    void shutdown();
+
+    // Both return the byte count, 0 on orderly close, -1 on error. SSL
+    // objects must not be used from two threads at once, so reads (stratum
+    // thread) and writes (mining threads) are serialized internally.
+    int send(const char* data, size_t size);
+    int recv(char* data, size_t size);
+    bool pending() const;
+
+    bool resumed() const { return was_resumed; }
+    const std::string& fingerprint() const { return peer_fingerprint; }
+    std::string version() const;
+
+private:
+    static int on_new_session(SSL* ssl, SSL_SESSION* session);
+    bool verify_fingerprint();
+
+    std::string host;
+    std::string pinned_fingerprint;
+    std::string peer_fingerprint;
+    SSL_CTX* ctx = nullptr;
+    SSL* ssl = nullptr;
+    SSL_SESSION* session = nullptr;
+    bool was_resumed = false;
+    mutable std::mutex io_mutex;
+};
@@ -0,0 +1,116 @@
+// include/trace.h
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "config.h"
+
+// Steps of a job's and a share's way through the miner. Job steps carry the
+// job's generation (unique across pools), share steps the nonce, so one job
+// or share can be followed from thread to thread.
+enum class TracePoint : uint8_t {
+    NOTIFY_PARSE,       // notify framed .. job parameters parsed
+    JOB_PUBLISH,        // parsed .. job handed to the devices
+    JOB_PICKUP,         // a device takes its first batch of the job
+    BATCH,              // kernel launch .. result read back
+    SHARE_FOUND,        // a device hands a share to the host
+    SHARE_QUEUED,       // pool unreachable, share held for later
+    SHARE_SERIALIZE,    // mining.submit built
+    SHARE_WRITE,        // mining.submit written to the socket
+    SHARE_ACK,          // mining.submit sent .. the pool's verdict read
+    COUNT
+};
+
+struct TraceRecord {
+    std::atomic<uint64_t> start_ns{0};      // since the tracer started
+    std::atomic<uint64_t> duration_ns{0};   // 0 for a point in time
+    std::atomic<uint64_t> id{0};
+    std::atomic<uint8_t> point{0};
+};
+
+// Ring of the latest records of one thread. Only its own thread writes;
+// a dump copies it while that goes on and drops whatever may have been
+// overwritten during the copy.
+struct TraceBuffer {
+    explicit TraceBuffer(size_t capacity) : records(capacity) {}
+
+    std::vector<TraceRecord> records;   // capacity is a power of two
+    std::atomic<uint64_t> started{0};   // records ever begun
+    std::atomic<uint64_t> head{0};      // records ever finished
+    int tid = 0;
+    std::string name;                   // shown as the thread's track name
+};
+
+// Opt-in recorder of the job lifecycle, dumped as Chrome trace-event JSON
+// (chrome://tracing, ui.perfetto.dev). Disabled, a trace call is one relaxed
+// load and a branch, no clock read. Enabled, it is a clock read and a few
+// stores into the calling thread's ring, never a lock, and memory stays at
+// events_per_thread records per thread however long the miner runs.
+class Tracer {
+public:
+    static Tracer& instance();
+    static bool enabled() { return active.load(std::memory_order_relaxed); }
+
+    // Starts recording; the file, if any, is written when the process exits
+    void start(const TraceConfig& config);
+
+    // Names the calling thread's track
+    void name_thread(const std::string& name);
+
+    void record(TracePoint point, uint64_t start_ns, uint64_t duration_ns, uint64_t id);
+    uint64_t ns(std::chrono::steady_clock::time_point time) const;
+    uint64_t now_ns() const { return ns(std::chrono::steady_clock::now()); }
+
+    // {"traceEvents": [...]}, appended to out
+    void render(std::string& out);
+    bool dump(const std::string& path);
+
+private:
+    Tracer() = default;
+    TraceBuffer& buffer();
+
+    static std::atomic<bool> active;
+    std::chrono::steady_clock::time_point origin;
+    size_t capacity = 0;
+    std::string file;
+    std::mutex mutex;       // guards buffers, taken once per thread and per dump
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+};
+
+// Hot-path helpers. trace_clock() is 0 while tracing is off, and a span
+// that started with tracing off is not recorded.
+inline uint64_t trace_clock() {
+    return Tracer::enabled() ? Tracer::instance().now_ns() : 0;
+}
+
+inline void trace_instant(TracePoint point, uint64_t id) {
+    if (Tracer::enabled()) {
+        Tracer& tracer = Tracer::instance();
+        tracer.record(point, tracer.now_ns(), 0, id);
+    }
+}
+
+inline void trace_span(TracePoint point, uint64_t start_ns, uint64_t id) {
+    if (Tracer::enabled() && start_ns) {
+        Tracer& tracer = Tracer::instance();
+        uint64_t now = tracer.now_ns();
+        tracer.record(point, start_ns, now > start_ns ? now - start_ns : 0, id);
+    }
+}
+
+// Share steps are keyed by nonce
+inline uint64_t trace_nonce(const std::string& nonce_hex) {
+    return strtoull(nonce_hex.c_str(), nullptr, 16);
+}
+
+inline void trace_thread_name(const std::string& name) {
+    if (Tracer::enabled()) {
+        Tracer::instance().name_thread(name);
+    }
+}
@@ -0,0 +1,272 @@
+// include/uint256.h
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// 256-bit unsigned integer for target and difficulty math. Words are 32-bit,
+// least significant first, which is the layout the kernel compares hashes
+// in, so the same type works on the host and (under nvcc) on the device.
+// Everything except the string and floating point helpers is constexpr.
+
+#if defined(__CUDACC__)
+#define UINT256_HD __host__ __device__
+#else
+#define UINT256_HD
+#endif
+
+struct uint256 {
+    uint32_t words[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+    UINT256_HD constexpr uint256() {}
+    UINT256_HD constexpr uint256(uint64_t value) {
+        words[0] = static_cast<uint32_t>(value);
+        words[1] = static_cast<uint32_t>(value >> 32);
+    }
+
+    UINT256_HD static constexpr uint256 from_words(const uint32_t in[8]) {
+        uint256 r;
+        for (int i = 0; i < 8; ++i) r.words[i] = in[i];
+        return r;
+    }
+
+    // Big-endian bytes, the order hashes are printed in
+    UINT256_HD static constexpr uint256 from_bytes_be(const uint8_t in[32]) {
+        uint256 r;
+        for (int i = 0; i < 8; ++i) {
+            r.words[7 - i] = (static_cast<uint32_t>(in[i * 4]) << 24) | (static_cast<uint32_t>(in[i * 4 + 1]) << 16) |
+                             (static_cast<uint32_t>(in[i * 4 + 2]) << 8) | in[i * 4 + 3];
+        }
+        return r;
+    }
+
+    UINT256_HD void to_bytes_be(uint8_t out[32]) const {
+        for (int i = 0; i < 8; ++i) {
+            uint32_t word = words[7 - i];
+            out[i * 4] = static_cast<uint8_t>(word >> 24);
+            out[i * 4 + 1] = static_cast<uint8_t>(word >> 16);
+            out[i * 4 + 2] = static_cast<uint8_t>(word >> 8);
+            out[i * 4 + 3] = static_cast<uint8_t>(word);
+        }
+    }
+
+    UINT256_HD static constexpr uint256 max() {
+        uint256 r;
+        for (int i = 0; i < 8; ++i) r.words[i] = 0xffffffffU;
+        return r;
+    }
+
+    UINT256_HD constexpr bool is_zero() const {
+        for (int i = 0; i < 8; ++i) {
+            if (words[i]) return false;
+        }
+        return true;
+    }
+
+    UINT256_HD constexpr int bits() const {
+        for (int i = 7; i >= 0; --i) {
+            if (words[i]) {
+                int n = 32;
+                while (!(words[i] & (1U << (n - 1)))) --n;
+                return i * 32 + n;
+            }
+        }
+        return 0;
+    }
+
+    // Top 64 bits, what the kernel's fast reject compares
+    UINT256_HD constexpr uint64_t high64() const {
+        return (static_cast<uint64_t>(words[7]) << 32) | words[6];
+    }
+
+    UINT256_HD constexpr uint64_t low64() const {
+        return (static_cast<uint64_t>(words[1]) << 32) | words[0];
+    }
+
+    UINT256_HD friend constexpr int compare(const uint256& a, const uint256& b) {
+        for (int i = 7; i >= 0; --i) {
+            if (a.words[i] < b.words[i]) return -1;
+            if (a.words[i] > b.words[i]) return 1;
+        }
+        return 0;
+    }
+
+    UINT256_HD friend constexpr bool operator==(const uint256& a, const uint256& b) { return compare(a, b) == 0; }
+    UINT256_HD friend constexpr bool operator!=(const uint256& a, const uint256& b) { return compare(a, b) != 0; }
+    UINT256_HD friend constexpr bool operator<(const uint256& a, const uint256& b) { return compare(a, b) < 0; }
+    UINT256_HD friend constexpr bool operator<=(const uint256& a, const uint256& b) { return compare(a, b) <= 0; }
+    UINT256_HD friend constexpr bool operator>(const uint256& a, const uint256& b) { return compare(a, b) > 0; }
+    UINT256_HD friend constexpr bool operator>=(const uint256& a, const uint256& b) { return compare(a, b) >= 0; }
+
+    UINT256_HD constexpr uint256 operator<<(int shift) const {
+        uint256 r;
+        if (shift >= 256) return r;
+        int word_shift = shift / 32, bit_shift = shift % 32;
+        for (int i = 7; i >= word_shift; --i) {
+            uint32_t w = words[i - word_shift] << bit_shift;
+            if (bit_shift && i - word_shift - 1 >= 0) w |= words[i - word_shift - 1] >> (32 - bit_shift);
+            r.words[i] = w;
+        }
+        return r;
+    }
+
+    UINT256_HD constexpr uint256 operator>>(int shift) const {
+        uint256 r;
+        if (shift >= 256) return r;
+        int word_shift = shift / 32, bit_shift = shift % 32;
+        for (int i = 0; i + word_shift < 8; ++i) {
+            uint32_t w = words[i + word_shift] >> bit_shift;
+            if (bit_shift && i + word_shift + 1 < 8) w |= words[i + word_shift + 1] << (32 - bit_shift);
+            r.words[i] = w;
+        }
+        return r;
+    }
+
+    UINT256_HD friend constexpr uint256 operator+(const uint256& a, const uint256& b) {
+        uint256 r;
+        uint64_t carry = 0;
+        for (int i = 0; i < 8; ++i) {
+            uint64_t sum = static_cast<uint64_t>(a.words[i]) + b.words[i] + carry;
+            r.words[i] = static_cast<uint32_t>(sum);
+            carry = sum >> 32;
+        }
+        return r;
+    }
+
+    UINT256_HD friend constexpr uint256 operator-(const uint256& a, const uint256& b) {
+        uint256 r;
+        uint64_t borrow = 0;
+        for (int i = 0; i < 8; ++i) {
+            uint64_t diff = static_cast<uint64_t>(a.words[i]) - b.words[i] - borrow;
+            r.words[i] = static_cast<uint32_t>(diff);
+            borrow = (diff >> 32) & 1;
+        }
+        return r;
+    }
+
+    // Truncated to 256 bits, like every other operation here
+    UINT256_HD friend constexpr uint256 operator*(const uint256& a, const uint256& b) {
+        uint256 r;
+        for (int i = 0; i < 8; ++i) {
+            uint64_t carry = 0;
+            for (int j = 0; i + j < 8; ++j) {
+                uint64_t cur = static_cast<uint64_t>(a.words[i]) * b.words[j] + r.words[i + j] + carry;
+                r.words[i + j] = static_cast<uint32_t>(cur);
+                carry = cur >> 32;
+            }
+        }
+        return r;
+    }
+
+    // Quotient and remainder. Divisors up to 32 bits (64 on the host) take
+    // the word-wise path; larger ones use shift-subtract, one step per
+    // quotient bit.
+    UINT256_HD static constexpr uint256 divmod(const uint256& a, const uint256& b, uint256& remainder) {
+        uint256 q;
+        remainder = uint256();
+        if (b.is_zero()) {
+            return q;
+        }
+
+        if (b.bits() <= 32) {
+            uint64_t divisor = b.words[0], rem = 0;
+            for (int i = 7; i >= 0; --i) {
+                uint64_t part = (rem << 32) | a.words[i];
+                q.words[i] = static_cast<uint32_t>(part / divisor);
+                rem = part % divisor;
+            }
+            remainder = uint256(rem);
+            return q;
+        }
+
+#if !defined(__CUDA_ARCH__)
+        // Difficulty-scaled divisors fit in 64 bits; the host has 128-bit division
+        if (b.bits() <= 64) {
+            unsigned __int128 divisor = b.low64(), rem = 0;
+            for (int i = 7; i >= 0; --i) {
+                unsigned __int128 part = (rem << 32) | a.words[i];
+                q.words[i] = static_cast<uint32_t>(part / divisor);
+                rem = part % divisor;
+            }
+            remainder = uint256(static_cast<uint64_t>(rem));
+            return q;
+        }
+#endif
+
+        if (a < b) {
+            remainder = a;
+            return q;
+        }
+        int shift = a.bits() - b.bits();
+        uint256 d = b << shift;
+        uint256 r = a;
+        for (int i = shift; i >= 0; --i) {
+            if (r >= d) {
+                r = r - d;
+                q.words[i / 32] |= 1U << (i % 32);
+            }
+            d = d >> 1;
+        }
+        remainder = r;
+        return q;
+    }
+
+    UINT256_HD friend constexpr uint256 operator/(const uint256& a, const uint256& b) {
+        uint256 rem;
+        return divmod(a, b, rem);
+    }
+
+    UINT256_HD friend constexpr uint256 operator%(const uint256& a, const uint256& b) {
+        uint256 rem;
+        divmod(a, b, rem);
+        return rem;
+    }
+
+    // Ravencoin/Bitcoin nBits: 8-bit exponent, 23-bit mantissa, sign bit
+    // ignored (targets are never negative).
+    UINT256_HD static constexpr uint256 from_compact(uint32_t compact) {
+        int size = static_cast<int>(compact >> 24);
+        uint32_t mantissa = compact & 0x007fffffU;
+        if (size <= 3) {
+            return uint256(mantissa >> (8 * (3 - size)));
+        }
+        return uint256(mantissa) << (8 * (size - 3));
+    }
+
+    UINT256_HD constexpr uint32_t to_compact() const {
+        int size = (bits() + 7) / 8;
+        uint32_t mantissa = size <= 3 ? static_cast<uint32_t>(low64() << (8 * (3 - size)))
+                                      : static_cast<uint32_t>((*this >> (8 * (size - 3))).low64());
+        // Keep the mantissa positive
+        if (mantissa & 0x00800000U) {
+            mantissa >>= 8;
+            size++;
+        }
+        return mantissa | (static_cast<uint32_t>(size) << 24);
+    }
+
+    double to_double() const;
+
+    // Up to 64 hex digits, optional 0x prefix; shorter strings are right
+    // aligned. Returns false on any non-hex character.
+    static bool from_hex(const char* hex, size_t length, uint256& out);
+    static bool from_hex(const std::string& hex, uint256& out) { return from_hex(hex.data(), hex.size(), out); }
+    // Always 64 lowercase digits
+    std::string to_hex() const;
+    void to_hex(char out[64]) const;
+};
+
+// Stratum difficulty 1 for KawPoW pools (as in kawpowminer): 255 * 2^216
+constexpr uint256 kDiff1Target = uint256(0xffULL) << 216;
+
+// target = diff1 / difficulty, with 16 fractional bits of difficulty;
+// anything at or below difficulty 2^-16 maps to the maximum target.
+uint256 target_from_difficulty(double difficulty);
+double difficulty_from_target(const uint256& target);
+
+// Difficulty a final KawPoW hash would satisfy, i.e. diff1 / hash
+double share_difficulty(const uint256& hash);
+
+// Expected hashes per share found at this difficulty, 2^256 / target
+double hashes_per_share(double difficulty);
@@ -6,6 +6,8 @@
 #include <cstring>
 #include <vector>
 #include <algorithm>
+#include "include/hex.h"
+#include "include/uint256.h"
 
 // ========== Keccak-f1600 (minimal) ==========
 extern "C" {
@@ -20,25 +22,15 @@ uint32_t byteswap32(uint32_t x) {
 
 // ========== Hex to Binary ==========
 std::vector<uint8_t> hex_to_bytes(const std::string& hex) {
-    std::vector<uint8_t> bytes;
-    bytes.reserve(hex.length() / 2);
-    for (std::size_t i = 0; i < hex.length(); i += 2) {
-        std::string byte_str = hex.substr(i, 2);
-        uint8_t byte = static_cast<uint8_t>(std::stoul(byte_str, nullptr, 16));
-        bytes.push_back(byte);
+    std::vector<uint8_t> bytes(hex.length() / 2);
+    size_t decoded = 0;
+    if (!hex_decode(hex.data(), hex.length(), bytes.data(), bytes.size(), &decoded)) {
+        return {};
     }
+    bytes.resize(decoded);
     return bytes;
 }
 
-// ========== Target Comparison ==========
-bool compare_hash_to_target(const std::vector<uint8_t>& hash, const std::vector<uint8_t>& target) {
-    for (int i = 0; i < 32; ++i) {
-        if (hash[i] < target[i]) return true;
-        if (hash[i] > target[i]) return false;
-    }
-    return true; // Equal
-}
-
 // ========== KawPoW Final Digest ==========
 std::vector<uint8_t> compute_final_hash(
     const std::vector<uint8_t>& header_hash,
@@ -72,18 +64,26 @@ int main() {
 
     auto header_bytes = hex_to_bytes(header_hex);
     auto mix_bytes    = hex_to_bytes(mix_hash_hex);
-    auto target_bytes = hex_to_bytes(target_hex);
+    uint256 target;
+    if (!uint256::from_hex(target_hex, target)) {
+        std::cout << "Invalid target: " << target_hex << "\n";
+        return 1;
+    }
     auto nonce        = std::stoull(nonce_hex, nullptr, 16);
 
     // Compute final hash
     auto final_hash = compute_final_hash(header_bytes, mix_bytes, nonce);
 
     std::cout << "Final Hash: ";
-    for (auto b : final_hash) std::cout << std::hex << std::setw(2) << std::setfill('0') << (int)b;
-    std::cout << "\n";
+    char final_hex[64];
+    hex_encode(final_hash.data(), 32, final_hex);
+    std::cout << std::string(final_hex, sizeof(final_hex)) << "\n";
 
     // Validate
-    if (compare_hash_to_target(final_hash, target_bytes)) {
+    uint256 hash = uint256::from_bytes_be(final_hash.data());
+    std::cout << "Share difficulty: " << share_difficulty(hash)
+              << " (target difficulty " << difficulty_from_target(target) << ")\n";
+    if (hash <= target) {
         std::cout << "✅ Share is VALID!\n";
     } else {
         std::cout << "❌ Share is INVALID!\n";
@@ -0,0 +1,798 @@
+#include "api_server.h"
+#include <algorithm>
+#include <cstring>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "kawpow.h"
+#include "metrics.h"
+#include "rapidjson/document.h"
+#include "stratum.h"
+#include "trace.h"
+#include "logging.h"
+
+#define WAKE_ID -1
+// Request line and headers
+#define MAX_REQUEST_SIZE 8192
+// Control requests carry a small JSON object at most
+#define MAX_BODY_SIZE 4096
+#define MAX_CONNECTIONS 64
+#define IDLE_TIMEOUT_S 60
+// Longest hashrate window, and so the length of the sample ring
+#define HISTORY_SECONDS 900
+#define SAMPLE_INTERVAL_MS 1000
+#define EPOCH_LENGTH 7500
+
+static const int kWindows[] = {10, 60, HISTORY_SECONDS};
+
+ApiServer::ApiServer(const Config& config, KawPow& kawpow)
+    : settings(config.getApi()), kawpow(kawpow), started(std::chrono::steady_clock::now()), writer(body) {
+    samples.resize(HISTORY_SECONDS + 1);
+    for (Sample& s : samples) {
+        s.hashes.resize(kawpow.device_count());
+    }
+}
+
+ApiServer::~ApiServer() {
+    stop();
+}
+
+void ApiServer::add_pool(Stratum* stratum) {
+    std::lock_guard<std::mutex> lock(pools_mutex);
+    pools.push_back(stratum);
+}
+
+bool ApiServer::start() {
+    sockaddr_storage addr;
+    memset(&addr, 0, sizeof(addr));
+    socklen_t addr_len = 0;
+    if (inet_pton(AF_INET6, settings.host.c_str(), &reinterpret_cast<sockaddr_in6*>(&addr)->sin6_addr) == 1) {
+        reinterpret_cast<sockaddr_in6*>(&addr)->sin6_family = AF_INET6;
+        reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port = htons(settings.port);
+        addr_len = sizeof(sockaddr_in6);
+    } else if (inet_pton(AF_INET, settings.host.c_str(), &reinterpret_cast<sockaddr_in*>(&addr)->sin_addr) == 1) {
+        reinterpret_cast<sockaddr_in*>(&addr)->sin_family = AF_INET;
+        reinterpret_cast<sockaddr_in*>(&addr)->sin_port = htons(settings.port);
+        addr_len = sizeof(sockaddr_in);
+    } else {
+        LOG_ERROR << "Invalid API listen address: " << settings.host;
+        return false;
+    }
+
+    listen_fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), addr_len) != 0 || listen(listen_fd, 64) != 0) {
+        LOG_ERROR << "API cannot listen on " << settings.host << ":" << settings.port << ": " << strerror(errno);
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr), &addr_len);
+    bound_port = ntohs(addr.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port
+                                                  : reinterpret_cast<sockaddr_in*>(&addr)->sin_port);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.fd = WAKE_ID;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+
+    running = true;
+    thread = std::thread(&ApiServer::loop, this);
+    LOG_INFO << "HTTP API listening on " << settings.host << ":" << bound_port;
+    return true;
+}
+
+void ApiServer::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) {
+        // The loop still notices within a sample interval
+    }
+    thread.join();
+
+    for (auto& entry : conns) {
+        close(entry.first);
+    }
+    conns.clear();
+    close(listen_fd);
+    close(wake_fd);
+    close(epoll_fd);
+}
+
+void ApiServer::loop() {
+    epoll_event events[64];
+    auto next_sample = std::chrono::steady_clock::now();
+
+    while (running) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= next_sample) {
+            sample(now);
+            close_idle(now);
+            next_sample += std::chrono::milliseconds(SAMPLE_INTERVAL_MS);
+            if (next_sample <= now) {
+                next_sample = now + std::chrono::milliseconds(SAMPLE_INTERVAL_MS);
+            }
+        }
+        int timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next_sample - now).count()) + 1;
+
+        int n = epoll_wait(epoll_fd, events, 64, timeout);
+        if (n < 0 && errno != EINTR) {
+            LOG_ERROR << "API epoll_wait failed: " << strerror(errno);
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == WAKE_ID) {
+                uint64_t count;
+                if (read(wake_fd, &count, sizeof(count)) < 0) {
+                    // Already drained
+                }
+                continue;
+            }
+            if (fd == listen_fd) {
+                accept_all();
+                continue;
+            }
+            auto it = conns.find(fd);
+            if (it == conns.end()) {
+                continue;
+            }
+            ApiConnection& conn = *it->second;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                close_connection(fd);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                write_to(conn);
+                if (conns.find(fd) == conns.end()) {
+                    continue;
+                }
+            }
+            if (events[i].events & EPOLLIN) {
+                read_from(conn);
+            }
+        }
+    }
+}
+
+void ApiServer::sample(std::chrono::steady_clock::time_point now) {
+    sample_head = (sample_head + 1) % samples.size();
+    sample_count = std::min(sample_count + 1, samples.size());
+    Sample& s = samples[sample_head];
+    s.time = now;
+    for (size_t i = 0; i < s.hashes.size(); ++i) {
+        s.hashes[i] = kawpow.device_stats(i).hashes.load(std::memory_order_relaxed);
+    }
+    highest = std::max(highest, hashrate(SIZE_MAX, kWindows[0]));
+}
+
+double ApiServer::hashrate(size_t device, int seconds) const {
+    if (sample_count < 2) {
+        return -1;
+    }
+    // One sample a second, so the window start is that many entries back;
+    // early on the window covers whatever history there is
+    size_t back = std::min<size_t>(seconds, sample_count - 1);
+    const Sample& newest = samples[sample_head];
+    const Sample& oldest = samples[(sample_head + samples.size() - back) % samples.size()];
+    double elapsed = std::chrono::duration<double>(newest.time - oldest.time).count();
+    if (elapsed <= 0) {
+        return -1;
+    }
+    uint64_t hashes = 0;
+    for (size_t i = 0; i < newest.hashes.size(); ++i) {
+        if (device == SIZE_MAX || device == i) {
+            hashes += newest.hashes[i] - oldest.hashes[i];
+        }
+    }
+    return hashes / elapsed;
+}
+
+void ApiServer::accept_all() {
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOG_WARN << "API accept failed: " << strerror(errno);
+            }
+            return;
+        }
+        if (conns.size() >= MAX_CONNECTIONS) {
+            close(fd);
+            continue;
+        }
+        std::unique_ptr<ApiConnection> conn(new ApiConnection);
+        conn->fd = fd;
+        conn->last_active = std::chrono::steady_clock::now();
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        conns[fd] = std::move(conn);
+    }
+}
+
+void ApiServer::read_from(ApiConnection& conn) {
+    char buffer[4096];
+    bool eof = false;
+    while (true) {
+        ssize_t n = recv(conn.fd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            conn.read_buffer.append(buffer, n);
+            conn.last_active = std::chrono::steady_clock::now();
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            close_connection(conn.fd);
+            return;
+        }
+        eof = true;
+        break;
+    }
+
+    while (handle_request(conn)) {
+    }
+    // A client that shut down its side after the request still gets the reply
+    if (eof) {
+        conn.keep_alive = false;
+        if (conn.write_buffer.empty()) {
+            close_connection(conn.fd);
+            return;
+        }
+        conn.read_closed = true;
+        update_events(conn);
+    }
+    if (!conn.want_write && !conn.write_buffer.empty()) {
+        write_to(conn);
+    }
+}
+
+void ApiServer::write_to(ApiConnection& conn) {
+    while (conn.write_offset < conn.write_buffer.size()) {
+        ssize_t n = send(conn.fd, conn.write_buffer.data() + conn.write_offset,
+                         conn.write_buffer.size() - conn.write_offset, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn.write_offset += n;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!conn.want_write) {
+                conn.want_write = true;
+                update_events(conn);
+            }
+            return;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        close_connection(conn.fd);
+        return;
+    }
+
+    // clear() keeps the capacity for the next reply
+    conn.write_buffer.clear();
+    conn.write_offset = 0;
+    if (!conn.keep_alive) {
+        close_connection(conn.fd);
+        return;
+    }
+    if (conn.want_write) {
+        conn.want_write = false;
+        update_events(conn);
+    }
+}
+
+void ApiServer::update_events(ApiConnection& conn) {
+    epoll_event ev;
+    ev.events = (conn.read_closed ? 0 : EPOLLIN) | (conn.want_write ? EPOLLOUT : 0);
+    ev.data.fd = conn.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &ev);
+}
+
+void ApiServer::close_connection(int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    conns.erase(fd);
+}
+
+void ApiServer::close_idle(std::chrono::steady_clock::time_point now) {
+    for (auto it = conns.begin(); it != conns.end();) {
+        if (now - it->second->last_active > std::chrono::seconds(IDLE_TIMEOUT_S)) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, it->first, nullptr);
+            close(it->first);
+            it = conns.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Answers the first complete request in the read buffer. Returns true when
+// another one may follow on the same connection.
+bool ApiServer::handle_request(ApiConnection& conn) {
+    size_t end = conn.read_buffer.find("\r\n\r\n");
+    if (end == std::string::npos) {
+        if (conn.read_buffer.size() > MAX_REQUEST_SIZE) {
+            conn.keep_alive = false;
+            conn.read_buffer.clear();
+            write_error("request too large");
+            respond(conn, 431, "Request Header Fields Too Large");
+        }
+        return false;
+    }
+
+    // Request line: METHOD SP target SP version
+    size_t line_end = conn.read_buffer.find("\r\n");
+    const char* line = conn.read_buffer.c_str();
+    const char* method_end = static_cast<const char*>(memchr(line, ' ', line_end));
+    const char* target_end = method_end ? static_cast<const char*>(memchr(method_end + 1, ' ', line + line_end - method_end - 1)) : nullptr;
+    if (!target_end) {
+        conn.keep_alive = false;
+        conn.read_buffer.clear();
+        write_error("bad request");
+        respond(conn, 400, "Bad Request");
+        return false;
+    }
+    std::string method(line, method_end);
+    std::string path(method_end + 1, target_end);
+    path = path.substr(0, path.find('?'));
+    bool http11 = strncmp(target_end + 1, "HTTP/1.1", 8) == 0;
+
+    // Only Connection, Content-Length and Authorization matter here
+    bool close_requested = false, keep_alive_requested = false, chunked = false;
+    size_t content_length = 0;
+    std::string authorization;
+    for (size_t pos = line_end + 2; pos < end;) {
+        size_t next = conn.read_buffer.find("\r\n", pos);
+        const char* header = conn.read_buffer.c_str() + pos;
+        if (strncasecmp(header, "Connection:", 11) == 0) {
+            std::string value = conn.read_buffer.substr(pos + 11, next - pos - 11);
+            close_requested = strcasestr(value.c_str(), "close") != nullptr;
+            keep_alive_requested = strcasestr(value.c_str(), "keep-alive") != nullptr;
+        } else if (strncasecmp(header, "Content-Length:", 15) == 0) {
+            content_length = strtoul(header + 15, nullptr, 10);
+        } else if (strncasecmp(header, "Transfer-Encoding:", 18) == 0) {
+            chunked = true;
+        } else if (strncasecmp(header, "Authorization:", 14) == 0) {
+            size_t start = conn.read_buffer.find_first_not_of(' ', pos + 14);
+            authorization = conn.read_buffer.substr(start, next - start);
+        }
+        pos = next + 2;
+    }
+    if (chunked || content_length > MAX_BODY_SIZE) {
+        conn.keep_alive = false;
+        conn.read_buffer.clear();
+        write_error(chunked ? "chunked bodies are not supported" : "body too large");
+        respond(conn, chunked ? 411 : 413, chunked ? "Length Required" : "Payload Too Large");
+        return false;
+    }
+    if (conn.read_buffer.size() < end + 4 + content_length) {
+        return false;   // the rest of the body is still on its way
+    }
+    request_body.assign(conn.read_buffer, end + 4, content_length);
+    conn.read_buffer.erase(0, end + 4 + content_length);
+    conn.keep_alive = http11 ? !close_requested : keep_alive_requested;
+
+    if (!authorized(authorization)) {
+        write_error("unauthorized");
+        respond(conn, 401, "Unauthorized");
+    } else if (method == "POST") {
+        control(conn, path);
+    } else if (method != "GET") {
+        write_error("method not allowed");
+        respond(conn, 405, "Method Not Allowed");
+    } else if (path == "/1/summary" || path == "/2/summary" || path == "/api.json") {
+        write_summary();
+        respond(conn, 200, "OK");
+    } else if (path == "/1/devices") {
+        write_devices();
+        respond(conn, 200, "OK");
+    } else if (path == "/1/pools") {
+        snapshot_pools();
+        write_pools();
+        respond(conn, 200, "OK");
+    } else if (path == "/metrics") {
+        text.clear();
+        Metrics::instance().render(text);
+        respond(conn, 200, "OK", "text/plain; version=0.0.4; charset=utf-8", text.data(), text.size());
+    } else if (path == "/1/trace" && Tracer::enabled()) {
+        text.clear();
+        Tracer::instance().render(text);
+        respond(conn, 200, "OK", "application/json", text.data(), text.size());
+    } else {
+        write_error("not found");
+        respond(conn, 404, "Not Found");
+    }
+    return conn.keep_alive;
+}
+
+// Compares in constant time, so the token cannot be guessed byte by byte
+bool ApiServer::authorized(const std::string& authorization) const {
+    if (settings.access_token.empty()) {
+        return true;
+    }
+    std::string expected = "Bearer " + settings.access_token;
+    if (authorization.size() != expected.size()) {
+        return false;
+    }
+    unsigned char diff = 0;
+    for (size_t i = 0; i < expected.size(); ++i) {
+        diff |= authorization[i] ^ expected[i];
+    }
+    return diff == 0;
+}
+
+// POST /1/devices/<index|all>/pause, /resume, /retune, /intensity {"intensity": n}
+//   answers with the devices as in /1/devices
+// POST /1/pools/switch {"pool": index}
+//   moves the failover session to that configured pool
+void ApiServer::control(ApiConnection& conn, const std::string& path) {
+    if (settings.restricted) {
+        write_error("restricted");
+        respond(conn, 403, "Forbidden");
+        return;
+    }
+    rapidjson::Document request;
+    if (!request_body.empty() && (request.Parse(request_body.c_str()).HasParseError() || !request.IsObject())) {
+        write_error("invalid JSON body");
+        respond(conn, 400, "Bad Request");
+        return;
+    }
+    if (!request.IsObject()) {
+        request.SetObject();
+    }
+
+    const std::string prefix = "/1/devices/";
+    if (path.compare(0, prefix.size(), prefix) == 0) {
+        size_t slash = path.find('/', prefix.size());
+        std::string which = path.substr(prefix.size(), slash - prefix.size());
+        std::string action = slash == std::string::npos ? "" : path.substr(slash + 1);
+        size_t first = 0, last = kawpow.device_count();
+        if (which != "all") {
+            char* parse_end = nullptr;
+            first = strtoul(which.c_str(), &parse_end, 10);
+            if (which.empty() || *parse_end || first >= kawpow.device_count()) {
+                write_error("no such device");
+                respond(conn, 404, "Not Found");
+                return;
+            }
+            last = first + 1;
+        }
+        int intensity = 0;
+        if (action == "intensity") {
+            if (!request.HasMember("intensity") || !request["intensity"].IsInt()) {
+                write_error("intensity must be an integer");
+                respond(conn, 400, "Bad Request");
+                return;
+            }
+            intensity = request["intensity"].GetInt();
+        } else if (action != "pause" && action != "resume" && action != "retune") {
+            write_error("not found");
+            respond(conn, 404, "Not Found");
+            return;
+        }
+        for (size_t device = first; device < last; ++device) {
+            bool done = action == "pause"    ? kawpow.set_paused(device, true)
+                      : action == "resume"   ? kawpow.set_paused(device, false)
+                      : action == "retune"   ? kawpow.retune(device)
+                                             : kawpow.set_intensity(device, intensity);
+            if (!done) {
+                write_error("intensity out of range");
+                respond(conn, 400, "Bad Request");
+                return;
+            }
+        }
+        body.Clear();
+        writer.Reset(body);
+        writer.StartArray();
+        for (size_t device = first; device < last; ++device) {
+            write_device(device);
+        }
+        writer.EndArray();
+        respond(conn, 200, "OK");
+    } else if (path == "/1/pools/switch") {
+        if (!request.HasMember("pool") || !request["pool"].IsUint()) {
+            write_error("pool must be the index of a configured pool");
+            respond(conn, 400, "Bad Request");
+            return;
+        }
+        size_t pool = request["pool"].GetUint();
+        bool switched = false;
+        std::lock_guard<std::mutex> lock(pools_mutex);
+        for (Stratum* stratum : pools) {
+            switched = switched || stratum->switch_pool(pool);
+        }
+        if (!switched) {
+            write_error("no failover session to switch, or no such pool");
+            respond(conn, 409, "Conflict");
+            return;
+        }
+        body.Clear();
+        writer.Reset(body);
+        writer.StartObject();
+        writer.Key("switching_to");
+        writer.Uint64(pool);
+        writer.EndObject();
+        respond(conn, 200, "OK");
+    } else {
+        write_error("not found");
+        respond(conn, 404, "Not Found");
+    }
+}
+
+void ApiServer::respond(ApiConnection& conn, int status, const char* reason) {
+    respond(conn, status, reason, "application/json", body.GetString(), body.GetSize());
+}
+
+void ApiServer::respond(ApiConnection& conn, int status, const char* reason, const char* content_type,
+                        const char* data, size_t size) {
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.1 %d %s\r\n"
+                     "Content-Type: %s\r\n"
+                     "Content-Length: %zu\r\n"
+                     "Access-Control-Allow-Origin: *\r\n"
+                     "%s"
+                     "Connection: %s\r\n\r\n",
+                     status, reason, content_type, size,
+                     status == 405 ? "Allow: GET, POST\r\n" : status == 401 ? "WWW-Authenticate: Bearer\r\n" : "",
+                     conn.keep_alive ? "keep-alive" : "close");
+    conn.write_buffer.append(head, n);
+    conn.write_buffer.append(data, size);
+}
+
+void ApiServer::write_error(const char* message) {
+    body.Clear();
+    writer.Reset(body);
+    writer.StartObject();
+    writer.Key("error");
+    writer.String(message);
+    writer.EndObject();
+}
+
+void ApiServer::write_rate(double rate) {
+    if (rate < 0) {
+        writer.Null();
+    } else {
+        writer.Double(static_cast<uint64_t>(rate * 100) / 100.0);
+    }
+}
+
+// Share-based estimate over the effective_hashrate window
+void ApiServer::write_effective(const EffectiveEstimate& e) {
+    writer.StartObject();
+    writer.Key("window");
+    writer.Uint64(static_cast<uint64_t>(e.seconds));
+    writer.Key("counted");
+    write_rate(e.counted);
+    writer.Key("hashrate");
+    write_rate(e.effective);
+    writer.Key("low");
+    write_rate(e.low);
+    writer.Key("high");
+    write_rate(e.high);
+    writer.Key("expected");
+    writer.Double(static_cast<uint64_t>(e.expected * 100) / 100.0);
+    writer.Key("accepted");
+    writer.Uint64(e.accepted);
+    writer.Key("rejected");
+    writer.Uint64(e.rejected);
+    writer.Key("stale");
+    writer.Uint64(e.stale);
+    writer.Key("diverged");
+    writer.Bool(e.diverged);
+    writer.EndObject();
+}
+
+void ApiServer::write_rates(size_t device) {
+    writer.StartArray();
+    for (int seconds : kWindows) {
+        write_rate(hashrate(device, seconds));
+    }
+    writer.EndArray();
+}
+
+void ApiServer::write_device(size_t device) {
+    const DeviceStats& stats = kawpow.device_stats(device);
+    uint64_t epoch = stats.dag_epoch.load(std::memory_order_relaxed);
+    writer.StartObject();
+    writer.Key("index");
+    writer.Uint64(device);
+    writer.Key("device_id");
+    writer.Int(stats.device_id);
+    writer.Key("hashrate");
+    write_rates(device);
+    writer.Key("hashes_total");
+    writer.Uint64(stats.hashes.load(std::memory_order_relaxed));
+    writer.Key("shares_found");
+    writer.Uint64(stats.shares.load(std::memory_order_relaxed));
+    writer.Key("effective");
+    write_effective(kawpow.effective_hashrate().device(device));
+    writer.Key("paused");
+    writer.Bool(stats.paused.load(std::memory_order_relaxed));
+    writer.Key("intensity");
+    writer.Int(stats.intensity.load(std::memory_order_relaxed));
+    writer.Key("tuning");
+    writer.Bool(stats.tuning.load(std::memory_order_relaxed));
+    writer.Key("tune");
+    writer.StartArray();
+    for (const TuneResult& result : kawpow.tune_results(device)) {
+        writer.StartObject();
+        writer.Key("intensity");
+        writer.Int(result.intensity);
+        writer.Key("hashrate");
+        write_rate(result.hashrate);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.Key("dag");
+    writer.StartObject();
+    writer.Key("epoch");
+    if (epoch == UINT64_MAX) {
+        writer.Null();
+    } else {
+        writer.Uint64(epoch);
+    }
+    writer.Key("size");
+    writer.Uint64(stats.dag_size.load(std::memory_order_relaxed));
+    writer.Key("building");
+    writer.Bool(stats.dag_building.load(std::memory_order_relaxed));
+    writer.EndObject();
+    writer.EndObject();
+}
+
+// Same field names as base/net/stratum/NetworkState's "connection"
+void ApiServer::write_pool(const PoolStatus& status) {
+    writer.StartObject();
+    writer.Key("pool");
+    writer.String(status.pool.c_str(), static_cast<rapidjson::SizeType>(status.pool.size()));
+    writer.Key("connected");
+    writer.Bool(status.connected);
+    writer.Key("tls");
+    writer.Bool(status.tls);
+    writer.Key("weight");
+    writer.Double(status.weight);
+    writer.Key("uptime");
+    writer.Uint64(status.uptime_ms / 1000);
+    writer.Key("uptime_ms");
+    writer.Uint64(status.uptime_ms);
+    writer.Key("ping");
+    writer.Double(status.results.rtt_ms);
+    writer.Key("failures");
+    writer.Uint(status.failures);
+    writer.Key("diff");
+    writer.Double(status.diff);
+    writer.Key("job_id");
+    writer.String(status.job_id.c_str(), static_cast<rapidjson::SizeType>(status.job_id.size()));
+    writer.Key("height");
+    writer.Uint64(status.block_number);
+    writer.Key("epoch");
+    writer.Uint64(status.block_number / EPOCH_LENGTH);
+    writer.Key("accepted");
+    writer.Uint64(status.results.accepted);
+    writer.Key("rejected");
+    writer.Uint64(status.results.rejected);
+    writer.Key("stale");
+    writer.Uint64(status.results.stale);
+    writer.Key("queued");
+    writer.Uint64(status.queued_shares);
+    writer.Key("effective");
+    write_effective(kawpow.effective_hashrate().pool(status.pool));
+    writer.EndObject();
+}
+
+void ApiServer::snapshot_pools() {
+    pool_status.clear();
+    std::lock_guard<std::mutex> lock(pools_mutex);
+    for (const Stratum* stratum : pools) {
+        pool_status.push_back(stratum->status());
+    }
+}
+
+void ApiServer::write_devices() {
+    body.Clear();
+    writer.Reset(body);
+    writer.StartArray();
+    for (size_t i = 0; i < kawpow.device_count(); ++i) {
+        write_device(i);
+    }
+    writer.EndArray();
+}
+
+void ApiServer::write_pools() {
+    body.Clear();
+    writer.Reset(body);
+    writer.StartArray();
+    for (const PoolStatus& status : pool_status) {
+        write_pool(status);
+    }
+    writer.EndArray();
+}
+
+void ApiServer::write_summary() {
+    snapshot_pools();
+    uint64_t hashes = 0, found = 0;
+    for (size_t i = 0; i < kawpow.device_count(); ++i) {
+        hashes += kawpow.device_stats(i).hashes.load(std::memory_order_relaxed);
+        found += kawpow.device_stats(i).shares.load(std::memory_order_relaxed);
+    }
+    uint64_t accepted = 0, rejected = 0, stale = 0;
+    const PoolStatus* active = nullptr;
+    for (const PoolStatus& status : pool_status) {
+        accepted += status.results.accepted;
+        rejected += status.results.rejected;
+        stale += status.results.stale;
+        if (!active || (status.connected && !active->connected)) {
+            active = &status;
+        }
+    }
+
+    body.Clear();
+    writer.Reset(body);
+    writer.StartObject();
+    writer.Key("ua");
+    writer.String("KawPowMiner/0.1");
+    writer.Key("uptime");
+    writer.Uint64(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started).count());
+    writer.Key("hashrate");
+    writer.StartObject();
+    writer.Key("total");
+    write_rates(SIZE_MAX);
+    writer.Key("highest");
+    write_rate(highest);
+    writer.EndObject();
+    writer.Key("devices");
+    writer.StartArray();
+    for (size_t i = 0; i < kawpow.device_count(); ++i) {
+        write_device(i);
+    }
+    writer.EndArray();
+    writer.Key("results");
+    writer.StartObject();
+    writer.Key("diff_current");
+    writer.Double(active ? active->diff : 0);
+    writer.Key("shares_good");
+    writer.Uint64(accepted);
+    writer.Key("shares_total");
+    writer.Uint64(accepted + rejected + stale);
+    writer.Key("shares_stale");
+    writer.Uint64(stale);
+    writer.Key("shares_found");
+    writer.Uint64(found);
+    writer.Key("hashes_total");
+    writer.Uint64(hashes);
+    writer.EndObject();
+    writer.Key("connection");
+    if (active) {
+        write_pool(*active);
+    } else {
+        writer.Null();
+    }
+    writer.Key("pools");
+    writer.StartArray();
+    for (const PoolStatus& status : pool_status) {
+        write_pool(status);
+    }
+    writer.EndArray();
+    writer.EndObject();
+}
@@ -0,0 +1,226 @@
+#include "bench_client.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include "base/crypto/sha3.h"
+#include "hex.h"
+#include "kawpow_verify.h"
+#include "logging.h"
+
+#define KAWPOW_EPOCH_LENGTH 7500
+// A run with no progress for this long has lost its devices
+#define BENCH_STALL_SECONDS 300
+
+// keccak-256("kawpow-miner benchmark"); never a real block
+static const char* kHeader = "0efc679dd0ebc4132ab4a67484b666669dcc32dc153d2e194819af1be13792ba";
+
+// Digests of kHeader over nonces [0, size) at a height, from
+// kawpow_verify_hash with the epoch's full DAG; one height in each of
+// epochs 0, 53 and 100
+static const struct {
+    uint64_t height;
+    uint64_t size;
+    uint64_t digest;
+} kReference[] = {
+    {3000, 250000, 0xf1dcd58e16a6e007ULL},
+    {3000, 500000, 0xae1c315c0b6b27cdULL},
+    {3000, 1000000, 0xd3c739f89c9b9cd3ULL},
+    {3000, 2000000, 0x903228e1546185d9ULL},
+    {3000, 3000000, 0xb3bee2f974ef87ffULL},
+    {3000, 4000000, 0xf34a5a372ae84bccULL},
+    {3000, 5000000, 0x68c026cdb846f50eULL},
+    {3000, 6000000, 0x41fa363aeb207df4ULL},
+    {3000, 7000000, 0xe9ca534216d424eaULL},
+    {3000, 8000000, 0x97853a91d1c80aa9ULL},
+    {3000, 9000000, 0xbb4fb8d08b999186ULL},
+    {3000, 10000000, 0x231a9769eaa6bb03ULL},
+    {400000, 250000, 0x4cd5d76ead878e2dULL},
+    {400000, 500000, 0x4adb096f74577452ULL},
+    {400000, 1000000, 0x52d663ca8893e2daULL},
+    {400000, 2000000, 0x130b828957d23548ULL},
+    {400000, 3000000, 0x163a1b350193e8f1ULL},
+    {400000, 4000000, 0x1d4d3a099b764a5eULL},
+    {400000, 5000000, 0xa5ff712fabe0c212ULL},
+    {400000, 6000000, 0xa35d79d5f44bd0e9ULL},
+    {400000, 7000000, 0xcb05d0d17ef9951fULL},
+    {400000, 8000000, 0xcffae4c41980a24cULL},
+    {400000, 9000000, 0x26ad37b61ca36438ULL},
+    {400000, 10000000, 0x64fe79b9f211ad9cULL},
+    {750000, 250000, 0x43d0f5c745761269ULL},
+    {750000, 500000, 0xf15d3563ec6f798dULL},
+    {750000, 1000000, 0xcbe426614c4f2e71ULL},
+    {750000, 2000000, 0xfc480479aa1cd197ULL},
+    {750000, 3000000, 0x7955c0b3f7a05dfaULL},
+    {750000, 4000000, 0x4aba363e50db151cULL},
+    {750000, 5000000, 0x75db17e171656054ULL},
+    {750000, 6000000, 0x10bb7aa239778dceULL},
+    {750000, 7000000, 0x8161dc6eb0cf7666ULL},
+    {750000, 8000000, 0xd878f21b866ab6ddULL},
+    {750000, 9000000, 0x82c7da20be24d616ULL},
+    {750000, 10000000, 0x9d46f73dc36448c7ULL},
+};
+
+static std::string seed_hash(uint64_t height) {
+    uint8_t seed[32] = {0};
+    for (uint64_t i = 0; i < height / KAWPOW_EPOCH_LENGTH; ++i) {
+        sha3_HashBuffer(256, SHA3_FLAGS_KECCAK, seed, sizeof(seed), seed, sizeof(seed));
+    }
+    std::string hex(64, '0');
+    hex_encode(seed, sizeof(seed), &hex[0]);
+    return hex;
+}
+
+static std::string format_digest(uint64_t digest) {
+    std::ostringstream out;
+    out << std::hex << std::setw(16) << std::setfill('0') << digest;
+    return out.str();
+}
+
+BenchClient::BenchClient(const Config& config, KawPow& kawpow, uint64_t nonces, const std::vector<uint64_t>& heights)
+    : kawpow(kawpow), nonces(nonces), heights(heights), header_hex(kHeader) {
+    slot = kawpow.add_source(nullptr, "bench", 1);
+    LOG_INFO << "Benchmark: " << nonces << " nonces on " << config.getCudaDevices().size() << " device(s)";
+}
+
+uint64_t BenchClient::parse_size(const std::string& size) {
+    char* end = nullptr;
+    uint64_t count = strtoull(size.c_str(), &end, 10);
+    if (end == size.c_str()) {
+        return 0;
+    }
+    std::string suffix(end);
+    if (suffix == "K" || suffix == "k") {
+        return count == 250 || count == 500 ? count * 1000 : 0;
+    }
+    if (suffix == "M" || suffix == "m") {
+        return count >= 1 && count <= 10 ? count * 1000000 : 0;
+    }
+    return suffix.empty() ? count : 0;
+}
+
+bool BenchClient::run() {
+    std::vector<BenchResult> results;
+    bool passed = true;
+    for (uint64_t height : heights) {
+        uint64_t expected = reference(height);
+        BenchResult result;
+        if (!run_height(height, result)) {
+            return false;
+        }
+        bool match = result.digest == expected;
+        passed = passed && match;
+        LOG_INFO << "Benchmark height " << height << " (epoch " << result.epoch << "): " << std::fixed
+                 << std::setprecision(3) << result.seconds << " s, DAG " << result.dag_seconds << " s, "
+                 << std::setprecision(2) << result.hashrate / 1e6 << " MH/s, digest " << format_digest(result.digest)
+                 << (match ? " OK" : " MISMATCH, expected " + format_digest(expected));
+        results.push_back(result);
+    }
+    kawpow.stop_mining();
+
+    if (results.size() > 1) {
+        LOG_INFO << "Benchmark summary";
+        for (const BenchResult& r : results) {
+            LOG_INFO << "  height " << r.height << "  epoch " << r.epoch << "  DAG " << std::fixed
+                     << std::setprecision(3) << r.dag_seconds << " s  total " << r.seconds << " s  "
+                     << std::setprecision(2) << r.hashrate / 1e6 << " MH/s";
+        }
+    }
+    if (passed) {
+        LOG_INFO << "Benchmark passed: every digest matched";
+    } else {
+        LOG_ERROR << "Benchmark FAILED: the kernel's hashes do not match the reference";
+    }
+    return passed;
+}
+
+bool BenchClient::run_height(uint64_t height, BenchResult& result) {
+    result.height = height;
+    result.epoch = height / KAWPOW_EPOCH_LENGTH;
+    for (size_t i = 0; i < kawpow.device_count(); ++i) {
+        kawpow.device_stats(i).dag_build_us = 0;
+    }
+
+    // A zero target: no hash meets it, so nothing is submitted
+    ShareBoundary target;
+    target.prefix = 0;
+    target.difficulty = 0;
+    auto start = std::chrono::steady_clock::now();
+    kawpow.set_job(slot, "bench" + std::to_string(height), header_hex, seed_hash(height), height, target, nonces);
+
+    uint64_t done = 0;
+    auto progress = start;
+    while (done < nonces) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        uint64_t now_done = kawpow.job_digest(slot, result.digest);
+        auto now = std::chrono::steady_clock::now();
+        if (now_done != done) {
+            done = now_done;
+            progress = now;
+        } else if (now - progress >= std::chrono::seconds(BENCH_STALL_SECONDS)) {
+            LOG_ERROR << "Benchmark stalled at " << done << " of " << nonces << " nonces";
+            return false;
+        }
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t dag_us = 0;
+    for (size_t i = 0; i < kawpow.device_count(); ++i) {
+        dag_us = std::max<uint64_t>(dag_us, kawpow.device_stats(i).dag_build_us);
+    }
+    result.dag_seconds = dag_us / 1e6;
+    double hashing = result.seconds - result.dag_seconds;
+    result.hashrate = hashing > 0 ? nonces / hashing : 0;
+    return true;
+}
+
+// The known digest for the height and size, or the host's own over the
+// same nonces at the height's epoch and period
+uint64_t BenchClient::reference(uint64_t height) {
+    for (const auto& known : kReference) {
+        if (known.height == height && known.size == nonces) {
+            return known.digest;
+        }
+    }
+    LOG_INFO << "No known digest for " << nonces << " nonces at height " << height << "; hashing them on the host to compare";
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+    KawpowEpoch epoch(height / KAWPOW_EPOCH_LENGTH);
+    if (!epoch.valid()) {
+        LOG_ERROR << "No light cache for epoch " << epoch.epoch();
+        return 0;
+    }
+    // Each hash derives 64 items from the light cache; past dag_items / 64
+    // nonces, building the whole DAG first is the cheaper way
+    if (nonces * 64 > epoch.dag_items() && !epoch.build_dag(threads)) {
+        LOG_WARN << "The " << epoch.dag_size() / (1024 * 1024)
+                 << " MiB DAG does not fit in host memory; hashing from the light cache instead, which is slow";
+    }
+
+    uint8_t header[32];
+    hex_decode(header_hex.data(), header_hex.size(), header, sizeof(header));
+    std::vector<uint64_t> digests(threads);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            uint64_t digest = 0;
+            KawpowResult r;
+            for (uint64_t nonce = t; nonce < nonces; nonce += threads) {
+                kawpow_verify_hash(epoch, height, header, nonce, r);
+                uint64_t prefix = 0;
+                for (int i = 0; i < 8; ++i) {
+                    prefix = (prefix << 8) | r.hash[i];
+                }
+                digest ^= prefix;
+            }
+            digests[t] = digest;
+        });
+    }
+    uint64_t digest = 0;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers[t].join();
+        digest ^= digests[t];
+    }
+    return digest;
+}
@@ -0,0 +1,310 @@
+#include "block_template.h"
+#include <algorithm>
+#include <cstring>
+#include "hex.h"
+#include "sha256.h"
+#include "logging.h"
+
+// Base58 address versions (chainparams)
+#define RVN_P2PKH_MAIN 60
+#define RVN_P2SH_MAIN 122
+#define RVN_P2PKH_TEST 111
+#define RVN_P2SH_TEST 196
+#define MAX_TAG_LENGTH 64
+
+// Display hex (most significant byte first) to internal byte order
+static bool hash_from_hex(const char* hex, Hash256& out) {
+    size_t decoded = 0;
+    if (!hex_decode(hex, strlen(hex), out.data(), out.size(), &decoded) || decoded != out.size()) {
+        return false;
+    }
+    std::reverse(out.begin(), out.end());
+    return true;
+}
+
+static void put_le32(std::vector<uint8_t>& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+static void put_le64(std::vector<uint8_t>& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+static void put_varint(std::vector<uint8_t>& out, uint64_t n) {
+    if (n < 0xfd) {
+        out.push_back(static_cast<uint8_t>(n));
+    } else if (n <= 0xffff) {
+        out.push_back(0xfd);
+        out.push_back(static_cast<uint8_t>(n));
+        out.push_back(static_cast<uint8_t>(n >> 8));
+    } else if (n <= 0xffffffff) {
+        out.push_back(0xfe);
+        put_le32(out, static_cast<uint32_t>(n));
+    } else {
+        out.push_back(0xff);
+        put_le64(out, n);
+    }
+}
+
+static void put_bytes(std::vector<uint8_t>& out, const uint8_t* data, size_t size) {
+    out.insert(out.end(), data, data + size);
+}
+
+bool parse_block_template(const rapidjson::Value& result, BlockTemplate& tpl) {
+    if (!result.IsObject() || !result.HasMember("previousblockhash") || !result.HasMember("bits") ||
+        !result.HasMember("height") || !result.HasMember("coinbasevalue") || !result.HasMember("transactions")) {
+        LOG_ERROR << "Block template is missing required fields";
+        return false;
+    }
+    if (!result["previousblockhash"].IsString() || !result["bits"].IsString() || !result["height"].IsUint() ||
+        !result["coinbasevalue"].IsInt64() || !result["transactions"].IsArray() ||
+        (result.HasMember("version") && !result["version"].IsInt()) ||
+        (result.HasMember("curtime") && !result["curtime"].IsUint()) ||
+        (result.HasMember("target") && !result["target"].IsString()) ||
+        (result.HasMember("longpollid") && !result["longpollid"].IsString()) ||
+        (result.HasMember("default_witness_commitment") && !result["default_witness_commitment"].IsString())) {
+        LOG_ERROR << "Block template has a field of the wrong type";
+        return false;
+    }
+
+    tpl.version = result.HasMember("version") ? result["version"].GetInt() : 0x20000000;
+    tpl.bits = static_cast<uint32_t>(strtoul(result["bits"].GetString(), nullptr, 16));
+    tpl.curtime = result.HasMember("curtime") ? result["curtime"].GetUint() : 0;
+    tpl.height = result["height"].GetUint();
+    tpl.coinbase_value = result["coinbasevalue"].GetInt64();
+    tpl.target_hex = result.HasMember("target") ? result["target"].GetString() : "";
+    tpl.longpollid = result.HasMember("longpollid") ? result["longpollid"].GetString() : "";
+    if (!hash_from_hex(result["previousblockhash"].GetString(), tpl.prev_hash)) {
+        LOG_ERROR << "Invalid previousblockhash in block template";
+        return false;
+    }
+
+    tpl.tx_data.clear();
+    tpl.txids.clear();
+    for (const auto& tx : result["transactions"].GetArray()) {
+        const char* key = tx.IsObject() && tx.HasMember("txid") ? "txid" : "hash";
+        Hash256 txid;
+        if (!tx.IsObject() || !tx.HasMember(key) || !tx[key].IsString() || !tx.HasMember("data") ||
+            !tx["data"].IsString() || !hash_from_hex(tx[key].GetString(), txid)) {
+            LOG_ERROR << "Invalid transaction in block template";
+            return false;
+        }
+        tpl.txids.push_back(txid);
+        tpl.tx_data.push_back(tx["data"].GetString());
+    }
+
+    tpl.witness_commitment.clear();
+    if (result.HasMember("default_witness_commitment")) {
+        const char* hex = result["default_witness_commitment"].GetString();
+        tpl.witness_commitment.resize(strlen(hex) / 2);
+        size_t decoded = 0;
+        if (!hex_decode(hex, strlen(hex), tpl.witness_commitment.data(), tpl.witness_commitment.size(), &decoded)) {
+            LOG_ERROR << "Invalid witness commitment in block template";
+            return false;
+        }
+        tpl.witness_commitment.resize(decoded);
+    }
+
+    tpl.merkle_branch = merkle_branch(tpl.txids);
+    return true;
+}
+
+bool address_to_script(const std::string& address, std::vector<uint8_t>& script) {
+    static const char kAlphabet[] = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+
+    // Big-number base conversion, most significant byte first
+    std::vector<uint8_t> bytes;
+    for (char ch : address) {
+        const char* digit = strchr(kAlphabet, ch);
+        if (ch == '\0' || !digit) {
+            return false;
+        }
+        int carry = static_cast<int>(digit - kAlphabet);
+        for (auto it = bytes.rbegin(); it != bytes.rend(); ++it) {
+            carry += 58 * *it;
+            *it = static_cast<uint8_t>(carry & 0xff);
+            carry >>= 8;
+        }
+        while (carry) {
+            bytes.insert(bytes.begin(), static_cast<uint8_t>(carry & 0xff));
+            carry >>= 8;
+        }
+    }
+    for (size_t i = 0; i < address.size() && address[i] == '1'; ++i) {
+        bytes.insert(bytes.begin(), 0);
+    }
+
+    // version, hash160, 4-byte checksum
+    if (bytes.size() != 25) {
+        return false;
+    }
+    uint8_t check[32];
+    sha256d(bytes.data(), 21, check);
+    if (memcmp(check, bytes.data() + 21, 4) != 0) {
+        return false;
+    }
+
+    script.clear();
+    if (bytes[0] == RVN_P2PKH_MAIN || bytes[0] == RVN_P2PKH_TEST) {
+        // OP_DUP OP_HASH160 <20> OP_EQUALVERIFY OP_CHECKSIG
+        script = {0x76, 0xa9, 0x14};
+        put_bytes(script, bytes.data() + 1, 20);
+        script.push_back(0x88);
+        script.push_back(0xac);
+    } else if (bytes[0] == RVN_P2SH_MAIN || bytes[0] == RVN_P2SH_TEST) {
+        // OP_HASH160 <20> OP_EQUAL
+        script = {0xa9, 0x14};
+        put_bytes(script, bytes.data() + 1, 20);
+        script.push_back(0x87);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::vector<uint8_t> build_coinbase(const BlockTemplate& tpl, const std::vector<uint8_t>& payout_script,
+                                    const std::string& tag, bool with_witness) {
+    with_witness = with_witness && !tpl.witness_commitment.empty();
+
+    // BIP34: the height opens the scriptSig as a minimal script number
+    std::vector<uint8_t> script_sig;
+    if (tpl.height >= 1 && tpl.height <= 16) {
+        script_sig.push_back(static_cast<uint8_t>(0x50 + tpl.height));
+    } else {
+        std::vector<uint8_t> number;
+        for (uint32_t h = tpl.height; h; h >>= 8) number.push_back(static_cast<uint8_t>(h));
+        if (!number.empty() && (number.back() & 0x80)) number.push_back(0);
+        script_sig.push_back(static_cast<uint8_t>(number.size()));
+        put_bytes(script_sig, number.data(), number.size());
+    }
+    size_t tag_size = std::min<size_t>(tag.size(), MAX_TAG_LENGTH);
+    if (tag_size) {
+        script_sig.push_back(static_cast<uint8_t>(tag_size));
+        put_bytes(script_sig, reinterpret_cast<const uint8_t*>(tag.data()), tag_size);
+    }
+
+    std::vector<uint8_t> tx;
+    tx.reserve(128 + payout_script.size() + tpl.witness_commitment.size());
+    put_le32(tx, 1);
+    if (with_witness) {
+        tx.push_back(0x00);     // marker
+        tx.push_back(0x01);     // flag
+    }
+
+    put_varint(tx, 1);
+    tx.insert(tx.end(), 32, 0);
+    put_le32(tx, 0xffffffff);
+    put_varint(tx, script_sig.size());
+    put_bytes(tx, script_sig.data(), script_sig.size());
+    put_le32(tx, 0xffffffff);
+
+    put_varint(tx, tpl.witness_commitment.empty() ? 1 : 2);
+    put_le64(tx, static_cast<uint64_t>(tpl.coinbase_value));
+    put_varint(tx, payout_script.size());
+    put_bytes(tx, payout_script.data(), payout_script.size());
+    if (!tpl.witness_commitment.empty()) {
+        put_le64(tx, 0);
+        put_varint(tx, tpl.witness_commitment.size());
+        put_bytes(tx, tpl.witness_commitment.data(), tpl.witness_commitment.size());
+    }
+
+    if (with_witness) {
+        // One stack item: the 32-byte witness reserved value
+        put_varint(tx, 1);
+        put_varint(tx, 32);
+        tx.insert(tx.end(), 32, 0);
+    }
+    put_le32(tx, 0);
+    return tx;
+}
+
+std::vector<Hash256> merkle_branch(const std::vector<Hash256>& txids) {
+    // Each level is the row minus the node on the coinbase path. Its first
+    // entry is that node's sibling; the rest pair up into the next row.
+    std::vector<Hash256> branch;
+    std::vector<Hash256> level = txids;
+    while (!level.empty()) {
+        branch.push_back(level[0]);
+        level.erase(level.begin());
+        if (level.empty()) {
+            break;
+        }
+        if (level.size() & 1) {
+            level.push_back(level.back());
+        }
+        sha256d_64(level[0].data(), level[0].data(), level.size() / 2);
+        level.resize(level.size() / 2);
+    }
+    return branch;
+}
+
+Hash256 merkle_root(const Hash256& coinbase_txid, const std::vector<Hash256>& branch) {
+    uint8_t pair[64];
+    Hash256 node = coinbase_txid;
+    for (const Hash256& sibling : branch) {
+        memcpy(pair, node.data(), 32);
+        memcpy(pair + 32, sibling.data(), 32);
+        sha256d_64(pair, node.data(), 1);
+    }
+    return node;
+}
+
+Hash256 merkle_root_full(std::vector<Hash256> leaves) {
+    if (leaves.empty()) {
+        return Hash256{};
+    }
+    while (leaves.size() > 1) {
+        if (leaves.size() & 1) {
+            leaves.push_back(leaves.back());
+        }
+        sha256d_64(leaves[0].data(), leaves[0].data(), leaves.size() / 2);
+        leaves.resize(leaves.size() / 2);
+    }
+    return leaves[0];
+}
+
+void kawpow_header(const BlockTemplate& tpl, const Hash256& merkle_root, uint8_t out[80]) {
+    std::vector<uint8_t> header;
+    header.reserve(80);
+    put_le32(header, static_cast<uint32_t>(tpl.version));
+    put_bytes(header, tpl.prev_hash.data(), 32);
+    put_bytes(header, merkle_root.data(), 32);
+    put_le32(header, tpl.curtime);
+    put_le32(header, tpl.bits);
+    put_le32(header, tpl.height);
+    memcpy(out, header.data(), 80);
+}
+
+std::string kawpow_header_hash(const uint8_t header[80]) {
+    uint8_t hash[32];
+    sha256d(header, 80, hash);
+    std::reverse(hash, hash + 32);
+    std::string hex(64, '0');
+    hex_encode(hash, 32, &hex[0]);
+    return hex;
+}
+
+std::string serialize_block(const uint8_t header[80], uint64_t nonce, const std::string& mix_hash_hex,
+                            const std::vector<uint8_t>& coinbase, const std::vector<std::string>& tx_data) {
+    Hash256 mix;
+    if (!hash_from_hex(mix_hash_hex.c_str(), mix)) {
+        return "";
+    }
+
+    std::vector<uint8_t> block;
+    block.reserve(80 + 8 + 32 + 9 + coinbase.size());
+    put_bytes(block, header, 80);
+    put_le64(block, nonce);
+    put_bytes(block, mix.data(), 32);
+    put_varint(block, 1 + tx_data.size());
+    put_bytes(block, coinbase.data(), coinbase.size());
+
+    size_t tx_chars = 0;
+    for (const std::string& tx : tx_data) tx_chars += tx.size();
+
+    std::string hex(block.size() * 2, '0');
+    hex_encode(block.data(), block.size(), &hex[0]);
+    hex.reserve(hex.size() + tx_chars);
+    for (const std::string& tx : tx_data) hex += tx;
+    return hex;
+}
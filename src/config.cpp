@@ -1,7 +1,10 @@
 #include "config.h"
 #include <fstream>
+#include <algorithm>
 #include <iostream>
 #include "rapidjson/istreamwrapper.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
 #include "logging.h"
 
 #ifndef ETHASH_H
@@ -17,6 +20,50 @@ typedef struct ethash_h256 ethash_h256_t;
 
 #endif
 
+bool parse_pool_url(const std::string& url, std::string& host, int& port, bool& tls) {
+    std::string rest = url;
+    tls = false;
+
+    // Strip protocol prefix
+    size_t protocol_pos = rest.find("://");
+    if (protocol_pos != std::string::npos) {
+        std::string scheme = rest.substr(0, protocol_pos);
+        tls = scheme.find("ssl") != std::string::npos || scheme.find("tls") != std::string::npos;
+        rest = rest.substr(protocol_pos + 3);
+    }
+
+    size_t port_pos = rest.rfind(":");
+    if (port_pos != std::string::npos) {
+        host = rest.substr(0, port_pos);
+        try {
+            port = std::stoi(rest.substr(port_pos + 1));
+        } catch (const std::exception&) {
+            return false;
+        }
+    } else {
+        host = rest;
+        port = 3333; // Default stratum port
+    }
+
+    return !host.empty() && port > 0 && port < 65536;
+}
+
+std::vector<std::string> Config::changed_sections(const Config& other) const {
+    std::vector<std::string> changed;
+    for (const auto& entry : sections) {
+        auto it = other.sections.find(entry.first);
+        if (it == other.sections.end() || it->second != entry.second) {
+            changed.push_back(entry.first);
+        }
+    }
+    for (const auto& entry : other.sections) {
+        if (!sections.count(entry.first)) {
+            changed.push_back(entry.first);
+        }
+    }
+    return changed;
+}
+
 bool Config::load(const std::string& filename) {
     LOG_INFO << "Loading configuration from: " << filename;
     std::ifstream ifs(filename);
@@ -29,11 +76,19 @@ bool Config::load(const std::string& filename) {
     rapidjson::Document doc;
     doc.ParseStream(isw);
 
-    if (doc.HasParseError()) {
+    if (doc.HasParseError() || !doc.IsObject()) {
         LOG_ERROR << "Failed to parse config file: " << doc.GetParseError();
         return false;
     }
 
+    for (auto& member : doc.GetObject()) {
+        rapidjson::StringBuffer text;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(text);
+        member.value.Accept(writer);
+        sections[member.name.GetString()] = text.GetString();
+    }
+    if (doc.HasMember("watch")) watch = doc["watch"].GetBool();
+
     LOG_INFO << "Parsing pool configuration...";
     if (doc.HasMember("pools")) {
         const rapidjson::Value& pools_val = doc["pools"];
@@ -42,13 +97,165 @@ bool Config::load(const std::string& filename) {
             pool.url = p["url"].GetString();
             pool.user = p["user"].GetString();
             pool.pass = p["pass"].GetString();
+            if (!parse_pool_url(pool.url, pool.host, pool.port, pool.tls)) {
+                LOG_ERROR << "Invalid pool url: " << pool.url;
+                continue;
+            }
+            if (p.HasMember("tls_fingerprint") && p["tls_fingerprint"].IsString()) {
+                pool.tls_fingerprint = p["tls_fingerprint"].GetString();
+            }
+            pool.nicehash = (p.HasMember("nicehash") && p["nicehash"].GetBool()) ||
+                            pool.host.find("nicehash.com") != std::string::npos;
+            if (p.HasMember("weight")) pool.weight = std::max(p["weight"].GetDouble(), 0.0);
             pools.push_back(pool);
-            LOG_INFO << "Added pool: " << pool.url << " with user: " << pool.user;
+            LOG_INFO << "Added pool: " << pool.url << " with user: " << pool.user << (pool.tls ? " (TLS)" : "")
+                     << (pool.nicehash ? " (NiceHash)" : "")
+                     << (pool.weight > 0 ? " (weight " + std::to_string(pool.weight) + ")" : "");
         }
     } else {
         LOG_WARN << "No pools configured in config file";
     }
 
+    if (doc.HasMember("pool_split")) {
+        const rapidjson::Value& split_val = doc["pool_split"];
+        if (split_val.HasMember("enabled")) pool_split.enabled = split_val["enabled"].GetBool();
+        if (split_val.HasMember("report_interval")) pool_split.report_interval = std::max(split_val["report_interval"].GetInt(), 1);
+    }
+    if (pool_split.enabled) {
+        size_t weighted = std::count_if(pools.begin(), pools.end(), [](const PoolConfig& pool) { return pool.weight > 0; });
+        if (weighted < 2) {
+            LOG_WARN << "Hashrate split needs at least two pools with a weight; mining with failover instead";
+            pool_split.enabled = false;
+        } else {
+            LOG_INFO << "Splitting hashrate between " << weighted << " weighted pools";
+        }
+    }
+
+    if (doc.HasMember("pool_selection")) {
+        const rapidjson::Value& sel_val = doc["pool_selection"];
+        if (sel_val.HasMember("enabled")) pool_selection.enabled = sel_val["enabled"].GetBool();
+        if (sel_val.HasMember("interval")) pool_selection.interval = sel_val["interval"].GetInt();
+        if (sel_val.HasMember("hysteresis")) pool_selection.hysteresis = sel_val["hysteresis"].GetDouble();
+        if (sel_val.HasMember("min_dwell")) pool_selection.min_dwell = sel_val["min_dwell"].GetInt();
+        LOG_INFO << "Latency-aware pool selection " << (pool_selection.enabled ? "enabled" : "disabled")
+                 << " (interval " << pool_selection.interval << "s, hysteresis " << pool_selection.hysteresis << ")";
+    }
+
+    if (doc.HasMember("dns")) {
+        const rapidjson::Value& dns_val = doc["dns"];
+        if (dns_val.HasMember("ipv6")) dns.ipv6 = dns_val["ipv6"].GetBool();
+        if (dns_val.HasMember("ttl")) dns.ttl = std::max(dns_val["ttl"].GetUint(), 1U);
+        LOG_INFO << "DNS cache TTL " << dns.ttl << "s, prefer " << (dns.ipv6 ? "IPv6" : "IPv4");
+    }
+
+    if (doc.HasMember("share_queue")) {
+        const rapidjson::Value& queue_val = doc["share_queue"];
+        if (queue_val.HasMember("enabled")) share_queue.enabled = queue_val["enabled"].GetBool();
+        if (queue_val.HasMember("file")) share_queue.file = queue_val["file"].GetString();
+        if (queue_val.HasMember("max_shares")) share_queue.max_shares = std::max(queue_val["max_shares"].GetUint(), 1U);
+        if (queue_val.HasMember("max_age")) share_queue.max_age = queue_val["max_age"].GetInt();
+    }
+    LOG_INFO << "Share replay queue " << (share_queue.enabled ? "enabled" : "disabled")
+             << (share_queue.file.empty() ? "" : " (" + share_queue.file + ")");
+
+    if (doc.HasMember("proxy")) {
+        const rapidjson::Value& proxy_val = doc["proxy"];
+        if (proxy_val.HasMember("enabled")) proxy.enabled = proxy_val["enabled"].GetBool();
+        if (proxy_val.HasMember("host")) proxy.host = proxy_val["host"].GetString();
+        if (proxy_val.HasMember("port")) proxy.port = proxy_val["port"].GetInt();
+        if (proxy_val.HasMember("extranonce_bytes")) proxy.extranonce_bytes = proxy_val["extranonce_bytes"].GetInt();
+        if (proxy_val.HasMember("max_connections")) proxy.max_connections = proxy_val["max_connections"].GetUint();
+        if (proxy.extranonce_bytes < 1 || proxy.extranonce_bytes > 3) {
+            LOG_ERROR << "Invalid proxy extranonce_bytes " << proxy.extranonce_bytes << ", must be 1 to 3";
+            proxy.enabled = false;
+            proxy.extranonce_bytes = 2;
+        }
+        if (proxy.enabled) {
+            LOG_INFO << "Stratum proxy on " << proxy.host << ":" << proxy.port << ", "
+                     << proxy.extranonce_bytes << " extranonce bytes per downstream";
+        }
+    }
+
+    if (doc.HasMember("solo")) {
+        const rapidjson::Value& solo_val = doc["solo"];
+        if (solo_val.HasMember("enabled")) solo.enabled = solo_val["enabled"].GetBool();
+        if (solo_val.HasMember("url")) solo.url = solo_val["url"].GetString();
+        if (solo_val.HasMember("user")) solo.user = solo_val["user"].GetString();
+        if (solo_val.HasMember("pass")) solo.pass = solo_val["pass"].GetString();
+        if (solo_val.HasMember("address")) solo.address = solo_val["address"].GetString();
+        if (solo_val.HasMember("coinbase_tag")) solo.coinbase_tag = solo_val["coinbase_tag"].GetString();
+        if (solo_val.HasMember("poll_interval")) solo.poll_interval = std::max(solo_val["poll_interval"].GetInt(), 1);
+        if (solo_val.HasMember("longpoll")) solo.longpoll = solo_val["longpoll"].GetBool();
+        if (solo_val.HasMember("notify_port")) solo.notify_port = solo_val["notify_port"].GetInt();
+        bool tls = false;
+        if (!parse_pool_url(solo.url, solo.host, solo.port, tls) || tls) {
+            LOG_ERROR << "Invalid solo node url: " << solo.url;
+            solo.enabled = false;
+        } else if (solo.url.find(':') == std::string::npos) {
+            solo.port = 8766;   // ravend's RPC port, not the stratum default
+        }
+        if (solo.enabled) {
+            LOG_INFO << "Solo mining against " << solo.host << ":" << solo.port << " paying to " << solo.address
+                     << (solo.longpoll ? " (long-poll)" : "");
+        }
+    }
+
+    if (doc.HasMember("keepalive")) {
+        const rapidjson::Value& keepalive_val = doc["keepalive"];
+        if (keepalive_val.HasMember("failover_budget_ms")) keepalive.failover_budget_ms = std::max(keepalive_val["failover_budget_ms"].GetInt(), 100);
+        if (keepalive_val.HasMember("probe_method")) keepalive.probe_method = keepalive_val["probe_method"].GetString();
+        if (keepalive_val.HasMember("tcp_user_timeout_ms")) keepalive.tcp_user_timeout_ms = std::max(keepalive_val["tcp_user_timeout_ms"].GetInt(), 0);
+        if (keepalive_val.HasMember("tcp_keepalive")) keepalive.tcp_keepalive = keepalive_val["tcp_keepalive"].GetBool();
+        if (keepalive_val.HasMember("notify_timeout")) keepalive.notify_timeout = std::max(keepalive_val["notify_timeout"].GetDouble(), 1.0);
+    }
+    LOG_INFO << "Dead connection failover within " << keepalive.failover_budget_ms << " ms"
+             << (keepalive.probe_method.empty() ? " (TCP keepalive only)" : " (probing with " + keepalive.probe_method + ")");
+
+    if (doc.HasMember("record")) {
+        const rapidjson::Value& record_val = doc["record"];
+        if (record_val.HasMember("enabled")) record.enabled = record_val["enabled"].GetBool();
+        if (record_val.HasMember("file")) record.file = record_val["file"].GetString();
+        if (record.enabled) {
+            LOG_INFO << "Recording stratum sessions to " << record.file;
+        }
+    }
+
+    if (doc.HasMember("share_journal")) {
+        const rapidjson::Value& journal_val = doc["share_journal"];
+        if (journal_val.HasMember("enabled")) share_journal.enabled = journal_val["enabled"].GetBool();
+        if (journal_val.HasMember("file")) share_journal.file = journal_val["file"].GetString();
+        if (share_journal.enabled) {
+            LOG_INFO << "Journaling shares to " << share_journal.file;
+        }
+    }
+
+    if (doc.HasMember("effective_hashrate")) {
+        const rapidjson::Value& effective_val = doc["effective_hashrate"];
+        if (effective_val.HasMember("window")) effective_hashrate.window = std::max(effective_val["window"].GetInt(), 60);
+        if (effective_val.HasMember("confidence")) {
+            effective_hashrate.confidence = std::min(std::max(effective_val["confidence"].GetDouble(), 0.5), 0.9999);
+        }
+    }
+
+    if (doc.HasMember("log")) {
+        const rapidjson::Value& log_val = doc["log"];
+        if (log_val.HasMember("level")) log.level = log_val["level"].GetString();
+        if (log_val.HasMember("console")) log.console = log_val["console"].GetBool();
+        if (log_val.HasMember("colors")) log.colors = log_val["colors"].GetBool();
+        if (log_val.HasMember("file")) log.file = log_val["file"].GetString();
+        if (log_val.HasMember("syslog")) log.syslog = log_val["syslog"].GetBool();
+    }
+
+    if (doc.HasMember("trace")) {
+        const rapidjson::Value& trace_val = doc["trace"];
+        if (trace_val.HasMember("enabled")) trace.enabled = trace_val["enabled"].GetBool();
+        if (trace_val.HasMember("file")) trace.file = trace_val["file"].GetString();
+        if (trace_val.HasMember("events_per_thread")) trace.events_per_thread = trace_val["events_per_thread"].GetUint();
+        if (trace.enabled) {
+            LOG_INFO << "Tracing the job lifecycle, " << trace.events_per_thread << " events per thread";
+        }
+    }
+
     LOG_INFO << "Parsing CUDA device configuration...";
     if (doc.HasMember("cuda")) {
         const rapidjson::Value& cuda_val = doc["cuda"];
@@ -71,13 +278,21 @@ bool Config::load(const std::string& filename) {
     LOG_INFO << "Parsing API configuration...";
     if (doc.HasMember("api")) {
         const rapidjson::Value& api_val = doc["api"];
+        if (api_val.HasMember("host")) api.host = api_val["host"].GetString();
+        if (api_val.HasMember("access_token") && api_val["access_token"].IsString()) {
+            api.access_token = api_val["access_token"].GetString();
+        }
+        if (api_val.HasMember("restricted")) api.restricted = api_val["restricted"].GetBool();
         if (api_val.HasMember("port")) {
-            api_port = api_val["port"].GetInt();
-            LOG_INFO << "API port set to: " << api_port;
+            api.port = api_val["port"].GetInt();
+            LOG_INFO << "API port set to: " << api.port;
         }
         if (api_val.HasMember("enabled")) {
-            api_enabled = api_val["enabled"].GetBool();
-            LOG_INFO << "API " << (api_enabled ? "enabled" : "disabled");
+            api.enabled = api_val["enabled"].GetBool();
+            LOG_INFO << "API " << (api.enabled ? "enabled" : "disabled");
+        }
+        if (api.enabled && !api.restricted && api.access_token.empty()) {
+            LOG_WARN << "API control endpoints are enabled without an access token";
         }
     } else {
         LOG_WARN << "No API configuration found in config file";
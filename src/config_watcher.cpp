@@ -0,0 +1,192 @@
+#include "config_watcher.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include "kawpow.h"
+#include "logging.h"
+
+// Quiet time after the last change before reloading, as in base/io/Watcher
+#define WATCH_DELAY_MS 500
+
+ConfigWatcher::ConfigWatcher(const std::string& path, std::function<void()> changed)
+    : path(path), changed(std::move(changed)) {
+    size_t slash = path.rfind('/');
+    dir = slash == std::string::npos ? "." : path.substr(0, slash);
+    name = slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+ConfigWatcher::~ConfigWatcher() {
+    if (running.exchange(false)) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            // The thread still notices at its next timeout
+        }
+        thread.join();
+    }
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+    }
+    if (wake_fd >= 0) {
+        close(wake_fd);
+    }
+}
+
+bool ConfigWatcher::start() {
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0 ||
+        inotify_add_watch(inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        LOG_WARN << "Cannot watch " << path << " for changes: " << strerror(errno);
+        return false;
+    }
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    running = true;
+    thread = std::thread(&ConfigWatcher::run, this);
+    LOG_INFO << "Watching " << path << " for changes";
+    return true;
+}
+
+void ConfigWatcher::run() {
+    alignas(inotify_event) char buffer[4096];
+    bool pending = false;
+    auto due = std::chrono::steady_clock::now();
+
+    while (running) {
+        int timeout = -1;
+        if (pending) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(due - std::chrono::steady_clock::now());
+            timeout = std::max<int>(left.count(), 0);
+        }
+        pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+        int ready = poll(fds, 2, timeout);
+        if (ready < 0 && errno != EINTR) {
+            LOG_ERROR << "Config watcher: " << strerror(errno);
+            return;
+        }
+
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            ssize_t n;
+            while ((n = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+                for (char* p = buffer; p < buffer + n;) {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+                    if (event->len && name == event->name) {
+                        // Each write pushes the reload back, so a save is read whole
+                        pending = true;
+                        due = std::chrono::steady_clock::now() + std::chrono::milliseconds(WATCH_DELAY_MS);
+                    }
+                    p += sizeof(inotify_event) + event->len;
+                }
+            }
+        }
+
+        if (pending && std::chrono::steady_clock::now() >= due && running) {
+            pending = false;
+            changed();
+        }
+    }
+}
+
+ConfigReloader::ConfigReloader(const Config& config, KawPow& kawpow)
+    : current(&config), kawpow(kawpow), devices(config.getCudaDevices()), pools(config.getPools()),
+      split(config.getPoolSplit().enabled) {
+}
+
+void ConfigReloader::reload(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    LOG_INFO << "Config file changed, reloading";
+    std::unique_ptr<Config> next(new Config);
+    if (!next->load(path)) {
+        LOG_ERROR << "Keeping the running configuration";
+        return;
+    }
+    std::vector<std::string> changed = current->changed_sections(*next);
+    if (changed.empty()) {
+        LOG_INFO << "Config unchanged";
+        return;
+    }
+
+    const Config& before = *current;
+    const Config& after = *next;
+    std::vector<std::string> deferred;
+    for (const std::string& section : changed) {
+        if (section == "log") {
+            log_configure(after.getLog());
+        } else if (section == "cuda") {
+            apply_devices(before, after);
+        } else if (section == "api" && on_api) {
+            on_api(after);
+        } else if (section == "pools" && apply_pools(after)) {
+            // applied
+        } else {
+            deferred.push_back(section);
+            continue;
+        }
+        LOG_INFO << "Applied changes to \"" << section << "\"";
+    }
+    for (const std::string& section : deferred) {
+        LOG_WARN << "Changes to \"" << section << "\" take effect at the next start";
+    }
+
+    snapshots.push_back(std::move(next));
+    current = snapshots.back().get();
+}
+
+// Devices are matched by device_id. The mining threads are the ones
+// started with the miner; one can be paused and resumed, not added.
+void ConfigReloader::apply_devices(const Config& before, const Config& after) {
+    auto find = [](const Config& config, int device_id) -> const CudaDeviceConfig* {
+        for (const CudaDeviceConfig& device : config.getCudaDevices()) {
+            if (device.device_id == device_id) {
+                return &device;
+            }
+        }
+        return nullptr;
+    };
+
+    for (size_t i = 0; i < devices.size(); ++i) {
+        const CudaDeviceConfig* was = find(before, devices[i].device_id);
+        const CudaDeviceConfig* now = find(after, devices[i].device_id);
+        if (!now) {
+            if (was) {
+                kawpow.set_paused(i, true);
+            }
+            continue;
+        }
+        if (!was) {
+            kawpow.set_paused(i, false);
+        }
+        if (!was || was->intensity != now->intensity) {
+            if (!kawpow.set_intensity(i, now->intensity)) {
+                LOG_WARN << "Device " << now->device_id << ": intensity " << now->intensity << " out of range";
+            }
+        }
+    }
+    for (const CudaDeviceConfig& device : after.getCudaDevices()) {
+        if (!std::any_of(devices.begin(), devices.end(),
+                         [&](const CudaDeviceConfig& d) { return d.device_id == device.device_id; })) {
+            LOG_WARN << "Device " << device.device_id << " starts mining at the next start";
+        }
+    }
+}
+
+static bool same_pool(const PoolConfig& a, const PoolConfig& b) {
+    return a.url == b.url && a.user == b.user && a.pass == b.pass && a.tls_fingerprint == b.tls_fingerprint &&
+           a.nicehash == b.nicehash && a.weight == b.weight;
+}
+
+// Only pools appended to a hashrate split: sessions are numbered by their
+// place in the list, and the ones running keep theirs
+bool ConfigReloader::apply_pools(const Config& after) {
+    const std::vector<PoolConfig>& next = after.getPools();
+    if (!on_pools_added || !split || next.size() <= pools.size() ||
+        !std::equal(pools.begin(), pools.end(), next.begin(), same_pool)) {
+        return false;
+    }
+    on_pools_added(after, pools.size());
+    pools = next;
+    return true;
+}
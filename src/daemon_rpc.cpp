@@ -0,0 +1,188 @@
+#include "daemon_rpc.h"
+#include <chrono>
+#include <cstring>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "logging.h"
+
+// Largest reply accepted; a full block template is well below this
+#define MAX_REPLY_SIZE (64 * 1024 * 1024)
+
+static std::string base64(const std::string& in) {
+    static const char kTable[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    size_t i = 0;
+    for (; i + 3 <= in.size(); i += 3) {
+        uint32_t v = (uint8_t(in[i]) << 16) | (uint8_t(in[i + 1]) << 8) | uint8_t(in[i + 2]);
+        out += kTable[v >> 18];
+        out += kTable[(v >> 12) & 63];
+        out += kTable[(v >> 6) & 63];
+        out += kTable[v & 63];
+    }
+    if (i + 1 == in.size()) {
+        uint32_t v = uint8_t(in[i]) << 16;
+        out += kTable[v >> 18];
+        out += kTable[(v >> 12) & 63];
+        out += "==";
+    } else if (i + 2 == in.size()) {
+        uint32_t v = (uint8_t(in[i]) << 16) | (uint8_t(in[i + 1]) << 8);
+        out += kTable[v >> 18];
+        out += kTable[(v >> 12) & 63];
+        out += kTable[(v >> 6) & 63];
+        out += '=';
+    }
+    return out;
+}
+
+DaemonRpc::DaemonRpc(const std::string& host, int port, const std::string& user, const std::string& pass)
+    : host(host), port(port), authorization(base64(user + ":" + pass)) {}
+
+DaemonRpc::~DaemonRpc() {
+    close_node();
+}
+
+bool DaemonRpc::connect_node(int timeout_seconds) {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) {
+        error = "cannot resolve " + host;
+        return false;
+    }
+
+    for (addrinfo* ai = result; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        timeval tv{timeout_seconds, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            freeaddrinfo(result);
+            return true;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    error = "cannot connect to " + host + ":" + std::to_string(port) + ": " + strerror(errno);
+    return false;
+}
+
+void DaemonRpc::close_node() {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+bool DaemonRpc::call(const std::string& method, const std::string& params, rapidjson::Document& reply, int timeout_seconds) {
+    std::string payload = "{\"jsonrpc\":\"1.0\",\"id\":" + std::to_string(next_id++) + ",\"method\":\"" + method +
+                          "\",\"params\":" + params + "}";
+    std::string request = "POST / HTTP/1.1\r\nHost: " + host + "\r\nAuthorization: Basic " + authorization +
+                          "\r\nContent-Type: application/json\r\nConnection: keep-alive\r\nContent-Length: " +
+                          std::to_string(payload.size()) + "\r\n\r\n" + payload;
+
+    // A kept-alive connection the node has since closed fails on first use;
+    // that case, and only that case, is retried on a fresh connection.
+    std::string body;
+    bool reused = fd >= 0;
+    if (!reused && !connect_node(timeout_seconds)) {
+        return false;
+    }
+    if (!exchange(request, body, timeout_seconds)) {
+        close_node();
+        if (!reused || !connect_node(timeout_seconds) || !exchange(request, body, timeout_seconds)) {
+            close_node();
+            return false;
+        }
+    }
+
+    reply.Parse(body.c_str());
+    if (reply.HasParseError() || !reply.IsObject()) {
+        error = "invalid JSON reply to " + method;
+        return false;
+    }
+    return true;
+}
+
+bool DaemonRpc::exchange(const std::string& request, std::string& body, int timeout_seconds) {
+    size_t sent = 0;
+    while (sent < request.size()) {
+        ssize_t n = send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            error = std::string("send failed: ") + strerror(errno);
+            return false;
+        }
+        sent += n;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout_seconds);
+    std::string data;
+    size_t header_end = std::string::npos;
+    size_t content_length = std::string::npos;
+    bool close_after = false;
+    char buf[65536];
+    while (true) {
+        if (header_end == std::string::npos) {
+            header_end = data.find("\r\n\r\n");
+            if (header_end != std::string::npos) {
+                std::string headers = data.substr(0, header_end);
+                for (char& c : headers) c = static_cast<char>(tolower(c));
+                int status = atoi(headers.c_str() + headers.find(' ') + 1);
+                if (status == 401 || status == 403) {
+                    error = "node rejected the RPC credentials";
+                    return false;
+                }
+                size_t pos = headers.find("\r\ncontent-length:");
+                if (pos != std::string::npos) {
+                    content_length = strtoul(headers.c_str() + pos + 17, nullptr, 10);
+                }
+                close_after = headers.find("\r\nconnection: close") != std::string::npos;
+                header_end += 4;
+            }
+        }
+        if (header_end != std::string::npos && content_length != std::string::npos &&
+            data.size() >= header_end + content_length) {
+            body = data.substr(header_end, content_length);
+            break;
+        }
+
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        pollfd pfd{fd, POLLIN, 0};
+        if (left <= 0 || poll(&pfd, 1, static_cast<int>(left)) <= 0) {
+            error = "timed out waiting for the node";
+            return false;
+        }
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            if (n == 0 && header_end != std::string::npos && content_length == std::string::npos) {
+                // No length given: the body runs until the node closes
+                body = data.substr(header_end);
+                close_after = true;
+                break;
+            }
+            error = n == 0 ? "node closed the connection" : std::string("recv failed: ") + strerror(errno);
+            return false;
+        }
+        data.append(buf, n);
+        if (data.size() > MAX_REPLY_SIZE) {
+            error = "reply too large";
+            return false;
+        }
+    }
+
+    if (close_after) {
+        close_node();
+    }
+    return true;
+}
@@ -0,0 +1,266 @@
+#include "dns_cache.h"
+#include <algorithm>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include "logging.h"
+
+// How long the first lookup of a host may block before giving up
+#define FIRST_LOOKUP_TIMEOUT_MS 10000
+// Retry interval for a host whose refresh failed while stale records remain
+#define FAILED_REFRESH_RETRY_MS 5000
+// RFC 8305 recommended "Connection Attempt Delay"
+#define HAPPY_EYEBALLS_DELAY_MS 250
+
+DnsCache::DnsCache(const Config& config) : config(config) {
+    worker = std::thread(&DnsCache::worker_main, this);
+}
+
+DnsCache::~DnsCache() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    cv.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void DnsCache::prefetch(const std::string& host) {
+    std::lock_guard<std::mutex> lock(mutex);
+    DnsEntry& entry = entries[host];
+    if (entry.records.empty()) {
+        enqueue_locked(host, entry);
+    }
+}
+
+bool DnsCache::lookup(const std::string& host, std::vector<sockaddr_storage>& records) {
+    // Literal addresses never need the resolver
+    sockaddr_storage literal;
+    memset(&literal, 0, sizeof(literal));
+    sockaddr_in* v4 = reinterpret_cast<sockaddr_in*>(&literal);
+    sockaddr_in6* v6 = reinterpret_cast<sockaddr_in6*>(&literal);
+    if (inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        records.assign(1, literal);
+        return true;
+    }
+    if (inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        records.assign(1, literal);
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    DnsEntry& entry = entries[host];
+
+    if (!entry.records.empty()) {
+        // Serve the cached answer right away, refreshing it in the
+        // background once the TTL has run out.
+        if (std::chrono::steady_clock::now() >= entry.expires) {
+            enqueue_locked(host, entry);
+        }
+        records = entry.records;
+        return true;
+    }
+
+    // Nothing cached yet: this is the only case where a caller waits
+    enqueue_locked(host, entry);
+    uint64_t generation = entry.generation;
+    cv.wait_for(lock, std::chrono::milliseconds(FIRST_LOOKUP_TIMEOUT_MS),
+                [&] { return entry.generation != generation || !running; });
+
+    if (entry.records.empty()) {
+        return false;
+    }
+    records = entry.records;
+    return true;
+}
+
+void DnsCache::enqueue_locked(const std::string& host, DnsEntry& entry) {
+    if (entry.pending) {
+        return;
+    }
+    entry.pending = true;
+    queue.push_back(host);
+    cv.notify_all();
+}
+
+void DnsCache::worker_main() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running) {
+        cv.wait(lock, [this] { return !queue.empty() || !running; });
+        if (!running) {
+            break;
+        }
+
+        std::string host = queue.front();
+        queue.pop_front();
+
+        lock.unlock();
+        int status = 0;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<sockaddr_storage> records = resolve(host, status);
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        lock.lock();
+
+        DnsEntry& entry = entries[host];
+        auto now = std::chrono::steady_clock::now();
+        if (!records.empty()) {
+            LOG_INFO << "Resolved " << host << " to " << records.size() << " addresses in " << elapsed << " ms";
+            entry.records = std::move(records);
+            entry.expires = now + std::chrono::seconds(config.getDns().ttl);
+        } else if (!entry.records.empty()) {
+            LOG_WARN << "Failed to refresh " << host << " (" << gai_strerror(status) << "), using stale records";
+            entry.expires = now + std::chrono::milliseconds(FAILED_REFRESH_RETRY_MS);
+        } else {
+            LOG_ERROR << "Failed to resolve hostname: " << host << " - " << gai_strerror(status);
+        }
+        entry.pending = false;
+        entry.generation++;
+        cv.notify_all();
+    }
+}
+
+std::vector<sockaddr_storage> DnsCache::resolve(const std::string& host, int& status) const {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    addrinfo* res = nullptr;
+    std::vector<sockaddr_storage> records;
+    status = getaddrinfo(host.c_str(), nullptr, &hints, &res);
+    if (status != 0) {
+        return records;
+    }
+
+    std::vector<sockaddr_storage> ipv4, ipv6;
+    for (addrinfo* ptr = res; ptr != nullptr; ptr = ptr->ai_next) {
+        if (ptr->ai_family != AF_INET && ptr->ai_family != AF_INET6) {
+            continue;
+        }
+        sockaddr_storage addr;
+        memset(&addr, 0, sizeof(addr));
+        memcpy(&addr, ptr->ai_addr, ptr->ai_addrlen);
+        (ptr->ai_family == AF_INET ? ipv4 : ipv6).push_back(addr);
+    }
+    freeaddrinfo(res);
+
+    // Interleave the families, preferred one first (RFC 8305 section 4)
+    std::vector<sockaddr_storage>& first = config.getDns().ipv6 ? ipv6 : ipv4;
+    std::vector<sockaddr_storage>& second = config.getDns().ipv6 ? ipv4 : ipv6;
+    for (size_t i = 0; i < std::max(first.size(), second.size()); ++i) {
+        if (i < first.size()) records.push_back(first[i]);
+        if (i < second.size()) records.push_back(second[i]);
+    }
+    return records;
+}
+
+static std::string address_to_string(const sockaddr_storage& addr) {
+    char buf[INET6_ADDRSTRLEN] = {0};
+    if (addr.ss_family == AF_INET) {
+        inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in*>(&addr)->sin_addr, buf, sizeof(buf));
+    } else {
+        inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6*>(&addr)->sin6_addr, buf, sizeof(buf));
+    }
+    return buf;
+}
+
+int happy_eyeballs_connect(const std::vector<sockaddr_storage>& records, int port, int timeout_ms, std::string& ip) {
+    using clock = std::chrono::steady_clock;
+
+    std::vector<pollfd> attempts;
+    std::vector<size_t> attempt_record;
+    size_t next = 0;
+    int winner = -1;
+    auto deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+    auto next_start = clock::now();
+
+    while (winner < 0) {
+        auto now = clock::now();
+        if (now >= deadline) {
+            break;
+        }
+
+        // Start the next attempt when its turn comes or nothing is in flight
+        if (next < records.size() && (now >= next_start || attempts.empty())) {
+            sockaddr_storage addr = records[next];
+            socklen_t len;
+            if (addr.ss_family == AF_INET) {
+                reinterpret_cast<sockaddr_in*>(&addr)->sin_port = htons(port);
+                len = sizeof(sockaddr_in);
+            } else {
+                reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port = htons(port);
+                len = sizeof(sockaddr_in6);
+            }
+
+            int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+            if (fd >= 0) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+                int result = ::connect(fd, reinterpret_cast<sockaddr*>(&addr), len);
+                if (result == 0) {
+                    winner = fd;
+                    ip = address_to_string(records[next]);
+                } else if (errno == EINPROGRESS) {
+                    pollfd pfd;
+                    pfd.fd = fd;
+                    pfd.events = POLLOUT;
+                    pfd.revents = 0;
+                    attempts.push_back(pfd);
+                    attempt_record.push_back(next);
+                } else {
+                    close(fd);
+                }
+            }
+            next++;
+            next_start = now + std::chrono::milliseconds(HAPPY_EYEBALLS_DELAY_MS);
+            continue;
+        }
+
+        if (attempts.empty()) {
+            break; // every address failed
+        }
+
+        auto wake = (next < records.size()) ? std::min(next_start, deadline) : deadline;
+        int wait_ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count());
+        if (poll(attempts.data(), attempts.size(), std::max(wait_ms, 0)) <= 0) {
+            continue;
+        }
+
+        for (size_t i = 0; i < attempts.size();) {
+            if (attempts[i].revents == 0) {
+                ++i;
+                continue;
+            }
+
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0) {
+                winner = attempts[i].fd;
+                ip = address_to_string(records[attempt_record[i]]);
+                attempts.erase(attempts.begin() + i);
+                attempt_record.erase(attempt_record.begin() + i);
+                break;
+            }
+
+            // A failed attempt lets the next address start immediately
+            close(attempts[i].fd);
+            attempts.erase(attempts.begin() + i);
+            attempt_record.erase(attempt_record.begin() + i);
+            next_start = clock::now();
+        }
+    }
+
+    for (const pollfd& pfd : attempts) {
+        close(pfd.fd);
+    }
+    return winner;
+}
@@ -0,0 +1,202 @@
+#include "effective_hashrate.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include "logging.h"
+#include "uint256.h"
+
+// Standard normal quantile, Abramowitz and Stegun 26.2.23 (error < 4.5e-4)
+static double normal_quantile(double p) {
+    double q = p < 0.5 ? p : 1 - p;
+    double t = std::sqrt(-2 * std::log(q));
+    double z = t - (2.515517 + 0.802853 * t + 0.010328 * t * t) /
+                   (1 + 1.432788 * t + 0.189269 * t * t + 0.001308 * t * t * t);
+    return p < 0.5 ? -z : z;
+}
+
+// Chi-square quantile with dof degrees of freedom. Two degrees is an
+// exponential distribution and exact; above that Wilson-Hilferty is good
+// to a few percent, plenty for an alarm.
+static double chi2_quantile(double p, double dof) {
+    if (dof <= 2) {
+        return -2 * std::log(1 - p);
+    }
+    double a = 2 / (9 * dof);
+    double c = 1 - a + normal_quantile(p) * std::sqrt(a);
+    return dof * std::max(c, 0.0) * c * c;
+}
+
+// Garwood bounds on the mean of a Poisson count k
+static void poisson_bounds(uint64_t k, double confidence, double& low, double& high) {
+    double tail = (1 - confidence) / 2;
+    low = k ? chi2_quantile(tail, 2.0 * k) / 2 : 0;
+    high = chi2_quantile(1 - tail, 2.0 * k + 2) / 2;
+}
+
+static std::string format_rate(double rate) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2) << rate / 1e6 << " MH/s";
+    return out.str();
+}
+
+EffectiveHashrate::EffectiveHashrate(const Config& config)
+    : settings(config.getEffectiveHashrate()), last_sample(std::chrono::steady_clock::now()) {
+    Metrics& metrics = Metrics::instance();
+    for (const CudaDeviceConfig& device : config.getCudaDevices()) {
+        std::string labels = "device=" + metric_label(std::to_string(device.device_id));
+        Window window;
+        window.name = "Device " + std::to_string(device.device_id);
+        window.rate = &metrics.gauge("kawpow_effective_hashrate", "Hashes per second credited by accepted shares", labels);
+        window.diverged_metric = &metrics.gauge("kawpow_hashrate_diverged", "1 while the counted hashrate is outside the effective hashrate's bounds", labels);
+        devices.push_back(window);
+        devices.back().buckets.emplace_back();
+        devices.back().buckets.back().start = last_sample;
+    }
+    last_devices.resize(devices.size());
+}
+
+EffectiveHashrate::Window& EffectiveHashrate::pool_window(const std::string& pool) {
+    auto it = pools.find(pool);
+    if (it != pools.end()) {
+        return it->second;
+    }
+    std::string labels = "pool=" + metric_label(pool);
+    Window& window = pools[pool];
+    window.name = "Pool " + pool;
+    window.rate = &Metrics::instance().gauge("kawpow_effective_hashrate", "Hashes per second credited by accepted shares", labels);
+    window.diverged_metric = &Metrics::instance().gauge("kawpow_hashrate_diverged", "1 while the counted hashrate is outside the effective hashrate's bounds", labels);
+    window.buckets.emplace_back();
+    window.buckets.back().start = last_sample;
+    return window;
+}
+
+void EffectiveHashrate::record_result(size_t device, const std::string& pool, double difficulty, bool accepted, bool stale) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Bucket* buckets[2] = {device < devices.size() ? &devices[device].buckets.back() : nullptr,
+                          &pool_window(pool).buckets.back()};
+    for (Bucket* bucket : buckets) {
+        if (!bucket) {
+            continue;
+        }
+        if (accepted) {
+            bucket->accepted++;
+            bucket->credited += hashes_per_share(difficulty);
+        } else if (stale) {
+            bucket->stale++;
+        } else {
+            bucket->rejected++;
+        }
+    }
+}
+
+void EffectiveHashrate::sample(std::chrono::steady_clock::time_point now, const std::vector<MinedWork>& device_work,
+                               const std::vector<std::pair<std::string, MinedWork>>& source_work) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < devices.size() && i < device_work.size(); ++i) {
+        MinedWork delta;
+        delta.hashes = device_work[i].hashes - last_devices[i].hashes;
+        delta.shares = device_work[i].shares - last_devices[i].shares;
+        last_devices[i] = device_work[i];
+        close(devices[i], now, delta);
+    }
+
+    // A failover session keeps its source but changes pools, so the work
+    // goes to whichever pool the source mines for now
+    last_sources.resize(source_work.size());
+    std::map<std::string, MinedWork> pool_work;
+    for (size_t i = 0; i < source_work.size(); ++i) {
+        MinedWork& work = pool_work[source_work[i].first];
+        work.hashes += source_work[i].second.hashes - last_sources[i].hashes;
+        work.shares += source_work[i].second.shares - last_sources[i].shares;
+        last_sources[i] = source_work[i].second;
+    }
+    for (const auto& entry : pool_work) {
+        if (!entry.first.empty()) {
+            pool_window(entry.first);
+        }
+    }
+    for (auto& entry : pools) {
+        close(entry.second, now, pool_work[entry.first]);
+    }
+    last_sample = now;
+}
+
+// Adds the work to the open bucket, opens the next one, drops buckets that
+// left the window, and logs a change in divergence
+void EffectiveHashrate::close(Window& window, std::chrono::steady_clock::time_point now, const MinedWork& work) {
+    window.buckets.back().hashes += work.hashes;
+    window.buckets.back().expected += work.shares;
+    window.buckets.emplace_back();
+    window.buckets.back().start = now;
+    while (window.buckets.size() > 2 && now - window.buckets[1].start >= std::chrono::seconds(settings.window)) {
+        window.buckets.pop_front();
+    }
+
+    EffectiveEstimate e = estimate(window);
+    window.rate->set(static_cast<int64_t>(e.effective));
+    bool diverged = e.counted > 0 && (e.counted < e.low || e.counted > e.high);
+    if (diverged == window.diverged) {
+        return;
+    }
+    window.diverged = diverged;
+    window.diverged_metric->set(diverged);
+    if (diverged) {
+        LOG_WARN << window.name << ": counted hashrate " << format_rate(e.counted) << " is outside the "
+                 << std::setprecision(3) << settings.confidence * 100 << "% bounds of the effective "
+                 << format_rate(e.effective) << " (" << format_rate(e.low) << " .. " << format_rate(e.high)
+                 << ") over " << static_cast<int>(e.seconds) << " s: " << e.accepted << " shares accepted of "
+                 << std::setprecision(1) << std::fixed << e.expected << " expected, " << e.rejected << " rejected, "
+                 << e.stale << " stale"
+                 << (e.counted > e.high ? "; hashes may be invalid" : "; hashes may be undercounted");
+    } else {
+        LOG_INFO << window.name << ": counted hashrate " << format_rate(e.counted)
+                 << " is back within the bounds of the effective " << format_rate(e.effective);
+    }
+}
+
+// Over the closed buckets; the open one has verdicts but no work yet
+EffectiveEstimate EffectiveHashrate::estimate(const Window& window) const {
+    EffectiveEstimate e;
+    if (window.buckets.size() < 2) {
+        return e;
+    }
+    double credited = 0;
+    uint64_t hashes = 0;
+    for (size_t i = 0; i + 1 < window.buckets.size(); ++i) {
+        const Bucket& b = window.buckets[i];
+        hashes += b.hashes;
+        credited += b.credited;
+        e.expected += b.expected;
+        e.accepted += b.accepted;
+        e.rejected += b.rejected;
+        e.stale += b.stale;
+    }
+    e.seconds = std::chrono::duration<double>(window.buckets.back().start - window.buckets.front().start).count();
+    if (e.seconds <= 0) {
+        return e;
+    }
+    e.counted = hashes / e.seconds;
+    e.effective = credited / e.seconds;
+
+    // Bounds are in shares; a share is worth what the mined targets say, or
+    // what the accepted ones did if nothing was mined here
+    double per_share = e.expected > 0 ? hashes / e.expected : e.accepted ? credited / e.accepted : 0;
+    double low, high;
+    poisson_bounds(e.accepted, settings.confidence, low, high);
+    e.low = low * per_share / e.seconds;
+    e.high = high * per_share / e.seconds;
+    e.diverged = window.diverged;
+    return e;
+}
+
+EffectiveEstimate EffectiveHashrate::device(size_t device) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return device < devices.size() ? estimate(devices[device]) : EffectiveEstimate();
+}
+
+EffectiveEstimate EffectiveHashrate::pool(const std::string& pool) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = pools.find(pool);
+    return it != pools.end() ? estimate(it->second) : EffectiveEstimate();
+}
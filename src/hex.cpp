@@ -0,0 +1,201 @@
+#include "hex.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HEX_X86 1
+#endif
+
+static const char kDigits[] = "0123456789abcdef";
+
+// 0-15 for hex digits, 0xff for anything else
+struct DecodeTable {
+    uint8_t value[256];
+    constexpr DecodeTable() : value() {
+        for (int i = 0; i < 256; ++i) value[i] = 0xff;
+        for (int i = 0; i < 10; ++i) value['0' + i] = static_cast<uint8_t>(i);
+        for (int i = 0; i < 6; ++i) {
+            value['a' + i] = static_cast<uint8_t>(10 + i);
+            value['A' + i] = static_cast<uint8_t>(10 + i);
+        }
+    }
+};
+static constexpr DecodeTable kDecode;
+
+// Each returns the number of input bytes (encode) or output bytes (decode)
+// it handled; the scalar loops finish the rest. Decoders return -1 on an
+// invalid character.
+typedef size_t (*EncodeBlock)(const uint8_t* in, size_t size, char* out);
+typedef long (*DecodeBlock)(const char* hex, size_t bytes, uint8_t* out);
+
+static size_t encode_none(const uint8_t*, size_t, char*) { return 0; }
+static long decode_none(const char*, size_t, uint8_t*) { return 0; }
+
+#ifdef HEX_X86
+// 16 bytes of nibbles -> 16 digit characters
+__attribute__((target("ssse3")))
+static inline __m128i digits_128(__m128i nibbles) {
+    const __m128i lut = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    return _mm_shuffle_epi8(lut, nibbles);
+}
+
+__attribute__((target("ssse3")))
+static size_t encode_ssse3(const uint8_t* in, size_t size, char* out) {
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128i hi = digits_128(_mm_and_si128(_mm_srli_epi16(bytes, 4), low_mask));
+        __m128i lo = digits_128(_mm_and_si128(bytes, low_mask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 2), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 2 + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    return i;
+}
+
+// 16 characters -> 16 nibble values; sets invalid lanes in bad
+__attribute__((target("ssse3")))
+static inline __m128i nibbles_128(__m128i chars, __m128i& bad) {
+    __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    __m128i alpha = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+    bad = _mm_or_si128(bad, _mm_andnot_si128(_mm_or_si128(is_digit, is_alpha), _mm_set1_epi8(-1)));
+    return _mm_or_si128(_mm_and_si128(is_digit, digit),
+                        _mm_and_si128(is_alpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+}
+
+__attribute__((target("ssse3")))
+static long decode_ssse3(const char* hex, size_t bytes, uint8_t* out) {
+    // high nibble * 16 + low nibble for each adjacent pair
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    __m128i bad = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i a = nibbles_128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hex + i * 2)), bad);
+        __m128i b = nibbles_128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hex + i * 2 + 16)), bad);
+        __m128i packed = _mm_packus_epi16(_mm_maddubs_epi16(a, weights), _mm_maddubs_epi16(b, weights));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+    }
+    return _mm_movemask_epi8(bad) ? -1 : static_cast<long>(i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i digits_256(__m256i nibbles) {
+    const __m256i lut = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+                                         '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    return _mm256_shuffle_epi8(lut, nibbles);
+}
+
+__attribute__((target("avx2")))
+static size_t encode_avx2(const uint8_t* in, size_t size, char* out) {
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        __m256i hi = digits_256(_mm256_and_si256(_mm256_srli_epi16(bytes, 4), low_mask));
+        __m256i lo = digits_256(_mm256_and_si256(bytes, low_mask));
+        // unpack works per 128-bit lane; reassemble the lanes in order
+        __m256i first = _mm256_unpacklo_epi8(hi, lo);
+        __m256i second = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i * 2), _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i * 2 + 32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    return i + encode_ssse3(in + i, size - i, out + i * 2);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i nibbles_256(__m256i chars, __m256i& bad) {
+    __m256i digit = _mm256_sub_epi8(chars, _mm256_set1_epi8('0'));
+    __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+    __m256i alpha = _mm256_sub_epi8(_mm256_or_si256(chars, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i is_alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, _mm256_set1_epi8(5)), alpha);
+    bad = _mm256_or_si256(bad, _mm256_andnot_si256(_mm256_or_si256(is_digit, is_alpha), _mm256_set1_epi8(-1)));
+    return _mm256_or_si256(_mm256_and_si256(is_digit, digit),
+                           _mm256_and_si256(is_alpha, _mm256_add_epi8(alpha, _mm256_set1_epi8(10))));
+}
+
+__attribute__((target("avx2")))
+static long decode_avx2(const char* hex, size_t bytes, uint8_t* out) {
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    __m256i bad = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i a = nibbles_256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(hex + i * 2)), bad);
+        __m256i b = nibbles_256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(hex + i * 2 + 32)), bad);
+        __m256i packed = _mm256_packus_epi16(_mm256_maddubs_epi16(a, weights), _mm256_maddubs_epi16(b, weights));
+        // packus interleaves the 128-bit lanes: a.lo b.lo a.hi b.hi
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permute4x64_epi64(packed, 0xd8));
+    }
+    if (_mm256_movemask_epi8(bad)) {
+        return -1;
+    }
+    long rest = decode_ssse3(hex + i * 2, bytes - i, out + i);
+    return rest < 0 ? -1 : static_cast<long>(i) + rest;
+}
+#endif
+
+struct HexBackend {
+    const char* name = "scalar";
+    EncodeBlock encode = encode_none;
+    DecodeBlock decode = decode_none;
+
+    HexBackend() {
+#ifdef HEX_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            name = "avx2";
+            encode = encode_avx2;
+            decode = decode_avx2;
+        } else if (__builtin_cpu_supports("ssse3")) {
+            name = "ssse3";
+            encode = encode_ssse3;
+            decode = decode_ssse3;
+        }
+#endif
+    }
+};
+static const HexBackend kBackend;
+
+bool hex_decode(const char* hex, size_t length, uint8_t* out, size_t out_size, size_t* decoded) {
+    size_t bytes = length / 2;
+    if ((length & 1) || bytes > out_size) {
+        return false;
+    }
+
+    long done = kBackend.decode(hex, bytes, out);
+    if (done < 0) {
+        return false;
+    }
+
+    for (size_t i = static_cast<size_t>(done); i < bytes; ++i) {
+        uint8_t hi = kDecode.value[static_cast<uint8_t>(hex[i * 2])];
+        uint8_t lo = kDecode.value[static_cast<uint8_t>(hex[i * 2 + 1])];
+        if ((hi | lo) & 0xf0) {
+            return false;
+        }
+        out[i] = static_cast<uint8_t>((hi << 4) | lo);
+    }
+
+    if (decoded) {
+        *decoded = bytes;
+    }
+    return true;
+}
+
+void hex_encode(const uint8_t* in, size_t size, char* out) {
+    for (size_t i = kBackend.encode(in, size, out); i < size; ++i) {
+        out[i * 2] = kDigits[in[i] >> 4];
+        out[i * 2 + 1] = kDigits[in[i] & 0x0f];
+    }
+}
+
+void hex_encode_u64(uint64_t value, char out[16]) {
+    for (int i = 15; i >= 0; --i) {
+        out[i] = kDigits[value & 0x0f];
+        value >>= 4;
+    }
+}
+
+const char* hex_backend() {
+    return kBackend.name;
+}
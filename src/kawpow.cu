@@ -1,40 +1,73 @@
 #include "kawpow.h"
+#include "hex.h"
+#include "kawpow_verify.h"
 #include "logging.h"
+#include "trace.h"
 
 #include <cuda_runtime.h>
 #include <iostream>
 #include <mutex>
 #include <cstdio>
 #include <chrono>
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
 #include <unordered_map>
 #include <mutex>
-extern "C" {
-    #include "libethash/ethash.h"
-}
 
 // Define constants once at the top
+#define KAWPOW_EPOCH_LENGTH 7500
+#define KAWPOW_PERIOD 3
+#define KAWPOW_DAG_PARENTS 512
 #define PROGPOW_LANES 16
 #define PROGPOW_REGS 32
-#define PROGPOW_LOOP_COUNT 64
-#define PROGPOW_DAG_ITEM_SIZE 64
-#define PROGPOW_DAG_PARENTS 256
+#define PROGPOW_DAG_LOADS 4
+#define PROGPOW_CACHE_WORDS 4096
+#define PROGPOW_CNT_DAG 64
+#define PROGPOW_CNT_CACHE 11
+#define PROGPOW_CNT_MATH 18
+// Words in a 2048-bit DAG item and in a 512-bit ethash node
+#define PROGPOW_ITEM_WORDS 64
+#define NODE_WORDS 16
+// DAG nodes generated per launch, so no single launch runs for seconds
+#define DAG_NODES_PER_LAUNCH (1u << 20)
+
+// Seconds between expected hits on the local monitoring boundary
+#define MONITOR_INTERVAL 2.0
+
+// What a batch found. Hits on the monitoring boundary are only counted;
+// a hash that meets the share target gets its own slot, so a monitoring
+// hit earlier in the batch can never hide a share.
+struct SearchResult {
+    unsigned long long share_nonce;     // 0 if no hash met the share target
+    uint32_t share_mix[8];
+    uint32_t share_hash[8];             // uint256 words, least significant first
+    unsigned int monitor_hits;
+};
 
 // --- FNV1a Hashing Helper ---
 #define FNV_PRIME 0x01000193
+#define FNV_OFFSET_BASIS 0x811c9dc5
 
 
-__constant__ uint32_t d_ravencoin_kawpow[15];
-// const uint64_t fixed_difficulty = 256; // tweak as needed
+// "RAVENCOINKAWPOW", one character per word, padding both Keccak-f800 calls
+__constant__ uint32_t d_ravencoin_kawpow[15] = {
+    0x00000072, 0x00000041, 0x00000056, 0x00000045, 0x0000004E,
+    0x00000043, 0x0000004F, 0x00000049, 0x0000004E, 0x0000004B,
+    0x00000041, 0x00000057, 0x00000050, 0x0000004F, 0x00000057
+};
+
+// The current period's program, from kawpow_program on the host
+__constant__ KawpowProgram c_program;
 
 
 __device__ inline uint32_t fnv1a_32(uint32_t a, uint32_t b) { return (a ^ b) * FNV_PRIME; }
-uint32_t fnv1a_32_cpu(uint32_t a, uint32_t b) { return (a ^ b) * FNV_PRIME; }
+// ethash's FNV-1, which picks the DAG's parents
+__device__ inline uint32_t fnv1_32(uint32_t a, uint32_t b) { return (a * FNV_PRIME) ^ b; }
 
 // --- Keccak Hashing & Helper Implementation for GPU ---
-__device__ inline uint64_t rotate_left(uint64_t x, uint8_t n) { return (x << n) | (x >> (64 - n)); }
-__device__ inline uint32_t rotate_right(uint32_t x, uint32_t n) { return (x >> n) | (x << (32 - n)); }
+__device__ inline uint32_t rotate_left(uint32_t x, uint32_t n) { return (x << (n & 31)) | (x >> ((32 - n) & 31)); }
+__device__ inline uint32_t rotate_right(uint32_t x, uint32_t n) { return (x >> (n & 31)) | (x << ((32 - n) & 31)); }
 
 // --- FIXED: Proper endianness handling ---
 __device__ inline uint32_t byteswap_32(uint32_t x) { 
@@ -44,49 +77,62 @@ __device__ inline uint32_t byteswap_32(uint32_t x) {
            ((x >> 24) & 0x000000ff); 
 }
 
-__device__ inline uint64_t byteswap_64(uint64_t x) {
-    return ((x << 56) & 0xff00000000000000ULL) |
-           ((x << 40) & 0x00ff000000000000ULL) |
-           ((x << 24) & 0x0000ff0000000000ULL) |
-           ((x << 8)  & 0x000000ff00000000ULL) |
-           ((x >> 8)  & 0x00000000ff000000ULL) |
-           ((x >> 24) & 0x0000000000ff0000ULL) |
-           ((x >> 40) & 0x000000000000ff00ULL) |
-           ((x >> 56) & 0x00000000000000ffULL);
-}
+__constant__ uint64_t d_keccak_round_constants[24] = {
+    0x0000000000000001, 0x0000000000008082, 0x800000000000808a, 0x8000000080008000,
+    0x000000000000808b, 0x0000000080000001, 0x8000000080008081, 0x8000000000008009,
+    0x000000000000008a, 0x0000000000000088, 0x0000000080008009, 0x000000008000000a,
+    0x000000008000808b, 0x800000000000008b, 0x8000000000008089, 0x8000000000008003,
+    0x8000000000008002, 0x8000000000000080, 0x000000000000800a, 0x800000008000000a,
+    0x8000000080008081, 0x8000000000008080, 0x0000000080000001, 0x8000000080008008
+};
+__constant__ uint8_t d_keccak_rotations[24] = {
+    1, 3, 6, 10, 15, 21, 28, 36, 45, 55, 2, 14, 27, 41, 56, 8, 25, 43, 62, 18, 39, 61, 20, 44
+};
+__constant__ uint8_t d_keccak_lanes[24] = {
+    10, 7, 11, 17, 18, 3, 5, 16, 8, 21, 24, 4, 15, 23, 19, 13, 12, 2, 20, 14, 22, 9, 6, 1
+};
 
-__device__ static void keccak_f1600(uint64_t* state) {
-    const uint64_t keccak_round_constants[24] = {
-        0x0000000000000001, 0x0000000000008082, 0x800000000000808a, 0x8000000080008000,
-        0x000000000000808b, 0x0000000080000001, 0x8000000080008081, 0x8000000000008009,
-        0x000000000000008a, 0x0000000000000088, 0x0000000080008009, 0x000000008000000a,
-        0x000000008000808b, 0x800000000000008b, 0x8000000000008089, 0x8000000000008003,
-        0x8000000000008002, 0x8000000000000080, 0x000000000000800a, 0x800000008000000a,
-        0x8000000080008081, 0x8000000000008080, 0x0000000080000001, 0x8000000080008008
-    };
-    
-    for (int i = 0; i < 24; ++i) {
-        uint64_t C[5], D;
-        for (int x = 0; x < 5; ++x) C[x] = state[x] ^ state[x + 5] ^ state[x + 10] ^ state[x + 15] ^ state[x + 20];
+// Keccak-f1600 (Word = uint64_t, 24 rounds) for the DAG's Keccak-512 and
+// Keccak-f800 (Word = uint32_t, 22 rounds) for KawPoW's own hashes; f800
+// takes the low half of each round constant and rotates modulo 32.
+template <typename Word>
+__device__ static void keccak_f(Word* state, int rounds) {
+    const int bits = sizeof(Word) * 8;
+    for (int round = 0; round < rounds; ++round) {
+        Word c[5];
+        for (int x = 0; x < 5; ++x) c[x] = state[x] ^ state[x + 5] ^ state[x + 10] ^ state[x + 15] ^ state[x + 20];
         for (int x = 0; x < 5; ++x) {
-            D = C[(x + 4) % 5] ^ rotate_left(C[(x + 1) % 5], 1);
-            for (int y = 0; y < 25; y += 5) state[y + x] ^= D;
+            Word d = c[(x + 4) % 5] ^ ((c[(x + 1) % 5] << 1) | (c[(x + 1) % 5] >> (bits - 1)));
+            for (int y = 0; y < 25; y += 5) state[y + x] ^= d;
         }
-        uint64_t current = state[1];
-        for (int x = 0; x < 24; ++x) {
-            int r = ((x + 1) * (x + 2) / 2) % 64;
-            int lane = (2 * (x % 5) + 3 * ((x / 5) % 5)) % 5;
-            uint64_t temp = state[1 + lane];
-            state[1 + lane] = rotate_left(current, r);
+        // Rho and pi
+        Word current = state[1];
+        for (int i = 0; i < 24; ++i) {
+            int lane = d_keccak_lanes[i];
+            int r = d_keccak_rotations[i] % bits;
+            Word temp = state[lane];
+            state[lane] = (current << r) | (current >> (bits - r));
             current = temp;
         }
         // Chi step
         for (int y = 0; y < 25; y += 5) {
-            uint64_t temp[5];
+            Word temp[5];
             for (int x = 0; x < 5; ++x) temp[x] = state[y + x];
             for (int x = 0; x < 5; ++x) state[y + x] = temp[x] ^ ((~temp[(x + 1) % 5]) & temp[(x + 2) % 5]);
         }
-        state[0] ^= keccak_round_constants[i];
+        state[0] ^= static_cast<Word>(d_keccak_round_constants[round]);
+    }
+}
+
+// Keccak-512 of one 64-byte node, in place
+__device__ static void keccak_512_node(uint32_t* node) {
+    uint64_t state[25] = {0};
+    for (int i = 0; i < 8; ++i) state[i] = node[2 * i] | ((uint64_t)node[2 * i + 1] << 32);
+    state[8] = 0x8000000000000001ULL;   // 0x01 after the message, 0x80 closing the 72-byte rate
+    keccak_f<uint64_t>(state, 24);
+    for (int i = 0; i < 8; ++i) {
+        node[2 * i] = (uint32_t)state[i];
+        node[2 * i + 1] = (uint32_t)(state[i] >> 32);
     }
 }
 
@@ -95,6 +141,7 @@ __device__ static void keccak_f1600(uint64_t* state) {
 struct DagCache {
     void* d_dag = nullptr;
     size_t size = 0;
+    uint32_t items = 0;
     uint64_t epoch = UINT64_MAX;
     std::mutex mutex;
 
@@ -115,88 +162,38 @@ static std::unordered_map<int, DagCache> g_dag_caches;
 static std::mutex g_dag_mutex;
 
 // ===================================================================================
-// == DAG & Light Cache Generation
-// ===================================================================================
-uint64_t get_kawpow_dag_size(uint64_t epoch) {
-    const uint64_t dag_size_initial = 1ULL * 1024 * 1024 * 1024;
-    const uint64_t dag_size_growth = 8ULL * 1024 * 1024;
-    return dag_size_initial + (epoch * dag_size_growth);
-}
-
-void* generate_kawpow_light_cache(uint64_t epoch, const char* seed_hash_hex, size_t& cache_size) {
-    const uint32_t light_cache_initial_size = 16 * 1024 * 1024;
-    const uint32_t light_cache_growth = 256 * 1024;
-    const uint32_t words_per_item = 16;
-    cache_size = light_cache_initial_size + (epoch * light_cache_growth);
-    uint32_t num_cache_items = cache_size / sizeof(uint32_t);
-    uint32_t* h_cache = (uint32_t*)malloc(cache_size);
-    if (!h_cache) { LOG_ERROR << "Failed to allocate memory for light cache on CPU."; return nullptr; }
-    
-    // Parse seed hash correctly
-    uint32_t seed[8];
-    for (int i = 0; i < 8; ++i) {
-        sscanf(seed_hash_hex + (i * 8), "%8x", &seed[i]);
-    }
-    
-    // Initialize cache with seed
-    for (int i = 0; i < 8; ++i) h_cache[i] = seed[i];
-    for (uint32_t i = 8; i < words_per_item; ++i) h_cache[i] = fnv1a_32_cpu(h_cache[i - 8], h_cache[i - 7]);
-    
-    // Generate remaining cache items
-    for (uint32_t i = words_per_item; i < num_cache_items; ++i) {
-        h_cache[i] = fnv1a_32_cpu(h_cache[i - words_per_item], h_cache[i - (words_per_item - 1)]);
-    }
-    
-    LOG_INFO << "Successfully generated " << cache_size / (1024*1024) << " MB light cache for epoch " << epoch;
-    return h_cache;
-}
-
-// ===================================================================================
-// == CORRECTED DAG Generation Kernel (Ethash/KawPoW Standard)
+// == DAG Generation
 // ===================================================================================
-__global__ void generate_dag_kernel(uint32_t* d_dag, const uint32_t* d_cache, uint32_t num_dag_items, uint32_t num_cache_items)
+// One 512-bit ethash node per thread, nodes [start, end): the light cache
+// node, 512 parents folded in with FNV-1, Keccak-512 before and after.
+// kawpow_verify derives the same nodes with ethash_calculate_dag_item4_opt.
+__global__ void generate_dag_kernel(uint32_t* d_dag, const uint32_t* d_cache, uint32_t cache_nodes, uint32_t start, uint32_t end)
 {
-    const uint32_t node_index = blockIdx.x * blockDim.x + threadIdx.x;
-    if (node_index >= num_dag_items) {
+    const uint32_t node_index = start + blockIdx.x * blockDim.x + threadIdx.x;
+    if (node_index >= end) {
         return;
     }
 
-    // Constants for standard Ethash DAG generation
-    const uint32_t HASH_WORDS = 16; // 512 bits / 32 bits per word
-    const uint32_t DAG_PARENTS = 256;
-
-    // The number of 64-byte items in the light cache
-    const uint32_t num_cache_words = num_cache_items / HASH_WORDS;
-
-    // Calculate the starting cache index for this DAG node
-    const uint32_t start_node_index = node_index % num_cache_words;
-    const uint32_t* cache_node_ptr = d_cache + start_node_index * HASH_WORDS;
-
-    // Initialize the mix state from the light cache
-    uint32_t mix[HASH_WORDS];
-    for (uint32_t i = 0; i < HASH_WORDS; ++i) {
-        mix[i] = cache_node_ptr[i];
+    uint32_t node[NODE_WORDS];
+    const uint32_t* init = d_cache + (size_t)(node_index % cache_nodes) * NODE_WORDS;
+    for (int i = 0; i < NODE_WORDS; ++i) {
+        node[i] = init[i];
     }
-
-    // Main DAG generation loop
-    for (uint32_t i = 0; i < DAG_PARENTS; ++i) {
-        // Calculate the index of the parent node to fetch from the light cache
-        // This uses standard modular arithmetic, NOT the complex "laned" version.
-        uint32_t parent_index = fnv1a_32(node_index ^ i, mix[i % HASH_WORDS]) % num_cache_words;
-        const uint32_t* parent_ptr = d_cache + parent_index * HASH_WORDS;
-
-        // Mix the parent data into the current state
-        for (uint32_t j = 0; j < HASH_WORDS; ++j) {
-            mix[j] = fnv1a_32(mix[j], parent_ptr[j]);
+    node[0] ^= node_index;
+    keccak_512_node(node);
+
+    for (uint32_t i = 0; i < KAWPOW_DAG_PARENTS; ++i) {
+        uint32_t parent_index = fnv1_32(node_index ^ i, node[i % NODE_WORDS]) % cache_nodes;
+        const uint32_t* parent = d_cache + (size_t)parent_index * NODE_WORDS;
+        for (int j = 0; j < NODE_WORDS; ++j) {
+            node[j] = fnv1_32(node[j], parent[j]);
         }
     }
+    keccak_512_node(node);
 
-    // Final step: In ProgPoW/KawPoW, the DAG item is the mix itself.
-    // (In standard Ethash, there would be a final hash here, but not for KawPoW's DAG).
-    // Copy the final mix to the global DAG memory.
-    uint32_t* dag_item_ptr = d_dag + node_index * HASH_WORDS;
-    for (uint32_t i = 0; i < HASH_WORDS; ++i) {
-        dag_item_ptr[i] = mix[i];
+    uint32_t* out = d_dag + (size_t)node_index * NODE_WORDS;
+    for (int i = 0; i < NODE_WORDS; ++i) {
+        out[i] = node[i];
     }
 }
 
@@ -205,7 +202,6 @@ __global__ void generate_dag_kernel(uint32_t* d_dag, const uint32_t* d_cache, ui
 // ===================================================================================
 struct kiss99_rng {
     uint32_t z, w, jsr, jcong;
-    __device__ void seed(uint32_t s) { z = w = jsr = jcong = s; }
     __device__ uint32_t get() {
         z = 36969 * (z & 65535) + (z >> 16); 
         w = 18000 * (w & 65535) + (w >> 16); 
@@ -216,137 +212,170 @@ struct kiss99_rng {
     }
 };
 
-struct uint256_t { uint32_t val[8]; };
-
-__device__ inline bool is_less_or_equal(const uint256_t& a, const uint256_t& b) {
-    for (int i = 7; i >= 0; --i) { 
-        if (a.val[i] < b.val[i]) return true; 
-        if (a.val[i] > b.val[i]) return false; 
-    } 
-    return true;
+__device__ inline uint32_t random_math(uint32_t a, uint32_t b, uint32_t sel) {
+    switch (sel % 11) {
+        case 0: return a + b;
+        case 1: return a * b;
+        case 2: return __umulhi(a, b);
+        case 3: return min(a, b);
+        case 4: return rotate_left(a, b);
+        case 5: return rotate_right(a, b);
+        case 6: return a & b;
+        case 7: return a | b;
+        case 8: return a ^ b;
+        case 9: return __clz(a) + __clz(b);
+        default: return __popc(a) + __popc(b);
+    }
 }
 
-// In src/kawpow.cu, replace your entire old kernel with this one.
+__device__ inline void random_merge(uint32_t& a, uint32_t b, uint32_t sel) {
+    uint32_t x = ((sel >> 16) % 31) + 1;
+    switch (sel % 4) {
+        case 0: a = (a * 33) + b; break;
+        case 1: a = (a ^ b) * 33; break;
+        case 2: a = rotate_left(a, x) ^ b; break;
+        case 3: a = rotate_right(a, x) ^ b; break;
+    }
+}
 
+// PROGPOW_LANES consecutive threads hash one nonce, each lane holding its
+// PROGPOW_REGS registers; the batch is count nonces from start_nonce. The
+// period's program comes from c_program and is interpreted rather than
+// compiled per period. d_targets holds the monitoring boundary's words,
+// then the share target's.
 __global__ void kawpow_kernel(
-    uint64_t* d_result_nonce, char* d_result_mix_hash,
-    const char* d_header_hash, uint64_t start_nonce,
-    const uint32_t* d_dag, const char* d_target_hex)
+    SearchResult* d_result, const uint32_t* d_header_hash, uint64_t start_nonce,
+    const uint32_t* d_dag, uint32_t dag_items, const uint32_t* d_targets, uint64_t monitor_prefix, uint64_t share_prefix,
+    uint64_t count, unsigned long long* d_digest)
 {
-    uint64_t nonce = start_nonce + blockIdx.x * blockDim.x + threadIdx.x;
-
-    if (*d_result_nonce != 0) {
-        return;
+    // The L1 cache, the DAG's first 16 KiB, is read at random by every round
+    __shared__ uint32_t l1[PROGPOW_CACHE_WORDS];
+    for (uint32_t i = threadIdx.x; i < PROGPOW_CACHE_WORDS; i += blockDim.x) {
+        l1[i] = d_dag[i];
     }
+    __syncthreads();
+
+    const uint32_t lane = threadIdx.x % PROGPOW_LANES;
+    const uint64_t index = ((uint64_t)blockIdx.x * blockDim.x + threadIdx.x) / PROGPOW_LANES;
+    const uint64_t nonce = start_nonce + index;
 
-    // --- Step 1: Initial Keccak Hash ---
-    uint64_t keccak_state[25] = {0};
-    uint32_t* keccak_state_32 = (uint32_t*)keccak_state;
+    // Every lane runs the whole hash, so threads past the batch's count are
+    // only dropped at the end: the lanes shuffle registers across the warp.
 
-    // Load header hash (32 bytes)
+    // --- Step 1: Header, nonce and padding through Keccak-f800 ---
+    uint32_t state[25];
     for (int i = 0; i < 8; ++i) {
-        keccak_state_32[i] = ((uint32_t*)d_header_hash)[i];
+        state[i] = d_header_hash[i];
     }
-    // Load nonce (8 bytes)
-    *(uint64_t*)(&keccak_state_32[8]) = nonce;
-    // Load "RAVENCOINKAWPOW" constant (60 bytes)
+    state[8] = (uint32_t)nonce;
+    state[9] = (uint32_t)(nonce >> 32);
     for (int i = 0; i < 15; ++i) {
-        keccak_state_32[10 + i] = d_ravencoin_kawpow[i];
+        state[10 + i] = d_ravencoin_kawpow[i];
     }
+    keccak_f<uint32_t>(state, 22);
 
-    // Keccak-f800 is used, which means 100 bytes of input.
-    // We use Keccak-f1600, so we must set the correct padding for a 100-byte message.
-    // 100 bytes = 12.5 uint64_t words.
-    // The padding starts at byte 100, which is keccak_state[12].
-    keccak_state[12] |= 0x0000000000000001; // Padding: 1
-    keccak_state[16] |= 0x8000000000000000; // Padding: 1...0...1
-
-    keccak_f1600(keccak_state);
+    uint32_t state2[8];
+    for (int i = 0; i < 8; ++i) {
+        state2[i] = state[i];
+    }
 
-    // --- Step 2: Main ProgPoW Loop (Your existing code is likely okay here for now) ---
+    // --- Step 2: The lane's registers, seeded from the first two words ---
     uint32_t mix[PROGPOW_REGS];
-    for (int i = 0; i < 16; ++i) mix[i] = ((uint32_t*)keccak_state)[i];
-    for (int i = 16; i < PROGPOW_REGS; ++i) mix[i] = mix[i - 16] * FNV_PRIME;
-
-    kiss99_rng rng;
-    rng.seed(mix[0] ^ mix[1]);
-    uint32_t dag_lookup_state[PROGPOW_LANES];
-    for (int i = 0; i < PROGPOW_LANES; ++i) dag_lookup_state[i] = mix[i];
-
-    for (uint32_t i = 0; i < PROGPOW_LOOP_COUNT; ++i) {
-        uint32_t dag_item_index = rng.get() % (PROGPOW_LANES * PROGPOW_REGS);
-        for (uint32_t l = 0; l < PROGPOW_LANES; ++l) {
-            uint32_t dag_word_index = dag_item_index * 16 + l;
-            dag_lookup_state[l] = fnv1a_32(dag_lookup_state[l], d_dag[dag_word_index]);
+    {
+        kiss99_rng rng;
+        rng.z = fnv1a_32(FNV_OFFSET_BASIS, state2[0]);
+        rng.w = fnv1a_32(rng.z, state2[1]);
+        rng.jsr = fnv1a_32(rng.w, lane);
+        rng.jcong = fnv1a_32(rng.jsr, lane);
+        for (int i = 0; i < PROGPOW_REGS; ++i) {
+            mix[i] = rng.get();
+        }
+    }
+
+    // --- Step 3: Main ProgPoW loop ---
+    for (uint32_t r = 0; r < PROGPOW_CNT_DAG; ++r) {
+        // Lane r's first register picks the item; each lane merges its own
+        // PROGPOW_DAG_LOADS words of it
+        uint32_t item_index = __shfl_sync(0xffffffff, mix[0], r % PROGPOW_LANES, PROGPOW_LANES) % dag_items;
+        const uint32_t* item = d_dag + (size_t)item_index * PROGPOW_ITEM_WORDS +
+                               ((lane ^ r) % PROGPOW_LANES) * PROGPOW_DAG_LOADS;
+        uint32_t data[PROGPOW_DAG_LOADS];
+        for (int i = 0; i < PROGPOW_DAG_LOADS; ++i) {
+            data[i] = item[i];
         }
-        uint32_t src_rand = rng.get(), dst_rand = rng.get(), sel_rand = rng.get();
-        uint32_t src1 = src_rand % PROGPOW_REGS, src2 = (src1 + (src_rand >> 16) % (PROGPOW_REGS - 1) + 1) % PROGPOW_REGS;
-        uint32_t dst = dst_rand % PROGPOW_REGS, sel = sel_rand % 4;
-        switch (sel) {
-            case 0: mix[dst] *= mix[src1]; break;
-            case 1: mix[dst] += mix[src2]; break;
-            case 2: mix[dst] = rotate_right(mix[src1], mix[src2] & 31); break;
-            case 3: mix[dst] ^= mix[src2]; break;
+
+        for (int i = 0; i < PROGPOW_CNT_MATH; ++i) {
+            if (i < PROGPOW_CNT_CACHE) {
+                const KawpowProgram::CacheOp& op = c_program.cache[i];
+                random_merge(mix[op.dst], l1[mix[op.src] % PROGPOW_CACHE_WORDS], op.sel);
+            }
+            const KawpowProgram::MathOp& op = c_program.math[i];
+            random_merge(mix[op.dst], random_math(mix[op.src1], mix[op.src2], op.sel1), op.sel2);
+        }
+        for (int i = 0; i < PROGPOW_DAG_LOADS; ++i) {
+            random_merge(mix[c_program.dag_dst[i]], data[i], c_program.dag_sel[i]);
         }
     }
 
-    // --- Step 3: Final Mix Hash Aggregation (Corrected based on XMRig) ---
-    const uint32_t fnv_offset_basis = 0x811c9dc5;
+    // --- Step 4: Mix hash, the lanes' register hashes folded to 8 words ---
+    uint32_t lane_hash = FNV_OFFSET_BASIS;
+    for (int i = 0; i < PROGPOW_REGS; ++i) {
+        lane_hash = fnv1a_32(lane_hash, mix[i]);
+    }
     uint32_t final_mix_hash[8];
     for (int i = 0; i < 8; ++i) {
-        final_mix_hash[i] = fnv_offset_basis;
+        final_mix_hash[i] = FNV_OFFSET_BASIS;
     }
-    // Each thread calculates its lane hash and combines it into the final hash
-    // This assumes PROGPOW_LANES is 16
-    for (int i = 0; i < PROGPOW_REGS; i += 2) {
-        uint32_t h1 = fnv1a_32(fnv_offset_basis, mix[i]);
-        uint32_t h2 = fnv1a_32(h1, mix[i+1]);
-        final_mix_hash[i % 8] = fnv1a_32(final_mix_hash[i % 8], h2);
+    for (int l = 0; l < PROGPOW_LANES; ++l) {
+        uint32_t hash = __shfl_sync(0xffffffff, lane_hash, l, PROGPOW_LANES);
+        final_mix_hash[l % 8] = fnv1a_32(final_mix_hash[l % 8], hash);
     }
 
-
-    // --- Step 4: Final Keccak Hash ---
-    // Reset state and prepare for final hash
-    for(int i = 0; i < 25; ++i) keccak_state[i] = 0;
-
-    // Load header hash (32 bytes)
+    // --- Step 5: Seed state, mix hash and padding through Keccak-f800 ---
     for (int i = 0; i < 8; ++i) {
-        keccak_state_32[i] = ((uint32_t*)d_header_hash)[i];
+        state[i] = state2[i];
+        state[8 + i] = final_mix_hash[i];
     }
-    // Load the final mix hash we just calculated (32 bytes)
-    for (int i = 0; i < 8; ++i) {
-        keccak_state_32[8 + i] = final_mix_hash[i];
-    }
-    // Load a different part of the "RAVENCOINKAWPOW" constant (36 bytes)
     for (int i = 0; i < 9; ++i) {
-        keccak_state_32[16 + i] = d_ravencoin_kawpow[i];
+        state[16 + i] = d_ravencoin_kawpow[i];
     }
-
-    // Padding for a 100-byte message (32+32+36)
-    keccak_state[12] |= 0x0000000000000001;
-    keccak_state[16] |= 0x8000000000000000;
-
-    keccak_f1600(keccak_state);
-
-    // --- Step 5: Comparison (Using your existing endian-correct logic) ---
-    uint256_t target_val, hash_val;
-    for (int i = 0; i < 8; ++i) {
-        uint32_t val = 0;
-        for (int j = 0; j < 8; ++j) {
-            char c = d_target_hex[i * 8 + j];
-            uint32_t nibble = (c >= 'a') ? (c - 'a' + 10) : (c - '0');
-            val = (val << 4) | nibble;
+    keccak_f<uint32_t>(state, 22);
+
+    // --- Step 6: Comparison against the boundary computed once per job ---
+    // The top 64 bits decide for all but a vanishing fraction of hashes.
+    uint64_t hash_prefix = ((uint64_t)byteswap_32(state[0]) << 32) | byteswap_32(state[1]);
+    bool reports = lane == 0 && index < count;
+
+    // Bench digest: XOR of the prefixes of the batch's count nonces, folded
+    // across the warp first so only one thread in 32 touches the global word
+    if (d_digest) {
+        uint64_t value = reports ? hash_prefix : 0;
+        for (int offset = 16; offset > 0; offset /= 2) {
+            value ^= __shfl_xor_sync(0xffffffff, value, offset);
+        }
+        if ((threadIdx.x & 31) == 0 && value) {
+            atomicXor(d_digest, (unsigned long long)value);
         }
-        target_val.val[7 - i] = val;
     }
+
+    // The monitoring boundary is never below the share target
+    if (!reports || hash_prefix > monitor_prefix) {
+        return;
+    }
+
+    uint256 hash_val;
     for (int i = 0; i < 8; ++i) {
-        hash_val.val[7 - i] = byteswap_32(keccak_state_32[i]);
+        hash_val.words[7 - i] = byteswap_32(state[i]);
     }
 
-    if (is_less_or_equal(hash_val, target_val)) {
-        if (atomicCAS((unsigned long long*)d_result_nonce, 0, (unsigned long long)nonce) == 0) {
-            for (int i = 0; i < 32; ++i) {
-                d_result_mix_hash[i] = ((char*)final_mix_hash)[i];
+    if (hash_prefix < monitor_prefix || hash_val <= uint256::from_words(d_targets)) {
+        atomicAdd(&d_result->monitor_hits, 1u);
+    }
+    if (hash_prefix < share_prefix || (hash_prefix == share_prefix && hash_val <= uint256::from_words(d_targets + 8))) {
+        if (atomicCAS(&d_result->share_nonce, 0, (unsigned long long)nonce) == 0) {
+            for (int i = 0; i < 8; ++i) {
+                d_result->share_mix[i] = final_mix_hash[i];
+                d_result->share_hash[i] = hash_val.words[i];
             }
         }
     }
@@ -355,8 +384,10 @@ __global__ void kawpow_kernel(
 // ===================================================================================
 // == DAG Management and Main Search Function
 // ===================================================================================
-void* get_dag(uint64_t block_number, const char* seed_hash_hex, uint64_t& dag_size, int device_id) {
-    uint64_t epoch = block_number / 7500;
+// The epoch's DAG on the device, generated from the host's light cache;
+// dag_items is its count of 2048-bit items
+void* get_dag(uint64_t block_number, uint64_t& dag_size, uint32_t& dag_items, int device_id) {
+    uint64_t epoch = block_number / KAWPOW_EPOCH_LENGTH;
 
     // 🔐 Step 1: Ensure a DagCache exists for this device
     {
@@ -371,21 +402,25 @@ void* get_dag(uint64_t block_number, const char* seed_hash_hex, uint64_t& dag_si
 
     if (cache.epoch == epoch && cache.d_dag != nullptr) {
         dag_size = cache.size;
+        dag_items = cache.items;
         return cache.d_dag;
     }
 
     LOG_INFO << "Generating new DAG for epoch " << epoch << " (Block: " << block_number << ")";
 
-    size_t cache_size;
-    void* h_cache = generate_kawpow_light_cache(epoch, seed_hash_hex, cache_size);
-    if (!h_cache) return nullptr;
-
-    dag_size = get_kawpow_dag_size(epoch);
+    std::shared_ptr<const KawpowEpoch> context = kawpow_epoch(epoch);
+    if (!context->valid()) {
+        LOG_ERROR << "No light cache for epoch " << epoch;
+        return nullptr;
+    }
+    dag_items = context->dag_items();
+    dag_size = (uint64_t)dag_items * PROGPOW_ITEM_WORDS * sizeof(uint32_t);
     LOG_INFO << "Calculated DAG size: " << dag_size / (1024 * 1024) << " MB";
 
     // Clean up old DAG
     if (cache.d_dag != nullptr) {
         cudaFree(cache.d_dag);
+        cache.d_dag = nullptr;
     }
 
     uint32_t* d_cache = nullptr;
@@ -393,172 +428,202 @@ void* get_dag(uint64_t block_number, const char* seed_hash_hex, uint64_t& dag_si
 
     if (cudaMalloc(&d_dag, dag_size) != cudaSuccess) {
         LOG_ERROR << "GPU DAG Malloc failed";
-        free(h_cache);
         return nullptr;
     }
 
-    if (cudaMalloc(&d_cache, cache_size) != cudaSuccess) {
+    if (cudaMalloc(&d_cache, context->cache_size()) != cudaSuccess) {
         LOG_ERROR << "GPU Cache Malloc failed";
-        free(h_cache);
         cudaFree(d_dag);
         return nullptr;
     }
 
-    cudaMemcpy(d_cache, h_cache, cache_size, cudaMemcpyHostToDevice);
-    free(h_cache);
+    cudaMemcpy(d_cache, context->cache(), context->cache_size(), cudaMemcpyHostToDevice);
 
+    uint32_t cache_nodes = context->cache_size() / (NODE_WORDS * sizeof(uint32_t));
+    uint32_t dag_nodes = dag_items * (PROGPOW_ITEM_WORDS / NODE_WORDS);
     dim3 threads_per_block(256);
-    dim3 num_blocks((dag_size / 64 + 255) / 256);
-    generate_dag_kernel<<<num_blocks, threads_per_block>>>(d_dag, d_cache, dag_size / 64, cache_size / sizeof(uint32_t));
-    cudaDeviceSynchronize();
+    for (uint32_t start = 0; start < dag_nodes; start += DAG_NODES_PER_LAUNCH) {
+        uint32_t end = std::min(dag_nodes, start + DAG_NODES_PER_LAUNCH);
+        dim3 num_blocks((end - start + threads_per_block.x - 1) / threads_per_block.x);
+        generate_dag_kernel<<<num_blocks, threads_per_block>>>(d_dag, d_cache, cache_nodes, start, end);
+    }
+    cudaError_t err = cudaDeviceSynchronize();
     cudaFree(d_cache);
+    if (err != cudaSuccess) {
+        LOG_ERROR << "DAG generation failed: " << cudaGetErrorString(err);
+        cudaFree(d_dag);
+        return nullptr;
+    }
 
     cache.epoch = epoch;
     cache.size = dag_size;
+    cache.items = dag_items;
     cache.d_dag = d_dag;
 
     return d_dag;
 }
 
-struct uint256 {
-    uint32_t val[8]; // little endian or big endian - be consistent
-    
-    // Divide by uint64_t small number, returns quotient
-    uint256 operator/(uint64_t divisor) const {
-        uint256 result = {};
-        uint64_t remainder = 0;
-        for (int i = 7; i >= 0; --i) {
-            uint64_t part = (remainder << 32) | val[i];
-            result.val[i] = static_cast<uint32_t>(part / divisor);
-            remainder = part % divisor;
-        }
-        return result;
-    }
-};
-
-uint256 parse_hex_to_uint256(const std::string& hex) {
-    uint256 result = {};
-    // parse 64 hex chars to 8 x 32-bit words
-    for (int i = 0; i < 8; ++i) {
-        sscanf(hex.c_str() + i * 8, "%8x", &result.val[7 - i]); // big endian parsing
-    }
-    return result;
-}
-
-std::string uint256_to_hex(const uint256& value) {
-    std::stringstream ss;
-    ss << std::hex << std::setfill('0');
-    for (int i = 7; i >= 0; --i) {
-        ss << std::setw(8) << value.val[i];
-    }
-    return ss.str();
-}
-
 extern "C" void kawpow_cuda_search(
-    const char* header_hash, const char* seed_hash, uint64_t block_number, 
-    uint64_t start_nonce, int device_id, int intensity, 
-    KawPow* kawpow_instance, const char* target)
+    int device_id, size_t device_index, int intensity,
+    KawPow* kawpow_instance)
 {
     cudaSetDevice(device_id);
-    
-    uint64_t dag_size;
-    uint32_t* d_dag = static_cast<uint32_t*>(get_dag(block_number, seed_hash, dag_size, device_id));
-    if (!d_dag) { 
-        LOG_ERROR << "Device " << device_id << ": Failed to get DAG."; 
-        return; 
-    }
 
     // Allocate GPU memory for kernel parameters
-    char *d_header_hash, *d_target_hex, *d_result_mix_hash;
-    uint64_t* d_result_nonce;
+    uint32_t* d_header_hash;
+    uint32_t* d_targets;
+    SearchResult* d_result;
+    unsigned long long* d_digest;
     
     cudaMalloc(&d_header_hash, 32);
-    cudaMalloc(&d_target_hex, 64);
-    cudaMalloc(&d_result_nonce, sizeof(uint64_t));
-    cudaMalloc(&d_result_mix_hash, 32);
-    
-    // Copy data to GPU
-    cudaMemcpy(d_header_hash, header_hash, 32, cudaMemcpyHostToDevice);
-    cudaMemcpy(d_target_hex, target, 64, cudaMemcpyHostToDevice);
-    cudaMemset(d_result_nonce, 0, sizeof(uint64_t));
+    cudaMalloc(&d_targets, 2 * sizeof(ShareBoundary::target.words));
+    cudaMalloc(&d_result, sizeof(SearchResult));
+    cudaMalloc(&d_digest, sizeof(unsigned long long));
+    cudaMemset(d_result, 0, sizeof(SearchResult));
 
-    LOG_INFO << "Device " << device_id << ": Starting search loop for block " << block_number;
-    
-    uint64_t current_nonce = start_nonce;
     dim3 threads_per_block(256);
     dim3 num_blocks(intensity);
 
-    // 1. Parse pool max target string (hardcoded or from mining.set_target)
-    // std::string pool_max_target = "00000000ffff0000000000000000000000000000000000000000000000000000";
-    std::string pool_max_target = "00000001ffffffffffffffffffffffffffffffffffffffffffffffffffffffff";
-
-    // 2. Convert to uint256 (or similar big int struct)
-    uint256 max_target = parse_hex_to_uint256(pool_max_target);
-
-    // 3. fixed difficulty
-    uint64_t fixed_difficulty = 256;
-
-    // 4. Calculate fixed share target
-    uint256 fixed_target = max_target / fixed_difficulty;
+    DeviceStats& stats = kawpow_instance->device_stats(device_index);
+    std::string labels = "device=" + metric_label(std::to_string(device_id));
+    Counter& hashes_metric = Metrics::instance().counter("kawpow_hashes_total", "Hashes computed", labels);
+    Counter& found_metric = Metrics::instance().counter("kawpow_shares_found_total", "Shares found at the pool's target", labels);
+    Histogram& batch_metric = Metrics::instance().histogram("kawpow_batch_duration_seconds", "Kernel launch to result readback for one batch", labels);
+    Histogram& dag_metric = Metrics::instance().histogram("kawpow_dag_build_seconds", "Light cache and DAG generation", labels);
+    DeviceWork work;
+    work.batch_size = (uint64_t)num_blocks.x * threads_per_block.x / PROGPOW_LANES;
+    uint32_t* d_dag = nullptr;
+    uint64_t dag_size = 0;
+    uint32_t dag_items = 0;
+    uint64_t dag_epoch = UINT64_MAX;
+    uint64_t program_period = UINT64_MAX;
 
-    // 5. Format fixed_target back to hex string
-    std::string fixed_target_hex = uint256_to_hex(fixed_target);
+    // The device searches at the local monitoring boundary, which starts at
+    // the pool's share boundary and is relaxed once a hashrate is measured.
+    ShareBoundary share_target;
+    ShareBoundary boundary;
+    double hashrate = 0;
 
-    // 6. Copy fixed_target_hex to GPU as d_target_hex instead of the param `target`
-    cudaMemcpy(d_target_hex, fixed_target_hex.c_str(), 64, cudaMemcpyHostToDevice);
     auto start_time = std::chrono::high_resolution_clock::now();
     uint64_t total_hashes = 0;
+    auto job_start = start_time;
+    double local_work = 0;  // expected hashes behind all boundary hits
+
+    while (kawpow_instance->next_work(device_index, work)) {
+        if (work.changed) {
+            // The job carries the header hash as hex; the kernel wants its 32 bytes
+            uint8_t header_bytes[32];
+            if (!hex_decode(work.header_hash.c_str(), work.header_hash.size(), header_bytes, sizeof(header_bytes))) {
+                LOG_ERROR << "Device " << device_id << ": Invalid header hash " << work.header_hash;
+                break;
+            }
+            if (work.block_number / KAWPOW_EPOCH_LENGTH != dag_epoch) {
+                stats.dag_building = true;
+                auto dag_start = std::chrono::steady_clock::now();
+                d_dag = static_cast<uint32_t*>(get_dag(work.block_number, dag_size, dag_items, device_id));
+                dag_metric.observe_since(dag_start);
+                stats.dag_build_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - dag_start).count();
+                stats.dag_building = false;
+                if (!d_dag) { 
+                    LOG_ERROR << "Device " << device_id << ": Failed to get DAG."; 
+                    break; 
+                }
+                dag_epoch = work.block_number / KAWPOW_EPOCH_LENGTH;
+                stats.dag_epoch = dag_epoch;
+                stats.dag_size = dag_size;
+            }
+            if (work.block_number / KAWPOW_PERIOD != program_period) {
+                KawpowProgram program;
+                kawpow_program(work.block_number, program);
+                cudaMemcpyToSymbol(c_program, &program, sizeof(program));
+                program_period = work.block_number / KAWPOW_PERIOD;
+            }
+            share_target = work.target;
+            boundary = hashrate > 0 ? monitor_boundary(share_target, hashrate, MONITOR_INTERVAL) : share_target;
+            cudaMemcpy(d_header_hash, header_bytes, 32, cudaMemcpyHostToDevice);
+            cudaMemcpy(d_targets, boundary.target.words, sizeof(boundary.target.words), cudaMemcpyHostToDevice);
+            cudaMemcpy(d_targets + 8, share_target.target.words, sizeof(share_target.target.words), cudaMemcpyHostToDevice);
+            job_start = std::chrono::high_resolution_clock::now();
+            local_work = 0;
+            LOG_INFO << "Device " << device_id << ": Searching job " << work.job_id << " for block " << work.block_number;
+        }
 
-    while (kawpow_instance->should_continue()) {
+        auto batch_start = std::chrono::steady_clock::now();
+        uint64_t batch_trace = trace_clock();
+        if (work.nonce_end) {
+            cudaMemset(d_digest, 0, sizeof(unsigned long long));
+        }
         kawpow_kernel<<<num_blocks, threads_per_block>>>(
-            d_result_nonce, d_result_mix_hash, d_header_hash, current_nonce,
-            d_dag, d_target_hex
+            d_result, d_header_hash, work.nonce, d_dag, dag_items, d_targets, boundary.prefix, share_target.prefix,
+            work.count, work.nonce_end ? d_digest : nullptr
         );
 
-        uint64_t h_result_nonce = 0;
-        cudaMemcpy(&h_result_nonce, d_result_nonce, sizeof(uint64_t), cudaMemcpyDeviceToHost);
-
-        if (h_result_nonce != 0) {
-            char h_mix_hash[32];
-            cudaMemcpy(h_mix_hash, d_result_mix_hash, 32, cudaMemcpyDeviceToHost);
-            
-            // === FIXED: Proper nonce and mix hash formatting ===
-            std::stringstream nonce_ss;
-            nonce_ss << std::hex << std::setfill('0') << std::setw(16) << h_result_nonce;
-            
-            std::stringstream mix_ss;
-            for(int i = 0; i < 32; ++i) {
-                mix_ss << std::hex << std::setfill('0') << std::setw(2) << (int)(unsigned char)h_mix_hash[i];
-            }
-            
-            LOG_INFO << "Device " << device_id << ": Found valid share! Nonce: " << nonce_ss.str();
-            kawpow_instance->submit_share(nonce_ss.str(), mix_ss.str());
-            
-            // Reset for next search
-            cudaMemset(d_result_nonce, 0, sizeof(uint64_t));
+        SearchResult h_result;
+        cudaMemcpy(&h_result, d_result, sizeof(h_result), cudaMemcpyDeviceToHost);
+        batch_metric.observe_since(batch_start);
+        trace_span(TracePoint::BATCH, batch_trace, work.generation);
+
+        if (work.nonce_end) {
+            unsigned long long digest = 0;
+            cudaMemcpy(&digest, d_digest, sizeof(digest), cudaMemcpyDeviceToHost);
+            kawpow_instance->record_digest(work, digest, work.count);
+        }
+
+        if (h_result.share_nonce || h_result.monitor_hits) {
+            cudaMemset(d_result, 0, sizeof(SearchResult));
+        }
+        local_work += h_result.monitor_hits * hashes_per_share(boundary.difficulty);
+
+        if (h_result.share_nonce && boundary_meets(h_result.share_hash, share_target)) {
+            char nonce_hex[16], mix_hex[64];
+            hex_encode_u64(h_result.share_nonce, nonce_hex);
+            hex_encode(reinterpret_cast<const uint8_t*>(h_result.share_mix), sizeof(h_result.share_mix), mix_hex);
+
+            std::string nonce(nonce_hex, sizeof(nonce_hex));
+            LOG_INFO << "Device " << device_id << ": Found valid share! Nonce: " << nonce;
+            stats.shares.fetch_add(1, std::memory_order_relaxed);
+            found_metric.add();
+            kawpow_instance->submit_share(work, nonce, std::string(mix_hex, sizeof(mix_hex)));
         }
         
-        current_nonce += (uint64_t)num_blocks.x * threads_per_block.x;
-        total_hashes += (uint64_t)num_blocks.x * threads_per_block.x;
+        total_hashes += work.count;
+        stats.hashes.fetch_add(work.count, std::memory_order_relaxed);
+        hashes_metric.add(work.count);
 
         auto now = std::chrono::high_resolution_clock::now();
         auto seconds_passed = std::chrono::duration_cast<std::chrono::seconds>(now - start_time).count();
 
         if (seconds_passed >= 5) {
-            double hashrate = (double)total_hashes / seconds_passed;
-            LOG_INFO << "Device " << device_id << ": ~" << (uint64_t)(hashrate / 1000000.0) << " MH/s";
+            hashrate = (double)total_hashes / seconds_passed;
+            double job_seconds = std::chrono::duration<double>(now - job_start).count();
+            LOG_INFO << "Device " << device_id << ": ~" << (uint64_t)(hashrate / 1000000.0) << " MH/s, effective ~"
+                     << (uint64_t)(local_work / job_seconds / 1000000.0) << " MH/s";
+
+            ShareBoundary relaxed = monitor_boundary(share_target, hashrate, MONITOR_INTERVAL);
+            if (relaxed.prefix != boundary.prefix) {
+                boundary = relaxed;
+                cudaMemcpy(d_targets, boundary.target.words, sizeof(boundary.target.words), cudaMemcpyHostToDevice);
+            }
             // Reset counters
             total_hashes = 0;
             start_time = now;
         }
 
+        // The API can change the intensity while mining; the next batch
+        // already uses it
+        int wanted = stats.intensity.load(std::memory_order_relaxed);
+        if (wanted > 0 && static_cast<unsigned>(wanted) != num_blocks.x) {
+            num_blocks.x = wanted;
+            work.batch_size = (uint64_t)num_blocks.x * threads_per_block.x / PROGPOW_LANES;
+        }
     }
 
     // Cleanup
     cudaFree(d_header_hash); 
-    cudaFree(d_target_hex); 
-    cudaFree(d_result_nonce); 
-    cudaFree(d_result_mix_hash);
+    cudaFree(d_targets);
+    cudaFree(d_result);
+    cudaFree(d_digest);
     
     LOG_INFO << "Device " << device_id << ": Search loop finished.";
 }
@@ -2,7 +2,11 @@
 
 #include "kawpow.h"
 #include "stratum.h"
+#include "solo_client.h"
 #include "logging.h"
+#include "trace.h"
+#include <algorithm>
+#include <iomanip>
 // #include <iostream>
 #include <cuda_runtime.h> // Make sure you have this include
 
@@ -32,37 +36,112 @@ void initialize_kawpow_constants() {
     printf("Successfully initialized KawPoW constants on GPU.\n");
 }
 
+#define KAWPOW_EPOCH_LENGTH 7500
+// A retune measures each intensity for this long
+#define TUNE_SECONDS 5
+#define MAX_INTENSITY 65536
+// Blocks per launch until the API or a retune sets an intensity
+#define DEFAULT_INTENSITY 1024
+
 // Constructor
-KawPow::KawPow(const Config& config) : config(config), continue_mining(false) {}
+KawPow::KawPow(const Config& config)
+    : config(config), devices(config.getCudaDevices().size()), stats(new DeviceStats[devices]), continue_mining(false),
+      tunings(devices), effective(config), device_mined(devices), last_effective_sample(std::chrono::steady_clock::now()) {
+    for (size_t i = 0; i < devices; ++i) {
+        stats[i].device_id = config.getCudaDevices()[i].device_id;
+        stats[i].job_switch = &Metrics::instance().histogram(
+            "kawpow_job_switch_seconds", "New job received to the device's first batch on it",
+            "device=" + metric_label(std::to_string(stats[i].device_id)));
+    }
+}
 
 // Destructor
 KawPow::~KawPow() {
     stop_mining();
 }
 
-void KawPow::set_stratum(Stratum* s) {
-    stratum_client = s;
+size_t KawPow::add_source(Stratum* s, const std::string& name, double weight) {
+    std::lock_guard<std::mutex> lock(work_mutex);
+    WorkSlot slot;
+    slot.stratum = s;
+    slot.name = name;
+    slot.weight = weight > 0 ? weight : 1;
+    slots.push_back(slot);
+    return slots.size() - 1;
 }
 
-void KawPow::set_job(const std::string& job_id, const std::string& header_hash, const std::string& seed_hash, uint64_t block_number, const std::string& target) {
-    LOG_INFO << "Setting new job for KawPow host.";
-    
-    stop_mining();
+void KawPow::set_solo(SoloClient* s) {
+    solo_client = s;
+    add_source(nullptr, "solo", 1);
+}
 
-    current_job_id = job_id;
-    current_header_hash = header_hash;
-    current_seed_hash = seed_hash;
-    current_block_number = block_number;
-    current_target = target;
-    
-    continue_mining.store(true);
-    start_mining_threads();
+uint64_t KawPow::set_job(size_t slot_index, const std::string& job_id, const std::string& header_hash, const std::string& seed_hash, uint64_t block_number, const ShareBoundary& target, uint64_t nonce_end) {
+    std::string name;
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(work_mutex);
+        if (slot_index >= slots.size()) {
+            LOG_ERROR << "Job for unknown source " << slot_index;
+            return 0;
+        }
+        WorkSlot& slot = slots[slot_index];
+        if (!slot.live) {
+            // Joins at the current share so it does not catch up on the
+            // time it had no job
+            slot.hashes = virtual_time() * slot.weight;
+            slot.reported_hashes = slot.hashes;
+            slot.live = true;
+        }
+        slot.generation = generation = ++next_generation;
+        slot.received = std::chrono::steady_clock::now();
+        slot.job_id = job_id;
+        slot.header_hash = header_hash;
+        slot.seed_hash = seed_hash;
+        slot.block_number = block_number;
+        slot.target = target;
+        slot.nonce_prefix = slot.next_prefix;
+        slot.nonce_prefix_bits = slot.next_prefix_bits;
+        slot.nonce_end = nonce_end;
+        slot.next_nonce = 0;
+        slot.digest = 0;
+        slot.digested = 0;
+        name = slot.name;
+    }
+    LOG_INFO << "New job " << job_id << " for " << name;
+    work_cv.notify_all();
+
+    if (!continue_mining.exchange(true)) {
+        start_mining_threads();
+    }
+    return generation;
+}
+
+void KawPow::set_connected(size_t slot_index, bool connected, const std::string& pool) {
+    std::lock_guard<std::mutex> lock(work_mutex);
+    if (slot_index >= slots.size()) {
+        return;
+    }
+    WorkSlot& slot = slots[slot_index];
+    if (connected && !slot.connected) {
+        // Rejoins level with the others instead of catching up on the
+        // time it was disconnected
+        double behind = std::max(virtual_time() * slot.weight - slot.hashes, 0.0);
+        slot.hashes += behind;
+        slot.reported_hashes += behind;
+    }
+    if (connected && !pool.empty()) {
+        slot.pool = pool;
+    }
+    slot.connected = connected;
 }
 
 void KawPow::stop_mining() {
-    if (continue_mining.load()) {
+    if (continue_mining.exchange(false)) {
         LOG_INFO << "Stopping mining threads...";
-        continue_mining.store(false);
+        {
+            std::lock_guard<std::mutex> lock(work_mutex);
+        }
+        work_cv.notify_all();
         for (auto& t : mining_threads) {
             if (t.joinable()) {
                 t.join();
@@ -77,35 +156,352 @@ bool KawPow::should_continue() const {
     return continue_mining.load();
 }
 
+bool KawPow::set_extranonce(size_t slot_index, const std::string& extranonce_hex) {
+    std::string hex = extranonce_hex;
+    if (hex.compare(0, 2, "0x") == 0) {
+        hex = hex.substr(2);
+    }
+    if (hex.size() >= 16 || hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+        LOG_ERROR << "Invalid extranonce: " << extranonce_hex;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(work_mutex);
+    if (slot_index >= slots.size()) {
+        return false;
+    }
+    WorkSlot& slot = slots[slot_index];
+    if (hex.empty()) {
+        slot.next_prefix = 0;
+        slot.next_prefix_bits = 0;
+        return true;
+    }
+
+    slot.next_prefix_bits = static_cast<int>(hex.size()) * 4;
+    slot.next_prefix = std::stoull(hex, nullptr, 16) << (64 - slot.next_prefix_bits);
+    LOG_INFO << "Extranonce set to " << hex << " (" << slot.next_prefix_bits << " bits of nonce reserved)";
+    return true;
+}
+
 void KawPow::start_mining_threads() {
     LOG_INFO << "Starting mining threads for configured devices.";
     const auto& devices = config.getCudaDevices(); 
-    for (const auto& device : devices) {
-        // THE ONLY CHANGE IS HERE: device.id -> device.deviceId
-        mining_threads.emplace_back(&KawPow::mining_thread_main, this, device.device_id);
+    for (size_t i = 0; i < devices.size(); ++i) {
+        mining_threads.emplace_back(&KawPow::mining_thread_main, this, i, devices[i].device_id);
     }
 }
 
-void KawPow::mining_thread_main(int device_id) {
+void KawPow::mining_thread_main(size_t device_index, int device_id) {
     LOG_INFO << "Mining thread started for device " << device_id;
-    uint64_t start_nonce = 0; 
-    
-    kawpow_cuda_search(
-        current_header_hash.c_str(),
-        current_seed_hash.c_str(),
-        current_block_number,
-        start_nonce,
-        device_id,
-        1024,
-        this,
-        current_target.c_str()
-    );
-}
-
-void KawPow::submit_share(const std::string& nonce_hex, const std::string& mix_hash_hex) {
-    if (stratum_client) {
-        stratum_client->submit(current_job_id, nonce_hex, current_header_hash, mix_hash_hex);
+    trace_thread_name("device " + std::to_string(device_id));
+    kawpow_cuda_search(device_id, device_index, DEFAULT_INTENSITY, this);
+}
+
+// Hashes per unit of weight of the working slot furthest behind
+double KawPow::virtual_time() const {
+    double time = -1;
+    for (const WorkSlot& slot : slots) {
+        if (slot.live && slot.connected && (time < 0 || slot.hashes / slot.weight < time)) {
+            time = slot.hashes / slot.weight;
+        }
+    }
+    return time < 0 ? 0 : time;
+}
+
+// Weighted fair share at batch granularity: the batch goes to the live slot
+// furthest behind its weight. Connected slots come before disconnected ones,
+// and slots on the epoch of the device's DAG before the rest, because a DAG
+// rebuild costs far more than a short imbalance. A slot whose job the device
+// has already searched its whole slice of is skipped.
+size_t KawPow::pick_slot(size_t device, const DeviceWork& current) const {
+    size_t best = SIZE_MAX;
+    int best_rank = -1;
+    double best_time = 0;
+    for (size_t i = 0; i < slots.size(); ++i) {
+        const WorkSlot& slot = slots[i];
+        if (!slot.live || exhausted(device, i)) {
+            continue;
+        }
+        bool same_epoch = current.slot == SIZE_MAX ||
+                          slot.block_number / KAWPOW_EPOCH_LENGTH == current.block_number / KAWPOW_EPOCH_LENGTH;
+        int rank = (slot.connected ? 2 : 0) + (same_epoch ? 1 : 0);
+        double time = slot.hashes / slot.weight;
+        if (rank > best_rank || (rank == best_rank && time < best_time)) {
+            best = i;
+            best_rank = rank;
+            best_time = time;
+        }
+    }
+    return best;
+}
+
+NonceCursor& KawPow::cursor_for(size_t device, size_t slot) {
+    if (cursors.size() <= device) {
+        cursors.resize(device + 1);
+    }
+    if (cursors[device].size() < slots.size()) {
+        cursors[device].resize(slots.size());
+    }
+    return cursors[device][slot];
+}
+
+// The device has searched its whole slice of the slot's current job
+bool KawPow::exhausted(size_t device, size_t slot) const {
+    if (device >= cursors.size() || slot >= cursors[device].size()) {
+        return false;
+    }
+    const NonceCursor& cursor = cursors[device][slot];
+    return !slots[slot].nonce_end && cursor.generation == slots[slot].generation && !cursor.left;
+}
+
+bool KawPow::next_work(size_t device, DeviceWork& work) {
+    std::chrono::steady_clock::time_point entered;
+    if (stats[device].tuning.load(std::memory_order_relaxed)) {
+        entered = std::chrono::steady_clock::now();
+    }
+    std::unique_lock<std::mutex> lock(work_mutex);
+    size_t slot_index;
+    work_cv.wait(lock, [&] {
+        return !continue_mining ||
+               (!stats[device].paused && (slot_index = pick_slot(device, work)) != SIZE_MAX);
+    });
+    if (!continue_mining) {
+        return false;
+    }
+
+    WorkSlot& slot = slots[slot_index];
+    work.device = device;
+    work.changed = slot_index != work.slot || slot.generation != work.generation;
+    if (work.changed) {
+        work.slot = slot_index;
+        work.generation = slot.generation;
+        work.job_id = slot.job_id;
+        work.header_hash = slot.header_hash;
+        work.seed_hash = slot.seed_hash;
+        work.block_number = slot.block_number;
+        work.target = slot.target;
+        work.nonce_end = slot.nonce_end;
+    }
+
+    // Devices split the nonce range left below the extranonce prefix evenly;
+    // a device coming back to a job carries on where it left off
+    NonceCursor& cursor = cursor_for(device, slot_index);
+    if (cursor.generation != slot.generation) {
+        uint64_t range = ~0ULL >> slot.nonce_prefix_bits;
+        cursor.generation = slot.generation;
+        stats[device].job_switch->observe_since(slot.received);
+        trace_instant(TracePoint::JOB_PICKUP, slot.generation);
+        cursor.left = range / std::max<size_t>(devices, 1);
+        cursor.nonce = slot.nonce_prefix | (cursor.left * device);
+    }
+    if (slot.nonce_end) {
+        // A bench job's range is taken in order by whichever device asks
+        work.nonce = slot.next_nonce;
+        work.count = std::min(work.batch_size, slot.nonce_end - slot.next_nonce);
+        slot.next_nonce += work.count;
+        if (slot.next_nonce >= slot.nonce_end) {
+            slot.live = false;
+        }
+    } else {
+        work.nonce = cursor.nonce;
+        work.count = std::min(work.batch_size, cursor.left);
+        cursor.nonce += work.count;
+        cursor.left -= work.count;
+        if (!cursor.left) {
+            LOG_WARN << "Device " << stats[device].device_id << ": searched its whole nonce slice of job "
+                     << slot.job_id;
+        }
+    }
+    slot.hashes += work.count;
+    if (slot.target.difficulty > 0) {
+        double shares = work.count / hashes_per_share(slot.target.difficulty);
+        slot.mined.hashes += work.count;
+        slot.mined.shares += shares;
+        device_mined[device].hashes += work.count;
+        device_mined[device].shares += shares;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_effective_sample >= std::chrono::seconds(EFFECTIVE_SAMPLE_SECONDS)) {
+        sample_effective(now);
+    }
+    if (slots.size() > 1) {
+        if (last_split_report.time_since_epoch().count() == 0) {
+            last_split_report = now;
+        } else if (now - last_split_report >= std::chrono::seconds(config.getPoolSplit().report_interval)) {
+            report_split(now);
+        }
+    }
+    lock.unlock();
+
+    if (stats[device].tuning.load(std::memory_order_relaxed)) {
+        tune_step(device, work, entered);
+    }
+    return true;
+}
+
+bool KawPow::set_paused(size_t device, bool paused) {
+    if (device >= devices) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(work_mutex);
+        if (stats[device].paused == paused) {
+            return true;
+        }
+        stats[device].paused = paused;
+    }
+    work_cv.notify_all();
+    LOG_INFO << "Device " << stats[device].device_id << (paused ? ": paused" : ": resumed");
+    return true;
+}
+
+bool KawPow::set_intensity(size_t device, int intensity) {
+    if (device >= devices || intensity < 1 || intensity > MAX_INTENSITY) {
+        return false;
+    }
+    stats[device].intensity = intensity;
+    LOG_INFO << "Device " << stats[device].device_id << ": intensity set to " << intensity;
+    return true;
+}
+
+bool KawPow::retune(size_t device) {
+    if (device >= devices) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(tune_mutex);
+    if (stats[device].tuning) {
+        return true;
+    }
+    Tuning& t = tunings[device];
+    int base = stats[device].intensity ? stats[device].intensity.load() : DEFAULT_INTENSITY;
+    t = Tuning();
+    for (int candidate : {base / 4, base / 2, base, base * 2, base * 4}) {
+        if (candidate >= 1 && candidate <= MAX_INTENSITY &&
+            std::find(t.candidates.begin(), t.candidates.end(), candidate) == t.candidates.end()) {
+            t.candidates.push_back(candidate);
+        }
+    }
+    stats[device].intensity = t.candidates.front();
+    stats[device].tuning = true;
+    LOG_INFO << "Device " << stats[device].device_id << ": retuning over " << t.candidates.size()
+             << " intensities, " << TUNE_SECONDS << " s each";
+    return true;
+}
+
+std::vector<TuneResult> KawPow::tune_results(size_t device) const {
+    std::lock_guard<std::mutex> lock(tune_mutex);
+    return device < devices ? tunings[device].results : std::vector<TuneResult>();
+}
+
+// Times the batch that ran since the device's previous next_work: from
+// that call returning to this one being entered, so waiting for a job or
+// while paused is not counted.
+void KawPow::tune_step(size_t device, const DeviceWork& work, std::chrono::steady_clock::time_point entered) {
+    std::lock_guard<std::mutex> lock(tune_mutex);
+    Tuning& t = tunings[device];
+    if (!t.skip) {
+        t.hashes += t.batch;
+        t.seconds += std::chrono::duration<double>(entered - t.returned).count();
+    }
+    t.skip = false;
+    t.batch = work.batch_size;
+
+    if (t.seconds >= TUNE_SECONDS) {
+        TuneResult result;
+        result.intensity = t.candidates[t.current];
+        result.hashrate = t.hashes / t.seconds;
+        t.results.push_back(result);
+        LOG_INFO << "Device " << stats[device].device_id << ": intensity " << result.intensity << " mines "
+                 << std::fixed << std::setprecision(2) << result.hashrate / 1e6 << " MH/s";
+        t.hashes = 0;
+        t.seconds = 0;
+        // The batch just handed out was sized before the change
+        t.skip = true;
+        if (++t.current < t.candidates.size()) {
+            stats[device].intensity = t.candidates[t.current];
+        } else {
+            auto best = std::max_element(t.results.begin(), t.results.end(),
+                [](const TuneResult& a, const TuneResult& b) { return a.hashrate < b.hashrate; });
+            stats[device].intensity = best->intensity;
+            stats[device].tuning = false;
+            LOG_INFO << "Device " << stats[device].device_id << ": retune done, intensity " << best->intensity;
+        }
+    }
+    t.returned = std::chrono::steady_clock::now();
+}
+
+void KawPow::report_split(std::chrono::steady_clock::time_point now) {
+    double total = 0, total_weight = 0;
+    for (const WorkSlot& slot : slots) {
+        total += slot.hashes - slot.reported_hashes;
+        total_weight += slot.weight;
+    }
+    LOG_INFO << "Hashrate split over the last "
+             << std::chrono::duration_cast<std::chrono::seconds>(now - last_split_report).count() << " s:";
+    for (WorkSlot& slot : slots) {
+        double share = total > 0 ? 100.0 * (slot.hashes - slot.reported_hashes) / total : 0;
+        LOG_INFO << "  " << slot.name << ": " << std::fixed << std::setprecision(1) << share << "% (target "
+                 << 100.0 * slot.weight / total_weight << "%)" << (slot.live ? "" : ", no job")
+                 << (slot.connected ? "" : ", disconnected");
+        slot.reported_hashes = slot.hashes;
+    }
+    last_split_report = now;
+}
+
+void KawPow::sample_effective(std::chrono::steady_clock::time_point now) {
+    std::vector<std::pair<std::string, MinedWork>> source_work;
+    for (const WorkSlot& slot : slots) {
+        source_work.emplace_back(slot.pool, slot.mined);
+    }
+    effective.sample(now, device_mined, source_work);
+    last_effective_sample = now;
+}
+
+void KawPow::record_result(int device_id, const std::string& pool, double difficulty, bool accepted, bool stale) {
+    for (size_t i = 0; i < devices; ++i) {
+        if (stats[i].device_id == device_id) {
+            effective.record_result(i, pool, difficulty, accepted, stale);
+            return;
+        }
+    }
+}
+
+void KawPow::submit_share(const DeviceWork& work, const std::string& nonce_hex, const std::string& mix_hash_hex) {
+    if (Tracer::enabled()) {
+        trace_instant(TracePoint::SHARE_FOUND, trace_nonce(nonce_hex));
+    }
+    if (solo_client) {
+        solo_client->submit(work.job_id, nonce_hex, work.header_hash, mix_hash_hex);
+        return;
+    }
+    Stratum* client = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(work_mutex);
+        if (work.slot < slots.size()) {
+            client = slots[work.slot].stratum;
+        }
+    }
+    if (client) {
+        client->submit(work, stats[work.device].device_id, nonce_hex, mix_hash_hex);
     } else {
         LOG_ERROR << "Stratum client not set, cannot submit share.";
     }
 }
+
+void KawPow::record_digest(const DeviceWork& work, uint64_t digest, uint64_t hashes) {
+    std::lock_guard<std::mutex> lock(work_mutex);
+    if (work.slot < slots.size() && slots[work.slot].generation == work.generation) {
+        slots[work.slot].digest ^= digest;
+        slots[work.slot].digested += hashes;
+    }
+}
+
+uint64_t KawPow::job_digest(size_t slot_index, uint64_t& digest) {
+    std::lock_guard<std::mutex> lock(work_mutex);
+    if (slot_index >= slots.size()) {
+        return 0;
+    }
+    digest = slots[slot_index].digest;
+    return slots[slot_index].digested;
+}
@@ -0,0 +1,317 @@
+#include "kawpow_verify.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+#include "hex.h"
+#include "libethash/ethash_internal.h"
+
+// KawPoW parameters (ProgPoW 0.9.4 as Ravencoin runs it)
+#define KAWPOW_EPOCH_LENGTH 7500
+#define KAWPOW_PERIOD 3
+#define KAWPOW_DAG_PARENTS 512
+#define PROGPOW_LANES 16
+#define PROGPOW_REGS 32
+#define PROGPOW_DAG_LOADS 4
+#define PROGPOW_CACHE_WORDS 4096
+#define PROGPOW_CNT_DAG 64
+#define PROGPOW_CNT_CACHE 11
+#define PROGPOW_CNT_MATH 18
+#define FNV_PRIME 0x01000193
+#define FNV_OFFSET_BASIS 0x811c9dc5
+// Epochs the ethash size tables cover
+#define MAX_EPOCHS 2048
+// Epoch contexts kept by kawpow_epoch
+#define CACHED_EPOCHS 2
+
+// "RAVENCOINKAWPOW", one character per word, padding both Keccak-f800 calls
+static const uint32_t kRavencoinKawpow[15] = {
+    0x00000072, 0x00000041, 0x00000056, 0x00000045, 0x0000004E,
+    0x00000043, 0x0000004F, 0x00000049, 0x0000004E, 0x0000004B,
+    0x00000041, 0x00000057, 0x00000050, 0x0000004F, 0x00000057
+};
+
+static inline uint32_t fnv1a(uint32_t h, uint32_t d) { return (h ^ d) * FNV_PRIME; }
+static inline uint32_t rotl32(uint32_t x, uint32_t n) { n &= 31; return n ? (x << n) | (x >> (32 - n)) : x; }
+static inline uint32_t rotr32(uint32_t x, uint32_t n) { n &= 31; return n ? (x >> n) | (x << (32 - n)) : x; }
+static inline uint32_t clz32(uint32_t x) { return x ? __builtin_clz(x) : 32; }
+
+static uint32_t random_math(uint32_t a, uint32_t b, uint32_t sel) {
+    switch (sel % 11) {
+        case 0: return a + b;
+        case 1: return a * b;
+        case 2: return static_cast<uint32_t>((static_cast<uint64_t>(a) * b) >> 32);
+        case 3: return std::min(a, b);
+        case 4: return rotl32(a, b);
+        case 5: return rotr32(a, b);
+        case 6: return a & b;
+        case 7: return a | b;
+        case 8: return a ^ b;
+        case 9: return clz32(a) + clz32(b);
+        default: return __builtin_popcount(a) + __builtin_popcount(b);
+    }
+}
+
+static void random_merge(uint32_t& a, uint32_t b, uint32_t sel) {
+    uint32_t x = ((sel >> 16) % 31) + 1;
+    switch (sel % 4) {
+        case 0: a = (a * 33) + b; break;
+        case 1: a = (a ^ b) * 33; break;
+        case 2: a = rotl32(a, x) ^ b; break;
+        case 3: a = rotr32(a, x) ^ b; break;
+    }
+}
+
+void kawpow_program(uint64_t block_number, KawpowProgram& program) {
+    uint64_t seed = block_number / KAWPOW_PERIOD;
+    uint32_t lo = static_cast<uint32_t>(seed), hi = static_cast<uint32_t>(seed >> 32);
+
+    Kiss99 rng;
+    rng.z = fnv1a(FNV_OFFSET_BASIS, lo);
+    rng.w = fnv1a(rng.z, hi);
+    rng.jsr = fnv1a(rng.w, lo);
+    rng.jcong = fnv1a(rng.jsr, hi);
+
+    // Fisher-Yates shuffles of the registers the cache reads and the
+    // merges write, so every register is written once per round
+    uint32_t dst_seq[PROGPOW_REGS], src_seq[PROGPOW_REGS];
+    for (uint32_t i = 0; i < PROGPOW_REGS; ++i) dst_seq[i] = src_seq[i] = i;
+    for (uint32_t i = PROGPOW_REGS; i > 1; --i) {
+        std::swap(dst_seq[i - 1], dst_seq[rng.get() % i]);
+        std::swap(src_seq[i - 1], src_seq[rng.get() % i]);
+    }
+
+    uint32_t src_counter = 0, dst_counter = 0;
+    for (int i = 0; i < PROGPOW_CNT_MATH; ++i) {
+        if (i < PROGPOW_CNT_CACHE) {
+            KawpowProgram::CacheOp& op = program.cache[i];
+            op.src = src_seq[src_counter++ % PROGPOW_REGS];
+            op.dst = dst_seq[dst_counter++ % PROGPOW_REGS];
+            op.sel = rng.get();
+        }
+        KawpowProgram::MathOp& op = program.math[i];
+        uint32_t src_rnd = rng.get() % (PROGPOW_REGS * (PROGPOW_REGS - 1));
+        op.src1 = src_rnd % PROGPOW_REGS;
+        op.src2 = src_rnd / PROGPOW_REGS;
+        if (op.src2 >= op.src1) ++op.src2;
+        op.sel1 = rng.get();
+        op.dst = dst_seq[dst_counter++ % PROGPOW_REGS];
+        op.sel2 = rng.get();
+    }
+    for (int i = 0; i < PROGPOW_DAG_LOADS; ++i) {
+        program.dag_dst[i] = i == 0 ? 0 : dst_seq[dst_counter++ % PROGPOW_REGS];
+        program.dag_sel[i] = rng.get();
+    }
+}
+
+KawpowEpoch::KawpowEpoch(uint64_t epoch) : number(epoch) {
+    if (epoch >= MAX_EPOCHS) {
+        return;
+    }
+    // KawPoW epoch n uses the sizes of ethash epoch n
+    uint64_t sizes_block = epoch * ETHASH_EPOCH_LENGTH;
+    ethash_h256_t seed = ethash_get_seedhash(epoch);
+    light = ethash_light_new_internal(ethash_get_cachesize(sizes_block), &seed);
+    if (!light) {
+        return;
+    }
+    dag_bytes = ethash_get_datasize(sizes_block);
+
+    for (uint32_t i = 0; i < PROGPOW_CACHE_WORDS / 64; ++i) {
+        item(i, &l1_cache[i * 64]);
+    }
+}
+
+KawpowEpoch::~KawpowEpoch() {
+    if (light) {
+        ethash_light_delete(light);
+    }
+}
+
+const uint32_t* KawpowEpoch::cache() const {
+    return light ? static_cast<const uint32_t*>(light->cache) : nullptr;
+}
+
+uint64_t KawpowEpoch::cache_size() const {
+    return light ? light->cache_size : 0;
+}
+
+void KawpowEpoch::item(uint32_t index, uint32_t words[64]) const {
+    if (!dag.empty()) {
+        memcpy(words, &dag[static_cast<size_t>(index) * 64], 64 * sizeof(uint32_t));
+        return;
+    }
+    node nodes[4];
+    ethash_calculate_dag_item4_opt(nodes, index * 4, KAWPOW_DAG_PARENTS, light);
+    memcpy(words, nodes, sizeof(nodes));
+}
+
+bool KawpowEpoch::build_dag(unsigned threads) {
+    if (!light) {
+        return false;
+    }
+    if (!dag.empty()) {
+        return true;
+    }
+
+    std::vector<uint32_t> data;
+    try {
+        data.resize(static_cast<size_t>(dag_items()) * 64);
+    } catch (const std::bad_alloc&) {
+        return false;
+    }
+
+    threads = std::max(threads, 1u);
+    uint32_t items = dag_items();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            for (uint32_t i = t; i < items; i += threads) {
+                ethash_calculate_dag_item4_opt(reinterpret_cast<node*>(&data[static_cast<size_t>(i) * 64]), i * 4,
+                                               KAWPOW_DAG_PARENTS, light);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    dag.swap(data);
+    return true;
+}
+
+std::shared_ptr<const KawpowEpoch> kawpow_epoch(uint64_t epoch) {
+    static std::mutex mutex;
+    static std::vector<std::shared_ptr<const KawpowEpoch>> recent;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < recent.size(); ++i) {
+        if (recent[i]->epoch() == epoch) {
+            auto found = recent[i];
+            recent.erase(recent.begin() + i);
+            recent.push_back(found);
+            return found;
+        }
+    }
+
+    auto context = std::make_shared<const KawpowEpoch>(epoch);
+    if (recent.size() >= CACHED_EPOCHS) {
+        recent.erase(recent.begin());
+    }
+    recent.push_back(context);
+    return context;
+}
+
+void kawpow_verify_hash(const KawpowEpoch& epoch, uint64_t block_number, const uint8_t header_hash[32], uint64_t nonce,
+                        KawpowResult& result) {
+    // Header, nonce and padding through Keccak-f800; the first two words
+    // of the result seed the lanes
+    uint32_t state[25];
+    memcpy(state, header_hash, 32);
+    state[8] = static_cast<uint32_t>(nonce);
+    state[9] = static_cast<uint32_t>(nonce >> 32);
+    for (int i = 0; i < 15; ++i) state[10 + i] = kRavencoinKawpow[i];
+    ethash_keccakf800(state);
+
+    uint32_t state2[8];
+    memcpy(state2, state, sizeof(state2));
+
+    uint32_t mix[PROGPOW_LANES][PROGPOW_REGS];
+    uint32_t z = fnv1a(FNV_OFFSET_BASIS, state2[0]);
+    uint32_t w = fnv1a(z, state2[1]);
+    for (uint32_t l = 0; l < PROGPOW_LANES; ++l) {
+        Kiss99 rng;
+        rng.z = z;
+        rng.w = w;
+        rng.jsr = fnv1a(w, l);
+        rng.jcong = fnv1a(rng.jsr, l);
+        for (int r = 0; r < PROGPOW_REGS; ++r) mix[l][r] = rng.get();
+    }
+
+    KawpowProgram program;
+    kawpow_program(block_number, program);
+    const uint32_t* l1 = epoch.l1();
+    uint32_t items = epoch.dag_items();
+
+    for (uint32_t r = 0; r < PROGPOW_CNT_DAG; ++r) {
+        uint32_t item[64];
+        epoch.item(mix[r % PROGPOW_LANES][0] % items, item);
+
+        for (int i = 0; i < PROGPOW_CNT_MATH; ++i) {
+            if (i < PROGPOW_CNT_CACHE) {
+                const KawpowProgram::CacheOp& op = program.cache[i];
+                for (int l = 0; l < PROGPOW_LANES; ++l) {
+                    random_merge(mix[l][op.dst], l1[mix[l][op.src] % PROGPOW_CACHE_WORDS], op.sel);
+                }
+            }
+            const KawpowProgram::MathOp& op = program.math[i];
+            for (int l = 0; l < PROGPOW_LANES; ++l) {
+                random_merge(mix[l][op.dst], random_math(mix[l][op.src1], mix[l][op.src2], op.sel1), op.sel2);
+            }
+        }
+
+        for (uint32_t l = 0; l < PROGPOW_LANES; ++l) {
+            uint32_t offset = ((l ^ r) % PROGPOW_LANES) * PROGPOW_DAG_LOADS;
+            for (int i = 0; i < PROGPOW_DAG_LOADS; ++i) {
+                random_merge(mix[l][program.dag_dst[i]], item[offset + i], program.dag_sel[i]);
+            }
+        }
+    }
+
+    // Each lane's registers fold to one word, the lanes to eight
+    uint32_t mix_hash[8];
+    for (int i = 0; i < 8; ++i) mix_hash[i] = FNV_OFFSET_BASIS;
+    for (int l = 0; l < PROGPOW_LANES; ++l) {
+        uint32_t lane_hash = FNV_OFFSET_BASIS;
+        for (int r = 0; r < PROGPOW_REGS; ++r) lane_hash = fnv1a(lane_hash, mix[l][r]);
+        mix_hash[l % 8] = fnv1a(mix_hash[l % 8], lane_hash);
+    }
+
+    // The seed state, mix hash and padding through Keccak-f800 again
+    memcpy(state, state2, 32);
+    memcpy(&state[8], mix_hash, 32);
+    for (int i = 0; i < 9; ++i) state[16 + i] = kRavencoinKawpow[i];
+    ethash_keccakf800(state);
+
+    memcpy(result.hash, state, 32);
+    memcpy(result.mix, mix_hash, 32);
+}
+
+ShareVerdict kawpow_verify_share(uint64_t block_number, const std::string& header_hex, const std::string& nonce_hex,
+                                 const std::string& mix_hex, const uint256& target, uint256* hash) {
+    uint8_t header[32], mix[32], nonce_bytes[8];
+    size_t decoded = 0;
+    if (!hex_decode(header_hex.data(), header_hex.size(), header, sizeof(header), &decoded) || decoded != 32 ||
+        !hex_decode(mix_hex.data(), mix_hex.size(), mix, sizeof(mix), &decoded) || decoded != 32 ||
+        !hex_decode(nonce_hex.data(), nonce_hex.size(), nonce_bytes, sizeof(nonce_bytes), &decoded) || decoded != 8) {
+        return ShareVerdict::BAD_INPUT;
+    }
+    uint64_t nonce = 0;
+    for (int i = 0; i < 8; ++i) nonce = (nonce << 8) | nonce_bytes[i];
+
+    auto epoch = kawpow_epoch(block_number / KAWPOW_EPOCH_LENGTH);
+    if (!epoch->valid()) {
+        return ShareVerdict::BAD_INPUT;
+    }
+
+    KawpowResult result;
+    kawpow_verify_hash(*epoch, block_number, header, nonce, result);
+    if (memcmp(result.mix, mix, 32) != 0) {
+        return ShareVerdict::BAD_MIX;
+    }
+    uint256 value = uint256::from_bytes_be(result.hash);
+    if (hash) {
+        *hash = value;
+    }
+    return value <= target ? ShareVerdict::VALID : ShareVerdict::LOW_DIFFICULTY;
+}
+
+const char* share_verdict_name(ShareVerdict verdict) {
+    switch (verdict) {
+        case ShareVerdict::VALID: return "valid";
+        case ShareVerdict::BAD_INPUT: return "malformed share";
+        case ShareVerdict::BAD_MIX: return "mix hash mismatch";
+        case ShareVerdict::LOW_DIFFICULTY: return "low difficulty share";
+    }
+    return "unknown";
+}
@@ -0,0 +1,359 @@
+#include "logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+// syslog.h has a LOG_INFO priority of its own, which kTags uses
+#undef LOG_INFO
+#include <syslog.h>
+#include "config.h"
+
+// Ring slots; a power of two
+#define LOG_RING_SLOTS 2048
+// Longer lines are cut
+#define LOG_LINE_MAX 1024
+// Nested LOG_* calls (one inside another's arguments) a thread can format
+#define LOG_NESTING 4
+// The writer sleeps at most this long when the ring is empty
+#define LOG_IDLE_MS 50
+
+std::atomic<int> log_level{LOG_LEVEL_INFO};
+
+struct LogTagInfo {
+    const char* label;
+    const char* color;
+    int priority;       // syslog
+};
+
+static const LogTagInfo kTags[] = {
+    {"ERROR", "31", LOG_ERR},
+    {"WARN ", "33", LOG_WARNING},
+    {"INFO ", "32", LOG_INFO},
+    {"CUDA ", "36", LOG_INFO},
+    {"STRATUM", "35", LOG_DEBUG},
+};
+
+// One line in the ring. sequence says whose turn the slot is: equal to
+// the enqueue position when free, position + 1 once filled (Vyukov's
+// bounded queue with a single consumer).
+struct LogSlot {
+    std::atomic<uint64_t> sequence{0};
+    uint64_t time_us = 0;
+    uint32_t suppressed = 0;
+    uint16_t length = 0;
+    LogTag tag = LogTag::INFO;
+    char text[LOG_LINE_MAX];
+};
+
+namespace {
+
+class LogWriter {
+public:
+    LogWriter() : slots(LOG_RING_SLOTS) {
+        for (size_t i = 0; i < slots.size(); ++i) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    static LogWriter& instance() {
+        // Never destroyed; threads may log while the process exits
+        static LogWriter* writer = new LogWriter;
+        return *writer;
+    }
+
+    void push(LogTag tag, uint64_t time_us, uint32_t suppressed, const std::string& text);
+    void configure(const LogConfig& config);
+    uint64_t dropped_total() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    void start();
+    void run();
+    bool drain();
+    void write(const LogSlot& slot);
+    void flush();
+    const char* timestamp(uint64_t time_us);
+
+    std::vector<LogSlot> slots;
+    std::atomic<uint64_t> enqueue_pos{0};
+    uint64_t dequeue_pos = 0;           // writer thread only
+    std::atomic<uint64_t> dropped{0};
+    uint64_t dropped_reported = 0;
+
+    std::once_flag started;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> idle{false};
+    std::mutex idle_mutex;
+    std::condition_variable idle_cv;
+
+    // Backends; changed by configure() under backend_mutex, which only the
+    // writer and configure() take
+    std::mutex backend_mutex;
+    bool console = true;
+    bool colors = isatty(STDOUT_FILENO);
+    FILE* file = nullptr;
+    bool use_syslog = false;
+
+    // Writer thread only
+    std::string console_batch;
+    std::string file_batch;
+    uint64_t stamp_second = UINT64_MAX;
+    char stamp[32];
+};
+
+void LogWriter::push(LogTag tag, uint64_t time_us, uint32_t suppressed, const std::string& text) {
+    std::call_once(started, [this] { start(); });
+
+    uint64_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    LogSlot* slot;
+    for (;;) {
+        slot = &slots[pos & (slots.size() - 1)];
+        int64_t diff = static_cast<int64_t>(slot->sequence.load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    size_t length = std::min(text.size(), sizeof(slot->text));
+    memcpy(slot->text, text.data(), length);
+    if (length < text.size()) {
+        memcpy(slot->text + length - 3, "...", 3);
+    }
+    slot->length = static_cast<uint16_t>(length);
+    slot->time_us = time_us;
+    slot->suppressed = suppressed;
+    slot->tag = tag;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+
+    if (idle.load(std::memory_order_relaxed) && idle.exchange(false)) {
+        idle_cv.notify_one();
+    }
+}
+
+void LogWriter::start() {
+    running = true;
+    thread = std::thread(&LogWriter::run, this);
+    // Whatever is still in the ring goes out when the process exits
+    std::atexit([] {
+        LogWriter& writer = instance();
+        writer.running = false;
+        writer.idle_cv.notify_one();
+        if (writer.thread.joinable()) {
+            writer.thread.join();
+        }
+    });
+}
+
+void LogWriter::run() {
+    while (running) {
+        if (drain()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        idle = true;
+        // A push between the drain and here may not wake us; the timeout
+        // bounds how long its line waits
+        idle_cv.wait_for(lock, std::chrono::milliseconds(LOG_IDLE_MS));
+        idle = false;
+    }
+    drain();
+}
+
+// Writes everything queued; false if there was nothing
+bool LogWriter::drain() {
+    std::lock_guard<std::mutex> lock(backend_mutex);
+    bool any = false;
+    for (;;) {
+        LogSlot& slot = slots[dequeue_pos & (slots.size() - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos + 1) {
+            break;
+        }
+        write(slot);
+        slot.sequence.store(dequeue_pos + slots.size(), std::memory_order_release);
+        ++dequeue_pos;
+        any = true;
+    }
+    uint64_t lost = dropped.load(std::memory_order_relaxed);
+    if (lost != dropped_reported) {
+        LogSlot note;
+        note.tag = LogTag::WARN;
+        note.time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        note.length = static_cast<uint16_t>(snprintf(note.text, sizeof(note.text),
+            "Log ring full, %llu lines dropped (%llu in total)",
+            static_cast<unsigned long long>(lost - dropped_reported), static_cast<unsigned long long>(lost)));
+        write(note);
+        dropped_reported = lost;
+        any = true;
+    }
+    if (any) {
+        flush();
+    }
+    return any;
+}
+
+// Formatting the wall clock costs a localtime_r; it is done once a second
+const char* LogWriter::timestamp(uint64_t time_us) {
+    uint64_t second = time_us / 1000000;
+    if (second != stamp_second) {
+        time_t t = static_cast<time_t>(second);
+        std::tm tm_buf;
+        localtime_r(&t, &tm_buf);
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %X", &tm_buf);
+        stamp_second = second;
+    }
+    return stamp;
+}
+
+void LogWriter::write(const LogSlot& slot) {
+    const LogTagInfo& tag = kTags[static_cast<int>(slot.tag)];
+    char prefix[64];
+    int prefix_len = snprintf(prefix, sizeof(prefix), "[%s %s] ", timestamp(slot.time_us), tag.label);
+    char suffix[48] = "";
+    if (slot.suppressed) {
+        snprintf(suffix, sizeof(suffix), " (%u similar lines suppressed)", slot.suppressed);
+    }
+
+    if (console) {
+        if (colors) {
+            console_batch += "\033[";
+            console_batch += tag.color;
+            console_batch += 'm';
+        }
+        console_batch.append(prefix, prefix_len);
+        console_batch.append(slot.text, slot.length);
+        console_batch += suffix;
+        if (colors) {
+            console_batch += "\033[0m";
+        }
+        console_batch += '\n';
+    }
+    if (file) {
+        file_batch.append(prefix, prefix_len);
+        file_batch.append(slot.text, slot.length);
+        file_batch += suffix;
+        file_batch += '\n';
+    }
+    if (use_syslog) {
+        // syslog stamps lines itself
+        syslog(tag.priority, "%.*s%s", static_cast<int>(slot.length), slot.text, suffix);
+    }
+}
+
+void LogWriter::flush() {
+    if (!console_batch.empty()) {
+        fwrite(console_batch.data(), 1, console_batch.size(), stdout);
+        fflush(stdout);
+        console_batch.clear();
+    }
+    if (file && !file_batch.empty()) {
+        fwrite(file_batch.data(), 1, file_batch.size(), file);
+        fflush(file);
+        file_batch.clear();
+    }
+}
+
+void LogWriter::configure(const LogConfig& config) {
+    std::lock_guard<std::mutex> lock(backend_mutex);
+    console = config.console;
+    colors = config.colors && isatty(STDOUT_FILENO);
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+    if (!config.file.empty()) {
+        file = fopen(config.file.c_str(), "a");
+        if (!file) {
+            fprintf(stderr, "Cannot open log file %s: %s\n", config.file.c_str(), strerror(errno));
+        }
+    }
+    if (config.syslog && !use_syslog) {
+        openlog("kawpow-miner", LOG_PID, LOG_USER);
+    } else if (!config.syslog && use_syslog) {
+        closelog();
+    }
+    use_syslog = config.syslog;
+}
+
+// A few streams per thread, reused from line to line
+struct LogStreams {
+    std::ostringstream streams[LOG_NESTING];
+    int depth = 0;
+};
+
+static thread_local LogStreams log_streams;
+
+} // namespace
+
+bool LogSite::allow(uint32_t now, uint32_t& skipped) {
+    // Races between threads at a second boundary at worst let a few
+    // lines more or less through
+    if (second.load(std::memory_order_relaxed) != now) {
+        second.store(now, std::memory_order_relaxed);
+        lines.store(0, std::memory_order_relaxed);
+    }
+    if (lines.fetch_add(1, std::memory_order_relaxed) >= LOG_SITE_RATE) {
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    skipped = suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+Logger::Logger(LogTag tag, LogSite& site) : tag(tag) {
+    time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    if (!site.allow(static_cast<uint32_t>(time_us / 1000000), suppressed)) {
+        return;
+    }
+    LogStreams& streams = log_streams;
+    if (streams.depth == LOG_NESTING) {
+        return;
+    }
+    stream = &streams.streams[streams.depth++];
+    stream->str(std::string());
+    stream->clear();
+    // Manipulators from the previous line must not carry over
+    stream->flags(std::ios_base::dec | std::ios_base::skipws);
+    stream->precision(6);
+    stream->fill(' ');
+}
+
+Logger::~Logger() {
+    if (stream) {
+        LogWriter::instance().push(tag, time_us, suppressed, stream->str());
+        log_streams.depth--;
+    }
+}
+
+void log_configure(const LogConfig& config) {
+    if (config.level == "error") {
+        log_level = LOG_LEVEL_ERROR;
+    } else if (config.level == "warn") {
+        log_level = LOG_LEVEL_WARN;
+    } else if (config.level == "debug") {
+        log_level = LOG_LEVEL_DEBUG;
+    } else {
+        log_level = LOG_LEVEL_INFO;
+    }
+    LogWriter::instance().configure(config);
+}
+
+uint64_t log_dropped() {
+    return LogWriter::instance().dropped_total();
+}
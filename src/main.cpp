@@ -1,29 +1,239 @@
 #include <iostream>
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "api_server.h"
+#include "bench_client.h"
 #include "config.h"
+#include "config_watcher.h"
 #include "stratum.h"
 #include "kawpow.h"
+#include "proxy_server.h"
+#include "solo_client.h"
+#include "trace.h"
 #include "logging.h"
 
-std::mutex log_mutex;
+// The API reports on the given pool sessions, so it has to go before they do
+static std::unique_ptr<ApiServer> start_api(const Config& config, KawPow& kawpow, const std::vector<Stratum*>& sessions) {
+    std::unique_ptr<ApiServer> api;
+    if (config.getApi().enabled) {
+        api.reset(new ApiServer(config, kawpow));
+        for (Stratum* session : sessions) {
+            api->add_pool(session);
+        }
+        if (!api->start()) {
+            api.reset();
+        }
+    }
+    return api;
+}
+
+#define CONFIG_PATH "config/config.json"
+
+// Edits to the config file are applied through reloader while it runs
+static std::unique_ptr<ConfigWatcher> watch_config(const Config& config, ConfigReloader& reloader) {
+    std::unique_ptr<ConfigWatcher> watcher;
+    if (config.getWatch()) {
+        watcher.reset(new ConfigWatcher(CONFIG_PATH, [&reloader] { reloader.reload(CONFIG_PATH); }));
+        if (!watcher->start()) {
+            watcher.reset();
+        }
+    }
+    return watcher;
+}
+
+static void run_session(Stratum* s) {
+    try {
+        s->run();
+    } catch (const std::exception& e) {
+        LOG_ERROR << "Fatal error: " << e.what();
+    }
+}
 
 int main(int argc, char** argv) {
     LOG_INFO << "KawPow Miner v3 starting up...";
+
+    // A write to a socket the pool already closed must surface as an error
+    // (and a reconnect), not kill the process.
+    signal(SIGPIPE, SIG_IGN);
     
     // Load configuration
     LOG_INFO << "Loading configuration...";
     Config config;
-    if (!config.load("config/config.json")) {
+    if (!config.load(CONFIG_PATH)) {
         LOG_ERROR << "Failed to load config.json - exiting";
         return 1;
     }
+    log_configure(config.getLog());
+
+    if (config.getTrace().enabled) {
+        Tracer::instance().start(config.getTrace());
+    }
+
+    // --replay <file> [--speed <x>] plays a recorded pool session into the
+    // miner instead of connecting anywhere.
+    // --bench <size> [--height <h>[,<h>...]] mines a synthetic job offline
+    // and checks the result; see BenchClient.
+    std::string replay_file;
+    double replay_speed = 1;
+    uint64_t bench_nonces = 0;
+    std::vector<uint64_t> bench_heights;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--replay") {
+            replay_file = argv[i + 1];
+        } else if (arg == "--speed") {
+            replay_speed = std::min(std::max(atof(argv[i + 1]), 1.0), 1000.0);
+        } else if (arg == "--bench") {
+            bench_nonces = BenchClient::parse_size(argv[i + 1]);
+            if (!bench_nonces) {
+                LOG_ERROR << "Benchmark size must be 250K, 500K, 1M to 10M, or a nonce count";
+                return 1;
+            }
+        } else if (arg == "--height") {
+            std::stringstream list(argv[i + 1]);
+            std::string height;
+            while (std::getline(list, height, ',')) {
+                bench_heights.push_back(strtoull(height.c_str(), nullptr, 10));
+            }
+        } else {
+            LOG_WARN << "Ignoring unknown option " << arg;
+        }
+    }
 
     // Initialize KawPoW
     LOG_INFO << "Initializing KawPoW mining engine...";
     KawPow kawpow(config);
 
+    if (bench_nonces) {
+        // A height with known digests, so the default run needs no host hashing
+        if (bench_heights.empty()) {
+            bench_heights.push_back(750000);
+        }
+        BenchClient bench(config, kawpow, bench_nonces, bench_heights);
+        return bench.run() ? 0 : 1;
+    }
+
+    // Solo mining talks to the node directly; no pool, no proxy
+    if (config.getSolo().enabled) {
+        LOG_INFO << "Starting solo mining client...";
+        SoloClient solo(config, kawpow);
+        std::unique_ptr<ApiServer> api = start_api(config, kawpow, {});
+        ConfigReloader reloader(config, kawpow);
+        reloader.on_api = [&](const Config& snapshot) {
+            api.reset();
+            api = start_api(snapshot, kawpow, {});
+        };
+        std::unique_ptr<ConfigWatcher> watcher = watch_config(config, reloader);
+        try {
+            solo.run();
+        } catch (const std::exception& e) {
+            LOG_ERROR << "Fatal error: " << e.what();
+            return 1;
+        }
+        LOG_INFO << "Miner shutting down...";
+        return 0;
+    }
+
+    // Hashrate split: one session per weighted pool, each on its own
+    // thread, with the devices dividing their batches between them
+    if (config.getPoolSplit().enabled && replay_file.empty()) {
+        if (config.getProxy().enabled) {
+            LOG_WARN << "The stratum proxy needs a single upstream session; not starting it with a hashrate split";
+        }
+        std::vector<std::unique_ptr<Stratum>> clients;
+        const auto& pools = config.getPools();
+        for (size_t i = 0; i < pools.size(); ++i) {
+            if (pools[i].weight > 0) {
+                clients.emplace_back(new Stratum(config, kawpow, static_cast<int>(i)));
+            }
+        }
+        std::vector<Stratum*> sessions;
+        for (auto& client : clients) {
+            sessions.push_back(client.get());
+        }
+        std::unique_ptr<ApiServer> api = start_api(config, kawpow, sessions);
+        std::vector<std::thread> threads;
+        for (auto& client : clients) {
+            threads.emplace_back(run_session, client.get());
+        }
+
+        // Pools appended to the file join the split with a session of
+        // their own, read from the snapshot that added them
+        std::mutex sessions_mutex;
+        ConfigReloader reloader(config, kawpow);
+        reloader.on_api = [&](const Config& snapshot) {
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+            api.reset();
+            api = start_api(snapshot, kawpow, sessions);
+        };
+        reloader.on_pools_added = [&](const Config& snapshot, size_t first) {
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+            const auto& added = snapshot.getPools();
+            for (size_t i = first; i < added.size(); ++i) {
+                if (added[i].weight <= 0) {
+                    continue;
+                }
+                clients.emplace_back(new Stratum(snapshot, kawpow, static_cast<int>(i)));
+                sessions.push_back(clients.back().get());
+                if (api) {
+                    api->add_pool(sessions.back());
+                }
+                threads.emplace_back(run_session, sessions.back());
+                LOG_INFO << "Pool " << added[i].host << ":" << added[i].port << " joins the split";
+            }
+        };
+        std::unique_ptr<ConfigWatcher> watcher = watch_config(config, reloader);
+
+        for (size_t i = 0;; ++i) {
+            std::thread t;
+            {
+                std::lock_guard<std::mutex> lock(sessions_mutex);
+                if (i >= threads.size()) {
+                    break;
+                }
+                t = std::move(threads[i]);
+            }
+            t.join();
+        }
+        LOG_INFO << "Miner shutting down...";
+        return 0;
+    }
+
     // Initialize and run Stratum client
     LOG_INFO << "Starting Stratum client...";
     Stratum stratum(config, kawpow);
+
+    if (!replay_file.empty()) {
+        bool replayed = stratum.replay(replay_file, replay_speed);
+        kawpow.stop_mining();
+        return replayed ? 0 : 1;
+    }
+
+    std::unique_ptr<ApiServer> api = start_api(config, kawpow, {&stratum});
+    ConfigReloader reloader(config, kawpow);
+    reloader.on_api = [&](const Config& snapshot) {
+        api.reset();
+        api = start_api(snapshot, kawpow, {&stratum});
+    };
+
+    // Optional local stratum server for other rigs, sharing this session
+    std::unique_ptr<ProxyServer> proxy;
+    if (config.getProxy().enabled) {
+        proxy.reset(new ProxyServer(config, [&stratum](const QueuedShare& share, ShareResultCallback done) {
+            stratum.submit_forwarded(share, done);
+        }));
+        if (proxy->start()) {
+            stratum.set_proxy(proxy.get());
+        } else {
+            proxy.reset();
+        }
+    }
+    std::unique_ptr<ConfigWatcher> watcher = watch_config(config, reloader);
     
     try {
         stratum.run();
@@ -0,0 +1,148 @@
+#include "metrics.h"
+#include <cstdio>
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (const Shard& shard : shards) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void Histogram::snapshot(uint64_t counts[HISTOGRAM_BUCKETS], uint64_t& sum_ns) const {
+    sum_ns = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+        counts[b] = 0;
+    }
+    for (const Shard& shard : shards) {
+        for (int b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+            counts[b] += shard.buckets[b].load(std::memory_order_relaxed);
+        }
+        sum_ns += shard.sum_ns.load(std::memory_order_relaxed);
+    }
+}
+
+Metrics& Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::Series& Metrics::series(const std::string& name, const std::string& help, Type type, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Family* family = nullptr;
+    for (auto& f : families) {
+        if (f->name == name) {
+            family = f.get();
+            break;
+        }
+    }
+    if (!family) {
+        families.emplace_back(new Family{name, help, type, {}});
+        family = families.back().get();
+    }
+    for (auto& s : family->series) {
+        if (s->labels == labels) {
+            return *s;
+        }
+    }
+    std::unique_ptr<Series> s(new Series);
+    s->labels = labels;
+    switch (family->type) {
+    case Type::COUNTER: s->counter.reset(new Counter); break;
+    case Type::GAUGE: s->gauge.reset(new Gauge); break;
+    case Type::HISTOGRAM: s->histogram.reset(new Histogram); break;
+    }
+    family->series.push_back(std::move(s));
+    return *family->series.back();
+}
+
+Counter& Metrics::counter(const std::string& name, const std::string& help, const std::string& labels) {
+    return *series(name, help, Type::COUNTER, labels).counter;
+}
+
+Gauge& Metrics::gauge(const std::string& name, const std::string& help, const std::string& labels) {
+    return *series(name, help, Type::GAUGE, labels).gauge;
+}
+
+Histogram& Metrics::histogram(const std::string& name, const std::string& help, const std::string& labels) {
+    return *series(name, help, Type::HISTOGRAM, labels).histogram;
+}
+
+static void append_sample(std::string& out, const std::string& name, const char* suffix, const std::string& labels,
+                          const char* extra_label, const char* value) {
+    out += name;
+    out += suffix;
+    if (!labels.empty() || extra_label) {
+        out += '{';
+        out += labels;
+        if (extra_label) {
+            if (!labels.empty()) {
+                out += ',';
+            }
+            out += extra_label;
+        }
+        out += '}';
+    }
+    out += ' ';
+    out += value;
+    out += '\n';
+}
+
+// Counts are printed exactly; %.9g would round hash counters past a billion
+static void append_sample(std::string& out, const std::string& name, const char* suffix, const std::string& labels,
+                          const char* extra_label, uint64_t value) {
+    char number[24];
+    snprintf(number, sizeof(number), "%llu", static_cast<unsigned long long>(value));
+    append_sample(out, name, suffix, labels, extra_label, number);
+}
+
+void Metrics::render(std::string& out) const {
+    static const char* kTypes[] = {"counter", "gauge", "histogram"};
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& family : families) {
+        out += "# HELP " + family->name + " " + family->help + "\n";
+        out += "# TYPE " + family->name + " " + kTypes[static_cast<int>(family->type)] + "\n";
+        for (const auto& s : family->series) {
+            if (s->counter) {
+                append_sample(out, family->name, "", s->labels, nullptr, s->counter->value());
+            } else if (s->gauge) {
+                char number[24];
+                snprintf(number, sizeof(number), "%lld", static_cast<long long>(s->gauge->value()));
+                append_sample(out, family->name, "", s->labels, nullptr, number);
+            } else {
+                uint64_t counts[HISTOGRAM_BUCKETS], sum_ns;
+                s->histogram->snapshot(counts, sum_ns);
+                uint64_t cumulative = 0;
+                char le[40];
+                for (int b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+                    cumulative += counts[b];
+                    if (b < HISTOGRAM_BUCKETS - 1) {
+                        snprintf(le, sizeof(le), "le=\"%.9g\"", (1ULL << b) * 1e-6);
+                    } else {
+                        snprintf(le, sizeof(le), "le=\"+Inf\"");
+                    }
+                    append_sample(out, family->name, "_bucket", s->labels, le, cumulative);
+                }
+                char sum[32];
+                snprintf(sum, sizeof(sum), "%.9g", sum_ns * 1e-9);
+                append_sample(out, family->name, "_sum", s->labels, nullptr, sum);
+                append_sample(out, family->name, "_count", s->labels, nullptr, cumulative);
+            }
+        }
+    }
+}
+
+std::string metric_label(const std::string& value) {
+    std::string out = "\"";
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
@@ -0,0 +1,278 @@
+#include "pool_scorer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unistd.h>
+#include "logging.h"
+
+// Number of latency samples kept per pool
+#define MAX_LATENCY_SAMPLES 32
+// Ravencoin target block interval; latency is scored as a fraction of it
+#define BLOCK_TIME_MS 60000.0
+// Latency assumed for a pool that has not been measured yet
+#define UNKNOWN_LATENCY_MS 1000.0
+// Weight of notify jitter against latency in the score
+#define NOTIFY_JITTER_WEIGHT 1.0
+#define PROBE_TIMEOUT_MS 3000
+#define EWMA_ALPHA 0.2
+
+static void push_sample(std::vector<uint16_t>& samples, uint32_t ms) {
+    if (samples.size() >= MAX_LATENCY_SAMPLES) {
+        samples.erase(samples.begin());
+    }
+    samples.push_back(static_cast<uint16_t>(std::min<uint32_t>(ms, 0xFFFF)));
+}
+
+static double median(std::vector<uint16_t> v) {
+    if (v.empty()) {
+        return 0.0;
+    }
+    std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    return v[v.size() / 2];
+}
+
+PoolScorer::PoolScorer(const Config& config, DnsCache& dns)
+    : config(config),
+      dns(dns),
+      stats(config.getPools().size()),
+      last_rank(std::chrono::steady_clock::now()),
+      last_switch(std::chrono::steady_clock::now()),
+      running(false) {}
+
+PoolScorer::~PoolScorer() {
+    stop();
+}
+
+void PoolScorer::start() {
+    const PoolSelectionConfig& sel = config.getPoolSelection();
+    if (!sel.enabled || stats.size() < 2 || running.load()) {
+        return;
+    }
+
+    LOG_INFO << "Starting pool latency probes for " << stats.size() << " pools every " << sel.interval << "s";
+    running.store(true);
+    probe_thread = std::thread(&PoolScorer::probe_loop, this);
+}
+
+void PoolScorer::stop() {
+    if (running.exchange(false)) {
+        probe_cv.notify_all();
+    }
+    if (probe_thread.joinable()) {
+        probe_thread.join();
+    }
+}
+
+void PoolScorer::record_connect(size_t pool, uint32_t ms) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pool >= stats.size()) return;
+    push_sample(stats[pool].connect_ms, ms);
+    stats[pool].failures = 0;
+}
+
+void PoolScorer::record_connect_failure(size_t pool) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pool >= stats.size()) return;
+    stats[pool].failures++;
+}
+
+void PoolScorer::record_rtt(size_t pool, uint32_t ms) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pool >= stats.size()) return;
+    push_sample(stats[pool].rtt_ms, ms);
+}
+
+void PoolScorer::record_notify(size_t pool) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pool >= stats.size()) return;
+
+    PoolStats& s = stats[pool];
+    auto now = std::chrono::steady_clock::now();
+    if (s.last_notify.time_since_epoch().count() != 0) {
+        double interval = std::chrono::duration<double, std::milli>(now - s.last_notify).count();
+        if (s.notify_interval_ms == 0.0) {
+            s.notify_interval_ms = interval;
+        } else {
+            s.notify_jitter_ms += EWMA_ALPHA * (std::fabs(interval - s.notify_interval_ms) - s.notify_jitter_ms);
+            s.notify_interval_ms += EWMA_ALPHA * (interval - s.notify_interval_ms);
+        }
+    }
+    s.last_notify = now;
+}
+
+double PoolScorer::expected_notify_interval_ms(size_t pool) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pool >= stats.size() || stats[pool].notify_interval_ms == 0.0) {
+        return BLOCK_TIME_MS;
+    }
+    return std::min(stats[pool].notify_interval_ms, BLOCK_TIME_MS);
+}
+
+void PoolScorer::record_result(size_t pool, bool accepted, bool stale) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pool >= stats.size()) return;
+
+    if (accepted) stats[pool].accepted++;
+    else if (stale) stats[pool].stale++;
+    else stats[pool].rejected++;
+}
+
+PoolResults PoolScorer::results(size_t pool) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    PoolResults r;
+    if (pool < stats.size()) {
+        r.accepted = stats[pool].accepted;
+        r.rejected = stats[pool].rejected;
+        r.stale = stats[pool].stale;
+        r.rtt_ms = median(stats[pool].rtt_ms);
+    }
+    return r;
+}
+
+double PoolScorer::score(size_t pool) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return score_locked(pool);
+}
+
+double PoolScorer::score_locked(size_t pool) const {
+    const PoolStats& s = stats[pool];
+    if (s.failures >= 3 || (s.failures > 0 && s.connect_ms.empty())) {
+        return 1.0;
+    }
+
+    // A connect probe measures the network round trip; submit RTT adds the
+    // pool's own processing time on top. Whichever is larger is the delay a
+    // found share sees before the pool credits it.
+    double latency = std::max(median(s.connect_ms), median(s.rtt_ms));
+    if (s.connect_ms.empty() && s.rtt_ms.empty()) {
+        latency = UNKNOWN_LATENCY_MS;
+    }
+
+    // A job that reaches us late, or irregularly, is mined stale for that
+    // long; the notify jitter counts the same as latency
+    double loss = (latency + NOTIFY_JITTER_WEIGHT * s.notify_jitter_ms) / BLOCK_TIME_MS;
+
+    uint64_t results = s.accepted + s.rejected + s.stale;
+    if (results > 0) {
+        loss += static_cast<double>(s.rejected + s.stale) / results;
+    }
+
+    return std::min(loss, 1.0);
+}
+
+size_t PoolScorer::select(size_t current) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto now = std::chrono::steady_clock::now();
+    last_rank = now;
+
+    if (stats.size() < 2 || current >= stats.size()) {
+        return current;
+    }
+
+    size_t best = current;
+    for (size_t i = 0; i < stats.size(); ++i) {
+        if (score_locked(i) < score_locked(best)) {
+            best = i;
+        }
+    }
+
+    if (best == current) {
+        return current;
+    }
+
+    double current_score = score_locked(current);
+    double best_score = score_locked(best);
+    const PoolSelectionConfig& sel = config.getPoolSelection();
+
+    if (current_score < 1.0 && now - last_switch < std::chrono::seconds(sel.min_dwell)) {
+        return current;
+    }
+    if (best_score >= current_score * (1.0 - sel.hysteresis)) {
+        return current;
+    }
+
+    LOG_INFO << "Pool " << config.getPools()[best].url << " scores " << best_score
+             << " vs " << current_score << " for " << config.getPools()[current].url << ", switching";
+    last_switch = now;
+    return best;
+}
+
+void PoolScorer::record_switch() {
+    std::lock_guard<std::mutex> lock(mutex);
+    last_switch = std::chrono::steady_clock::now();
+}
+
+size_t PoolScorer::next_after_failure(size_t failed) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stats.size() < 2) {
+        return failed;
+    }
+
+    size_t best = (failed + 1) % stats.size();
+    for (size_t i = 0; i < stats.size(); ++i) {
+        if (i != failed && score_locked(i) < score_locked(best)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+bool PoolScorer::rank_due() {
+    const PoolSelectionConfig& sel = config.getPoolSelection();
+    if (!sel.enabled || stats.size() < 2) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::chrono::steady_clock::now() - last_rank >= std::chrono::seconds(sel.interval);
+}
+
+void PoolScorer::print() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto& pools = config.getPools();
+    for (size_t i = 0; i < stats.size(); ++i) {
+        const PoolStats& s = stats[i];
+        LOG_INFO << "Pool " << pools[i].host << ":" << pools[i].port
+                 << " connect " << median(s.connect_ms) << "ms"
+                 << " rtt " << median(s.rtt_ms) << "ms"
+                 << " notify jitter " << static_cast<uint64_t>(s.notify_jitter_ms) << "ms"
+                 << " accepted " << s.accepted << " rejected " << s.rejected << " stale " << s.stale
+                 << " score " << score_locked(i);
+    }
+}
+
+void PoolScorer::probe_loop() {
+    const int interval = config.getPoolSelection().interval;
+    while (running.load()) {
+        for (size_t i = 0; i < stats.size() && running.load(); ++i) {
+            probe(i);
+        }
+
+        std::unique_lock<std::mutex> lock(probe_mutex);
+        probe_cv.wait_for(lock, std::chrono::seconds(interval), [this] { return !running.load(); });
+    }
+}
+
+// Measures the TCP handshake time to a pool, racing its addresses the same
+// way a real connect does.
+void PoolScorer::probe(size_t pool) {
+    const PoolConfig& cfg = config.getPools()[pool];
+
+    std::vector<sockaddr_storage> records;
+    if (!dns.lookup(cfg.host, records)) {
+        record_connect_failure(pool);
+        return;
+    }
+
+    std::string ip;
+    auto start = std::chrono::steady_clock::now();
+    int fd = happy_eyeballs_connect(records, cfg.port, PROBE_TIMEOUT_MS, ip);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+    if (fd >= 0) {
+        close(fd);
+        record_connect(pool, static_cast<uint32_t>(elapsed));
+    } else {
+        record_connect_failure(pool);
+    }
+}
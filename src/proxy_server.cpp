@@ -0,0 +1,474 @@
+#include "proxy_server.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "rapidjson/document.h"
+#include "rapidjson/writer.h"
+#include "rapidjson/stringbuffer.h"
+#include "logging.h"
+
+#define LISTEN_ID 0
+#define WAKE_ID 1
+// A rig that stops reading is dropped rather than buffered without bound
+#define MAX_QUEUED_BYTES (1024 * 1024)
+#define MAX_LINE_LENGTH (16 * 1024)
+#define STATS_INTERVAL 60
+
+static std::string json_string(const std::string& text) {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.String(text.c_str(), static_cast<rapidjson::SizeType>(text.size()));
+    return buffer.GetString();
+}
+
+static std::string json_value(const rapidjson::Value& value) {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    value.Accept(writer);
+    return buffer.GetString();
+}
+
+static std::string response(const std::string& id, const std::string& result, const std::string& error = "") {
+    return "{\"id\":" + id + ",\"result\":" + result + ",\"error\":" +
+           (error.empty() ? "null" : "[20," + json_string(error) + ",null]") + "}\n";
+}
+
+static std::string strip_hex_prefix(const std::string& hex) {
+    return hex.compare(0, 2, "0x") == 0 ? hex.substr(2) : hex;
+}
+
+ProxyServer::ProxyServer(const Config& config, ProxySubmitHandler submit)
+    : settings(config.getProxy()), submit(submit) {
+    // Slice 0 belongs to the local devices; hand out the rest lowest first
+    uint64_t slices = 1ULL << (8 * settings.extranonce_bytes);
+    free_slices.reserve(std::min<uint64_t>(slices - 1, settings.max_connections));
+    for (uint32_t slice = std::min<uint64_t>(slices - 1, settings.max_connections); slice >= 1; --slice) {
+        free_slices.push_back(slice);
+    }
+}
+
+ProxyServer::~ProxyServer() {
+    stop();
+}
+
+bool ProxyServer::start() {
+    sockaddr_storage addr;
+    memset(&addr, 0, sizeof(addr));
+    socklen_t addr_len = 0;
+    if (inet_pton(AF_INET6, settings.host.c_str(), &reinterpret_cast<sockaddr_in6*>(&addr)->sin6_addr) == 1) {
+        reinterpret_cast<sockaddr_in6*>(&addr)->sin6_family = AF_INET6;
+        reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port = htons(settings.port);
+        addr_len = sizeof(sockaddr_in6);
+    } else if (inet_pton(AF_INET, settings.host.c_str(), &reinterpret_cast<sockaddr_in*>(&addr)->sin_addr) == 1) {
+        reinterpret_cast<sockaddr_in*>(&addr)->sin_family = AF_INET;
+        reinterpret_cast<sockaddr_in*>(&addr)->sin_port = htons(settings.port);
+        addr_len = sizeof(sockaddr_in);
+    } else {
+        LOG_ERROR << "Invalid proxy listen address: " << settings.host;
+        return false;
+    }
+
+    listen_fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), addr_len) != 0 || listen(listen_fd, 511) != 0) {
+        LOG_ERROR << "Proxy cannot listen on " << settings.host << ":" << settings.port << ": " << strerror(errno);
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr), &addr_len);
+    bound_port = ntohs(addr.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port
+                                                  : reinterpret_cast<sockaddr_in*>(&addr)->sin_port);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = LISTEN_ID;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.u64 = WAKE_ID;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+
+    running = true;
+    thread = std::thread(&ProxyServer::loop, this);
+    LOG_INFO << "Stratum proxy listening on " << settings.host << ":" << bound_port;
+    return true;
+}
+
+void ProxyServer::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) {
+        // The loop still notices within its poll timeout
+    }
+    thread.join();
+
+    for (auto& entry : conns) {
+        close(entry.second->fd);
+    }
+    conns.clear();
+    close(listen_fd);
+    close(wake_fd);
+    close(epoll_fd);
+}
+
+std::string ProxyServer::extranonce_for(uint32_t slice) const {
+    static const char hex[] = "0123456789abcdef";
+    std::string out = upstream_extranonce;
+    for (int i = settings.extranonce_bytes * 2 - 1; i >= 0; --i) {
+        out += hex[(slice >> (4 * i)) & 0x0f];
+    }
+    return out;
+}
+
+std::string ProxyServer::extranonce_message(const ProxyConnection& conn) const {
+    return "{\"id\":null,\"method\":\"mining.set_extranonce\",\"params\":[\"" + extranonce_for(conn.slice) + "\"]}\n";
+}
+
+std::string ProxyServer::set_upstream_extranonce(const std::string& extranonce) {
+    std::string local;
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        upstream_extranonce = extranonce;
+        local = extranonce_for(0);
+    }
+    post({Outbound::EXTRANONCE, 0, nullptr});
+    return local;
+}
+
+void ProxyServer::broadcast_job(const std::string& line) {
+    auto shared = std::make_shared<const std::string>(line + "\n");
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        last_job = shared;
+    }
+    post({Outbound::BROADCAST, 0, shared});
+}
+
+void ProxyServer::broadcast_target(const std::string& line) {
+    auto shared = std::make_shared<const std::string>(line + "\n");
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        last_target = shared;
+    }
+    post({Outbound::BROADCAST, 0, shared});
+}
+
+void ProxyServer::post(Outbound outbound) {
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        inbox.push_back(std::move(outbound));
+    }
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) {
+        // Counter saturated: the loop is already due to wake up
+    }
+}
+
+void ProxyServer::loop() {
+    std::vector<epoll_event> events(1024);
+    auto last_stats = std::chrono::steady_clock::now();
+
+    while (running) {
+        int n = epoll_wait(epoll_fd, events.data(), static_cast<int>(events.size()), 1000);
+        if (n < 0 && errno != EINTR) {
+            LOG_ERROR << "Proxy epoll_wait failed: " << strerror(errno);
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            uint64_t id = events[i].data.u64;
+            if (id == LISTEN_ID) {
+                accept_all();
+                continue;
+            }
+            if (id == WAKE_ID) {
+                uint64_t count;
+                while (read(wake_fd, &count, sizeof(count)) > 0) {}
+                drain_inbox();
+                continue;
+            }
+
+            auto it = conns.find(id);
+            if (it == conns.end()) {
+                continue;
+            }
+            ProxyConnection& conn = *it->second;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                conn.closing = true;
+            }
+            if (!conn.closing && (events[i].events & EPOLLIN)) {
+                read_from(conn);
+            }
+            if (!conn.closing && (events[i].events & EPOLLOUT)) {
+                write_to(conn);
+            }
+        }
+
+        for (auto it = conns.begin(); it != conns.end();) {
+            if (it->second->closing) {
+                ProxyConnection& conn = *it->second;
+                close_connection(conn);
+                it = conns.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        connection_count = conns.size();
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_stats >= std::chrono::seconds(STATS_INTERVAL)) {
+            print_stats();
+            last_stats = now;
+        }
+    }
+}
+
+void ProxyServer::drain_inbox() {
+    std::vector<Outbound> work;
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        work.swap(inbox);
+    }
+
+    for (Outbound& outbound : work) {
+        if (outbound.kind == Outbound::LINE) {
+            auto it = conns.find(outbound.connection);
+            if (it != conns.end() && !it->second->closing) {
+                send(*it->second, outbound.line);
+            }
+            continue;
+        }
+
+        for (auto& entry : conns) {
+            ProxyConnection& conn = *entry.second;
+            if (!conn.subscribed || conn.closing) {
+                continue;
+            }
+            if (outbound.kind == Outbound::BROADCAST) {
+                send(conn, outbound.line);
+            } else {
+                std::lock_guard<std::mutex> lock(state_mutex);
+                send(conn, extranonce_message(conn));
+            }
+        }
+    }
+}
+
+void ProxyServer::accept_all() {
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOG_ERROR << "Proxy accept failed: " << strerror(errno);
+            }
+            return;
+        }
+
+        if (free_slices.empty()) {
+            LOG_WARN << "Proxy is full (" << conns.size() << " downstream connections), refusing a new one";
+            close(fd);
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        std::unique_ptr<ProxyConnection> conn(new ProxyConnection);
+        conn->id = next_connection_id++;
+        conn->fd = fd;
+        conn->slice = free_slices.back();
+        free_slices.pop_back();
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = conn->id;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        conns[conn->id] = std::move(conn);
+    }
+}
+
+void ProxyServer::read_from(ProxyConnection& conn) {
+    char buf[4096];
+    while (true) {
+        ssize_t n = recv(conn.fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            conn.read_buffer.append(buf, n);
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            conn.closing = true;
+        }
+        break;
+    }
+
+    size_t start = 0, end;
+    while (!conn.closing && (end = conn.read_buffer.find('\n', start)) != std::string::npos) {
+        if (end > start) {
+            handle_line(conn, conn.read_buffer.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    conn.read_buffer.erase(0, start);
+
+    if (conn.read_buffer.size() > MAX_LINE_LENGTH) {
+        LOG_WARN << "Proxy downstream " << conn.worker << " sent an overlong line, disconnecting";
+        conn.closing = true;
+    }
+}
+
+void ProxyServer::send(ProxyConnection& conn, const std::string& line) {
+    send(conn, std::make_shared<const std::string>(line));
+}
+
+void ProxyServer::send(ProxyConnection& conn, std::shared_ptr<const std::string> line) {
+    conn.queued_bytes += line->size();
+    conn.write_queue.push_back(std::move(line));
+    if (conn.queued_bytes > MAX_QUEUED_BYTES) {
+        LOG_WARN << "Proxy downstream " << conn.worker << " is not reading, disconnecting";
+        conn.closing = true;
+        return;
+    }
+    if (!conn.want_write) {
+        write_to(conn);
+    }
+}
+
+void ProxyServer::write_to(ProxyConnection& conn) {
+    while (!conn.write_queue.empty()) {
+        const std::string& front = *conn.write_queue.front();
+        ssize_t n = ::send(conn.fd, front.data() + conn.write_offset, front.size() - conn.write_offset,
+                           MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                conn.closing = true;
+                return;
+            }
+            break;
+        }
+        conn.write_offset += n;
+        conn.queued_bytes -= n;
+        if (conn.write_offset == front.size()) {
+            conn.write_queue.pop_front();
+            conn.write_offset = 0;
+        }
+    }
+
+    bool want_write = !conn.write_queue.empty();
+    if (want_write != conn.want_write) {
+        conn.want_write = want_write;
+        update_events(conn);
+    }
+}
+
+void ProxyServer::update_events(ProxyConnection& conn) {
+    epoll_event ev;
+    ev.events = EPOLLIN | (conn.want_write ? EPOLLOUT : 0);
+    ev.data.u64 = conn.id;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &ev);
+}
+
+void ProxyServer::close_connection(ProxyConnection& conn) {
+    if (!conn.worker.empty()) {
+        LOG_STRATUM << "Proxy downstream " << conn.worker << " disconnected";
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn.fd, nullptr);
+    close(conn.fd);
+    free_slices.push_back(conn.slice);
+}
+
+void ProxyServer::handle_line(ProxyConnection& conn, const std::string& line) {
+    rapidjson::Document doc;
+    doc.Parse(line.c_str());
+    if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("method") || !doc["method"].IsString()) {
+        LOG_WARN << "Proxy downstream sent an invalid request: " << line;
+        conn.closing = true;
+        return;
+    }
+
+    std::string id = doc.HasMember("id") ? json_value(doc["id"]) : "null";
+    std::string method = doc["method"].GetString();
+    const rapidjson::Value* params = doc.HasMember("params") && doc["params"].IsArray() ? &doc["params"] : nullptr;
+
+    if (method == "mining.subscribe") {
+        std::shared_ptr<const std::string> job, target;
+        std::string extranonce;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            extranonce = extranonce_for(conn.slice);
+            job = last_job;
+            target = last_target;
+        }
+        conn.subscribed = true;
+        send(conn, response(id, "[null," + json_string(extranonce) + "]"));
+        if (target) send(conn, target);
+        if (job) send(conn, job);
+    } else if (method == "mining.authorize") {
+        if (params && params->Size() > 0 && (*params)[0].IsString()) {
+            conn.worker = (*params)[0].GetString();
+        }
+        LOG_STRATUM << "Proxy downstream " << conn.worker << " authorized (" << conns.size() << " connected)";
+        send(conn, response(id, "true"));
+    } else if (method == "mining.extranonce.subscribe") {
+        send(conn, response(id, "true"));
+    } else if (method == "mining.submit") {
+        if (!params || params->Size() < 5 || !(*params)[1].IsString() || !(*params)[2].IsString() ||
+            !(*params)[3].IsString() || !(*params)[4].IsString()) {
+            send(conn, response(id, "false", "Malformed share"));
+            return;
+        }
+        handle_submit(conn, id, (*params)[1].GetString(), (*params)[2].GetString(), (*params)[3].GetString(),
+                      (*params)[4].GetString());
+    } else {
+        send(conn, response(id, "null", "Unsupported method"));
+    }
+}
+
+void ProxyServer::handle_submit(ProxyConnection& conn, const std::string& id, const std::string& job_id,
+                                const std::string& nonce, const std::string& header, const std::string& mix) {
+    std::string prefix;
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        prefix = extranonce_for(conn.slice);
+    }
+
+    // The slice is what keeps rigs apart; a nonce outside it would be
+    // someone else's work (or a duplicate) as far as the pool is concerned
+    QueuedShare share;
+    share.job_id = job_id;
+    share.nonce_hex = strip_hex_prefix(nonce);
+    share.header_hash = strip_hex_prefix(header);
+    share.mix_hash_hex = strip_hex_prefix(mix);
+    if (share.nonce_hex.size() != 16 || strncasecmp(share.nonce_hex.c_str(), prefix.c_str(), prefix.size()) != 0) {
+        rejected++;
+        send(conn, response(id, "false", "Nonce outside assigned extranonce range"));
+        return;
+    }
+
+    forwarded++;
+    uint64_t connection = conn.id;
+    submit(share, [this, connection, id](bool ok, const std::string& error) {
+        (ok ? accepted : rejected)++;
+        post({Outbound::LINE, connection, std::make_shared<const std::string>(
+                 response(id, ok ? "true" : "false", ok ? "" : (error.empty() ? "Rejected by pool" : error)))});
+    });
+}
+
+void ProxyServer::print_stats() const {
+    LOG_INFO << "Proxy: " << connection_count.load() << " downstream connections, " << forwarded.load()
+             << " shares forwarded, " << accepted.load() << " accepted, " << rejected.load() << " rejected";
+}
@@ -0,0 +1,115 @@
+#include "session_log.h"
+#include <cstring>
+#include "logging.h"
+
+static const char kMagic[8] = {'K', 'P', 'S', 'E', 'S', 'S', '0', '1'};
+
+// Buffered records reach the file at least this often
+#define FLUSH_INTERVAL_MS 1000
+
+static void put_varint(FILE* file, uint64_t value) {
+    uint8_t buf[10];
+    size_t n = 0;
+    while (value >= 0x80) {
+        buf[n++] = static_cast<uint8_t>(value) | 0x80;
+        value >>= 7;
+    }
+    buf[n++] = static_cast<uint8_t>(value);
+    fwrite(buf, 1, n, file);
+}
+
+static bool get_varint(FILE* file, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(file);
+        if (c == EOF) {
+            return false;
+        }
+        value |= static_cast<uint64_t>(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+SessionRecorder::~SessionRecorder() {
+    if (file) {
+        fclose(file);
+    }
+}
+
+bool SessionRecorder::open(const std::string& path) {
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        LOG_ERROR << "Cannot open session recording " << path;
+        return false;
+    }
+    uint64_t wall_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    uint8_t start[8];
+    for (int i = 0; i < 8; ++i) start[i] = static_cast<uint8_t>(wall_ms >> (8 * i));
+    fwrite(kMagic, 1, sizeof(kMagic), file);
+    fwrite(start, 1, sizeof(start), file);
+    last = last_flush = std::chrono::steady_clock::now();
+    return true;
+}
+
+void SessionRecorder::record(SessionEvent event, const char* data, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) {
+        return;
+    }
+    // Taken under the lock so deltas never go negative across threads
+    auto now = std::chrono::steady_clock::now();
+    put_varint(file, std::chrono::duration_cast<std::chrono::microseconds>(now - last).count());
+    fputc(static_cast<int>(event), file);
+    put_varint(file, size);
+    fwrite(data, 1, size, file);
+    last = now;
+    if (now - last_flush >= std::chrono::milliseconds(FLUSH_INTERVAL_MS)) {
+        fflush(file);
+        last_flush = now;
+    }
+}
+
+SessionReader::~SessionReader() {
+    if (file) {
+        fclose(file);
+    }
+}
+
+bool SessionReader::open(const std::string& path) {
+    file = fopen(path.c_str(), "rb");
+    if (!file) {
+        LOG_ERROR << "Cannot open session recording " << path;
+        return false;
+    }
+    char magic[sizeof(kMagic)];
+    uint8_t start[8];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+        fread(start, 1, sizeof(start), file) != sizeof(start)) {
+        LOG_ERROR << path << " is not a session recording";
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    for (int i = 0; i < 8; ++i) wall_start_ms |= static_cast<uint64_t>(start[i]) << (8 * i);
+    return true;
+}
+
+bool SessionReader::next(SessionRecord& record) {
+    uint64_t delta, size;
+    int event;
+    if (!file || !get_varint(file, delta) || (event = fgetc(file)) == EOF || event > 2 || !get_varint(file, size)) {
+        return false;
+    }
+    record.data.resize(size);
+    if (size && fread(&record.data[0], 1, size, file) != size) {
+        return false;
+    }
+    time_us += delta;
+    record.time_us = time_us;
+    record.event = static_cast<SessionEvent>(event);
+    return true;
+}
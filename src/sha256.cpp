@@ -0,0 +1,220 @@
+#include "sha256.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHA256_X86 1
+#endif
+
+static const uint32_t kInit[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const uint32_t kRound[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+static inline uint32_t load_be32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+static inline void store_be32(uint8_t* p, uint32_t v) {
+    p[0] = static_cast<uint8_t>(v >> 24);
+    p[1] = static_cast<uint8_t>(v >> 16);
+    p[2] = static_cast<uint8_t>(v >> 8);
+    p[3] = static_cast<uint8_t>(v);
+}
+
+static void compress(uint32_t state[8], const uint8_t block[64]) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) w[i] = load_be32(block + i * 4);
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + kRound[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha256(const uint8_t* data, size_t size, uint8_t out[32]) {
+    uint32_t state[8];
+    memcpy(state, kInit, sizeof(state));
+
+    size_t done = 0;
+    for (; done + 64 <= size; done += 64) {
+        compress(state, data + done);
+    }
+
+    // Final one or two blocks: the tail, 0x80, zeros, bit length
+    uint8_t tail[128] = {0};
+    size_t rest = size - done;
+    memcpy(tail, data + done, rest);
+    tail[rest] = 0x80;
+    size_t blocks = rest + 9 > 64 ? 2 : 1;
+    uint64_t bits = static_cast<uint64_t>(size) * 8;
+    for (int i = 0; i < 8; ++i) {
+        tail[blocks * 64 - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+    }
+    for (size_t i = 0; i < blocks; ++i) {
+        compress(state, tail + i * 64);
+    }
+
+    for (int i = 0; i < 8; ++i) store_be32(out + i * 4, state[i]);
+}
+
+void sha256d(const uint8_t* data, size_t size, uint8_t out[32]) {
+    uint8_t first[32];
+    sha256(data, size, first);
+    sha256(first, sizeof(first), out);
+}
+
+// Padding block for a 64-byte message and for a 32-byte digest
+static const uint8_t kPad64[64] = {0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02, 0x00};
+
+static void sha256d_64_one(const uint8_t in[64], uint8_t out[32]) {
+    uint32_t state[8];
+    memcpy(state, kInit, sizeof(state));
+    compress(state, in);
+    compress(state, kPad64);
+
+    uint8_t second[64] = {0};
+    for (int i = 0; i < 8; ++i) store_be32(second + i * 4, state[i]);
+    second[32] = 0x80;
+    second[62] = 0x01;      // 256 bits
+    memcpy(state, kInit, sizeof(state));
+    compress(state, second);
+    for (int i = 0; i < 8; ++i) store_be32(out + i * 4, state[i]);
+}
+
+// Each returns how many of the count inputs it hashed; the scalar loop does
+// the rest.
+typedef size_t (*MultiBlock)(const uint8_t* in, uint8_t* out, size_t count);
+
+static size_t multi_none(const uint8_t*, uint8_t*, size_t) { return 0; }
+
+#ifdef SHA256_X86
+// Eight messages side by side, one per 32-bit lane
+#define ROTR8(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+__attribute__((target("avx2")))
+static inline void compress_8way(__m256i state[8], __m256i w[16]) {
+    __m256i a = state[0], b = state[1], c = state[2], d = state[3];
+    __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        __m256i wi;
+        if (i < 16) {
+            wi = w[i];
+        } else {
+            __m256i w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w15, 7), ROTR8(w15, 18)), _mm256_srli_epi32(w15, 3));
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w2, 17), ROTR8(w2, 19)), _mm256_srli_epi32(w2, 10));
+            wi = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0), _mm256_add_epi32(w[(i - 7) & 15], s1));
+            w[i & 15] = wi;
+        }
+        __m256i sigma1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(e, 6), ROTR8(e, 11)), ROTR8(e, 25));
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, sigma1),
+                                      _mm256_add_epi32(ch, _mm256_add_epi32(_mm256_set1_epi32(kRound[i]), wi)));
+        __m256i sigma0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(a, 2), ROTR8(a, 13)), ROTR8(a, 22));
+        __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        __m256i t2 = _mm256_add_epi32(sigma0, maj);
+        h = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+        d = c; c = b; b = a; a = _mm256_add_epi32(t1, t2);
+    }
+    state[0] = _mm256_add_epi32(state[0], a); state[1] = _mm256_add_epi32(state[1], b);
+    state[2] = _mm256_add_epi32(state[2], c); state[3] = _mm256_add_epi32(state[3], d);
+    state[4] = _mm256_add_epi32(state[4], e); state[5] = _mm256_add_epi32(state[5], f);
+    state[6] = _mm256_add_epi32(state[6], g); state[7] = _mm256_add_epi32(state[7], h);
+}
+
+__attribute__((target("avx2")))
+static size_t multi_avx2(const uint8_t* in, uint8_t* out, size_t count) {
+    // Byte swap within each 32-bit word: big-endian message words
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256i lanes = _mm256_setr_epi32(0, 16, 32, 48, 64, 80, 96, 112);
+    size_t n = 0;
+    for (; n + 8 <= count; n += 8) {
+        const int* base = reinterpret_cast<const int*>(in + n * 64);
+        __m256i w[16];
+        for (int i = 0; i < 16; ++i) {
+            // Word i of each of the eight 64-byte inputs
+            w[i] = _mm256_shuffle_epi8(_mm256_i32gather_epi32(base + i, lanes, 4), bswap);
+        }
+
+        __m256i state[8];
+        for (int i = 0; i < 8; ++i) state[i] = _mm256_set1_epi32(kInit[i]);
+        compress_8way(state, w);
+        for (int i = 0; i < 16; ++i) w[i] = _mm256_set1_epi32(load_be32(kPad64 + i * 4));
+        compress_8way(state, w);
+
+        // Second hash: the digest plus padding for 256 bits
+        for (int i = 0; i < 8; ++i) w[i] = state[i];
+        w[8] = _mm256_set1_epi32(0x80000000);
+        for (int i = 9; i < 15; ++i) w[i] = _mm256_setzero_si256();
+        w[15] = _mm256_set1_epi32(256);
+        for (int i = 0; i < 8; ++i) state[i] = _mm256_set1_epi32(kInit[i]);
+        compress_8way(state, w);
+
+        // Transpose back: lane j's eight words form output j
+        alignas(32) uint32_t words[8][8];
+        for (int i = 0; i < 8; ++i) {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(words[i]), _mm256_shuffle_epi8(state[i], bswap));
+        }
+        for (int lane = 0; lane < 8; ++lane) {
+            uint32_t digest[8];
+            for (int i = 0; i < 8; ++i) digest[i] = words[i][lane];
+            memcpy(out + (n + lane) * 32, digest, 32);
+        }
+    }
+    return n;
+}
+#endif
+
+struct Sha256Backend {
+    const char* name = "scalar";
+    MultiBlock multi = multi_none;
+
+    Sha256Backend() {
+#ifdef SHA256_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            name = "avx2";
+            multi = multi_avx2;
+        }
+#endif
+    }
+};
+static const Sha256Backend kBackend;
+
+void sha256d_64(const uint8_t* in, uint8_t* out, size_t count) {
+    for (size_t i = kBackend.multi(in, out, count); i < count; ++i) {
+        sha256d_64_one(in + i * 64, out + i * 32);
+    }
+}
+
+const char* sha256_backend() {
+    return kBackend.name;
+}
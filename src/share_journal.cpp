@@ -0,0 +1,201 @@
+#include "share_journal.h"
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "logging.h"
+
+static const char kMagic[8] = {'K', 'P', 'J', 'R', 'N', 'L', '0', '1'};
+
+#define HEADER_SIZE 64
+// The file grows by this many records at a time (1 MiB)
+#define CHUNK_RECORDS 4096
+// Records reach the disk at least this often
+#define SYNC_INTERVAL_MS 1000
+// Beyond this many records waiting for the writer, new ones are dropped
+#define MAX_PENDING 65536
+
+ShareJournal::ShareJournal(const Config& config, const std::string& suffix) {
+    const ShareJournalConfig& settings = config.getShareJournal();
+    if (!settings.enabled || settings.file.empty()) {
+        return;
+    }
+    if (!open(settings.file + suffix)) {
+        return;
+    }
+    writer = std::thread(&ShareJournal::run, this);
+}
+
+ShareJournal::~ShareJournal() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_one();
+    if (writer.joinable()) {
+        writer.join();
+    }
+    if (map) {
+        msync(map, map_size, MS_SYNC);
+        munmap(map, map_size);
+        // Drop the unused end of the last chunk
+        if (ftruncate(fd, HEADER_SIZE + count * sizeof(ShareRecord)) != 0) {
+            LOG_WARN << "Cannot trim share journal: " << strerror(errno);
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool ShareJournal::open(const std::string& path) {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        LOG_ERROR << "Cannot open share journal " << path << ": " << strerror(errno);
+        return false;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    size_t size = st.st_size;
+    if (size < HEADER_SIZE) {
+        uint8_t header[HEADER_SIZE] = {};
+        uint32_t record_size = sizeof(ShareRecord);
+        uint64_t created_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        memcpy(header, kMagic, sizeof(kMagic));
+        memcpy(header + 8, &record_size, sizeof(record_size));
+        memcpy(header + 16, &created_ms, sizeof(created_ms));
+        if (pwrite(fd, header, sizeof(header), 0) != HEADER_SIZE) {
+            LOG_ERROR << "Cannot write share journal " << path << ": " << strerror(errno);
+            close(fd);
+            fd = -1;
+            return false;
+        }
+        size = HEADER_SIZE;
+    } else {
+        char magic[8];
+        if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic) || memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+            LOG_ERROR << path << " is not a share journal";
+            close(fd);
+            fd = -1;
+            return false;
+        }
+    }
+
+    // Append after the last complete record; a crash can leave the rest
+    // of a chunk zeroed
+    uint64_t slots = (size - HEADER_SIZE) / sizeof(ShareRecord);
+    if (!reserve(slots)) {
+        return false;
+    }
+    const ShareRecord* records = reinterpret_cast<const ShareRecord*>(map + HEADER_SIZE);
+    while (count < slots && records[count].magic == SHARE_RECORD_MAGIC) {
+        count++;
+    }
+    LOG_INFO << "Share journal " << path << ": " << count << " records";
+    return true;
+}
+
+// Makes room for at least records, growing the file by whole chunks
+bool ShareJournal::reserve(uint64_t records) {
+    uint64_t chunks = (records + CHUNK_RECORDS) / CHUNK_RECORDS;
+    size_t size = HEADER_SIZE + chunks * CHUNK_RECORDS * sizeof(ShareRecord);
+    if (map && size <= map_size) {
+        return true;
+    }
+    if (map) {
+        munmap(map, map_size);
+        map = nullptr;
+    }
+    if (ftruncate(fd, size) != 0) {
+        LOG_ERROR << "Cannot grow share journal: " << strerror(errno);
+        return false;
+    }
+    void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        LOG_ERROR << "Cannot map share journal: " << strerror(errno);
+        return false;
+    }
+    map = static_cast<uint8_t*>(mapped);
+    map_size = size;
+    return true;
+}
+
+void ShareJournal::record(const ShareRecord& r) {
+    if (!map) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pending.size() >= MAX_PENDING) {
+        dropped++;
+        return;
+    }
+    pending.push_back(r);
+}
+
+void ShareJournal::run() {
+    std::vector<ShareRecord> batch;
+    for (;;) {
+        uint64_t lost;
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait_for(lock, std::chrono::milliseconds(SYNC_INTERVAL_MS), [this] { return stopping; });
+            batch.swap(pending);
+            lost = dropped;
+            dropped = 0;
+            stop = stopping;
+        }
+        if (lost) {
+            LOG_WARN << "Share journal fell behind, " << lost << " records dropped";
+        }
+        write_batch(batch);
+        batch.clear();
+        if (stop) {
+            return;
+        }
+    }
+}
+
+void ShareJournal::write_batch(std::vector<ShareRecord>& batch) {
+    if (batch.empty() || !reserve(count + batch.size())) {
+        return;
+    }
+    size_t offset = HEADER_SIZE + count * sizeof(ShareRecord);
+    size_t bytes = batch.size() * sizeof(ShareRecord);
+    memcpy(map + offset, batch.data(), bytes);
+    count += batch.size();
+
+    // msync wants a page aligned start
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = offset / page * page;
+    if (msync(map + start, offset + bytes - start, MS_SYNC) != 0) {
+        LOG_WARN << "Cannot sync share journal: " << strerror(errno);
+    }
+}
+
+ShareJournalReader::~ShareJournalReader() {
+    if (file) {
+        fclose(file);
+    }
+}
+
+bool ShareJournalReader::open(const std::string& path) {
+    file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    uint8_t header[HEADER_SIZE];
+    uint32_t record_size = 0;
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, kMagic, sizeof(kMagic)) != 0) {
+        return false;
+    }
+    memcpy(&record_size, header + 8, sizeof(record_size));
+    return record_size == sizeof(ShareRecord);
+}
+
+bool ShareJournalReader::next(ShareRecord& record) {
+    return file && fread(&record, sizeof(record), 1, file) == 1 && record.magic == SHARE_RECORD_MAGIC;
+}
@@ -0,0 +1,255 @@
+#include "share_queue.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <unistd.h>
+#include "logging.h"
+
+// Rewrite the file once this many resolved records have accumulated
+#define COMPACT_THRESHOLD 1024
+
+static uint64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static std::string queued_record(const QueuedShare& share) {
+    std::ostringstream line;
+    line << "Q\t" << share.seq << "\t" << share.expires_ms << "\t" << share.block_number << "\t"
+         << share.job_id << "\t" << share.nonce_hex << "\t" << share.header_hash << "\t" << share.mix_hash_hex << "\t"
+         << share.pool << "\n";
+    return line.str();
+}
+
+ShareQueue::ShareQueue(const Config& config, const std::string& suffix) : settings(config.getShareQueue()) {
+    if (!settings.file.empty()) {
+        settings.file += suffix;
+    }
+    if (settings.enabled && !settings.file.empty()) {
+        load();
+        writer = std::thread(&ShareQueue::run, this);
+    }
+}
+
+ShareQueue::~ShareQueue() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_one();
+    if (writer.joinable()) {
+        writer.join();
+    }
+    if (file) {
+        fclose(file);
+    }
+}
+
+void ShareQueue::load() {
+    std::map<uint64_t, QueuedShare> live;
+    std::ifstream in(settings.file);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string type;
+        std::getline(fields, type, '\t');
+
+        QueuedShare share;
+        std::string seq;
+        std::getline(fields, seq, '\t');
+        try {
+            share.seq = std::stoull(seq);
+        } catch (const std::exception&) {
+            continue; // torn write at the end of the file
+        }
+
+        if (type == "R") {
+            live.erase(share.seq);
+            continue;
+        }
+
+        std::string expires, block;
+        std::getline(fields, expires, '\t');
+        std::getline(fields, block, '\t');
+        std::getline(fields, share.job_id, '\t');
+        std::getline(fields, share.nonce_hex, '\t');
+        std::getline(fields, share.header_hash, '\t');
+        std::getline(fields, share.mix_hash_hex, '\t');
+        std::getline(fields, share.pool, '\t');
+        if (type != "Q" || share.mix_hash_hex.empty()) {
+            continue;
+        }
+        share.expires_ms = std::strtoull(expires.c_str(), nullptr, 10);
+        share.block_number = std::strtoull(block.c_str(), nullptr, 10);
+        live[share.seq] = share;
+    }
+
+    uint64_t now = now_ms();
+    for (auto& entry : live) {
+        next_seq = std::max(next_seq, entry.first + 1);
+        if (entry.second.expires_ms > now) {
+            shares.push_back(entry.second);
+        } else {
+            discarded_expired++;
+        }
+    }
+
+    // Before the writer starts, so the file is still this thread's
+    std::string records;
+    for (const QueuedShare& share : shares) {
+        records += queued_record(share);
+    }
+    rewrite(records);
+    if (!shares.empty() || discarded_expired) {
+        LOG_INFO << "Loaded " << shares.size() << " undelivered shares from " << settings.file
+                 << ", " << discarded_expired << " expired";
+    }
+}
+
+void ShareQueue::run() {
+    std::string batch;
+    for (;;) {
+        bool compact, stop;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return stopping || compact_due || !pending.empty(); });
+            compact = compact_due;
+            stop = stopping;
+            batch.clear();
+            if (compact) {
+                // The queue as it is now replaces the file, records still
+                // pending included
+                for (const QueuedShare& share : shares) {
+                    batch += queued_record(share);
+                }
+                pending.clear();
+                compact_due = false;
+            } else {
+                batch.swap(pending);
+            }
+        }
+
+        if (compact) {
+            rewrite(batch);
+        } else if (file && !batch.empty()) {
+            fputs(batch.c_str(), file);
+            fflush(file);
+            fdatasync(fileno(file));
+        }
+        if (stop) {
+            return;
+        }
+    }
+}
+
+void ShareQueue::rewrite(const std::string& records) {
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+
+    std::string tmp = settings.file + ".tmp";
+    FILE* out = fopen(tmp.c_str(), "w");
+    if (!out) {
+        LOG_ERROR << "Cannot write share queue file " << tmp << ", queue is memory only";
+        return;
+    }
+    fputs(records.c_str(), out);
+    fflush(out);
+    fdatasync(fileno(out));
+    fclose(out);
+    rename(tmp.c_str(), settings.file.c_str());
+
+    file = fopen(settings.file.c_str(), "a");
+}
+
+// Called under the lock; the writer picks the record up
+void ShareQueue::append(const std::string& record) {
+    if (!writer.joinable()) {
+        return;
+    }
+    pending += record;
+    cv.notify_one();
+}
+
+void ShareQueue::push(QueuedShare share) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!settings.enabled) {
+        if (on_discard) {
+            on_discard(share, "queue disabled");
+        }
+        return;
+    }
+
+    if (shares.size() >= settings.max_shares) {
+        resolve_locked(shares.front());
+        if (on_discard) {
+            on_discard(shares.front(), "queue full");
+        }
+        shares.pop_front();
+        dropped_overflow++;
+    }
+
+    share.seq = next_seq++;
+    shares.push_back(share);
+    queued_total++;
+    append(queued_record(share));
+    LOG_WARN << "Pool unreachable, queued share " << share.nonce_hex << " for job " << share.job_id
+             << " (" << shares.size() << " waiting)";
+}
+
+std::vector<QueuedShare> ShareQueue::take_replayable(uint64_t current_block, const std::string& pool) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<QueuedShare> replay;
+    uint64_t now = now_ms();
+
+    for (const QueuedShare& share : shares) {
+        if (share.expires_ms <= now) {
+            discarded_expired++;
+            if (on_discard) {
+                on_discard(share, "expired in queue");
+            }
+        } else if (share.pool != pool) {
+            discarded_pool++;
+            if (on_discard) {
+                on_discard(share, "pool changed");
+            }
+        } else if (share.block_number != current_block) {
+            discarded_stale++;
+            if (on_discard) {
+                on_discard(share, "block passed in queue");
+            }
+        } else {
+            replay.push_back(share);
+            replayed++;
+        }
+        resolve_locked(share);
+    }
+    shares.clear();
+
+    if (resolved_records >= COMPACT_THRESHOLD && writer.joinable()) {
+        compact_due = true;
+        resolved_records = 0;
+        cv.notify_one();
+    }
+    return replay;
+}
+
+void ShareQueue::resolve_locked(const QueuedShare& share) {
+    append("R\t" + std::to_string(share.seq) + "\n");
+    resolved_records++;
+}
+
+size_t ShareQueue::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return shares.size();
+}
+
+void ShareQueue::print_stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    LOG_INFO << "Share queue: " << queued_total << " queued, " << replayed << " replayed, "
+             << discarded_expired << " expired, " << discarded_stale << " stale block, " << discarded_pool << " other pool, "
+             << dropped_overflow << " dropped (queue full), " << shares.size() << " waiting";
+}
@@ -0,0 +1,39 @@
+#include "share_target.h"
+
+static ShareBoundary make_boundary(const uint256& target) {
+    ShareBoundary boundary;
+    boundary.target = target;
+    boundary.prefix = target.high64();
+    boundary.difficulty = difficulty_from_target(target);
+    return boundary;
+}
+
+bool boundary_from_hex(const std::string& hex, ShareBoundary& boundary) {
+    size_t digits = hex.size() - (hex.compare(0, 2, "0x") == 0 ? 2 : 0);
+    uint256 target;
+    if (digits != 64 || !uint256::from_hex(hex, target)) {
+        return false;
+    }
+    boundary = make_boundary(target);
+    return true;
+}
+
+ShareBoundary boundary_from_difficulty(double difficulty) {
+    return make_boundary(target_from_difficulty(difficulty));
+}
+
+std::string boundary_to_hex(const ShareBoundary& boundary) {
+    return boundary.target.to_hex();
+}
+
+bool boundary_meets(const uint32_t hash[8], const ShareBoundary& boundary) {
+    return uint256::from_words(hash) <= boundary.target;
+}
+
+ShareBoundary monitor_boundary(const ShareBoundary& share, double hashrate, double interval_seconds) {
+    double difficulty = hashrate * interval_seconds / hashes_per_share(1.0);
+    if (hashrate <= 0 || difficulty >= share.difficulty) {
+        return share;
+    }
+    return boundary_from_difficulty(difficulty);
+}
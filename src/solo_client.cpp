@@ -0,0 +1,263 @@
+#include "solo_client.h"
+#include <chrono>
+#include <cstring>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "base/crypto/sha3.h"
+#include "hex.h"
+#include "sha256.h"
+#include "share_target.h"
+#include "logging.h"
+
+#define KAWPOW_EPOCH_LENGTH 7500
+#define MAX_SOLO_JOBS 8
+#define TEMPLATE_TIMEOUT 30
+// A long-poll that times out is simply reissued
+#define LONGPOLL_TIMEOUT 60
+
+SoloClient::SoloClient(const Config& config, KawPow& kawpow)
+    : config(config), settings(config.getSolo()), kawpow(kawpow),
+      submit_rpc(settings.host, settings.port, settings.user, settings.pass) {
+    LOG_INFO << "Initializing solo mining client";
+    kawpow.set_solo(this);
+}
+
+SoloClient::~SoloClient() {
+    stop();
+}
+
+void SoloClient::run() {
+    if (!address_to_script(settings.address, payout_script)) {
+        LOG_ERROR << "Invalid payout address for solo mining: " << settings.address;
+        return;
+    }
+
+    running = true;
+    if (settings.notify_port > 0) {
+        notify_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(settings.notify_port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(notify_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+            LOG_INFO << "Listening for block notifications on 127.0.0.1:" << settings.notify_port << "/udp";
+            notify_thread = std::thread(&SoloClient::notify_loop, this);
+        } else {
+            LOG_ERROR << "Cannot bind block notification port " << settings.notify_port << ": " << strerror(errno);
+            close(notify_fd);
+            notify_fd = -1;
+        }
+    }
+    if (settings.longpoll) {
+        longpoll_thread = std::thread(&SoloClient::longpoll_loop, this);
+    }
+
+    DaemonRpc rpc(settings.host, settings.port, settings.user, settings.pass);
+    while (running) {
+        refresh(rpc, "");
+
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake_cv.wait_for(lock, std::chrono::seconds(settings.poll_interval), [this] { return wake_pending || !running; });
+        wake_pending = false;
+    }
+}
+
+void SoloClient::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    wake();
+    if (longpoll_thread.joinable()) longpoll_thread.join();
+    if (notify_thread.joinable()) notify_thread.join();
+    if (notify_fd >= 0) {
+        close(notify_fd);
+        notify_fd = -1;
+    }
+}
+
+void SoloClient::wake() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        wake_pending = true;
+    }
+    wake_cv.notify_one();
+}
+
+bool SoloClient::refresh(DaemonRpc& rpc, const std::string& longpollid) {
+    std::string params = "[{\"rules\":[\"segwit\"]" +
+                         (longpollid.empty() ? std::string() : ",\"longpollid\":\"" + longpollid + "\"") + "}]";
+    auto start = std::chrono::steady_clock::now();
+    rapidjson::Document reply;
+    if (!rpc.call("getblocktemplate", params, reply, longpollid.empty() ? TEMPLATE_TIMEOUT : LONGPOLL_TIMEOUT)) {
+        if (longpollid.empty()) {
+            LOG_WARN << "getblocktemplate failed: " << rpc.last_error();
+        } else {
+            LOG_STRATUM << "Long-poll ended without a template: " << rpc.last_error();
+        }
+        return false;
+    }
+    if (reply.HasMember("error") && !reply["error"].IsNull()) {
+        const rapidjson::Value& error = reply["error"];
+        LOG_ERROR << "getblocktemplate error: "
+                  << (error.IsObject() && error.HasMember("message") ? error["message"].GetString() : "unknown");
+        return false;
+    }
+
+    auto tpl = std::make_shared<BlockTemplate>();
+    if (!reply.HasMember("result") || !parse_block_template(reply["result"], *tpl)) {
+        return false;
+    }
+    LOG_STRATUM << "getblocktemplate round trip "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+                << " ms";
+    apply_template(tpl, longpollid.empty() ? "poll" : "long-poll");
+    return true;
+}
+
+void SoloClient::apply_template(std::shared_ptr<const BlockTemplate> tpl, const char* source) {
+    std::lock_guard<std::mutex> apply_lock(apply_mutex);
+    auto start = std::chrono::steady_clock::now();
+
+    SoloJob job;
+    job.tpl = tpl;
+    uint64_t job_id;
+    std::string seed;
+    {
+        std::lock_guard<std::mutex> lock(job_mutex);
+        current_longpollid = tpl->longpollid;
+
+        // A poll only restarts work for a new block; new transactions wait
+        // for the long-poll, which the node answers when they matter.
+        bool new_block = tpl->prev_hash != current_prev_hash;
+        if (!new_block && strcmp(source, "long-poll") != 0) {
+            return;
+        }
+        current_prev_hash = tpl->prev_hash;
+        job_id = next_job_id++;
+        seed = seed_hash(tpl->height);
+    }
+
+    job.coinbase = build_coinbase(*tpl, payout_script, settings.coinbase_tag, true);
+    std::vector<uint8_t> stripped = build_coinbase(*tpl, payout_script, settings.coinbase_tag, false);
+    Hash256 coinbase_txid;
+    sha256d(stripped.data(), stripped.size(), coinbase_txid.data());
+    kawpow_header(*tpl, merkle_root(coinbase_txid, tpl->merkle_branch), job.header);
+    std::string header_hash = kawpow_header_hash(job.header);
+
+    ShareBoundary target;
+    if (!boundary_from_hex(tpl->target_hex, target)) {
+        boundary_from_hex(uint256::from_compact(tpl->bits).to_hex(), target);
+    }
+
+    char id_hex[17];
+    snprintf(id_hex, sizeof(id_hex), "%llx", static_cast<unsigned long long>(job_id));
+    {
+        std::lock_guard<std::mutex> lock(job_mutex);
+        jobs[job_id] = job;
+        while (jobs.size() > MAX_SOLO_JOBS) {
+            jobs.erase(jobs.begin());
+        }
+    }
+
+    LOG_INFO << "New block template from " << source << " - height " << tpl->height << ", "
+             << tpl->txids.size() << " transactions, difficulty " << target.difficulty;
+    LOG_STRATUM << "  Header hash " << header_hash << " built in "
+                << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count()
+                << " us";
+    kawpow.set_job(0, id_hex, header_hash, seed, tpl->height, target);
+}
+
+// Ethash seed: Keccak-256 applied once per epoch to 32 zero bytes
+std::string SoloClient::seed_hash(uint64_t block_number) {
+    uint64_t epoch = block_number / KAWPOW_EPOCH_LENGTH;
+    if (epoch != seed_epoch) {
+        uint8_t seed[32] = {0};
+        for (uint64_t i = 0; i < epoch; ++i) {
+            sha3_HashBuffer(256, SHA3_FLAGS_KECCAK, seed, sizeof(seed), seed, sizeof(seed));
+        }
+        seed_hex.assign(64, '0');
+        hex_encode(seed, sizeof(seed), &seed_hex[0]);
+        seed_epoch = epoch;
+    }
+    return seed_hex;
+}
+
+void SoloClient::longpoll_loop() {
+    DaemonRpc rpc(settings.host, settings.port, settings.user, settings.pass);
+    while (running) {
+        std::string longpollid;
+        {
+            std::lock_guard<std::mutex> lock(job_mutex);
+            longpollid = current_longpollid;
+        }
+        if (longpollid.empty() || !refresh(rpc, longpollid)) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    }
+}
+
+void SoloClient::notify_loop() {
+    char buf[512];
+    while (running) {
+        pollfd pfd{notify_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 1000) <= 0) {
+            continue;
+        }
+        ssize_t n = recv(notify_fd, buf, sizeof(buf) - 1, 0);
+        if (n > 0) {
+            buf[n] = '\0';
+            LOG_INFO << "Block notification " << buf;
+            wake();
+        }
+    }
+}
+
+void SoloClient::submit(const std::string& job_id, const std::string& nonce_hex, const std::string& header_hash_hex,
+                        const std::string& mix_hash_hex) {
+    SoloJob job;
+    {
+        std::lock_guard<std::mutex> lock(job_mutex);
+        auto it = jobs.find(strtoull(job_id.c_str(), nullptr, 16));
+        if (it == jobs.end()) {
+            LOG_WARN << "Block solution for unknown job " << job_id << " dropped";
+            return;
+        }
+        job = it->second;
+    }
+
+    uint64_t nonce = strtoull(nonce_hex.c_str(), nullptr, 16);
+    std::string block = serialize_block(job.header, nonce, mix_hash_hex, job.coinbase, job.tpl->tx_data);
+    if (block.empty()) {
+        LOG_ERROR << "Invalid mix hash in block solution: " << mix_hash_hex;
+        return;
+    }
+    LOG_INFO << "Submitting block at height " << job.tpl->height << " - Nonce: " << nonce_hex;
+    LOG_STRATUM << "  Header hash " << header_hash_hex;
+
+    rapidjson::Document reply;
+    bool sent;
+    {
+        std::lock_guard<std::mutex> lock(submit_mutex);
+        sent = submit_rpc.call("submitblock", "[\"" + block + "\"]", reply, TEMPLATE_TIMEOUT);
+    }
+    if (!sent) {
+        LOG_ERROR << "submitblock failed: " << submit_rpc.last_error();
+    } else if (reply.HasMember("error") && !reply["error"].IsNull()) {
+        const rapidjson::Value& error = reply["error"];
+        LOG_ERROR << "Block rejected: "
+                  << (error.IsObject() && error.HasMember("message") ? error["message"].GetString() : "unknown error");
+    } else if (reply.HasMember("result") && reply["result"].IsString()) {
+        // BIP22 reasons; "inconclusive" means accepted but not on the best chain yet
+        LOG_ERROR << "Block rejected by node: " << reply["result"].GetString();
+    } else {
+        LOG_INFO << "Block accepted by node at height " << job.tpl->height;
+    }
+
+    // Whatever happened, the chain tip has probably moved
+    wake();
+}
@@ -6,98 +6,193 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
 #include <errno.h>
-#include <netdb.h>
 #include <vector>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <cstring>
 #include "rapidjson/document.h"
 #include "rapidjson/writer.h"
 #include "rapidjson/stringbuffer.h"
+#include "hex.h"
 #include "logging.h"
+#include "trace.h"
+#include "proxy_server.h"
 
 // Connection timeout in seconds
 #define CONNECTION_TIMEOUT 10
+// Jobs remembered for the expiry and block number of shares found on them
+#define MAX_RECENT_JOBS 16
+// Largest pool message accepted; a notify is a few hundred bytes
+#define MAX_MESSAGE_SIZE (64 * 1024)
+// How often an outstanding liveness probe is checked for its ACK
+#define PROBE_CHECK_MS 20
+// Shortest wait for a new job; pools that send a job on connect and another
+// right after would otherwise measure a notify interval of a few ms
+#define MIN_JOB_WAIT_MS 10000
 
-Stratum::Stratum(const Config& config, KawPow& kawpow) : config(config), kawpow(kawpow), sock(0) {
+static uint64_t wall_clock_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t wall_clock_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+Stratum::Stratum(const Config& config, KawPow& kawpow, int pinned_pool)
+    : config(config), kawpow(kawpow), sock(-1), pinned_pool(pinned_pool), dns(config), scorer(config, dns),
+      share_queue(config, pinned_pool < 0 ? "" : "." + std::to_string(pinned_pool)),
+      journal(config, pinned_pool < 0 ? "" : "." + std::to_string(pinned_pool)) {
     LOG_INFO << "Initializing Stratum client";
-    kawpow.set_stratum(this);
+    if (journal.enabled()) {
+        share_queue.set_discard_handler([this](const QueuedShare& share, const char* reason) {
+            journal_share(share, ShareOutcome::LOST, 0, reason);
+        });
+    }
+    if (pinned_pool < 0) {
+        slot = kawpow.add_source(this, "pool", 1);
+    } else {
+        const PoolConfig& pool = config.getPools()[pinned_pool];
+        pool_index = pinned_pool;
+        slot = kawpow.add_source(this, pool.host + ":" + std::to_string(pool.port), pool.weight);
+    }
+    if (!config.getPools().empty()) {
+        const PoolConfig& pool = config.getPools()[pool_index];
+        live_status.pool = pool.host + ":" + std::to_string(pool.port);
+        status_pool = pool_index;
+    }
+
+    Metrics& metrics = Metrics::instance();
+    for (size_t i = 0; i < config.getPools().size(); ++i) {
+        PoolMetrics m;
+        if (pinned_pool < 0 || static_cast<size_t>(pinned_pool) == i) {
+            const PoolConfig& pool = config.getPools()[i];
+            m.labels = "pool=" + metric_label(pool.host + ":" + std::to_string(pool.port));
+            m.accepted = &metrics.counter("kawpow_shares_total", "Share verdicts from the pool", m.labels + ",result=\"accepted\"");
+            m.rejected = &metrics.counter("kawpow_shares_total", "Share verdicts from the pool", m.labels + ",result=\"rejected\"");
+            m.stale = &metrics.counter("kawpow_shares_total", "Share verdicts from the pool", m.labels + ",result=\"stale\"");
+            m.submit_rtt = &metrics.histogram("kawpow_submit_rtt_seconds", "mining.submit sent to the pool's verdict", m.labels);
+            m.share_to_wire = &metrics.histogram("kawpow_share_to_wire_seconds", "Share handed over by a device to its submit leaving the socket", m.labels);
+            m.connected = &metrics.gauge("kawpow_pool_connected", "1 while a session with the pool is up", m.labels);
+        }
+        pool_metrics.push_back(m);
+    }
+
+    // Resolve every pool up front so no connect has to wait for DNS
+    for (const PoolConfig& pool : config.getPools()) {
+        dns.prefetch(pool.host);
+        tls_sessions.emplace_back(pool.tls ? new TlsTransport(pool.host, pool.tls_fingerprint) : nullptr);
+    }
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+Stratum::~Stratum() {
+    if (wake_fd >= 0) {
+        close(wake_fd);
+    }
 }
 
 void Stratum::run() {
     LOG_INFO << "Starting Stratum client";
-    connect();
-    subscribe();
-    authorize();
+    if (config.getRecord().enabled) {
+        recorder.reset(new SessionRecorder);
+        std::string file = config.getRecord().file;
+        if (pinned_pool >= 0) {
+            file += "." + std::to_string(pinned_pool);
+        }
+        if (!recorder->open(file)) {
+            recorder.reset();
+        }
+    }
+    // A pool pinned by the hashrate split keeps its session; the split
+    // itself is the pool selection
+    if (pinned_pool < 0) {
+        scorer.start();
+        trace_thread_name("stratum");
+    } else {
+        const PoolConfig& pool = config.getPools()[pinned_pool];
+        trace_thread_name("stratum " + pool.host + ":" + std::to_string(pool.port));
+    }
+    open_session();
 
     char buffer[4096];
-    memset(buffer, 0, sizeof(buffer));
-    size_t buffer_offset = 0;
     
     LOG_INFO << "Entering main receive loop";
     while (true) {
-        // Use poll to wait for data with a timeout
-        struct pollfd fds;
-        fds.fd = sock;
-        fds.events = POLLIN;
-        int poll_result = poll(&fds, 1, 5000); // 5 second timeout
-        
-        if (poll_result < 0) {
-            LOG_ERROR << "Poll error: " << strerror(errno);
-            break;
-        } else if (poll_result == 0) {
-            // Timeout - no data received
-            LOG_INFO << "No data received for 5 seconds, connection still active";
+        int requested = requested_pool.exchange(-1);
+        if (requested >= 0 && static_cast<size_t>(requested) != pool_index) {
+            LOG_INFO << "Switching to pool " << config.getPools()[requested].url << " as requested";
+            scorer.record_switch();
+            disconnect();
+            pool_index = requested;
+            open_session();
             continue;
         }
-        
-        int bytes_received = recv(sock, buffer + buffer_offset, sizeof(buffer) - buffer_offset - 1, 0);
-        if (bytes_received > 0) {
-            buffer_offset += bytes_received;
-            buffer[buffer_offset] = '\0'; // Ensure null termination
-            
-            LOG_STRATUM << "Received " << bytes_received << " bytes, total buffer: " << buffer_offset << " bytes";
-            
-            // Process complete lines in the buffer
-            char* line_start = buffer;
-            char* line_end;
-            
-            while ((line_end = strstr(line_start, "\n")) != nullptr) {
-                *line_end = '\0'; // Replace newline with null terminator
-                std::string message(line_start);
-                
-                // Process the complete message
-                handle_message(message);
-                
-                // Move to the next line
-                line_start = line_end + 1;
+
+        // Periodically re-rank pools and migrate to a clearly better one
+        if (pinned_pool < 0 && scorer.rank_due()) {
+            scorer.print();
+            size_t best = scorer.select(pool_index);
+            if (best != pool_index) {
+                disconnect();
+                pool_index = best;
+                open_session();
+                continue;
             }
+        }
+
+        int wait_ms = check_liveness();
+        if (wait_ms < 0) {
+            continue;
+        }
+
+        // Records already decrypted and buffered by TLS are not visible to poll
+        if (!(tls && tls->pending())) {
+            struct pollfd fds[2];
+            fds[0].fd = sock;
+            fds[0].events = POLLIN;
+            fds[1].fd = wake_fd;
+            fds[1].events = POLLIN;
+            int poll_result = poll(fds, 2, wait_ms);
             
-            // Move any remaining incomplete data to the beginning of the buffer
-            if (line_start < buffer + buffer_offset) {
-                size_t remaining = buffer + buffer_offset - line_start;
-                memmove(buffer, line_start, remaining);
-                buffer_offset = remaining;
-            } else {
-                buffer_offset = 0;
+            if (poll_result < 0) {
+                LOG_ERROR << "Poll error: " << strerror(errno);
+                break;
+            }
+            if (fds[1].revents & POLLIN) {
+                uint64_t count;
+                while (read(wake_fd, &count, sizeof(count)) > 0) {}
+                send_forwarded();
+            }
+            if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+        }
+        
+        int bytes_received = recv_some(buffer, sizeof(buffer));
+        if (bytes_received > 0) {
+            last_alive = std::chrono::steady_clock::now();
+            LOG_STRATUM << "Received " << bytes_received << " bytes";
+            if (!handle_received(buffer, bytes_received)) {
+                fail_over("bad message", 0);
             }
         } else if (bytes_received == 0) {
             LOG_ERROR << "Connection closed by pool";
-            LOG_INFO << "Attempting to reconnect...";
-            close(sock);
-            connect();
-            subscribe();
-            authorize();
-            buffer_offset = 0;
+            fail_over("closed by pool", 0);
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // TLS consumed a non-application record
+            continue;
         } else {
             LOG_ERROR << "Error receiving data: " << strerror(errno);
             if (errno == ECONNRESET || errno == ETIMEDOUT) {
-                LOG_INFO << "Connection reset or timed out, attempting to reconnect...";
-                close(sock);
-                connect();
-                subscribe();
-                authorize();
-                buffer_offset = 0;
+                // ETIMEDOUT is TCP_USER_TIMEOUT or keepalive giving up
+                fail_over(errno == ETIMEDOUT ? "TCP timeout" : "reset",
+                          std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - last_alive).count());
             } else {
                 break;
             }
@@ -105,166 +200,571 @@ void Stratum::run() {
     }
 }
 
-void Stratum::connect() {
-    const PoolConfig& pool = config.getPools()[0];
-    
-    // Improved URL parsing
-    std::string url = pool.url;
-    std::string host;
-    int port;
-    
-    // Check if URL has protocol prefix
-    size_t protocol_pos = url.find("://");
-    if (protocol_pos != std::string::npos) {
-        url = url.substr(protocol_pos + 3); // Remove protocol part
+static void log_timings(const char* name, std::vector<double>& samples) {
+    if (samples.empty()) {
+        return;
     }
-    
-    // Extract host and port
-    size_t port_pos = url.rfind(":");
-    if (port_pos != std::string::npos) {
-        host = url.substr(0, port_pos);
-        port = std::stoi(url.substr(port_pos + 1));
-    } else {
-        // Default port if not specified
-        host = url;
-        port = 3333; // Default stratum port
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (double sample : samples) total += sample;
+    LOG_INFO << "  " << name << ": " << samples.size() << ", mean " << total / samples.size() << " us, p50 "
+             << samples[samples.size() / 2] << " us, p99 " << samples[samples.size() * 99 / 100] << " us, max "
+             << samples.back() << " us";
+}
+
+static std::string strip_hex_prefix(const char* hex) {
+    return strncmp(hex, "0x", 2) == 0 ? hex + 2 : hex;
+}
+
+// Feeds a recording back through the paths a live session takes, without a
+// network: pool messages go through handle_received at their recorded time
+// divided by speed, recorded shares go through submit() and whatever the
+// miner sends is dropped. Replayed submits get new request ids, so the
+// pool's verdicts are renumbered to match.
+bool Stratum::replay(const std::string& path, double speed) {
+    SessionReader reader;
+    if (!reader.open(path)) {
+        return false;
+    }
+    LOG_INFO << "Replaying stratum session " << path << " at " << speed << "x";
+    replay_thread = std::this_thread::get_id();
+    replaying = true;
+    connected = true;
+
+    std::map<int64_t, int> submit_ids;
+    std::vector<double> job_switch_us, submit_us;
+    uint64_t messages = 0;
+    double max_lag_ms = 0;
+    auto start = std::chrono::steady_clock::now();
+    SessionRecord record;
+    while (reader.next(record)) {
+        auto due = start + std::chrono::microseconds(static_cast<int64_t>(record.time_us / speed));
+        auto now = std::chrono::steady_clock::now();
+        if (due > now) {
+            std::this_thread::sleep_until(due);
+        } else {
+            max_lag_ms = std::max(max_lag_ms, std::chrono::duration<double, std::milli>(now - due).count());
+        }
+
+        if (record.event == SessionEvent::CONNECTED) {
+            LOG_INFO << "Replay: session with " << record.data;
+            submit_ids.clear();
+            start_session();
+            continue;
+        }
+
+        rapidjson::Document doc;
+        doc.Parse(record.data.c_str());
+        if (doc.HasParseError() || !doc.IsObject()) {
+            continue;
+        }
+        bool has_id = doc.HasMember("id") && doc["id"].IsInt64();
+
+        if (record.event == SessionEvent::SENT) {
+            if (!has_id || !doc.HasMember("method") || !doc["method"].IsString() ||
+                strcmp(doc["method"].GetString(), "mining.submit") != 0 || !doc.HasMember("params") ||
+                !doc["params"].IsArray() || doc["params"].Size() < 5) {
+                continue;
+            }
+            const rapidjson::Value& params = doc["params"];
+            if (!params[1].IsString() || !params[2].IsString() || !params[3].IsString() || !params[4].IsString()) {
+                continue;
+            }
+            replay_sent.clear();
+            DeviceWork work;
+            work.job_id = params[1].GetString();
+            work.header_hash = params[3].GetString();
+            work.target = pool_target;
+            auto submit_start = std::chrono::steady_clock::now();
+            submit(work, -1, strip_hex_prefix(params[2].GetString()), strip_hex_prefix(params[4].GetString()));
+            submit_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - submit_start).count());
+
+            rapidjson::Document sent;
+            sent.Parse(replay_sent.c_str());
+            if (!sent.HasParseError() && sent.IsObject() && sent.HasMember("id") && sent["id"].IsInt()) {
+                submit_ids[doc["id"].GetInt64()] = sent["id"].GetInt();
+            }
+            continue;
+        }
+
+        std::string message = record.data;
+        if (has_id) {
+            auto it = submit_ids.find(doc["id"].GetInt64());
+            if (it != submit_ids.end()) {
+                doc["id"].SetInt(it->second);
+                rapidjson::StringBuffer buffer;
+                rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+                doc.Accept(writer);
+                message = buffer.GetString();
+                submit_ids.erase(it);
+            }
+        }
+        bool notify = doc.HasMember("method") && doc["method"].IsString() &&
+                      strcmp(doc["method"].GetString(), "mining.notify") == 0;
+        message += "\n";
+        auto feed_start = std::chrono::steady_clock::now();
+        handle_received(message.data(), message.size());
+        if (notify) {
+            job_switch_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - feed_start).count());
+        }
+        messages++;
+    }
+
+    connected = false;
+    replaying = false;
+    double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    LOG_INFO << "Replay finished: " << messages << " pool messages in " << elapsed_ms << " ms, recorded over "
+             << record.time_us / 1000 << " ms, fell behind by up to " << max_lag_ms << " ms";
+    log_timings("Job switches (notify to mining)", job_switch_us);
+    log_timings("Share submits", submit_us);
+    return true;
+}
+
+// True once the peer has acknowledged everything sent so far
+static bool all_acknowledged(int sock) {
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+    return getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &length) == 0 && info.tcpi_unacked == 0;
+}
+
+// Decides whether the connection is still alive. A pool that has been
+// silent for half the failover budget gets a probe, which has the other half
+// to be answered. Until the pool has replied to a probe on this session, the
+// TCP acknowledgement of the probe is enough, since pools that ignore the
+// method still ACK it; after that any data must arrive, which also catches a
+// hung pool process whose kernel keeps ACKing. A pool that is reachable but
+// stops sending jobs is caught by the notify timeout. Returns how long the
+// receive loop may wait before asking again, or -1 after failing over.
+int Stratum::check_liveness() {
+    const KeepaliveConfig& keepalive = config.getKeepalive();
+    auto now = std::chrono::steady_clock::now();
+    auto ms_since = [&now](std::chrono::steady_clock::time_point then) {
+        return std::chrono::duration<double, std::milli>(now - then).count();
+    };
+
+    double job_limit_ms = std::max(keepalive.notify_timeout * scorer.expected_notify_interval_ms(pool_index),
+                                   static_cast<double>(MIN_JOB_WAIT_MS));
+    if (ms_since(last_job) > job_limit_ms) {
+        LOG_WARN << "No new job for " << static_cast<int>(ms_since(last_job) / 1000) << " s";
+        fail_over("no new jobs", ms_since(last_job));
+        return -1;
+    }
+    int next_ms = static_cast<int>(job_limit_ms - ms_since(last_job)) + 1;
+
+    if (keepalive.probe_method.empty()) {
+        return std::min(next_ms, 1000);
+    }
+    int half_budget = keepalive.failover_budget_ms / 2;
+    if (probing) {
+        if (last_alive >= probe_sent || (!probe_answered && all_acknowledged(sock))) {
+            probing = false;
+            last_alive = std::max(last_alive, now);
+        } else if (ms_since(probe_sent) >= half_budget) {
+            LOG_WARN << "Liveness probe unanswered after " << half_budget << " ms";
+            fail_over("probe timeout", ms_since(last_alive));
+            return -1;
+        } else {
+            // ACKs do not wake poll, so look again shortly
+            return std::min(next_ms, PROBE_CHECK_MS);
+        }
+    }
+
+    if (ms_since(last_alive) >= half_budget) {
+        probe_id = track_request(false);
+        std::string msg = "{\"id\":" + std::to_string(probe_id) + ",\"method\":\"" + keepalive.probe_method +
+                          "\",\"params\":[]}\n";
+        send_line(msg);
+        probing = true;
+        probe_sent = now;
+        return std::min(next_ms, PROBE_CHECK_MS);
+    }
+    return std::min(next_ms, half_budget - static_cast<int>(ms_since(last_alive)) + 1);
+}
+
+void Stratum::fail_over(const std::string& cause, double undetected_ms) {
+    FailureStats& stats = failure_stats[cause];
+    stats.count++;
+    stats.total_ms += undetected_ms;
+    stats.max_ms = std::max(stats.max_ms, undetected_ms);
+    LOG_WARN << "Connection failure (" << cause << ") noticed " << static_cast<int>(undetected_ms)
+             << " ms after the pool's last sign of life, failing over";
+    for (const auto& entry : failure_stats) {
+        LOG_INFO << "  " << entry.first << ": " << entry.second.count << " failures, undetected for "
+                 << static_cast<int>(entry.second.total_ms / entry.second.count) << " ms on average, "
+                 << static_cast<int>(entry.second.max_ms) << " ms at most";
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(status_mutex);
+        live_status.failures++;
+    }
+    Metrics::instance().counter("kawpow_reconnects_total", "Pool sessions abandoned, by cause",
+                                pool_metrics[pool_index].labels + ",cause=" + metric_label(cause)).add();
+    disconnect();
+    scorer.record_connect_failure(pool_index);
+    if (pinned_pool < 0) {
+        pool_index = scorer.next_after_failure(pool_index);
+    }
+    open_session();
+}
+
+// Connects to the pool at pool_index, retrying other pools in score order
+// until one accepts, then subscribes and authorizes.
+void Stratum::open_session() {
+    size_t failed = 0;
+    while (!connect()) {
+        scorer.record_connect_failure(pool_index);
+        size_t next = pinned_pool < 0 ? scorer.next_after_failure(pool_index) : pool_index.load();
+        // Pause once every pool has had a try, or failing over between two
+        // dead pools spins
+        if (next == pool_index || ++failed % config.getPools().size() == 0) {
+            send_forwarded();
+            LOG_INFO << "Retrying connection in 5 seconds...";
+            std::this_thread::sleep_for(std::chrono::seconds(5));
+        }
+        pool_index = next;
+    }
+    start_session();
+}
+
+// Session state for a fresh connection (or the start of a replayed one)
+void Stratum::start_session() {
+    const PoolConfig& pool = config.getPools()[pool_index];
+    std::string name = pool.host + ":" + std::to_string(pool.port);
+    if (recorder) {
+        recorder->record(SessionEvent::CONNECTED, name);
+    }
+
+    kawpow.set_connected(slot, true, name);
+    pool_metrics[pool_index].connected->set(1);
+    {
+        std::lock_guard<std::mutex> lock(status_mutex);
+        live_status.pool = name;
+        live_status.connected = true;
+        live_status.tls = pool.tls;
+        live_status.weight = pinned_pool < 0 ? 0 : pool.weight;
+        live_status.job_id.clear();
+        status_pool = pool_index;
+        session_start = std::chrono::steady_clock::now();
     }
 
+    // Extranonces are per session; the new one arrives with the subscribe result
+    reset_receive();
+    last_alive = last_job = std::chrono::steady_clock::now();
+    probing = false;
+    probe_answered = false;
+    session_id.clear();
+    apply_extranonce("");
+    pool_target = boundary_from_difficulty(1);
+    {
+        // Responses to requests sent on the old connection will never arrive;
+        // shares among them go back to the queue to be replayed. Forwarded
+        // shares are failed instead, their rig resubmits on its own terms.
+        std::lock_guard<std::mutex> lock(request_mutex);
+        for (const auto& entry : pending_requests) {
+            if (entry.second.on_result) {
+                entry.second.on_result(false, "Upstream reconnected");
+            } else if (entry.second.share) {
+                share_queue.push(entry.second.share_data);
+            }
+        }
+        pending_requests.clear();
+    }
+    connected = true;
+    replay_pending = true;
+    subscribe();
+    authorize();
+}
+
+// Lets the kernel give up on a dead peer too: unacknowledged data aborts the
+// connection after tcp_user_timeout_ms, and keepalive covers an idle
+// connection when probes are off (its granularity is whole seconds).
+static void tune_keepalive(int sock, const KeepaliveConfig& keepalive) {
+    if (keepalive.tcp_user_timeout_ms > 0) {
+        unsigned int timeout = keepalive.tcp_user_timeout_ms;
+        setsockopt(sock, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout));
+    }
+    if (keepalive.tcp_keepalive) {
+        int on = 1;
+        int idle = std::max(1, keepalive.failover_budget_ms / 2000);
+        int interval = 1;
+        int count = 2;
+        setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+        setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+        setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+        setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+    }
+}
+
+bool Stratum::connect() {
+    const PoolConfig& pool = config.getPools()[pool_index];
+    const std::string& host = pool.host;
+    int port = pool.port;
+
     LOG_INFO << "Connecting to pool " << host << ":" << port;
-    LOG_INFO << "Resolving hostname...";
 
-    // Create socket
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        LOG_ERROR << "Failed to create socket: " << strerror(errno);
-        exit(1);
+    // Cached lookup; only the very first resolution of a host can block
+    std::vector<sockaddr_storage> records;
+    if (!dns.lookup(host, records)) {
+        LOG_ERROR << "Failed to resolve hostname: " << host;
+        return false;
     }
 
-    // Set socket to non-blocking mode for timeout support
-    int flags = fcntl(sock, F_GETFL, 0);
-    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    LOG_INFO << "Racing connection attempts across " << records.size() << " addresses, up to " << CONNECTION_TIMEOUT << " seconds...";
+    auto connect_start = std::chrono::steady_clock::now();
 
-    // Prepare server address
-    sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    
-    // Try to resolve hostname
-    if (inet_pton(AF_INET, host.c_str(), &server_addr.sin_addr) <= 0) {
-        // If direct IP conversion fails, try to resolve as hostname
-        struct hostent *he;
-        he = gethostbyname(host.c_str());
-        if (he == nullptr) {
-            LOG_ERROR << "Failed to resolve hostname: " << host << " - " << strerror(errno);
-            close(sock);
-            exit(1);
+    std::string ip;
+    int fd = happy_eyeballs_connect(records, port, CONNECTION_TIMEOUT * 1000, ip);
+    if (fd < 0) {
+        LOG_ERROR << "Connection to " << host << ":" << port << " failed on all addresses";
+        return false;
+    }
+
+    auto connect_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - connect_start).count();
+    scorer.record_connect(pool_index, static_cast<uint32_t>(connect_ms));
+    LOG_INFO << "Successfully connected to pool at " << ip << " in " << connect_ms << " ms";
+    tune_keepalive(fd, config.getKeepalive());
+
+    TlsTransport* transport = nullptr;
+    if (pool.tls) {
+        // TLS keeps the socket non-blocking and waits inside the transport
+        transport = tls_sessions[pool_index].get();
+        auto handshake_start = std::chrono::steady_clock::now();
+        if (!transport->handshake(fd, CONNECTION_TIMEOUT * 1000)) {
+            close(fd);
+            return false;
         }
-        
-        LOG_INFO << "Hostname resolved successfully";
-        memcpy(&server_addr.sin_addr, he->h_addr_list[0], he->h_length);
+        LOG_INFO << "TLS handshake completed in " << std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - handshake_start).count() << " ms";
     } else {
-        LOG_INFO << "IP address provided, no resolution needed";
+        // Set socket back to blocking mode
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
     }
 
-    LOG_INFO << "Attempting connection to " << inet_ntoa(server_addr.sin_addr) << ":" << port;
-    
-    // Connect with timeout
-    int result = ::connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr));
-    if (result < 0 && errno != EINPROGRESS) {
-        LOG_ERROR << "Connection failed immediately: " << strerror(errno);
+    // Submits from the mining threads only ever see a finished connection
+    std::lock_guard<std::mutex> lock(conn_mutex);
+    sock = fd;
+    tls = transport;
+    return true;
+}
+
+void Stratum::disconnect() {
+    // From here on submits go to the share queue instead of the socket
+    connected = false;
+    kawpow.set_connected(slot, false);
+    pool_metrics[pool_index].connected->set(0);
+    {
+        std::lock_guard<std::mutex> lock(status_mutex);
+        live_status.connected = false;
+    }
+    std::lock_guard<std::mutex> lock(conn_mutex);
+    if (tls) {
+        tls->shutdown();
+        tls = nullptr;
+    }
+    if (sock >= 0) {
         close(sock);
-        exit(1);
+        sock = -1;
     }
+}
 
-    if (result < 0 && errno == EINPROGRESS) {
-        LOG_INFO << "Connection in progress, waiting up to " << CONNECTION_TIMEOUT << " seconds...";
-        
-        // Wait for connection with timeout
-        fd_set write_fds;
-        FD_ZERO(&write_fds);
-        FD_SET(sock, &write_fds);
-        
-        struct timeval timeout;
-        timeout.tv_sec = CONNECTION_TIMEOUT;
-        timeout.tv_usec = 0;
-        
-        result = select(sock + 1, NULL, &write_fds, NULL, &timeout);
-        
-        if (result < 0) {
-            LOG_ERROR << "Connection error: " << strerror(errno);
-            close(sock);
-            exit(1);
-        } else if (result == 0) {
-            LOG_ERROR << "Connection timed out after " << CONNECTION_TIMEOUT << " seconds";
-            close(sock);
-            exit(1);
-        }
-        
-        // Check if connection was successful
-        int error = 0;
-        socklen_t len = sizeof(error);
-        if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
-            LOG_ERROR << "Connection failed: " << strerror(error ? error : errno);
-            close(sock);
-            exit(1);
+bool Stratum::send_line(const std::string& msg) {
+    if (recorder) {
+        recorder->record(SessionEvent::SENT, msg.data(), msg.size() - (!msg.empty() && msg.back() == '\n'));
+    }
+    std::lock_guard<std::mutex> lock(conn_mutex);
+    if (replaying) {
+        // Nothing goes out; the replay driver wants its own submits back
+        if (std::this_thread::get_id() == replay_thread) {
+            replay_sent = msg;
         }
+        return true;
     }
-    
-    // Set socket back to blocking mode
-    fcntl(sock, F_SETFL, flags);
-    
-    LOG_INFO << "Successfully connected to pool";
+    // A submit racing a reconnect must not write to a closed, or reused, fd
+    if (!connected || sock < 0) {
+        return false;
+    }
+    if (tls) {
+        return tls->send(msg.c_str(), msg.length()) == static_cast<int>(msg.length());
+    }
+    return send(sock, msg.c_str(), msg.length(), 0) >= 0;
 }
 
-void Stratum::handle_message(const std::string& message) {
-    // Split the message if it contains multiple JSON objects
-    std::string buffer = message;
-    size_t pos = 0;
-    std::vector<std::string> messages;
-    
-    // Try to find complete JSON objects
-    while (pos < buffer.length()) {
-        // Find the start of a JSON object
-        size_t start = buffer.find_first_of('{', pos);
-        if (start == std::string::npos) break;
-        
-        // Find the matching closing brace
-        int brace_count = 1;
-        size_t end = start + 1;
-        
-        while (end < buffer.length() && brace_count > 0) {
-            if (buffer[end] == '{') brace_count++;
-            else if (buffer[end] == '}') brace_count--;
-            end++;
-        }
-        
-        if (brace_count == 0) {
-            // Found a complete JSON object
-            std::string json_obj = buffer.substr(start, end - start);
-            messages.push_back(json_obj);
-            pos = end;
-        } else {
-            // Incomplete JSON object
-            break;
+int Stratum::recv_some(char* data, size_t size) {
+    if (tls) {
+        return tls->recv(data, size);
+    }
+    return recv(sock, data, size, 0);
+}
+
+// Pools report stale shares as stratum error 21 ("Job not found") or with
+// "stale" in the message text.
+static bool is_stale_error(const rapidjson::Value& error) {
+    const rapidjson::Value* code = nullptr;
+    const rapidjson::Value* text = nullptr;
+    if (error.IsArray() && error.Size() >= 2) {
+        code = &error[0];
+        text = &error[1];
+    } else if (error.IsObject() && error.HasMember("code") && error.HasMember("message")) {
+        code = &error["code"];
+        text = &error["message"];
+    } else {
+        return false;
+    }
+
+    if (code->IsInt() && code->GetInt() == 21) {
+        return true;
+    }
+    if (text->IsString()) {
+        std::string msg = text->GetString();
+        std::transform(msg.begin(), msg.end(), msg.begin(), ::tolower);
+        return msg.find("stale") != std::string::npos || msg.find("job not found") != std::string::npos;
+    }
+    return false;
+}
+
+// Remembers when a request was sent so its response yields an RTT sample.
+// Requests without a fixed id get the next free one.
+int Stratum::track_request(bool share, int fixed_id, const QueuedShare* share_data, ShareResultCallback on_result) {
+    std::lock_guard<std::mutex> lock(request_mutex);
+    int id = fixed_id ? fixed_id : next_request_id++;
+    PendingRequest& request = pending_requests[id];
+    request.sent = std::chrono::steady_clock::now();
+    request.share = share;
+    if (share_data) {
+        request.share_data = *share_data;
+    }
+    request.on_result = std::move(on_result);
+    return id;
+}
+
+PoolStatus Stratum::status() const {
+    PoolStatus status;
+    size_t pool;
+    {
+        std::lock_guard<std::mutex> lock(status_mutex);
+        status = live_status;
+        pool = status_pool;
+        if (status.connected) {
+            status.uptime_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - session_start).count();
         }
     }
-    
-    // Process each JSON message
-    if (messages.empty()) {
-        LOG_ERROR << "Failed to parse any complete JSON objects from message";
-        LOG_ERROR << "Raw message: " << message;
-        return;
+    status.results = scorer.results(pool);
+    status.queued_shares = share_queue.size();
+    return status;
+}
+
+bool Stratum::switch_pool(size_t pool) {
+    if (pinned_pool >= 0 || pool >= config.getPools().size()) {
+        return false;
     }
-    
-    LOG_INFO << "Split message into " << messages.size() << " JSON objects";
-    
-    for (const auto& msg : messages) {
-        process_single_message(msg);
+    requested_pool = static_cast<int>(pool);
+    return true;
+}
+
+void Stratum::record_result(bool accepted, bool stale) {
+    scorer.record_result(pool_index, accepted, stale);
+    const PoolMetrics& m = pool_metrics[pool_index];
+    (accepted ? m.accepted : stale ? m.stale : m.rejected)->add();
+}
+
+// Hex fields of a share as 32 raw bytes, zero if malformed
+static void share_bytes(const std::string& hex, uint8_t out[32]) {
+    size_t skip = hex.compare(0, 2, "0x") == 0 ? 2 : 0;
+    if (!hex_decode(hex.data() + skip, hex.size() - skip, out, 32)) {
+        memset(out, 0, 32);
+    }
+}
+
+void Stratum::journal_share(const QueuedShare& share, ShareOutcome outcome, uint64_t sent_us, const std::string& reason) {
+    const PoolConfig& pool = config.getPools()[pool_index];
+    ShareRecord r;
+    r.outcome = static_cast<uint8_t>(outcome);
+    r.device = static_cast<int16_t>(share.device);
+    r.found_us = share.found_us;
+    r.sent_us = sent_us;
+    r.answered_us = outcome == ShareOutcome::LOST ? 0 : wall_clock_us();
+    r.nonce = strtoull(share.nonce_hex.c_str(), nullptr, 16);
+    r.block_number = share.block_number;
+    r.difficulty = share.target.difficulty;
+    share_bytes(share.header_hash, r.header_hash);
+    share_bytes(share.mix_hash_hex, r.mix_hash);
+    char target_hex[64];
+    share.target.target.to_hex(target_hex);
+    hex_decode(target_hex, sizeof(target_hex), r.target, sizeof(r.target));
+    share_record_text(r.job_id, share.job_id);
+    share_record_text(r.pool, share.pool.empty() ? pool.host + ":" + std::to_string(pool.port) : share.pool);
+    share_record_text(r.reason, reason);
+    journal.record(r);
+}
+
+bool Stratum::take_request(int id, PendingRequest& request) {
+    std::lock_guard<std::mutex> lock(request_mutex);
+    auto it = pending_requests.find(id);
+    if (it == pending_requests.end()) {
+        return false;
     }
+    request = it->second;
+    pending_requests.erase(it);
+    return true;
 }
 
+// Messages are newline terminated, but a read can end anywhere: mid-line,
+// inside a string, or with several objects in one line. Objects are framed
+// by brace depth outside of JSON strings and whatever is left waits in
+// recv_buffer for the next read. Returns false if the pool sends something
+// that cannot be a message, in which case the connection is dropped.
+bool Stratum::handle_received(const char* data, size_t size) {
+    recv_buffer.append(data, size);
+
+    size_t start = 0;
+    for (size_t i = scan_offset; i < recv_buffer.size(); ++i) {
+        char c = recv_buffer[i];
+        if (scan_in_string) {
+            if (scan_escaped) {
+                scan_escaped = false;
+            } else if (c == '\\') {
+                scan_escaped = true;
+            } else if (c == '"') {
+                scan_in_string = false;
+            }
+        } else if (c == '{') {
+            if (scan_depth++ == 0) {
+                start = i;
+            }
+        } else if (scan_depth == 0) {
+            start = i + 1;      // newlines and anything else between objects
+        } else if (c == '"') {
+            scan_in_string = true;
+        } else if (c == '}' && --scan_depth == 0) {
+            if (recorder) {
+                recorder->record(SessionEvent::RECEIVED, recv_buffer.data() + start, i + 1 - start);
+            }
+            process_single_message(recv_buffer.substr(start, i + 1 - start));
+            start = i + 1;
+        }
+    }
+
+    recv_buffer.erase(0, scan_depth > 0 ? start : recv_buffer.size());
+    scan_offset = recv_buffer.size();
+    if (recv_buffer.size() > MAX_MESSAGE_SIZE) {
+        LOG_ERROR << "Pool message exceeds " << MAX_MESSAGE_SIZE << " bytes without terminating";
+        return false;
+    }
+    return true;
+}
+
+void Stratum::reset_receive() {
+    recv_buffer.clear();
+    scan_offset = 0;
+    scan_depth = 0;
+    scan_in_string = false;
+    scan_escaped = false;
+}
 
 void Stratum::process_single_message(const std::string& message) {
+    uint64_t received = trace_clock();
     LOG_STRATUM << "Processing JSON object: " << message;
 
     rapidjson::Document doc;
@@ -276,6 +776,19 @@ void Stratum::process_single_message(const std::string& message) {
         return;
     }
 
+    // A probe reply only shows the pool is there; an error for an unknown
+    // method counts as much as a result
+    if (probe_id && doc.HasMember("id") && doc["id"].IsInt() && doc["id"].GetInt() == probe_id) {
+        PendingRequest request;
+        if (take_request(probe_id, request)) {
+            scorer.record_rtt(pool_index, static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                              std::chrono::steady_clock::now() - request.sent).count()));
+        }
+        probe_id = 0;
+        probe_answered = true;
+        return;
+    }
+
     if (doc.HasMember("method")) {
         std::string method = doc["method"].GetString();
         LOG_STRATUM << "Received method: " << method;
@@ -291,50 +804,144 @@ void Stratum::process_single_message(const std::string& message) {
 
             // --- Safely parse all required job parameters from the pool message ---
             std::string job_id = params[0].IsString() ? params[0].GetString() : "";
-            std::string header_hash = params[1].IsString() ? params[1].GetString() : "";
-            std::string seed_hash = params[2].IsString() ? params[2].GetString() : ""; // <-- The missing piece
-            bool clean_job = params[4].IsBool() ? params[4].GetBool() : true;
+            // Pools send the hashes with or without 0x; the miner keeps bare hex
+            std::string header_hash = params[1].IsString() ? strip_hex_prefix(params[1].GetString()) : "";
+            std::string seed_hash = params[2].IsString() ? strip_hex_prefix(params[2].GetString()) : ""; // <-- The missing piece
             uint64_t block_number = params[5].IsUint64() ? params[5].GetUint64() : 0;
             
             if (job_id.empty() || header_hash.empty() || seed_hash.empty() || block_number == 0) {
                 LOG_ERROR << "Could not parse essential job parameters from mining.notify.";
                 return;
             }
+            uint64_t parsed = trace_clock();
 
+            scorer.record_notify(pool_index);
+            last_job = std::chrono::steady_clock::now();
+            {
+                std::lock_guard<std::mutex> lock(job_mutex);
+                JobInfo& job = recent_jobs[job_id];
+                job.expires_ms = wall_clock_ms() + config.getShareQueue().max_age * 1000ULL;
+                job.block_number = block_number;
+                job.pool = pool_name();
+                last_block_number = block_number;
+                while (recent_jobs.size() > MAX_RECENT_JOBS) {
+                    auto oldest = std::min_element(recent_jobs.begin(), recent_jobs.end(),
+                        [](const std::pair<const std::string, JobInfo>& a, const std::pair<const std::string, JobInfo>& b) {
+                            return a.second.expires_ms < b.second.expires_ms;
+                        });
+                    recent_jobs.erase(oldest);
+                }
+            }
             LOG_INFO << "New Job Received - ID: " << job_id << " Block: " << block_number;
             LOG_STRATUM << "  Header Hash: " << header_hash;
             LOG_STRATUM << "  Seed Hash:   " << seed_hash; // We have it!
 
-            // Stop any previous mining work
-            if (clean_job) {
-                kawpow.stop_mining();
+            // The first job of a new session tells which queued shares
+            // are still for the current block
+            if (replay_pending) {
+                replay_pending = false;
+                replay_shares(block_number);
             }
 
-            // --- THIS IS THE CORRECTED FUNCTION CALL with all 5 arguments ---
-            kawpow.set_job(job_id, header_hash, seed_hash, block_number, current_target);
+            // The share target is bound to the job: the one in the notify
+            // itself if the pool sends it, otherwise the latest
+            // set_target / set_difficulty.
+            ShareBoundary job_target = pool_target;
+            if (params.Size() > 3 && params[3].IsString() && boundary_from_hex(params[3].GetString(), job_target)) {
+                pool_target = job_target;
+            }
+            LOG_STRATUM << "  Share target: " << boundary_to_hex(job_target) << " (difficulty " << job_target.difficulty << ")";
+            if (params.Size() > 6 && params[6].IsString()) {
+                // Block target as Ravencoin compact bits
+                uint32_t bits = static_cast<uint32_t>(strtoul(params[6].GetString(), nullptr, 16));
+                LOG_STRATUM << "  Network difficulty: " << difficulty_from_target(uint256::from_compact(bits));
+            }
 
-        } else if (method == "mining.set_target" && doc.HasMember("params")) {
+            // Devices move to the new job with their next batch, so a
+            // clean job and a plain update are handled alike
+            {
+                std::lock_guard<std::mutex> lock(status_mutex);
+                live_status.job_id = job_id;
+                live_status.block_number = block_number;
+                live_status.diff = job_target.difficulty;
+            }
+            uint64_t generation = kawpow.set_job(slot, job_id, header_hash, seed_hash, block_number, job_target);
+            if (received && parsed) {
+                Tracer::instance().record(TracePoint::NOTIFY_PARSE, received, parsed - received, generation);
+                trace_span(TracePoint::JOB_PUBLISH, parsed, generation);
+            }
+            if (proxy) {
+                proxy->broadcast_job(message);
+            }
+
+        } else if (method == "mining.set_extranonce" && doc.HasMember("params")) {
             const rapidjson::Value& params = doc["params"];
             if (params.IsArray() && params.Size() > 0 && params[0].IsString()) {
-                current_target = params[0].GetString();
-                LOG_STRATUM << "Target set to: " << current_target;
+                apply_extranonce(params[0].GetString());
+            }
+        } else if (method == "mining.set_target" && doc.HasMember("params")) {
+            const rapidjson::Value& params = doc["params"];
+            if (params.IsArray() && params.Size() > 0 && params[0].IsString() &&
+                boundary_from_hex(params[0].GetString(), pool_target)) {
+                LOG_INFO << "Pool set share target " << boundary_to_hex(pool_target)
+                         << " (difficulty " << pool_target.difficulty << "), applies from the next job";
+                if (proxy) {
+                    proxy->broadcast_target(message);
+                }
+            } else {
+                LOG_ERROR << "Invalid mining.set_target: " << message;
+            }
+        } else if (method == "mining.set_difficulty" && doc.HasMember("params")) {
+            const rapidjson::Value& params = doc["params"];
+            if (params.IsArray() && params.Size() > 0 && params[0].IsNumber() && params[0].GetDouble() > 0) {
+                pool_target = boundary_from_difficulty(params[0].GetDouble());
+                LOG_INFO << "Pool set difficulty " << params[0].GetDouble() << ", applies from the next job";
+                if (proxy) {
+                    proxy->broadcast_target(message);
+                }
+            } else {
+                LOG_ERROR << "Invalid mining.set_difficulty: " << message;
             }
         }
     } else if (doc.HasMember("id") && doc.HasMember("result")) {
-        LOG_STRATUM << "Received response for request ID: " << doc["id"].GetInt();
+        int id = doc["id"].IsInt() ? doc["id"].GetInt() : -1;
+        LOG_STRATUM << "Received response for request ID: " << id;
+
+        PendingRequest request;
+        bool tracked = take_request(id, request);
+        if (tracked) {
+            auto rtt_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - request.sent).count();
+            scorer.record_rtt(pool_index, static_cast<uint32_t>(rtt_ms));
+            if (request.share) {
+                pool_metrics[pool_index].submit_rtt->observe_since(request.sent);
+                if (Tracer::enabled()) {
+                    trace_span(TracePoint::SHARE_ACK, Tracer::instance().ns(request.sent), trace_nonce(request.share_data.nonce_hex));
+                }
+            }
+            LOG_STRATUM << "Round trip for request ID " << id << ": " << rtt_ms << " ms";
+        }
         
         // Check for share submission response
-        if (doc["id"].GetInt() == 4) {
+        if (tracked && request.share) {
             const rapidjson::Value& result = doc["result"];
+            bool accepted = false;
+            std::string reason;
+            if (doc.HasMember("error") && doc["error"].IsArray() && doc["error"].Size() >= 2 && doc["error"][1].IsString()) {
+                reason = doc["error"][1].GetString();
+            }
             if (result.IsBool()) {
                 if (result.GetBool()) {
                     LOG_INFO << "Share accepted by pool";
+                    record_result(true, false);
+                    accepted = true;
                 } else {
                     LOG_ERROR << "Share rejected by pool (result=false)";
+                    bool stale = false;
                     
                     // Check for error details
                     if (doc.HasMember("error") && !doc["error"].IsNull()) {
                         const rapidjson::Value& error = doc["error"];
+                        stale = is_stale_error(error);
                         if (error.IsArray() && error.Size() >= 2) {
                             LOG_ERROR << "Error code: " << error[0].GetInt() 
                                      << ", Message: " << error[1].GetString();
@@ -343,7 +950,11 @@ void Stratum::process_single_message(const std::string& message) {
                             LOG_ERROR << "Full response: " << message;
                         }
                     }
+                    record_result(false, stale);
                 }
+            } else if (result.IsNull() && doc.HasMember("error") && !doc["error"].IsNull()) {
+                LOG_ERROR << "Share rejected by pool: " << message;
+                record_result(false, is_stale_error(doc["error"]));
             } else {
                 LOG_ERROR << "Unexpected result type for share submission: " 
                          << (result.IsBool() ? "bool" : 
@@ -351,15 +962,29 @@ void Stratum::process_single_message(const std::string& message) {
                             (result.IsArray() ? "array" : 
                             (result.IsObject() ? "object" : "unknown"))));
             }
-        } else if (doc["id"].GetInt() == 1 || doc["id"].GetInt() == 2) {
-            // Handle subscription or authorization responses
-            const rapidjson::Value& result = doc["result"];
-            if (!result.IsNull() && result.IsArray() && result.Size() > 1) {
-                if (session_id.empty() && result[1].IsString()) {
-                    session_id = result[1].GetString();
-                    LOG_STRATUM << "Session ID received: " << session_id;
-                }
+            bool stale = !accepted && doc.HasMember("error") && !doc["error"].IsNull() && is_stale_error(doc["error"]);
+            const QueuedShare& share = request.share_data;
+            if (share.device >= 0) {
+                const PoolConfig& pool = config.getPools()[pool_index];
+                kawpow.record_result(share.device, pool.host + ":" + std::to_string(pool.port), share.target.difficulty,
+                                     accepted, stale);
+            }
+            if (journal.enabled()) {
+                ShareOutcome outcome = accepted ? ShareOutcome::ACCEPTED : stale ? ShareOutcome::STALE : ShareOutcome::REJECTED;
+                // The request was timed on the steady clock
+                uint64_t sent_us = wall_clock_us() - std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - request.sent).count();
+                journal_share(share, outcome, sent_us, reason);
             }
+            if (request.on_result) {
+                request.on_result(accepted, reason);
+            }
+        } else if (id == 1) {
+            handle_subscribe_result(doc["result"]);
+        } else if (id == 3) {
+            // Pools without mining.extranonce.subscribe answer false; the
+            // extranonce from the subscribe result stays in effect.
+            LOG_STRATUM << "Extranonce subscription " << (doc["result"].IsTrue() ? "accepted" : "not supported");
         }
     } else if (doc.HasMember("error") && !doc["error"].IsNull()) {
         LOG_ERROR << "Stratum error received:";
@@ -381,10 +1006,13 @@ void Stratum::subscribe() {
     
     rapidjson::Document d;
     d.SetObject();
-    d.AddMember("id", 1, d.GetAllocator());
+    d.AddMember("id", track_request(false, 1), d.GetAllocator());
     d.AddMember("method", "mining.subscribe", d.GetAllocator());
     rapidjson::Value params(rapidjson::kArrayType);
     params.PushBack("KawPowMiner/0.1", d.GetAllocator());
+    if (config.getPools()[pool_index].nicehash) {
+        params.PushBack("EthereumStratum/1.0.0", d.GetAllocator());
+    }
     d.AddMember("params", params, d.GetAllocator());
     
     rapidjson::StringBuffer buffer;
@@ -393,15 +1021,72 @@ void Stratum::subscribe() {
     std::string msg = std::string(buffer.GetString()) + "\n";
     
     LOG_STRATUM << "Sending subscription request: " << msg;
-    if (send(sock, msg.c_str(), msg.length(), 0) < 0) {
+    if (!send_line(msg)) {
         LOG_ERROR << "Failed to send subscription request: " << strerror(errno);
     }
 }
 
+// Both dialects put the extranonce second in the subscribe result:
+//   stratum:        [session_id | null, "extranonce"]
+//   NiceHash/1.0.0: [["mining.notify", "session_id", "EthereumStratum/1.0.0"], "extranonce"]
+void Stratum::handle_subscribe_result(const rapidjson::Value& result) {
+    if (!result.IsArray() || result.Size() < 2) {
+        LOG_STRATUM << "Subscribe result carries no extranonce";
+        return;
+    }
+
+    const rapidjson::Value& session = result[0];
+    if (session.IsArray() && session.Size() >= 2 && session[1].IsString()) {
+        session_id = session[1].GetString();
+        if (session.Size() >= 3 && session[2].IsString()) {
+            LOG_INFO << "Pool speaks " << session[2].GetString();
+        }
+    } else if (session.IsString()) {
+        session_id = session.GetString();
+    }
+    LOG_STRATUM << "Session ID received: " << session_id;
+
+    if (result[1].IsString()) {
+        apply_extranonce(result[1].GetString());
+    }
+
+    if (config.getPools()[pool_index].nicehash) {
+        subscribe_extranonce();
+    }
+}
+
+void Stratum::apply_extranonce(const std::string& value) {
+    if (value == extranonce) {
+        return;
+    }
+    // Behind the proxy the local devices take slice 0 of the pool's space
+    if (kawpow.set_extranonce(slot, proxy ? proxy->set_upstream_extranonce(value) : value)) {
+        extranonce = value;
+    }
+}
+
+void Stratum::subscribe_extranonce() {
+    rapidjson::Document d;
+    d.SetObject();
+    d.AddMember("id", track_request(false, 3), d.GetAllocator());
+    d.AddMember("method", "mining.extranonce.subscribe", d.GetAllocator());
+    d.AddMember("params", rapidjson::Value(rapidjson::kArrayType), d.GetAllocator());
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    d.Accept(writer);
+    std::string msg = std::string(buffer.GetString()) + "\n";
+
+    LOG_STRATUM << "Sending extranonce subscription: " << msg;
+    if (!send_line(msg)) {
+        LOG_ERROR << "Failed to send extranonce subscription: " << strerror(errno);
+    }
+}
+
 void Stratum::authorize() {
     LOG_INFO << "Authorizing with mining pool";
     
-    const PoolConfig& pool = config.getPools()[0];
+    const PoolConfig& pool = config.getPools()[pool_index];
     rapidjson::Document d;
     d.SetObject();
     d.AddMember("id", 2, d.GetAllocator());
@@ -417,23 +1102,121 @@ void Stratum::authorize() {
     std::string msg = std::string(buffer.GetString()) + "\n";
     
     LOG_STRATUM << "Sending authorization request for user: " << pool.user;
-    if (send(sock, msg.c_str(), msg.length(), 0) < 0) {
+    if (!send_line(msg)) {
         LOG_ERROR << "Failed to send authorization request: " << strerror(errno);
     }
 }
 
-void Stratum::submit(
-    const std::string& job_id,
-    const std::string& nonce_hex,
-    const std::string& header_hash_raw,
-    const std::string& mix_hash_hex
-) {
-    const PoolConfig& pool = config.getPools()[0];
-    LOG_INFO << "Submitting share - Job: " << job_id << ", Nonce: " << nonce_hex;
+// Called from the mining threads. While the pool is unreachable shares are
+// queued instead of sent, so mining continues on the last job undisturbed.
+void Stratum::submit(const DeviceWork& work, int device_id, const std::string& nonce_hex, const std::string& mix_hash_hex) {
+    QueuedShare share;
+    share.job_id = work.job_id;
+    share.nonce_hex = nonce_hex;
+    share.header_hash = work.header_hash;
+    share.mix_hash_hex = mix_hash_hex;
+    share.found_us = wall_clock_us();
+    share.device = device_id;
+    share.target = work.target;
+    fill_job_info(share);
+    if (share.pool != pool_name()) {
+        // Found on a job of a pool this session has left; the job id means
+        // nothing to the new one
+        if (journal.enabled()) {
+            journal_share(share, ShareOutcome::LOST, 0, "pool changed");
+        }
+        return;
+    }
+
+    auto handed_over = std::chrono::steady_clock::now();
+    if (!connected || !send_share(share)) {
+        share_queue.push(share);
+        if (Tracer::enabled()) {
+            trace_instant(TracePoint::SHARE_QUEUED, trace_nonce(nonce_hex));
+        }
+    } else {
+        pool_metrics[pool_index].share_to_wire->observe_since(handed_over);
+    }
+}
+
+// Called from the proxy thread. The send happens on the stratum thread, so
+// a slow pool socket never stalls the proxy's event loop.
+void Stratum::submit_forwarded(const QueuedShare& share, ShareResultCallback done) {
+    {
+        std::lock_guard<std::mutex> lock(forward_mutex);
+        forwarded.emplace_back(share, std::move(done));
+        forwarded.back().first.found_us = wall_clock_us();
+    }
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOG_ERROR << "Failed to wake the stratum thread: " << strerror(errno);
+    }
+}
+
+// Downstream rigs keep their own resubmission logic, so a forwarded share
+// that cannot be sent now fails rather than being queued.
+void Stratum::send_forwarded() {
+    std::vector<std::pair<QueuedShare, ShareResultCallback>> batch;
+    {
+        std::lock_guard<std::mutex> lock(forward_mutex);
+        batch.swap(forwarded);
+    }
+    for (auto& entry : batch) {
+        QueuedShare& share = entry.first;
+        fill_job_info(share);
+        if (share.pool != pool_name()) {
+            entry.second(false, "Job from a previous pool");
+        } else if (!connected || !send_share(share, entry.second)) {
+            entry.second(false, "Upstream not connected");
+        }
+    }
+}
+
+void Stratum::fill_job_info(QueuedShare& share) {
+    std::lock_guard<std::mutex> lock(job_mutex);
+    auto it = recent_jobs.find(share.job_id);
+    if (it != recent_jobs.end()) {
+        share.expires_ms = it->second.expires_ms;
+        share.block_number = it->second.block_number;
+        share.pool = it->second.pool;
+    } else {
+        share.expires_ms = wall_clock_ms() + config.getShareQueue().max_age * 1000ULL;
+        share.block_number = last_block_number;
+        share.pool = pool_name();
+    }
+}
+
+std::string Stratum::pool_name() const {
+    const PoolConfig& pool = config.getPools()[pool_index];
+    return pool.host + ":" + std::to_string(pool.port);
+}
+
+// Resubmits queued shares that are still for the current block
+void Stratum::replay_shares(uint64_t block_number) {
+    if (!share_queue.enabled() || share_queue.size() == 0) {
+        return;
+    }
+
+    std::vector<QueuedShare> replay = share_queue.take_replayable(block_number, pool_name());
+    LOG_INFO << "Replaying " << replay.size() << " queued shares for block " << block_number;
+    for (const QueuedShare& share : replay) {
+        if (!send_share(share)) {
+            share_queue.push(share);
+        }
+    }
+    share_queue.print_stats();
+}
+
+bool Stratum::send_share(const QueuedShare& share, ShareResultCallback on_result) {
+    const PoolConfig& pool = config.getPools()[pool_index];
+    LOG_INFO << "Submitting share - Job: " << share.job_id << ", Nonce: " << share.nonce_hex;
+    uint64_t serialize_start = trace_clock();
+    uint64_t nonce_id = serialize_start ? trace_nonce(share.nonce_hex) : 0;
 
     rapidjson::Document d;
     d.SetObject();
-    d.AddMember("id", 4, d.GetAllocator());
+    int id = track_request(true, 0, &share, std::move(on_result));
+    d.AddMember("id", id, d.GetAllocator());
     d.AddMember("method", "mining.submit", d.GetAllocator());
 
     rapidjson::Value params(rapidjson::kArrayType);
@@ -442,22 +1225,18 @@ void Stratum::submit(
     params.PushBack(rapidjson::Value(pool.user.c_str(), d.GetAllocator()).Move(), d.GetAllocator());
 
     // Job ID
-    params.PushBack(rapidjson::Value(job_id.c_str(), d.GetAllocator()).Move(), d.GetAllocator());
+    params.PushBack(rapidjson::Value(share.job_id.c_str(), d.GetAllocator()).Move(), d.GetAllocator());
 
     // Nonce (already padded)
-    std::string full_nonce = "0x" + nonce_hex;
+    std::string full_nonce = "0x" + share.nonce_hex;
     params.PushBack(rapidjson::Value(full_nonce.c_str(), d.GetAllocator()).Move(), d.GetAllocator());
 
-    // Header hash (rebuild as 0x-prefixed hex string)
-    std::stringstream header_ss;
-    header_ss << "0x";
-    for (size_t i = 0; i < header_hash_raw.size(); ++i) {
-        header_ss << std::hex << std::setw(2) << std::setfill('0') << (int)(unsigned char)header_hash_raw[i];
-    }
-    params.PushBack(rapidjson::Value(header_ss.str().c_str(), d.GetAllocator()).Move(), d.GetAllocator());
+    // Header hash, already hex as received in mining.notify
+    std::string full_header = share.header_hash.compare(0, 2, "0x") == 0 ? share.header_hash : "0x" + share.header_hash;
+    params.PushBack(rapidjson::Value(full_header.c_str(), d.GetAllocator()).Move(), d.GetAllocator());
 
     // Mix hash (already formatted)
-    std::string full_mix = "0x" + mix_hash_hex;
+    std::string full_mix = "0x" + share.mix_hash_hex;
     params.PushBack(rapidjson::Value(full_mix.c_str(), d.GetAllocator()).Move(), d.GetAllocator());
 
     d.AddMember("params", params, d.GetAllocator());
@@ -469,9 +1248,17 @@ void Stratum::submit(
     std::string msg = std::string(buffer.GetString()) + "\n";
 
     LOG_STRATUM << "Sending share submission: " << msg;
+    trace_span(TracePoint::SHARE_SERIALIZE, serialize_start, nonce_id);
 
-    if (send(sock, msg.c_str(), msg.length(), 0) < 0) {
+    uint64_t write_start = trace_clock();
+    bool sent = send_line(msg);
+    trace_span(TracePoint::SHARE_WRITE, write_start, nonce_id);
+    if (!sent) {
         LOG_ERROR << "Failed to submit share: " << strerror(errno);
+        // The caller queues it; forget the request so it is not queued twice
+        PendingRequest dropped;
+        take_request(id, dropped);
+        return false;
     }
+    return true;
 }
-
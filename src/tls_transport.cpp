@@ -0,0 +1,216 @@
+#include "tls_transport.h"
+#include <chrono>
+#include <cstring>
+#include <strings.h>
+#include <poll.h>
+#include <errno.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509.h>
+#include "hex.h"
+#include "logging.h"
+
+static const char* last_ssl_error() {
+    const char* reason = ERR_reason_error_string(ERR_get_error());
+    return reason ? reason : "connection closed or timed out";
+}
+
+static bool wait_fd(int fd, short events, int timeout_ms) {
+    struct pollfd fds;
+    fds.fd = fd;
+    fds.events = events;
+    return poll(&fds, 1, timeout_ms) > 0;
+}
+
+TlsTransport::TlsTransport(const std::string& host, const std::string& fingerprint)
+    : host(host), pinned_fingerprint(fingerprint) {
+    ctx = SSL_CTX_new(TLS_client_method());
+    if (!ctx) {
+        LOG_ERROR << "Failed to create TLS context for " << host;
+        return;
+    }
+
+    SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+    // Non-blocking reads must return on TLS 1.3 post-handshake messages
+    // instead of waiting for the next application record.
+    SSL_CTX_clear_mode(ctx, SSL_MODE_AUTO_RETRY);
+
+    // Keep sessions ourselves so they survive the SSL object of a closed
+    // connection; with TLS 1.3 tickets only arrive after the handshake.
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, &TlsTransport::on_new_session);
+}
+
+TlsTransport::~TlsTransport() {
+    shutdown();
+    if (session) {
+        SSL_SESSION_free(session);
+    }
+    if (ctx) {
+        SSL_CTX_free(ctx);
+    }
+}
+
+int TlsTransport::on_new_session(SSL* ssl, SSL_SESSION* new_session) {
+    TlsTransport* self = static_cast<TlsTransport*>(SSL_get_app_data(ssl));
+    if (!self) {
+        return 0;
+    }
+
+    if (self->session) {
+        SSL_SESSION_free(self->session);
+    }
+    self->session = new_session;
+    return 1; // we keep the reference
+}
+
+bool TlsTransport::handshake(int fd, int timeout_ms) {
+    std::lock_guard<std::mutex> lock(io_mutex);
+    if (!ctx) {
+        return false;
+    }
+
+    if (ssl) {
+        SSL_free(ssl);
+    }
+    ssl = SSL_new(ctx);
+    if (!ssl) {
+        return false;
+    }
+
+    SSL_set_app_data(ssl, this);
+    SSL_set_fd(ssl, fd);
+    SSL_set_tlsext_host_name(ssl, host.c_str());
+    if (session && SSL_SESSION_is_resumable(session)) {
+        SSL_set_session(ssl, session);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (true) {
+        int rc = SSL_connect(ssl);
+        if (rc == 1) {
+            break;
+        }
+
+        int err = SSL_get_error(ssl, rc);
+        int left = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+        if ((err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) || left <= 0 ||
+            !wait_fd(fd, err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT, left)) {
+            LOG_ERROR << "TLS handshake with " << host << " failed: " << last_ssl_error();
+            SSL_free(ssl);
+            ssl = nullptr;
+            return false;
+        }
+    }
+
+    if (!verify_fingerprint()) {
+        SSL_free(ssl);
+        ssl = nullptr;
+        return false;
+    }
+
+    was_resumed = SSL_session_reused(ssl) == 1;
+    LOG_INFO << "TLS " << SSL_get_version(ssl) << " with " << host
+             << (was_resumed ? " (session resumed)" : " (full handshake)")
+             << ", fingerprint " << peer_fingerprint;
+    return true;
+}
+
+bool TlsTransport::verify_fingerprint() {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    X509* cert = SSL_get1_peer_certificate(ssl);
+#else
+    X509* cert = SSL_get_peer_certificate(ssl);
+#endif
+    if (!cert) {
+        LOG_ERROR << "Failed to get server certificate from " << host;
+        return false;
+    }
+
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    bool ok = X509_digest(cert, EVP_sha256(), md, &len) == 1;
+    X509_free(cert);
+    if (!ok) {
+        return false;
+    }
+
+    peer_fingerprint.resize(len * 2);
+    hex_encode(md, len, &peer_fingerprint[0]);
+
+    if (!pinned_fingerprint.empty() &&
+        (pinned_fingerprint.size() != peer_fingerprint.size() ||
+         strncasecmp(pinned_fingerprint.c_str(), peer_fingerprint.c_str(), peer_fingerprint.size()) != 0)) {
+        LOG_ERROR << "Failed to verify server certificate fingerprint for " << host;
+        LOG_ERROR << "\"" << peer_fingerprint << "\" was given";
+        LOG_ERROR << "\"" << pinned_fingerprint << "\" was configured";
+        return false;
+    }
+    return true;
+}
+
+void TlsTransport::shutdown() {
+    std::lock_guard<std::mutex> lock(io_mutex);
+    if (ssl) {
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+        ssl = nullptr;
+    }
+}
+
+int TlsTransport::send(const char* data, size_t size) {
+    std::lock_guard<std::mutex> lock(io_mutex);
+    if (!ssl) {
+        return -1;
+    }
+
+    size_t written = 0;
+    while (written < size) {
+        int rc = SSL_write(ssl, data + written, static_cast<int>(size - written));
+        if (rc > 0) {
+            written += rc;
+            continue;
+        }
+
+        int err = SSL_get_error(ssl, rc);
+        if ((err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) &&
+            wait_fd(SSL_get_fd(ssl), err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT, 5000)) {
+            continue;
+        }
+        return -1;
+    }
+    return static_cast<int>(written);
+}
+
+int TlsTransport::recv(char* data, size_t size) {
+    std::lock_guard<std::mutex> lock(io_mutex);
+    if (!ssl) {
+        return -1;
+    }
+
+    int rc = SSL_read(ssl, data, static_cast<int>(size));
+    if (rc > 0) {
+        return rc;
+    }
+
+    int err = SSL_get_error(ssl, rc);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (err == SSL_ERROR_ZERO_RETURN) {
+        return 0;
+    }
+    errno = ECONNRESET;
+    return -1;
+}
+
+bool TlsTransport::pending() const {
+    std::lock_guard<std::mutex> lock(io_mutex);
+    return ssl && SSL_pending(ssl) > 0;
+}
+
+std::string TlsTransport::version() const {
+    std::lock_guard<std::mutex> lock(io_mutex);
+    return ssl ? SSL_get_version(ssl) : "";
+}
@@ -0,0 +1,203 @@
+#include "trace.h"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include "logging.h"
+
+std::atomic<bool> Tracer::active{false};
+
+struct TracePointInfo {
+    const char* name;
+    const char* category;
+    bool share;         // id is a nonce, not a job generation
+    bool async;         // spans other work on its thread, gets its own track
+};
+
+static const TracePointInfo kPoints[] = {
+    {"notify parse", "job", false, false},
+    {"job publish", "job", false, false},
+    {"job pickup", "job", false, false},
+    {"batch", "job", false, false},
+    {"share found", "share", true, false},
+    {"share queued", "share", true, false},
+    {"share serialize", "share", true, false},
+    {"share write", "share", true, false},
+    {"share ack", "share", true, true},
+};
+static_assert(sizeof(kPoints) / sizeof(kPoints[0]) == static_cast<size_t>(TracePoint::COUNT),
+              "every trace point needs a name");
+
+// A record as copied out of a ring
+struct TraceEvent {
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    uint64_t id;
+    uint8_t point;
+};
+
+Tracer& Tracer::instance() {
+    // Never destroyed: device threads may still record while the process exits
+    static Tracer* tracer = new Tracer;
+    return *tracer;
+}
+
+void Tracer::start(const TraceConfig& config) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (active) {
+        return;
+    }
+    capacity = 16;
+    while (capacity < config.events_per_thread) {
+        capacity <<= 1;
+    }
+    file = config.file;
+    origin = std::chrono::steady_clock::now();
+    if (!file.empty()) {
+        std::atexit([] {
+            Tracer& tracer = instance();
+            tracer.dump(tracer.file);
+        });
+    }
+    active = true;
+}
+
+uint64_t Tracer::ns(std::chrono::steady_clock::time_point time) const {
+    return time > origin ? std::chrono::duration_cast<std::chrono::nanoseconds>(time - origin).count() : 0;
+}
+
+TraceBuffer& Tracer::buffer() {
+    static thread_local TraceBuffer* mine = nullptr;
+    if (!mine) {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffers.emplace_back(new TraceBuffer(capacity));
+        mine = buffers.back().get();
+        mine->tid = static_cast<int>(buffers.size());
+        mine->name = "thread " + std::to_string(mine->tid);
+    }
+    return *mine;
+}
+
+void Tracer::name_thread(const std::string& name) {
+    TraceBuffer& b = buffer();
+    std::lock_guard<std::mutex> lock(mutex);
+    b.name = name;
+}
+
+// started moves before the slot is touched and head after, so a dump can
+// tell which of the records it copied were being overwritten meanwhile
+void Tracer::record(TracePoint point, uint64_t start_ns, uint64_t duration_ns, uint64_t id) {
+    TraceBuffer& b = buffer();
+    uint64_t h = b.head.load(std::memory_order_relaxed);
+    b.started.store(h + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    TraceRecord& r = b.records[h & (b.records.size() - 1)];
+    r.start_ns.store(start_ns, std::memory_order_relaxed);
+    r.duration_ns.store(duration_ns, std::memory_order_relaxed);
+    r.id.store(id, std::memory_order_relaxed);
+    r.point.store(static_cast<uint8_t>(point), std::memory_order_relaxed);
+    b.head.store(h + 1, std::memory_order_release);
+}
+
+static void copy_ring(const TraceBuffer& b, std::vector<TraceEvent>& events) {
+    size_t capacity = b.records.size();
+    uint64_t head = b.head.load(std::memory_order_acquire);
+    uint64_t first = head > capacity ? head - capacity : 0;
+    events.clear();
+    for (uint64_t i = first; i < head; ++i) {
+        const TraceRecord& r = b.records[i & (capacity - 1)];
+        events.push_back({r.start_ns.load(std::memory_order_relaxed), r.duration_ns.load(std::memory_order_relaxed),
+                          r.id.load(std::memory_order_relaxed), r.point.load(std::memory_order_relaxed)});
+    }
+    // Record n overwrites record n - capacity; drop any the writer has
+    // reached since head was read
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t started = b.started.load(std::memory_order_relaxed);
+    if (started > capacity && started - capacity > first) {
+        events.erase(events.begin(), events.begin() + std::min<uint64_t>(started - capacity - first, events.size()));
+    }
+}
+
+static void append_event(std::string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static void append_event(std::string& out, const char* format, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    out += ",\n";
+    out.append(line, std::min<size_t>(std::max(n, 0), sizeof(line) - 1));
+}
+
+void Tracer::render(std::string& out) {
+    std::vector<std::pair<TraceBuffer*, std::string>> threads;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& b : buffers) {
+            threads.emplace_back(b.get(), b->name);
+        }
+    }
+
+    out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"kawpow-miner\"}}";
+    std::vector<TraceEvent> events;
+    for (const auto& thread : threads) {
+        const TraceBuffer& b = *thread.first;
+        std::string name;
+        for (char c : thread.second) {
+            if (c == '"' || c == '\\') {
+                name += '\\';
+            }
+            name += c;
+        }
+        append_event(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                     b.tid, name.c_str());
+
+        copy_ring(b, events);
+        for (const TraceEvent& e : events) {
+            if (e.point >= static_cast<uint8_t>(TracePoint::COUNT)) {
+                continue;
+            }
+            const TracePointInfo& info = kPoints[e.point];
+            char args[48];
+            if (info.share) {
+                snprintf(args, sizeof(args), "{\"nonce\":\"%016llx\"}", static_cast<unsigned long long>(e.id));
+            } else {
+                snprintf(args, sizeof(args), "{\"job\":%llu}", static_cast<unsigned long long>(e.id));
+            }
+            double ts = e.start_ns / 1000.0;
+            if (info.async) {
+                append_event(out, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"b\",\"id\":\"0x%llx\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":%s}",
+                             info.name, info.category, static_cast<unsigned long long>(e.id), ts, b.tid, args);
+                append_event(out, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"e\",\"id\":\"0x%llx\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                             info.name, info.category, static_cast<unsigned long long>(e.id),
+                             (e.start_ns + e.duration_ns) / 1000.0, b.tid);
+            } else if (e.duration_ns) {
+                append_event(out, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":%s}",
+                             info.name, info.category, ts, e.duration_ns / 1000.0, b.tid, args);
+            } else {
+                append_event(out, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":%s}",
+                             info.name, info.category, ts, b.tid, args);
+            }
+        }
+    }
+    out += "\n]}\n";
+}
+
+bool Tracer::dump(const std::string& path) {
+    std::string out;
+    render(out);
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        LOG_ERROR << "Cannot write trace to " << path;
+        return false;
+    }
+    bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+    ok = fclose(f) == 0 && ok;
+    if (ok) {
+        LOG_INFO << "Wrote " << out.size() / 1024 << " KB of trace events to " << path;
+    } else {
+        LOG_ERROR << "Cannot write trace to " << path;
+    }
+    return ok;
+}
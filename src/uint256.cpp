@@ -0,0 +1,76 @@
+#include "uint256.h"
+#include <cmath>
+#include <cstring>
+#include "hex.h"
+
+// Fractional difficulties are divided with 16 bits of fixed point
+#define DIFFICULTY_FRACTION_BITS 16
+
+double uint256::to_double() const {
+    double value = 0;
+    for (int i = 7; i >= 0; --i) {
+        value = value * 4294967296.0 + words[i];
+    }
+    return value;
+}
+
+bool uint256::from_hex(const char* hex, size_t length, uint256& out) {
+    if (length >= 2 && hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X')) {
+        hex += 2;
+        length -= 2;
+    }
+    if (length == 0 || length > 64) {
+        return false;
+    }
+
+    // Short strings right-align: pad them with zeros to the full 64 digits
+    char padded[64];
+    if (length < 64) {
+        memset(padded, '0', sizeof(padded) - length);
+        memcpy(padded + sizeof(padded) - length, hex, length);
+        hex = padded;
+    }
+
+    uint8_t bytes[32];
+    if (!hex_decode(hex, sizeof(padded), bytes, sizeof(bytes))) {
+        return false;
+    }
+    out = from_bytes_be(bytes);
+    return true;
+}
+
+void uint256::to_hex(char out[64]) const {
+    uint8_t bytes[32];
+    to_bytes_be(bytes);
+    hex_encode(bytes, sizeof(bytes), out);
+}
+
+std::string uint256::to_hex() const {
+    std::string out(64, '0');
+    to_hex(&out[0]);
+    return out;
+}
+
+uint256 target_from_difficulty(double difficulty) {
+    double scaled = std::round(difficulty * (1 << DIFFICULTY_FRACTION_BITS));
+    if (!(scaled > 1)) {
+        return uint256::max();
+    }
+
+    // Difficulties beyond 2^48 lose the fraction, which no pool sends
+    uint64_t divisor = scaled < 18446744073709551615.0 ? static_cast<uint64_t>(scaled) : ~0ULL;
+    return (kDiff1Target << DIFFICULTY_FRACTION_BITS) / uint256(divisor);
+}
+
+double difficulty_from_target(const uint256& target) {
+    return target.is_zero() ? 0 : kDiff1Target.to_double() / target.to_double();
+}
+
+double share_difficulty(const uint256& hash) {
+    return difficulty_from_target(hash);
+}
+
+double hashes_per_share(double difficulty) {
+    // 2^256 / diff1 = 2^40 / 255
+    return difficulty * std::ldexp(1.0, 40) / 255.0;
+}